@@ -1,54 +1,17 @@
 #include "PreCompile.h"
+#include <DiskTools/Fat.h>
+#include <DiskTools/ImageStore.h>
+#include <PortableRuntime/Unicode.h>
 
 namespace BuildImage
 {
 
-constexpr unsigned int fat_max_file_name_length = 8;
-constexpr unsigned int fat_max_extension_length = 3;
+// Floppy disks, which are all that BuildImage makes, have 512 byte sectors.
+// The sector size is passed to each part of the image, so that other formats
+// only need their own geometry.
+constexpr unsigned int floppy_bytes_per_sector = 512;
 
-#pragma pack(push, 1)
-struct Bios_parameter_block
-{
-    uint8_t OEM_name[8];
-    uint16_t bytes_per_sector;
-    uint8_t sectors_per_cluster;
-    uint16_t reserved_sectors;
-    uint8_t file_allocation_table_count;
-    uint16_t root_entry_count;
-    uint16_t sector_count;
-    uint8_t media_descriptor;
-    uint16_t sectors_per_file_allocation_table;
-    uint16_t sectors_per_track;
-    uint16_t head_count;
-    uint32_t hidden_sector_count;
-    uint32_t huge_sector_count;
-    uint8_t drive_number;
-    uint8_t reserved;
-    uint8_t boot_signature;
-    uint32_t volume_id;
-    uint8_t volume_label[fat_max_file_name_length + fat_max_extension_length];
-    uint8_t file_system_type[8];
-};
-
-struct Root_directory_entry
-{
-    uint8_t file_name[fat_max_file_name_length];
-    uint8_t extension[fat_max_extension_length];
-    uint8_t attributes;
-    uint16_t reserved;
-    uint16_t creation_time;
-    uint16_t creation_date;
-    uint16_t last_access_date;
-    uint16_t ignored;
-    uint16_t last_write_time;
-    uint16_t last_write_date;
-    uint16_t first_logical_cluster;
-    uint32_t file_size;
-};
-#pragma pack(pop)
-
-constexpr unsigned int bytes_per_sector = 512;
-static std::vector<uint8_t> get_default_boot_sector()
+static std::vector<uint8_t> get_default_boot_sector(unsigned int bytes_per_sector)
 {
     std::vector<uint8_t> boot_sector(bytes_per_sector);
 
@@ -59,7 +22,7 @@ static std::vector<uint8_t> get_default_boot_sector()
     return boot_sector;
 }
 
-static std::vector<uint8_t> get_empty_file_allocation_table(unsigned int sector_count)
+static std::vector<uint8_t> get_empty_file_allocation_table(unsigned int sector_count, unsigned int bytes_per_sector)
 {
     std::vector<uint8_t> file_allocation_table(sector_count * bytes_per_sector);
 
@@ -70,7 +33,7 @@ static std::vector<uint8_t> get_empty_file_allocation_table(unsigned int sector_
     return file_allocation_table;
 }
 
-static std::vector<uint8_t> get_empty_root_directory(unsigned int sector_count)
+static std::vector<uint8_t> get_empty_root_directory(unsigned int sector_count, unsigned int bytes_per_sector)
 {
     std::vector<uint8_t> root_directory(sector_count * bytes_per_sector);
 
@@ -79,10 +42,11 @@ static std::vector<uint8_t> get_empty_root_directory(unsigned int sector_count)
 
 static void usage()
 {
-    std::cerr << "buildimage [-b=file] [-l=label] -f=file.img\n";
+    std::cerr << "buildimage [-b=file] [-l=label] [-s=dir] -f=file.img\n";
     std::cerr << "    -f=file   Output file name\n";
     std::cerr << "    -b=file   Install bootsector from \"file\"\n";
     std::cerr << "    -l=label  Set volume label to \"label\"\n";
+    std::cerr << "    -s=dir    Also add the image to the image store in \"dir\"\n";
     std::cerr << std::endl;
 
 #if 0
@@ -132,12 +96,12 @@ static bool is_legal_fat_character(wchar_t ch)
 // TODO: Consider outputting a std::string instead of std::wstring.
 static std::wstring sanitize_label(const std::wstring& input_label)
 {
-    static_assert(sizeof(Bios_parameter_block().volume_label) == (sizeof(Root_directory_entry().file_name) + sizeof(Root_directory_entry().extension)),
+    static_assert(DiskTools::Bios_parameter_block_layout::volume_label::size == (DiskTools::Directory_entry_layout::file_name::size + DiskTools::Directory_entry_layout::extension::size),
                   "Directory entry and BPB must match size for volume label.");
 
     std::wstring output_label(input_label);
 
-    output_label.erase(sizeof(Bios_parameter_block().volume_label), std::wstring::npos);
+    output_label.erase(DiskTools::Bios_parameter_block_layout::volume_label::size, std::wstring::npos);
     std::transform(std::cbegin(output_label), std::cend(output_label), std::begin(output_label), towupper);
     std::for_each(std::cbegin(output_label), std::cend(output_label), [](wchar_t ch)
     {
@@ -150,15 +114,39 @@ static std::wstring sanitize_label(const std::wstring& input_label)
     return output_label;
 }
 
+// Images are named in the store by their file name, without the directory.
+static void add_image_to_store(
+    const std::vector<uint8_t>& disk_image,
+    unsigned int bytes_per_sector,
+    const std::wstring& store_path,
+    const std::wstring& image_file_name)
+{
+    // Floppy images are small, so use smaller chunks than RipISO does for discs.
+    constexpr uint32_t store_average_chunk_size = 16 * 1024;
+
+    const auto separator = image_file_name.find_last_of(L"\\/");
+    const auto image_name = (separator == std::wstring::npos) ? image_file_name : image_file_name.substr(separator + 1);
+
+    DiskTools::Image_store store(PortableRuntime::utf8_from_utf16(store_path));
+    DiskTools::Image_store_writer writer(&store,
+                                         PortableRuntime::utf8_from_utf16(image_name),
+                                         DiskTools::content_defined_chunking(store_average_chunk_size),
+                                         bytes_per_sector);
+    writer.write(disk_image.data(), disk_image.size());
+    writer.commit();
+}
+
 static void output_boot_sector(
     const std::wstring& boot_sector_file_name,
     const std::wstring& image_file_name,
-    const std::wstring& label)
+    const std::wstring& label,
+    const std::wstring& store_path)
 {
     (void)label;    // TODO: Add support for this.
-    auto boot_sector = get_default_boot_sector();
-    const auto file_allocation_table = get_empty_file_allocation_table(9);
-    const auto root_directory = get_empty_root_directory(14);
+    constexpr unsigned int bytes_per_sector = floppy_bytes_per_sector;
+    auto boot_sector = get_default_boot_sector(bytes_per_sector);
+    const auto file_allocation_table = get_empty_file_allocation_table(9, bytes_per_sector);
+    const auto root_directory = get_empty_root_directory(14, bytes_per_sector);
 
     if(!boot_sector_file_name.empty())
     {
@@ -181,13 +169,19 @@ static void output_boot_sector(
     std::ofstream output_file(image_file_name, std::ios::binary | std::ios::trunc);
     output_file.write(reinterpret_cast<const char*>(disk_image.data()), disk_image.size());
     output_file.close();
+
+    if(!store_path.empty())
+    {
+        add_image_to_store(disk_image, bytes_per_sector, store_path, image_file_name);
+    }
 }
 
-static std::tuple<std::wstring, std::wstring, std::wstring> parse_command_line(int argc, PTSTR* argv)
+static std::tuple<std::wstring, std::wstring, std::wstring, std::wstring> parse_command_line(int argc, PTSTR* argv)
 {
     std::wstring boot_sector_file_name;
     std::wstring image_file_name;
     std::wstring label;
+    std::wstring store_path;
     for(int ii = 0; ii < argc; ++ii)
     {
         if(_tcsncmp(argv[ii], _T("-b="), 3) == 0)
@@ -202,6 +196,10 @@ static std::tuple<std::wstring, std::wstring, std::wstring> parse_command_line(i
         {
             label = &argv[ii][3];
         }
+        else if(_tcsncmp(argv[ii], _T("-s="), 3) == 0)
+        {
+            store_path = &argv[ii][3];
+        }
     }
 
     if(image_file_name.empty())
@@ -210,7 +208,7 @@ static std::tuple<std::wstring, std::wstring, std::wstring> parse_command_line(i
     }
     label = sanitize_label(label);
 
-    return std::make_tuple(boot_sector_file_name, image_file_name, label);
+    return std::make_tuple(boot_sector_file_name, image_file_name, label, store_path);
 }
 
 }
@@ -231,9 +229,10 @@ int _tmain(int argc, _In_reads_(argc) PTSTR* argv)
             std::wstring boot_sector_file_name;
             std::wstring image_file_name;
             std::wstring label;
-            std::tie(boot_sector_file_name, image_file_name, label) = BuildImage::parse_command_line(argc, argv);
+            std::wstring store_path;
+            std::tie(boot_sector_file_name, image_file_name, label, store_path) = BuildImage::parse_command_line(argc, argv);
 
-            BuildImage::output_boot_sector(boot_sector_file_name, image_file_name, label);
+            BuildImage::output_boot_sector(boot_sector_file_name, image_file_name, label, store_path);
         }
         catch(...)
         {
@@ -2,10 +2,17 @@
 
 #include <Windows.h>
 #include <tchar.h>
+#include <cassert>
 #include <algorithm>
+#include <array>
 #include <cstdint>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
 #include <tuple>
+#include <unordered_map>
 #include <vector>
 
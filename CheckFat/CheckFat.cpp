@@ -0,0 +1,164 @@
+// This program checks the consistency of a FAT12/16/32 volume on a disk or
+// image, without changing it.
+
+#include "PreCompile.h"
+#include <DiskTools/BlockDevice.h>
+#include <DiskTools/FatCheck.h>
+#include <DiskTools/FatVolume.h>
+#include <DiskTools/IoStatistics.h>
+#include <DiskTools/StringUtils.h>
+#include <DiskTools/Trace.h>
+#include <Parsing/CommandLine.h>
+#include <WindowsCommon/CheckHR.h>
+#include <WindowsCommon/CommandLine.h>
+#include <WindowsCommon/DebuggerTracing.h>
+#include <WindowsCommon/Wrappers.h>
+#include <PortableRuntime/CheckException.h>
+#include <PortableRuntime/Tracing.h>
+#include <PortableRuntime/Unicode.h>
+
+namespace CheckFat
+{
+
+// Returns true if the volume has no problems.
+static bool check_volume(const std::string& drive, unsigned int partition_number)
+{
+    DISKTOOLS_TRACE_SPAN("CheckFat", "check");
+
+    const auto device = DiskTools::open_disk_or_device(drive);
+    const auto result = DiskTools::check_fat_volume(device.get(), DiskTools::find_fat_volume(device.get(), partition_number));
+
+    for(const auto& problem : result.problems)
+    {
+        std::fwprintf(stdout, L"%s\n", PortableRuntime::utf16_from_utf8(problem).c_str());
+    }
+    if(result.problem_count > result.problems.size())
+    {
+        std::fwprintf(stdout, L"...and %llu more problems.\n", result.problem_count - result.problems.size());
+    }
+    if(result.problem_count > 0)
+    {
+        std::fwprintf(stdout, L"\n");
+    }
+
+    std::fwprintf(stdout, L"%llu files in %llu directories.\n", result.file_count, result.directory_count);
+    std::fwprintf(stdout,
+                  L"%u clusters: %u allocated, %u reachable, %u bad.\n",
+                  result.cluster_count,
+                  result.allocated_clusters,
+                  result.reachable_clusters,
+                  result.bad_clusters);
+    std::fwprintf(stdout,
+                  L"%u lost clusters in %u chains, %u cross-linked clusters, %llu differing FAT sectors.\n",
+                  result.lost_clusters,
+                  result.lost_chains,
+                  result.cross_linked_clusters,
+                  result.differing_fat_sectors);
+    std::fwprintf(stdout, (0 == result.problem_count) ? L"No problems found.\n" : L"%llu problems found.\n", result.problem_count);
+
+    return 0 == result.problem_count;
+}
+
+static int parse_arguments_and_execute()
+{
+    enum
+    {
+        Argument_drive = 0,
+        Argument_partition,
+        Argument_help,
+    };
+
+    const std::vector<Parsing::Argument_descriptor> argument_map =
+    {
+        { Argument_drive,     u8"drive",     u8'd', true,  u8"The disk number, or the path of a device or image, to check. Default: 0." },
+        { Argument_partition, u8"partition", u8'p', true,  u8"The partition that holds the volume. Default: the volume at the start of the device, or the first FAT partition." },
+        { Argument_help,      u8"help",      u8'?', false, nullptr },
+    };
+#ifndef NDEBUG
+    Parsing::validate_argument_map(argument_map);
+#endif
+
+    const auto arguments = WindowsCommon::args_from_command_line();
+    const auto options = Parsing::options_from_allowed_args(arguments, argument_map);
+
+    int error_level = 0;
+    if(options.count(Argument_help) == 0)
+    {
+        const std::string drive = (options.count(Argument_drive) > 0) ? options.at(Argument_drive) : std::string(u8"0");
+        const uint64_t partition_number = (options.count(Argument_partition) > 0) ?
+                                          DiskTools::parse_unsigned(options.at(Argument_partition), argument_map[Argument_partition].long_name) : 0;
+        CHECK_EXCEPTION(partition_number <= UINT_MAX, u8"--" + std::string(argument_map[Argument_partition].long_name) + u8" is out of range.");
+
+        // A damaged volume is an error, so scripts can test ERRORLEVEL.
+        if(!check_volume(drive, static_cast<unsigned int>(partition_number)))
+        {
+            error_level = 1;
+        }
+    }
+    else
+    {
+        constexpr auto arg_program_name = 0;
+
+        // Hold a reference to program_name_long for the duration of the output functions.
+        const auto program_name_long = PortableRuntime::utf16_from_utf8(arguments[arg_program_name]);
+        const auto program_name = PathFindFileNameW(program_name_long.c_str());
+
+        std::fwprintf(stderr, L"Usage: %s [options]\nOptions:\n", program_name);
+        std::fwprintf(stderr, PortableRuntime::utf16_from_utf8(Parsing::Options_help_text(argument_map)).c_str());
+        std::fwprintf(stderr,
+                      L"\nTo check a floppy image:\n  %s -%c floppy.img\n",
+                      program_name,
+                      argument_map[Argument_drive].short_name);
+        std::fwprintf(stderr,
+                      L"\nTo check the second partition of the second drive:\n  %s -%c 1 -%c 2\n",
+                      program_name,
+                      argument_map[Argument_drive].short_name,
+                      argument_map[Argument_partition].short_name);
+        error_level = 1;
+    }
+
+    return error_level;
+}
+
+}
+
+int wmain(int argc, _In_reads_(argc) wchar_t** argv)
+{
+    (void)argc;     // Unreferenced parameter.
+    (void)argv;
+
+    // ERRORLEVEL zero is the success code.
+    int error_level;
+
+    // Set outside the try block so error messages use the proper code page.
+    // This class does not throw.
+    WindowsCommon::UTF8_console_code_page code_page;
+
+    // Writes I/O statistics on exit when DISKTOOLS_IO_STATISTICS is set.
+    DiskTools::Io_statistics_report io_statistics_report;
+
+    // Writes a trace on exit when built with DISKTOOLS_TRACE and DISKTOOLS_TRACE is set.
+    DISKTOOLS_TRACE_REPORT();
+
+    try
+    {
+        PortableRuntime::set_dprintf(WindowsCommon::debugger_dprintf);
+
+        // Set wprintf output to UTF-8 in Windows console.
+        // CHECK_EXCEPTION ensures against the case that the CRT invalid parameter handler
+        // routine is set by a global constructor.
+        CHECK_EXCEPTION(_setmode(_fileno(stdout), _O_U8TEXT) != -1, u8"Failed to set UTF-8 output mode.");
+        CHECK_EXCEPTION(_setmode(_fileno(stderr), _O_U8TEXT) != -1, u8"Failed to set UTF-8 output mode.");
+
+        assert(WindowsCommon::args_from_command_line().size() == (static_cast<size_t>(argc)));
+        error_level = CheckFat::parse_arguments_and_execute();
+    }
+    catch(const std::exception& ex)
+    {
+        std::fwprintf(stderr, L"\n%s\n", PortableRuntime::utf16_from_utf8(ex.what()).c_str());
+        error_level = 1;
+    }
+
+    return error_level;
+}
+
@@ -0,0 +1,168 @@
+// This program writes a defragmented copy of a disk image that holds a
+// FAT12/16/32 volume, and optionally trims the free space from its end.
+
+#include "PreCompile.h"
+#include <DiskTools/BlockDevice.h>
+#include <DiskTools/FatCompact.h>
+#include <DiskTools/FatVolume.h>
+#include <DiskTools/IoStatistics.h>
+#include <DiskTools/StringUtils.h>
+#include <DiskTools/Trace.h>
+#include <Parsing/CommandLine.h>
+#include <WindowsCommon/CheckHR.h>
+#include <WindowsCommon/CommandLine.h>
+#include <WindowsCommon/DebuggerTracing.h>
+#include <WindowsCommon/Wrappers.h>
+#include <PortableRuntime/CheckException.h>
+#include <PortableRuntime/Tracing.h>
+#include <PortableRuntime/Unicode.h>
+
+namespace CompactFat
+{
+
+static void print_fragmentation(const wchar_t* label, const DiskTools::Fat_fragmentation& fragmentation)
+{
+    std::fwprintf(stdout,
+                  L"%s: %llu of %llu files and directories fragmented, %llu runs, %u clusters used, the last at cluster %u.\n",
+                  label,
+                  fragmentation.fragmented_chain_count,
+                  fragmentation.chain_count,
+                  fragmentation.run_count,
+                  fragmentation.used_clusters,
+                  fragmentation.last_used_cluster);
+}
+
+static void report_fragmentation(const std::string& drive, unsigned int partition_number)
+{
+    const auto device = DiskTools::open_disk_or_device(drive);
+    DiskTools::Fat_volume volume(device.get(), DiskTools::find_fat_volume(device.get(), partition_number));
+    print_fragmentation(L"Fragmentation", DiskTools::measure_fat_fragmentation(&volume));
+}
+
+static void compact_image(const std::string& drive, unsigned int partition_number, const std::string& output_file_name, bool truncate)
+{
+    DISKTOOLS_TRACE_SPAN("CompactFat", "compact");
+
+    const auto device = DiskTools::open_disk_or_device(drive);
+    const auto result = DiskTools::compact_fat_image(device.get(),
+                                                     DiskTools::find_fat_volume(device.get(), partition_number),
+                                                     output_file_name.c_str(),
+                                                     truncate);
+
+    print_fragmentation(L"Before", result.before);
+    print_fragmentation(L"After", result.after);
+    std::fwprintf(stdout, L"Image size: %llu bytes, was %llu bytes.\n", result.destination_size, result.source_size);
+}
+
+static int parse_arguments_and_execute()
+{
+    enum
+    {
+        Argument_drive = 0,
+        Argument_partition,
+        Argument_output,
+        Argument_truncate,
+        Argument_help,
+    };
+
+    const std::vector<Parsing::Argument_descriptor> argument_map =
+    {
+        { Argument_drive,     u8"drive",     u8'd', true,  u8"The image, disk number, or device path to read." },
+        { Argument_partition, u8"partition", u8'p', true,  u8"The partition that holds the volume. Default: the volume at the start of the device, or the first FAT partition." },
+        { Argument_output,    u8"output",    u8'o', true,  u8"Write the defragmented image to this file.  Without it, only the fragmentation is reported." },
+        { Argument_truncate,  u8"truncate",  u8't', false, u8"Shrink the volume to the space its files use, and end the image there." },
+        { Argument_help,      u8"help",      u8'?', false, nullptr },
+    };
+#ifndef NDEBUG
+    Parsing::validate_argument_map(argument_map);
+#endif
+
+    const auto arguments = WindowsCommon::args_from_command_line();
+    const auto options = Parsing::options_from_allowed_args(arguments, argument_map);
+
+    int error_level = 0;
+    if((options.count(Argument_help) == 0) && (options.count(Argument_drive) > 0))
+    {
+        const std::string drive = options.at(Argument_drive);
+        const uint64_t partition_number = (options.count(Argument_partition) > 0) ?
+                                          DiskTools::parse_unsigned(options.at(Argument_partition), argument_map[Argument_partition].long_name) : 0;
+        CHECK_EXCEPTION(partition_number <= UINT_MAX, u8"--" + std::string(argument_map[Argument_partition].long_name) + u8" is out of range.");
+
+        if(options.count(Argument_output) > 0)
+        {
+            compact_image(drive, static_cast<unsigned int>(partition_number), options.at(Argument_output), options.count(Argument_truncate) > 0);
+        }
+        else
+        {
+            CHECK_EXCEPTION(options.count(Argument_truncate) == 0, u8"--" + std::string(argument_map[Argument_truncate].long_name) + u8" requires --output.");
+            report_fragmentation(drive, static_cast<unsigned int>(partition_number));
+        }
+    }
+    else
+    {
+        constexpr auto arg_program_name = 0;
+
+        // Hold a reference to program_name_long for the duration of the output functions.
+        const auto program_name_long = PortableRuntime::utf16_from_utf8(arguments[arg_program_name]);
+        const auto program_name = PathFindFileNameW(program_name_long.c_str());
+
+        std::fwprintf(stderr, L"Usage: %s [options]\nOptions:\n", program_name);
+        std::fwprintf(stderr, PortableRuntime::utf16_from_utf8(Parsing::Options_help_text(argument_map)).c_str());
+        std::fwprintf(stderr,
+                      L"\nTo report the fragmentation of a USB stick image:\n  %s -%c usb.img\n",
+                      program_name,
+                      argument_map[Argument_drive].short_name);
+        std::fwprintf(stderr,
+                      L"\nTo write a defragmented copy without its trailing free space:\n  %s -%c usb.img -%c compact.img -%c\n",
+                      program_name,
+                      argument_map[Argument_drive].short_name,
+                      argument_map[Argument_output].short_name,
+                      argument_map[Argument_truncate].short_name);
+        error_level = 1;
+    }
+
+    return error_level;
+}
+
+}
+
+int wmain(int argc, _In_reads_(argc) wchar_t** argv)
+{
+    (void)argc;     // Unreferenced parameter.
+    (void)argv;
+
+    // ERRORLEVEL zero is the success code.
+    int error_level;
+
+    // Set outside the try block so error messages use the proper code page.
+    // This class does not throw.
+    WindowsCommon::UTF8_console_code_page code_page;
+
+    // Writes I/O statistics on exit when DISKTOOLS_IO_STATISTICS is set.
+    DiskTools::Io_statistics_report io_statistics_report;
+
+    // Writes a trace on exit when built with DISKTOOLS_TRACE and DISKTOOLS_TRACE is set.
+    DISKTOOLS_TRACE_REPORT();
+
+    try
+    {
+        PortableRuntime::set_dprintf(WindowsCommon::debugger_dprintf);
+
+        // Set wprintf output to UTF-8 in Windows console.
+        // CHECK_EXCEPTION ensures against the case that the CRT invalid parameter handler
+        // routine is set by a global constructor.
+        CHECK_EXCEPTION(_setmode(_fileno(stdout), _O_U8TEXT) != -1, u8"Failed to set UTF-8 output mode.");
+        CHECK_EXCEPTION(_setmode(_fileno(stderr), _O_U8TEXT) != -1, u8"Failed to set UTF-8 output mode.");
+
+        assert(WindowsCommon::args_from_command_line().size() == (static_cast<size_t>(argc)));
+        error_level = CompactFat::parse_arguments_and_execute();
+    }
+    catch(const std::exception& ex)
+    {
+        std::fwprintf(stderr, L"\n%s\n", PortableRuntime::utf16_from_utf8(ex.what()).c_str());
+        error_level = 1;
+    }
+
+    return error_level;
+}
+
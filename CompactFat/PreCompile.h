@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cassert>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef _MSC_VER
+
+#include <Shlwapi.h>
+#include <windows.h>
+#include <strsafe.h>
+
+// APIs for MSVCRT UTF-8 output.
+#include <fcntl.h>
+#include <io.h>
+
+#endif
+
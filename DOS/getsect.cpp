@@ -17,6 +17,8 @@ limitations under the License.
 #include <stdio.h>
 #include <bios.h>
 
+// The CHS functions of INT 13h, which biosdisk calls, always transfer 512 byte
+// sectors.  512e disks are addressed this way too, and 4Kn disks not at all.
 const unsigned int sector_size = 512;
 unsigned char sector[sector_size];
 
@@ -0,0 +1,191 @@
+// This program compares two disks or images, lists the sectors that differ and
+// the partitions they fall in, and can write a patch that WriteImage applies.
+
+#include "PreCompile.h"
+#include <DiskTools/BlockDevice.h>
+#include <DiskTools/DirectRead.h>
+#include <DiskTools/ImageDiff.h>
+#include <DiskTools/IoStatistics.h>
+#include <DiskTools/OutputSink.h>
+#include <DiskTools/PartitionTable.h>
+#include <DiskTools/StringUtils.h>
+#include <DiskTools/Trace.h>
+#include <Parsing/CommandLine.h>
+#include <WindowsCommon/CheckHR.h>
+#include <WindowsCommon/CommandLine.h>
+#include <WindowsCommon/DebuggerTracing.h>
+#include <WindowsCommon/Wrappers.h>
+#include <PortableRuntime/CheckException.h>
+#include <PortableRuntime/Tracing.h>
+#include <PortableRuntime/Unicode.h>
+
+namespace DiffImage
+{
+
+// Lists the partitions that an extent overlaps, such as "1 (NTFS/HPFS), 5 (DOS FAT16)".
+static std::wstring partition_names(const std::vector<DiskTools::Partition_location>& partitions, uint64_t start_sector, uint64_t sector_count)
+{
+    std::wstring names;
+    for(const auto partition : DiskTools::partitions_overlapping(partitions, start_sector, sector_count))
+    {
+        if(!names.empty())
+        {
+            names += L", ";
+        }
+        names += std::to_wstring(partition->number);
+
+        const PCTSTR file_system_name = DiskTools::get_file_system_name(partition->file_system_type);
+        if(!partition->is_gpt && (nullptr != file_system_name))
+        {
+            names += L" (";
+            names += file_system_name;
+            names += L")";
+        }
+    }
+
+    return names.empty() ? std::wstring(L"-") : names;
+}
+
+static void diff_images(
+    const std::string& original_name,
+    const std::string& modified_name,
+    unsigned int thread_count,
+    _In_opt_z_ const char* patch_file_name)
+{
+    // Partitions are read from the original, or from the modified image if the original has none.
+    const auto original = DiskTools::open_disk_or_device(original_name);
+    const unsigned int sector_size = original->sector_size();
+    auto partitions = DiskTools::read_partition_layout(original.get());
+    if(partitions.empty())
+    {
+        partitions = DiskTools::read_partition_layout(DiskTools::open_disk_or_device(modified_name).get());
+    }
+
+    const auto extents = DiskTools::find_differences(original_name, modified_name, sector_size, thread_count, DiskTools::default_diff_block_size);
+
+    DiskTools::Output_sink output;
+    output.write(u8"         LBA       Sectors  Partitions\n");
+    uint64_t differing_bytes = 0;
+    for(const auto& extent : extents)
+    {
+        const uint64_t start_sector = extent.offset / sector_size;
+        const uint64_t sector_count = (extent.offset + extent.length + sector_size - 1) / sector_size - start_sector;
+        output.write_decimal(start_sector, 12).write(u8"  ");
+        output.write_decimal(sector_count, 12).write(u8"  ");
+        output.write(PortableRuntime::utf8_from_utf16(partition_names(partitions, start_sector, sector_count).c_str())).write(u8"\n");
+        differing_bytes += extent.length;
+    }
+    output.flush();
+    std::fwprintf(stderr,
+                  L"%llu extents, %llu bytes differ.\n",
+                  static_cast<unsigned long long>(extents.size()),
+                  static_cast<unsigned long long>(differing_bytes));
+
+    if(nullptr != patch_file_name)
+    {
+        DiskTools::write_image_patch(original_name, modified_name, extents, patch_file_name);
+    }
+}
+
+static int parse_arguments_and_execute()
+{
+    enum
+    {
+        Argument_original = 0,
+        Argument_modified,
+        Argument_patch,
+        Argument_threads,
+        Argument_help,
+    };
+
+    const std::vector<Parsing::Argument_descriptor> argument_map =
+    {
+        { Argument_original, u8"original", u8'o', true,  u8"The disk number, or the path of a device or image, to compare from." },
+        { Argument_modified, u8"modified", u8'm', true,  u8"The disk number, or the path of a device or image, to compare to." },
+        { Argument_patch,    u8"patch",    u8'p', true,  u8"Write a patch that turns the original into the modified image to this file." },
+        { Argument_threads,  u8"threads",  u8't', true,  u8"The number of comparison threads. Default: one per processor." },
+        { Argument_help,     u8"help",     u8'?', false, nullptr },
+    };
+#ifndef NDEBUG
+    Parsing::validate_argument_map(argument_map);
+#endif
+
+    const auto arguments = WindowsCommon::args_from_command_line();
+    const auto options = Parsing::options_from_allowed_args(arguments, argument_map);
+
+    int error_level = 0;
+    if((options.count(Argument_help) == 0) && (options.count(Argument_original) > 0) && (options.count(Argument_modified) > 0))
+    {
+        const uint64_t thread_count = (options.count(Argument_threads) > 0) ?
+                                      DiskTools::parse_unsigned(options.at(Argument_threads), argument_map[Argument_threads].long_name) :
+                                      std::thread::hardware_concurrency();
+
+        diff_images(options.at(Argument_original),
+                    options.at(Argument_modified),
+                    static_cast<unsigned int>(std::min<uint64_t>(std::max<uint64_t>(thread_count, 1), UINT_MAX)),
+                    (options.count(Argument_patch) > 0) ? options.at(Argument_patch).c_str() : nullptr);
+    }
+    else
+    {
+        constexpr auto arg_program_name = 0;
+
+        // Hold a reference to program_name_long for the duration of the output functions.
+        const auto program_name_long = PortableRuntime::utf16_from_utf8(arguments[arg_program_name]);
+        const auto program_name = PathFindFileNameW(program_name_long.c_str());
+
+        std::fwprintf(stderr, L"Usage: %s [options]\nOptions:\n", program_name);
+        std::fwprintf(stderr, PortableRuntime::utf16_from_utf8(Parsing::Options_help_text(argument_map)).c_str());
+        std::fwprintf(stderr,
+                      L"\nTo compare the second drive with an image of it, and save a patch:\n  %s -%c golden.img -%c 1 -%c disk.patch\n",
+                      program_name,
+                      argument_map[Argument_original].short_name,
+                      argument_map[Argument_modified].short_name,
+                      argument_map[Argument_patch].short_name);
+        error_level = 1;
+    }
+
+    return error_level;
+}
+
+}
+
+int wmain(int argc, _In_reads_(argc) wchar_t** argv)
+{
+    (void)argc;     // Unreferenced parameter.
+    (void)argv;
+
+    // ERRORLEVEL zero is the success code.
+    int error_level;
+
+    // Set outside the try block so error messages use the proper code page.
+    // This class does not throw.
+    WindowsCommon::UTF8_console_code_page code_page;
+
+    // Writes I/O statistics on exit when DISKTOOLS_IO_STATISTICS is set.
+    DiskTools::Io_statistics_report io_statistics_report;
+
+    // Writes a trace on exit when built with DISKTOOLS_TRACE and DISKTOOLS_TRACE is set.
+    DISKTOOLS_TRACE_REPORT();
+
+    try
+    {
+        PortableRuntime::set_dprintf(WindowsCommon::debugger_dprintf);
+
+        // Set wprintf output to UTF-8 in Windows console.
+        // CHECK_EXCEPTION ensures against the case that the CRT invalid parameter handler
+        // routine is set by a global constructor.
+        CHECK_EXCEPTION(_setmode(_fileno(stdout), _O_U8TEXT) != -1, u8"Failed to set UTF-8 output mode.");
+        CHECK_EXCEPTION(_setmode(_fileno(stderr), _O_U8TEXT) != -1, u8"Failed to set UTF-8 output mode.");
+
+        assert(WindowsCommon::args_from_command_line().size() == (static_cast<size_t>(argc)));
+        error_level = DiffImage::parse_arguments_and_execute();
+    }
+    catch(const std::exception& ex)
+    {
+        std::fwprintf(stderr, L"\n%s\n", PortableRuntime::utf16_from_utf8(ex.what()).c_str());
+        error_level = 1;
+    }
+
+    return error_level;
+}
+
@@ -0,0 +1,963 @@
+// This program measures sector I/O throughput and latency against a disk or an
+// image file.  Write benchmarks only run against image files, whose contents
+// they destroy.
+
+#include "PreCompile.h"
+#include <DiskTools/BlockDevice.h>
+#include <DiskTools/BufferPool.h>
+#include <DiskTools/Copy.h>
+#include <DiskTools/DirectRead.h>
+#include <DiskTools/IoStatistics.h>
+#include <DiskTools/ParallelScan.h>
+#include <DiskTools/ReportUtils.h>
+#include <DiskTools/SimulatedDevice.h>
+#include <DiskTools/Trace.h>
+#include <Parsing/CommandLine.h>
+#include <WindowsCommon/CheckHR.h>
+#include <WindowsCommon/CommandLine.h>
+#include <WindowsCommon/DebuggerTracing.h>
+#include <WindowsCommon/ScopedWindowsTypes.h>
+#include <WindowsCommon/Wrappers.h>
+#include <PortableRuntime/CheckException.h>
+#include <PortableRuntime/Tracing.h>
+#include <PortableRuntime/Unicode.h>
+
+namespace DiskBench
+{
+
+enum class Access_pattern
+{
+    sequential,
+    random,
+};
+
+struct Benchmark_configuration
+{
+    std::string workload;
+    Access_pattern pattern;
+    bool is_write;
+    size_t block_size;
+    unsigned int queue_depth;
+    bool is_direct;
+    unsigned int thread_count;
+};
+
+struct Benchmark_result
+{
+    Benchmark_configuration configuration;
+    uint64_t operations;
+    uint64_t bytes;
+    double seconds;
+    double latency_p50_us;
+    double latency_p90_us;
+    double latency_p99_us;
+    double latency_p999_us;
+    double latency_max_us;
+};
+
+// Per-thread measurements.  Latencies are in performance counter ticks.
+struct Worker_result
+{
+    uint64_t operations = 0;
+    uint64_t bytes = 0;
+    std::vector<uint64_t> latencies;
+};
+
+struct Benchmark_options
+{
+    std::string target;
+    std::vector<std::string> workloads;
+    std::vector<std::string> patterns;
+    std::vector<size_t> block_sizes;
+    std::vector<unsigned int> queue_depths;
+    std::vector<unsigned int> thread_counts;
+    std::vector<bool> direct_modes;
+    double seconds;
+    uint64_t copy_length;
+    std::string scratch_file_name;
+    bool allow_write;
+};
+
+// xorshift64*, which is plenty for choosing random offsets, and is
+// reproducible across runs for a given seed.
+static uint64_t next_random(_Inout_ uint64_t* state) noexcept
+{
+    uint64_t value = *state;
+    value ^= value >> 12;
+    value ^= value << 25;
+    value ^= value >> 27;
+    *state = value;
+    return value * 0x2545F4914F6CDD1Dull;
+}
+
+// Storage that compresses or deduplicates would report unrealistic numbers for
+// constant data, so writes use pseudo-random buffers.
+static void fill_random(_Out_writes_bytes_(size) uint8_t* buffer, size_t size, uint64_t seed) noexcept
+{
+    uint64_t state = seed | 1;
+    for(size_t index = 0; index < size; ++index)
+    {
+        buffer[index] = static_cast<uint8_t>(next_random(&state) >> 56);
+    }
+}
+
+static std::string pattern_name(Access_pattern pattern)
+{
+    return (Access_pattern::sequential == pattern) ? u8"sequential" : u8"random";
+}
+
+// Chooses the next offset for a worker.  Sequential workers each walk their own
+// region of the target, so that threads do not read each other's data.
+class Offset_generator
+{
+    Access_pattern m_pattern;
+    size_t m_block_size;
+    uint64_t m_region_start;
+    uint64_t m_region_blocks;
+    uint64_t m_next_block;
+    uint64_t m_random_state;
+
+public:
+    Offset_generator(Access_pattern pattern, size_t block_size, uint64_t device_size, unsigned int thread_index, unsigned int thread_count) noexcept :
+        m_pattern(pattern),
+        m_block_size(block_size),
+        m_region_start(0),
+        m_region_blocks(device_size / block_size),
+        m_next_block(0),
+        m_random_state(0x9E3779B97F4A7C15ull * (thread_index + 1))
+    {
+        if(Access_pattern::sequential == m_pattern)
+        {
+            m_region_blocks = std::max<uint64_t>(1, (device_size / block_size) / thread_count);
+            m_region_start = m_region_blocks * thread_index * block_size;
+        }
+    }
+
+    uint64_t next() noexcept
+    {
+        uint64_t block;
+        if(Access_pattern::sequential == m_pattern)
+        {
+            block = m_next_block;
+            m_next_block = (m_next_block + 1) % m_region_blocks;
+        }
+        else
+        {
+            block = next_random(&m_random_state) % m_region_blocks;
+        }
+
+        return m_region_start + block * m_block_size;
+    }
+};
+
+static Benchmark_result summarize(const Benchmark_configuration& configuration, std::vector<Worker_result>* worker_results, uint64_t elapsed_ticks)
+{
+    const double tick_frequency = static_cast<double>(DiskTools::get_tick_frequency());
+
+    Benchmark_result result{};
+    result.configuration = configuration;
+    result.seconds = elapsed_ticks / tick_frequency;
+
+    std::vector<uint64_t> latencies;
+    for(const auto& worker_result : *worker_results)
+    {
+        result.operations += worker_result.operations;
+        result.bytes += worker_result.bytes;
+        latencies.insert(latencies.end(), worker_result.latencies.cbegin(), worker_result.latencies.cend());
+    }
+
+    if(!latencies.empty())
+    {
+        const auto percentile_us = [&latencies, tick_frequency](double percentile)
+        {
+            const size_t index = std::min(latencies.size() - 1, static_cast<size_t>(latencies.size() * percentile));
+            std::nth_element(latencies.begin(), latencies.begin() + index, latencies.end());
+            return latencies[index] * 1000000.0 / tick_frequency;
+        };
+
+        result.latency_p50_us  = percentile_us(0.50);
+        result.latency_p90_us  = percentile_us(0.90);
+        result.latency_p99_us  = percentile_us(0.99);
+        result.latency_p999_us = percentile_us(0.999);
+        result.latency_max_us  = *std::max_element(latencies.cbegin(), latencies.cend()) * 1000000.0 / tick_frequency;
+    }
+
+    return result;
+}
+
+static uint64_t get_target_size(const std::string& target)
+{
+    return DiskTools::open_block_device(target.c_str())->size();
+}
+
+struct Io_slot
+{
+    OVERLAPPED overlapped;      // Must be first, so that completions can be mapped back to slots.
+    uint8_t* buffer;
+    uint64_t issue_ticks;
+};
+
+// Cancels the requests still in flight and waits for their completions, so that
+// an exception cannot free the slots or the buffers while the kernel still uses them.
+class Outstanding_io_guard
+{
+    HANDLE m_handle;
+    HANDLE m_completion_port;
+    unsigned int* m_outstanding;
+
+public:
+    Outstanding_io_guard(HANDLE handle, HANDLE completion_port, _In_ unsigned int* outstanding) noexcept :
+        m_handle(handle),
+        m_completion_port(completion_port),
+        m_outstanding(outstanding)
+    {
+    }
+
+    ~Outstanding_io_guard()
+    {
+        if(*m_outstanding > 0)
+        {
+            CancelIoEx(m_handle, nullptr);
+        }
+
+        while(*m_outstanding > 0)
+        {
+            DWORD bytes_transferred;
+            ULONG_PTR completion_key;
+            LPOVERLAPPED overlapped;
+            (void)GetQueuedCompletionStatus(m_completion_port, &bytes_transferred, &completion_key, &overlapped, INFINITE);
+            if(nullptr == overlapped)
+            {
+                // The port itself failed, so there is nothing left to wait on.
+                break;
+            }
+            --*m_outstanding;
+        }
+    }
+
+    // Not implemented to prevent accidental copying/moving.
+    Outstanding_io_guard(const Outstanding_io_guard&) = delete;
+    Outstanding_io_guard(Outstanding_io_guard&&) noexcept = delete;
+    Outstanding_io_guard& operator=(const Outstanding_io_guard&) = delete;
+    Outstanding_io_guard& operator=(Outstanding_io_guard&&) noexcept = delete;
+};
+
+// Keeps queue_depth overlapped requests in flight until stop_ticks, using a
+// completion port to find out which request finished.
+static void run_io_worker(
+    const Benchmark_configuration& configuration,
+    const std::string& target,
+    uint64_t device_size,
+    unsigned int thread_index,
+    uint64_t stop_ticks,
+    _Out_ Worker_result* result)
+{
+    // Allocated before the handle is opened, so that the buffers outlive any
+    // requests still in flight if an exception closes the handle.
+    const auto buffers = DiskTools::acquire_io_buffer(configuration.block_size * configuration.queue_depth);
+    if(configuration.is_write)
+    {
+        fill_random(buffers.data(), configuration.block_size * configuration.queue_depth, thread_index + 1);
+    }
+
+    DWORD flags = FILE_FLAG_OVERLAPPED;
+    if(configuration.is_direct)
+    {
+        flags |= FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH;
+    }
+
+    const auto handle = WindowsCommon::create_file(target.c_str(),
+                                                   configuration.is_write ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ,
+                                                   FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                                   nullptr,
+                                                   OPEN_EXISTING,
+                                                   flags,
+                                                   nullptr);
+
+    std::unique_ptr<void, std::function<void (HANDLE handle)>> completion_port(
+        CreateIoCompletionPort(handle, nullptr, 0, 1),
+        [](HANDLE port)
+        {
+            if(nullptr != port)
+            {
+                CloseHandle(port);
+            }
+        });
+    CHECK_BOOL_LAST_ERROR(completion_port.get() != nullptr);
+
+    Offset_generator offsets(configuration.pattern, configuration.block_size, device_size, thread_index, configuration.thread_count);
+    std::vector<Io_slot> slots(configuration.queue_depth);
+
+    // Declared after slots, so that it drains the requests before slots is freed.
+    unsigned int outstanding = 0;
+    const Outstanding_io_guard outstanding_guard(handle, completion_port.get(), &outstanding);
+
+    // Cast is safe as block sizes are limited to well under MAX_DWORD.
+    const DWORD block_size = static_cast<DWORD>(configuration.block_size);
+
+    const auto issue = [&](Io_slot* slot)
+    {
+        const uint64_t offset = offsets.next();
+        slot->overlapped = OVERLAPPED{};
+        slot->overlapped.Offset     = static_cast<DWORD>(offset & 0xffffffff);
+        slot->overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        slot->issue_ticks = DiskTools::get_ticks();
+
+        const BOOL issued = configuration.is_write ?
+            WriteFile(handle, slot->buffer, block_size, nullptr, &slot->overlapped) :
+            ReadFile(handle, slot->buffer, block_size, nullptr, &slot->overlapped);
+        if(!issued)
+        {
+            CHECK_BOOL_LAST_ERROR(GetLastError() == ERROR_IO_PENDING);
+        }
+
+        // Requests that complete synchronously still post a completion.
+        ++outstanding;
+    };
+
+    result->latencies.reserve(1024 * 1024);
+    for(unsigned int slot_index = 0; slot_index < configuration.queue_depth; ++slot_index)
+    {
+        slots[slot_index].buffer = buffers.data() + slot_index * configuration.block_size;
+        issue(&slots[slot_index]);
+    }
+
+    while(outstanding > 0)
+    {
+        DWORD bytes_transferred;
+        ULONG_PTR completion_key;
+        LPOVERLAPPED overlapped;
+        const BOOL succeeded = GetQueuedCompletionStatus(completion_port.get(), &bytes_transferred, &completion_key, &overlapped, INFINITE);
+        if(nullptr != overlapped)
+        {
+            // A failed request still dequeues its completion.
+            --outstanding;
+        }
+        CHECK_BOOL_LAST_ERROR(succeeded != 0);
+
+        const uint64_t now = DiskTools::get_ticks();
+        const auto slot = reinterpret_cast<Io_slot*>(overlapped);
+        result->latencies.push_back(now - slot->issue_ticks);
+        ++result->operations;
+        result->bytes += bytes_transferred;
+
+        if(now < stop_ticks)
+        {
+            issue(slot);
+        }
+    }
+}
+
+// Synchronous reads through the DiskTools device layer, which is the path
+// that the partition tools and the image store use.
+static void run_block_device_worker(
+    const Benchmark_configuration& configuration,
+    const std::string& target,
+    unsigned int thread_index,
+    uint64_t stop_ticks,
+    _Out_ Worker_result* result)
+{
+    const auto device = DiskTools::open_block_device(target.c_str());
+    const auto buffer = DiskTools::acquire_io_buffer(configuration.block_size);
+    Offset_generator offsets(configuration.pattern, configuration.block_size, device->size(), thread_index, configuration.thread_count);
+
+    result->latencies.reserve(1024 * 1024);
+    uint64_t now = DiskTools::get_ticks();
+    while(now < stop_ticks)
+    {
+        const uint64_t start = now;
+        device->read(offsets.next(), buffer.data(), configuration.block_size);
+        now = DiskTools::get_ticks();
+
+        result->latencies.push_back(now - start);
+        ++result->operations;
+        result->bytes += configuration.block_size;
+    }
+}
+
+static Benchmark_result run_threads(
+    const Benchmark_configuration& configuration,
+    double seconds,
+    const std::function<void (unsigned int thread_index, uint64_t stop_ticks, Worker_result* result)>& worker)
+{
+    std::vector<Worker_result> worker_results(configuration.thread_count);
+    std::vector<std::exception_ptr> worker_exceptions(configuration.thread_count);
+    std::vector<std::thread> threads;
+    threads.reserve(configuration.thread_count);
+
+    const uint64_t start = DiskTools::get_ticks();
+    const uint64_t stop_ticks = start + static_cast<uint64_t>(seconds * DiskTools::get_tick_frequency());
+    {
+        // If a thread fails to start, those that did are joined once they reach stop_ticks.
+        const DiskTools::Thread_joiner joiner(&threads);
+        for(unsigned int thread_index = 0; thread_index < configuration.thread_count; ++thread_index)
+        {
+            threads.emplace_back([&, thread_index]()
+            {
+                DISKTOOLS_TRACE_THREAD_NAME("worker");
+
+                try
+                {
+                    worker(thread_index, stop_ticks, &worker_results[thread_index]);
+                }
+                catch(...)
+                {
+                    worker_exceptions[thread_index] = std::current_exception();
+                }
+            });
+        }
+    }
+    const uint64_t elapsed = DiskTools::get_ticks() - start;
+
+    for(const auto& exception : worker_exceptions)
+    {
+        if(exception)
+        {
+            std::rethrow_exception(exception);
+        }
+    }
+
+    return summarize(configuration, &worker_results, elapsed);
+}
+
+// Times each read or write that passes through it.  The native handle is
+// forwarded, so copy_device still takes its direct path, which is not timed.
+class Timed_device : public DiskTools::Block_device
+{
+    DiskTools::Block_device* m_device;
+    Worker_result* m_result;
+
+public:
+    Timed_device(_In_ DiskTools::Block_device* device, _In_ Worker_result* result) noexcept :
+        m_device(device),
+        m_result(result)
+    {
+    }
+
+    uint64_t size() const noexcept override
+    {
+        return m_device->size();
+    }
+
+    unsigned int sector_size() const noexcept override
+    {
+        return m_device->sector_size();
+    }
+
+    void read(uint64_t offset, _Out_writes_bytes_(size) uint8_t* buffer, size_t size) override
+    {
+        const uint64_t start = DiskTools::get_ticks();
+        m_device->read(offset, buffer, size);
+        m_result->latencies.push_back(DiskTools::get_ticks() - start);
+        ++m_result->operations;
+        m_result->bytes += size;
+    }
+
+    void write(uint64_t offset, _In_reads_bytes_(size) const uint8_t* buffer, size_t size) override
+    {
+        const uint64_t start = DiskTools::get_ticks();
+        m_device->write(offset, buffer, size);
+        m_result->latencies.push_back(DiskTools::get_ticks() - start);
+        ++m_result->operations;
+        m_result->bytes += size;
+    }
+
+    HANDLE native_handle() const noexcept override
+    {
+        return m_device->native_handle();
+    }
+
+    void refresh_size() override
+    {
+        m_device->refresh_size();
+    }
+};
+
+// The RipISO loop: stream the target into a file.  Latency is per buffer read.
+static Benchmark_result run_rip_copy(const Benchmark_configuration& configuration, const Benchmark_options& options)
+{
+    std::vector<Worker_result> worker_results(1);
+
+    const auto source = DiskTools::open_block_device(options.target.c_str());
+    Timed_device timed_source(source.get(), &worker_results[0]);
+    const uint64_t length = std::min(options.copy_length, source->size());
+
+    const auto output_file = WindowsCommon::create_file(options.scratch_file_name.c_str(),
+                                                        GENERIC_WRITE,
+                                                        0,
+                                                        nullptr,
+                                                        CREATE_ALWAYS,
+                                                        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE,
+                                                        nullptr);
+
+    const uint64_t start = DiskTools::get_ticks();
+    DiskTools::stream_device(&timed_source, 0, length, configuration.block_size, [&output_file](_In_reads_bytes_(size) const uint8_t* buffer, size_t size)
+    {
+        // Cast is safe as block sizes are limited to well under MAX_DWORD.
+        DWORD amount_written;
+        CHECK_BOOL_LAST_ERROR(WriteFile(output_file, buffer, static_cast<DWORD>(size), &amount_written, nullptr) != 0);
+    });
+    const uint64_t elapsed = DiskTools::get_ticks() - start;
+
+    return summarize(configuration, &worker_results, elapsed);
+}
+
+// The WriteImage path: copy a scratch image onto the target.  Latency is per
+// buffer written outside of the direct path, which is only seen in the total time.
+static Benchmark_result run_write_image(const Benchmark_configuration& configuration, const Benchmark_options& options)
+{
+    std::vector<Worker_result> worker_results(1);
+
+    const auto target = DiskTools::open_block_device(options.target.c_str(), true);
+    const uint64_t length = std::min(options.copy_length, target->size());
+
+    // Build the source image once per run, outside of the timed region.
+    auto image = DiskTools::open_image_file(options.scratch_file_name.c_str(), CREATE_ALWAYS);
+    {
+        std::vector<uint8_t> buffer(DiskTools::default_copy_buffer_size);
+        fill_random(buffer.data(), buffer.size(), length);
+        for(uint64_t offset = 0; offset < length; offset += buffer.size())
+        {
+            image->write(offset, buffer.data(), static_cast<size_t>(std::min<uint64_t>(buffer.size(), length - offset)));
+        }
+    }
+
+    Timed_device timed_target(target.get(), &worker_results[0]);
+
+    const uint64_t start = DiskTools::get_ticks();
+    DiskTools::copy_device(image.get(), &timed_target, length, configuration.block_size);
+    const uint64_t elapsed = DiskTools::get_ticks() - start;
+
+    // Only the buffered writes counted themselves.
+    worker_results[0].bytes = length;
+
+    // The image is not opened for FILE_SHARE_DELETE, so close it before deleting it.
+    image.reset();
+    CHECK_BOOL_LAST_ERROR(DeleteFileW(PortableRuntime::utf16_from_utf8(options.scratch_file_name).c_str()) != 0);
+
+    return summarize(configuration, &worker_results, elapsed);
+}
+
+static std::vector<Benchmark_result> run_benchmarks(const Benchmark_options& options)
+{
+    std::vector<Benchmark_result> results;
+    const uint64_t device_size = get_target_size(options.target);
+
+    for(const auto& workload : options.workloads)
+    {
+        for(const auto block_size : options.block_sizes)
+        {
+            CHECK_EXCEPTION(block_size <= device_size, u8"Block size is larger than the target.");
+
+            Benchmark_configuration configuration{};
+            configuration.workload = workload;
+            configuration.pattern = Access_pattern::sequential;
+            configuration.block_size = block_size;
+            configuration.queue_depth = 1;
+            configuration.thread_count = 1;
+
+            if(u8"io" == workload)
+            {
+                for(const auto& pattern : options.patterns)
+                {
+                    configuration.pattern  = (pattern.compare(0, 4, u8"rand") == 0) ? Access_pattern::random : Access_pattern::sequential;
+                    configuration.is_write = (pattern.find(u8"write") != std::string::npos);
+
+                    for(const auto queue_depth : options.queue_depths)
+                    {
+                        for(const bool is_direct : options.direct_modes)
+                        {
+                            for(const auto thread_count : options.thread_counts)
+                            {
+                                configuration.queue_depth = queue_depth;
+                                configuration.is_direct = is_direct;
+                                configuration.thread_count = thread_count;
+
+                                results.push_back(run_threads(configuration, options.seconds, [&](unsigned int thread_index, uint64_t stop_ticks, Worker_result* result)
+                                {
+                                    run_io_worker(configuration, options.target, device_size, thread_index, stop_ticks, result);
+                                }));
+                            }
+                        }
+                    }
+                }
+            }
+            else if(u8"disktools-read" == workload)
+            {
+                for(const auto pattern : { Access_pattern::sequential, Access_pattern::random })
+                {
+                    for(const auto thread_count : options.thread_counts)
+                    {
+                        configuration.pattern = pattern;
+                        configuration.thread_count = thread_count;
+
+                        results.push_back(run_threads(configuration, options.seconds, [&](unsigned int thread_index, uint64_t stop_ticks, Worker_result* result)
+                        {
+                            run_block_device_worker(configuration, options.target, thread_index, stop_ticks, result);
+                        }));
+                    }
+                }
+            }
+            else if(u8"rip-copy" == workload)
+            {
+                results.push_back(run_rip_copy(configuration, options));
+            }
+            else if(u8"write-image" == workload)
+            {
+                configuration.is_write = true;
+                results.push_back(run_write_image(configuration, options));
+            }
+        }
+    }
+
+    return results;
+}
+
+// read_sector_from_handle queries the geometry on every call, so it is measured
+// separately, one sector at a time, as PartitionInfo and WinPartitionInfo use it.
+static Benchmark_result run_read_sector_from_handle(const Benchmark_options& options)
+{
+    Benchmark_configuration configuration{};
+    configuration.workload = u8"read-sector-from-handle";
+    configuration.pattern = Access_pattern::sequential;
+    configuration.queue_depth = 1;
+    configuration.thread_count = 1;
+
+    const auto handle = WindowsCommon::create_file(options.target.c_str(),
+                                                   GENERIC_READ,
+                                                   FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                                   nullptr,
+                                                   OPEN_EXISTING,
+                                                   FILE_ATTRIBUTE_NORMAL,
+                                                   nullptr);
+
+    std::vector<Worker_result> worker_results(1);
+    std::array<uint8_t, 4096> buffer;
+
+    const uint64_t start = DiskTools::get_ticks();
+    const uint64_t stop_ticks = start + static_cast<uint64_t>(options.seconds * DiskTools::get_tick_frequency());
+    uint64_t now = start;
+    for(uint64_t sector = 0; now < stop_ticks; ++sector)
+    {
+        unsigned int bytes_read = static_cast<unsigned int>(buffer.size());
+        CHECK_HR(DiskTools::read_sector_from_handle(buffer.data(), &bytes_read, handle, sector));
+        CHECK_EXCEPTION(bytes_read > 0, u8"Reached the end of the target.");
+
+        const uint64_t previous = now;
+        now = DiskTools::get_ticks();
+        worker_results[0].latencies.push_back(now - previous);
+        ++worker_results[0].operations;
+        worker_results[0].bytes += bytes_read;
+        configuration.block_size = bytes_read;
+    }
+
+    return summarize(configuration, &worker_results, now - start);
+}
+
+static std::string format_double(double value)
+{
+    char buffer[32];
+    CHECK_HR(StringCchPrintfA(buffer, ARRAYSIZE(buffer), "%.3f", value));
+    return buffer;
+}
+
+static std::vector<std::pair<std::string, std::string>> result_fields(const Benchmark_result& result)
+{
+    const auto& configuration = result.configuration;
+    const double megabytes_per_second = (result.seconds > 0) ? (result.bytes / (1024.0 * 1024.0) / result.seconds) : 0;
+    const double operations_per_second = (result.seconds > 0) ? (result.operations / result.seconds) : 0;
+
+    // Text fields are listed first, and are quoted in JSON.
+    return
+    {
+        { u8"workload",        configuration.workload },
+        { u8"pattern",         pattern_name(configuration.pattern) },
+        { u8"operation",       configuration.is_write ? u8"write" : u8"read" },
+        { u8"mode",            configuration.is_direct ? u8"direct" : u8"buffered" },
+        { u8"block_size",      std::to_string(configuration.block_size) },
+        { u8"queue_depth",     std::to_string(configuration.queue_depth) },
+        { u8"threads",         std::to_string(configuration.thread_count) },
+        { u8"operations",      std::to_string(result.operations) },
+        { u8"bytes",           std::to_string(result.bytes) },
+        { u8"seconds",         format_double(result.seconds) },
+        { u8"mb_per_second",   format_double(megabytes_per_second) },
+        { u8"iops",            format_double(operations_per_second) },
+        { u8"latency_p50_us",  format_double(result.latency_p50_us) },
+        { u8"latency_p90_us",  format_double(result.latency_p90_us) },
+        { u8"latency_p99_us",  format_double(result.latency_p99_us) },
+        { u8"latency_p999_us", format_double(result.latency_p999_us) },
+        { u8"latency_max_us",  format_double(result.latency_max_us) },
+    };
+}
+
+constexpr size_t text_field_count = 4;
+
+static std::string format_csv(const std::vector<Benchmark_result>& results)
+{
+    std::string output;
+    for(size_t index = 0; index < results.size(); ++index)
+    {
+        const auto fields = result_fields(results[index]);
+        if(0 == index)
+        {
+            for(size_t field = 0; field < fields.size(); ++field)
+            {
+                output += ((field > 0) ? u8"," : u8"") + fields[field].first;
+            }
+            output += u8"\n";
+        }
+
+        for(size_t field = 0; field < fields.size(); ++field)
+        {
+            output += ((field > 0) ? u8"," : u8"") + fields[field].second;
+        }
+        output += u8"\n";
+    }
+
+    return output;
+}
+
+static std::string format_json(const std::string& target, const std::vector<Benchmark_result>& results)
+{
+    std::string output = u8"{\n  \"target\": \"" + DiskTools::json_escape(target) + u8"\",\n  \"results\": [\n";
+    for(size_t index = 0; index < results.size(); ++index)
+    {
+        const auto fields = result_fields(results[index]);
+
+        output += u8"    {";
+        for(size_t field = 0; field < fields.size(); ++field)
+        {
+            const bool is_text = field < text_field_count;
+            output += ((field > 0) ? u8", \"" : u8"\"") + fields[field].first + u8"\": ";
+            output += is_text ? (u8"\"" + DiskTools::json_escape(fields[field].second) + u8"\"") : fields[field].second;
+        }
+        output += (index + 1 < results.size()) ? u8"},\n" : u8"}\n";
+    }
+    output += u8"  ]\n}\n";
+
+    return output;
+}
+
+static std::vector<std::string> split_list(const std::string& list)
+{
+    std::vector<std::string> items;
+    size_t start = 0;
+    while(start <= list.size())
+    {
+        const size_t end = std::min(list.find(',', start), list.size());
+        if(end > start)
+        {
+            items.push_back(list.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+
+    return items;
+}
+
+// Parses sizes such as 4096, 64K, or 1M.
+static uint64_t parse_size(const std::string& text)
+{
+    char* end;
+    uint64_t value = _strtoui64(text.c_str(), &end, 10);
+    CHECK_EXCEPTION(end != text.c_str(), u8"Invalid size: " + text);
+
+    switch(*end)
+    {
+        case 'G': case 'g': value *= 1024;      // Fall through.
+        case 'M': case 'm': value *= 1024;      // Fall through.
+        case 'K': case 'k': value *= 1024; ++end; break;
+    }
+    CHECK_EXCEPTION(*end == '\0', u8"Invalid size: " + text);
+
+    return value;
+}
+
+static int parse_arguments_and_execute()
+{
+    enum
+    {
+        Argument_target = 0,
+        Argument_workloads,
+        Argument_patterns,
+        Argument_block_sizes,
+        Argument_queue_depths,
+        Argument_threads,
+        Argument_modes,
+        Argument_seconds,
+        Argument_length,
+        Argument_scratch,
+        Argument_format,
+        Argument_output,
+        Argument_allow_write,
+        Argument_help,
+    };
+
+    const std::vector<Parsing::Argument_descriptor> argument_map =
+    {
+        { Argument_target,       u8"target",       u8't', true,  u8"The disk (\\\\.\\PhysicalDrive1) or image file to benchmark." },
+        { Argument_workloads,    u8"workloads",    u8'w', true,  u8"Any of io, disktools-read, rip-copy, write-image. Default: io,disktools-read,rip-copy." },
+        { Argument_patterns,     u8"patterns",     u8'p', true,  u8"io patterns: seq-read, rand-read, seq-write, rand-write. Default: seq-read,rand-read." },
+        { Argument_block_sizes,  u8"block-sizes",  u8'b', true,  u8"Block sizes, with optional K, M suffix. Default: 4K,64K,1M." },
+        { Argument_queue_depths, u8"queue-depths", u8'q', true,  u8"io queue depths. Default: 1,4,32." },
+        { Argument_threads,      u8"threads",      u8'n', true,  u8"Thread counts for io and disktools-read. Default: 1,4." },
+        { Argument_modes,        u8"modes",        u8'm', true,  u8"io modes: buffered, direct. Default: buffered,direct." },
+        { Argument_seconds,      u8"seconds",      u8's', true,  u8"Duration of each timed run. Default: 5." },
+        { Argument_length,       u8"length",       u8'l', true,  u8"Bytes copied by rip-copy and write-image. Default: 256M." },
+        { Argument_scratch,      u8"scratch",      u8'x', true,  u8"Scratch file for rip-copy and write-image. Default: DiskBench.tmp." },
+        { Argument_format,       u8"format",       u8'f', true,  u8"Output format: csv or json. Default: csv." },
+        { Argument_output,       u8"output",       u8'o', true,  u8"Output file. Default: standard output." },
+        { Argument_allow_write,  u8"allow-write",  u8'a', false, u8"Allow write benchmarks, which destroy the contents of an image file target." },
+        { Argument_help,         u8"help",         u8'?', false, nullptr },
+    };
+#ifndef NDEBUG
+    Parsing::validate_argument_map(argument_map);
+#endif
+
+    const auto arguments = WindowsCommon::args_from_command_line();
+    const auto options = Parsing::options_from_allowed_args(arguments, argument_map);
+
+    const auto option_or_default = [&options](int argument, const char* default_value)
+    {
+        return (options.count(argument) > 0) ? options.at(argument) : std::string(default_value);
+    };
+
+    int error_level = 0;
+    if((options.count(Argument_help) == 0) && (options.count(Argument_target) > 0))
+    {
+        Benchmark_options benchmark_options;
+        benchmark_options.target = options.at(Argument_target);
+        benchmark_options.workloads = split_list(option_or_default(Argument_workloads, u8"io,disktools-read,rip-copy"));
+        benchmark_options.patterns = split_list(option_or_default(Argument_patterns, u8"seq-read,rand-read"));
+        benchmark_options.seconds = atof(option_or_default(Argument_seconds, u8"5").c_str());
+        benchmark_options.copy_length = parse_size(option_or_default(Argument_length, u8"256M"));
+        benchmark_options.scratch_file_name = option_or_default(Argument_scratch, u8"DiskBench.tmp");
+        benchmark_options.allow_write = options.count(Argument_allow_write) > 0;
+
+        for(const auto& size : split_list(option_or_default(Argument_block_sizes, u8"4K,64K,1M")))
+        {
+            const uint64_t block_size = parse_size(size);
+            CHECK_EXCEPTION((block_size >= 512) && (block_size <= 64 * 1024 * 1024) && (block_size % 512 == 0), u8"Block sizes must be multiples of 512, up to 64M: " + size);
+            benchmark_options.block_sizes.push_back(static_cast<size_t>(block_size));
+        }
+        for(const auto& depth : split_list(option_or_default(Argument_queue_depths, u8"1,4,32")))
+        {
+            benchmark_options.queue_depths.push_back(std::max(1, atoi(depth.c_str())));
+        }
+        for(const auto& count : split_list(option_or_default(Argument_threads, u8"1,4")))
+        {
+            benchmark_options.thread_counts.push_back(std::max(1, atoi(count.c_str())));
+        }
+        for(const auto& mode : split_list(option_or_default(Argument_modes, u8"buffered,direct")))
+        {
+            CHECK_EXCEPTION((u8"buffered" == mode) || (u8"direct" == mode), u8"Unknown mode: " + mode);
+            benchmark_options.direct_modes.push_back(u8"direct" == mode);
+        }
+        for(const auto& workload : benchmark_options.workloads)
+        {
+            CHECK_EXCEPTION((u8"io" == workload) || (u8"disktools-read" == workload) || (u8"rip-copy" == workload) || (u8"write-image" == workload),
+                            u8"Unknown workload: " + workload);
+        }
+
+        const bool writes_target =
+            (std::find(benchmark_options.workloads.cbegin(), benchmark_options.workloads.cend(), u8"write-image") != benchmark_options.workloads.cend()) ||
+            std::any_of(benchmark_options.patterns.cbegin(), benchmark_options.patterns.cend(), [](const std::string& pattern)
+            {
+                return pattern.find(u8"write") != std::string::npos;
+            });
+        CHECK_EXCEPTION(!writes_target || !DiskTools::is_device_path(benchmark_options.target.c_str()),
+                        u8"Write benchmarks only run against image files, not disks: " + benchmark_options.target);
+        CHECK_EXCEPTION(!writes_target || benchmark_options.allow_write,
+                        u8"Write benchmarks destroy the contents of the target. Pass --" + std::string(argument_map[Argument_allow_write].long_name) + u8" to confirm.");
+
+        const bool is_simulated = DiskTools::is_simulated_device_path(benchmark_options.target.c_str());
+        CHECK_EXCEPTION(!is_simulated || (std::find(benchmark_options.workloads.cbegin(), benchmark_options.workloads.cend(), u8"io") == benchmark_options.workloads.cend()),
+                        u8"The io workload issues its own Windows I/O, so it cannot run against a simulated device.");
+
+        auto results = run_benchmarks(benchmark_options);
+        if(!is_simulated && std::find(benchmark_options.workloads.cbegin(), benchmark_options.workloads.cend(), u8"disktools-read") != benchmark_options.workloads.cend())
+        {
+            results.push_back(run_read_sector_from_handle(benchmark_options));
+        }
+
+        const std::string format = option_or_default(Argument_format, u8"csv");
+        CHECK_EXCEPTION((u8"csv" == format) || (u8"json" == format), u8"Unknown format: " + format);
+        const std::string output = (u8"json" == format) ? format_json(benchmark_options.target, results) : format_csv(results);
+
+        if(options.count(Argument_output) > 0)
+        {
+            std::ofstream output_file(PortableRuntime::utf16_from_utf8(options.at(Argument_output)), std::ios::binary | std::ios::trunc);
+            CHECK_EXCEPTION(output_file.good(), u8"Error opening: " + options.at(Argument_output));
+
+            output_file.write(output.data(), output.size());
+            CHECK_EXCEPTION(!output_file.fail(), u8"Error writing output file.");
+        }
+        else
+        {
+            std::fwprintf(stdout, L"%s", PortableRuntime::utf16_from_utf8(output).c_str());
+        }
+    }
+    else
+    {
+        constexpr auto arg_program_name = 0;
+
+        // Hold a reference to program_name_long for the duration of the output functions.
+        const auto program_name_long = PortableRuntime::utf16_from_utf8(arguments[arg_program_name]);
+        const auto program_name = PathFindFileNameW(program_name_long.c_str());
+
+        std::fwprintf(stderr, L"Usage: %s [options]\nOptions:\n", program_name);
+        std::fwprintf(stderr, PortableRuntime::utf16_from_utf8(Parsing::Options_help_text(argument_map)).c_str());
+        std::fwprintf(stderr,
+                      L"\nTo find the best RipISO buffer size for the first CD drive:\n  %s -%c \\\\.\\CDROM0 -%c rip-copy -%c 64K,256K,1M,4M\n",
+                      program_name,
+                      argument_map[Argument_target].short_name,
+                      argument_map[Argument_workloads].short_name,
+                      argument_map[Argument_block_sizes].short_name);
+        error_level = 1;
+    }
+
+    return error_level;
+}
+
+}
+
+int wmain(int argc, _In_reads_(argc) wchar_t** argv)
+{
+    (void)argc;     // Unreferenced parameter.
+    (void)argv;
+
+    // ERRORLEVEL zero is the success code.
+    int error_level;
+
+    // Set outside the try block so error messages use the proper code page.
+    // This class does not throw.
+    WindowsCommon::UTF8_console_code_page code_page;
+
+    // Writes I/O statistics on exit when DISKTOOLS_IO_STATISTICS is set.
+    DiskTools::Io_statistics_report io_statistics_report;
+
+    // Writes a trace on exit when built with DISKTOOLS_TRACE and DISKTOOLS_TRACE is set.
+    DISKTOOLS_TRACE_REPORT();
+
+    try
+    {
+        PortableRuntime::set_dprintf(WindowsCommon::debugger_dprintf);
+
+        // Set wprintf output to UTF-8 in Windows console.
+        // CHECK_EXCEPTION ensures against the case that the CRT invalid parameter handler
+        // routine is set by a global constructor.
+        CHECK_EXCEPTION(_setmode(_fileno(stdout), _O_U8TEXT) != -1, u8"Failed to set UTF-8 output mode.");
+        CHECK_EXCEPTION(_setmode(_fileno(stderr), _O_U8TEXT) != -1, u8"Failed to set UTF-8 output mode.");
+
+        assert(WindowsCommon::args_from_command_line().size() == (static_cast<size_t>(argc)));
+        error_level = DiskBench::parse_arguments_and_execute();
+    }
+    catch(const std::exception& ex)
+    {
+        std::fwprintf(stderr, L"\n%s\n", PortableRuntime::utf16_from_utf8(ex.what()).c_str());
+        error_level = 1;
+    }
+
+    return error_level;
+}
+
@@ -0,0 +1,171 @@
+#include "PreCompile.h"
+#include "AllocatedImage.h" // Pick up forward declarations to ensure correctness.
+#include "BlockDevice.h"
+#include "Copy.h"
+#include "Fat.h"
+#include "PartitionTable.h"
+#include "Trace.h"
+#include <PortableRuntime/CheckException.h>
+
+namespace DiskTools
+{
+
+// Adds the unused clusters of the FAT volume at volume_offset to skipped, in
+// increasing order.  Returns false, and adds nothing, if there is no FAT volume there.
+static bool find_unused_clusters(
+    _In_ Block_device* device,
+    uint64_t volume_offset,
+    uint64_t volume_end,
+    _Inout_ std::vector<Image_extent>* skipped)
+{
+    // Boot sectors are at least 512 bytes, even on devices with smaller reported sectors.
+    std::vector<uint8_t> boot_sector(std::max(device->sector_size(), 512u));
+    if(volume_offset + boot_sector.size() > device->size())
+    {
+        return false;
+    }
+    device->read(volume_offset, boot_sector.data(), boot_sector.size());
+
+    Fat_geometry geometry;
+    if(!fat_geometry_from_boot_sector(boot_sector.data(), boot_sector.size(), &geometry))
+    {
+        return false;
+    }
+
+    // A volume that claims to run past its partition is only trusted up to the partition end.
+    volume_end = std::min(volume_end, volume_offset + geometry.total_sectors * geometry.bytes_per_sector);
+    if(volume_offset + geometry.first_data_sector * geometry.bytes_per_sector > volume_end)
+    {
+        return false;
+    }
+
+    const auto entries = read_file_allocation_table(device, volume_offset, geometry, geometry.active_file_allocation_table);
+
+    // Join runs of unused clusters, and skip the space after the last cluster as well.
+    const uint64_t cluster_size = static_cast<uint64_t>(geometry.sectors_per_cluster) * geometry.bytes_per_sector;
+    for(uint32_t cluster = fat_first_cluster; cluster < entries.size(); ++cluster)
+    {
+        if((entries[cluster] != fat_free_cluster) && (entries[cluster] != fat_bad_cluster))
+        {
+            continue;
+        }
+
+        const uint64_t offset = volume_offset + cluster_offset(geometry, cluster);
+        if(offset >= volume_end)
+        {
+            break;
+        }
+
+        const uint64_t length = std::min(cluster_size, volume_end - offset);
+        if(!skipped->empty() && (skipped->back().offset + skipped->back().length == offset))
+        {
+            skipped->back().length += length;
+        }
+        else
+        {
+            skipped->push_back(Image_extent { offset, length });
+        }
+    }
+
+    const uint64_t clusters_end = volume_offset + cluster_offset(geometry, static_cast<uint32_t>(entries.size()));
+    if(clusters_end < volume_end)
+    {
+        skipped->push_back(Image_extent { clusters_end, volume_end - clusters_end });
+    }
+
+    return true;
+}
+
+std::vector<Image_extent> find_allocated_extents(_In_ Block_device* device)
+{
+    DISKTOOLS_TRACE_SPAN("DiskTools", "find_allocated_extents");
+
+    // Unpartitioned media, such as floppies and some USB sticks, have the volume at sector zero.
+    std::vector<Image_extent> skipped;
+    if(!find_unused_clusters(device, 0, device->size(), &skipped))
+    {
+        auto partitions = read_partition_layout(device);
+        std::sort(partitions.begin(), partitions.end(), [](const Partition_location& left, const Partition_location& right)
+        {
+            return left.start_sector < right.start_sector;
+        });
+
+        // Overlapping partitions would make the skipped ranges overlap, so those are kept whole.
+        uint64_t previous_end = 0;
+        for(const auto& partition : partitions)
+        {
+            const uint64_t volume_offset = partition.start_sector * device->sector_size();
+            const uint64_t volume_end = std::min((partition.start_sector + partition.sector_count) * device->sector_size(), device->size());
+            if((volume_offset >= previous_end) && (volume_offset < volume_end))
+            {
+                find_unused_clusters(device, volume_offset, volume_end, &skipped);
+                previous_end = volume_end;
+            }
+        }
+    }
+
+    // The extents are what remains of the device.
+    std::vector<Image_extent> extents;
+    uint64_t offset = 0;
+    for(const auto& skip : skipped)
+    {
+        if(skip.offset > offset)
+        {
+            extents.push_back(Image_extent { offset, skip.offset - offset });
+        }
+        offset = skip.offset + skip.length;
+    }
+    if(offset < device->size())
+    {
+        extents.push_back(Image_extent { offset, device->size() - offset });
+    }
+
+    return extents;
+}
+
+void stream_extents(
+    _In_ Block_device* source,
+    const std::vector<Image_extent>& extents,
+    uint64_t length,
+    size_t buffer_size,
+    bool fill_gaps,
+    const std::function<void (uint64_t offset, _In_reads_bytes_(size) const uint8_t* buffer, size_t size)>& write_output)
+{
+    std::vector<uint8_t> zeros;
+    uint64_t position = 0;
+    const auto write_zeros = [&](uint64_t end)
+    {
+        zeros.resize(buffer_size);
+        while(position < end)
+        {
+            const size_t size = static_cast<size_t>(std::min<uint64_t>(buffer_size, end - position));
+            write_output(position, zeros.data(), size);
+            position += size;
+        }
+    };
+
+    for(const auto& extent : extents)
+    {
+        CHECK_EXCEPTION(extent.offset + extent.length <= length, u8"Extent is past the end of the image.");
+
+        if(fill_gaps)
+        {
+            write_zeros(extent.offset);
+        }
+
+        position = extent.offset;
+        stream_device(source, extent.offset, extent.length, buffer_size, [&](_In_reads_bytes_(size) const uint8_t* buffer, size_t size)
+        {
+            write_output(position, buffer, size);
+            position += size;
+        });
+    }
+
+    if(fill_gaps)
+    {
+        write_zeros(length);
+    }
+}
+
+}
+
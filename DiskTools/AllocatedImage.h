@@ -0,0 +1,37 @@
+#pragma once
+
+namespace DiskTools
+{
+
+class Block_device;
+
+// A byte range of a device that an image needs.
+struct Image_extent
+{
+    uint64_t offset;
+    uint64_t length;
+};
+
+// Finds the parts of a disk or image that hold data.  For each FAT12/16/32
+// volume, either in the partition table or at the start of an unpartitioned
+// device, that is the boot area, the FATs, the FAT12/16 root directory, and the
+// clusters that the FAT marks as in use.  Clusters marked bad are left out, as
+// they hold nothing and may not be readable.  Everything outside FAT volumes,
+// including the MBR, the gaps between partitions, and other file systems, is
+// kept whole.  Extents are sorted and never touch.
+std::vector<Image_extent> find_allocated_extents(_In_ Block_device* device);
+
+// Reads the extents of source in order, and passes each buffer to
+// write_output with its byte offset on the device.  With fill_gaps, the bytes
+// between extents, up to length, are passed as zeros, for outputs that must be
+// written sequentially.
+void stream_extents(
+    _In_ Block_device* source,
+    const std::vector<Image_extent>& extents,
+    uint64_t length,
+    size_t buffer_size,
+    bool fill_gaps,
+    const std::function<void (uint64_t offset, _In_reads_bytes_(size) const uint8_t* buffer, size_t size)>& write_output);
+
+}
+
@@ -0,0 +1,403 @@
+#include "PreCompile.h"
+#include "BlockDevice.h"    // Pick up forward declarations to ensure correctness.
+#include "BufferPool.h"
+#include "ImageStore.h"
+#include "IoStatistics.h"
+#include "SectorSize.h"
+#include "SimulatedDevice.h"
+#include "Trace.h"
+#include <PortableRuntime/CheckException.h>
+#include <PortableRuntime/Unicode.h>
+#include <WindowsCommon/CheckHR.h>
+#include <WindowsCommon/ScopedWindowsTypes.h>
+#include <WindowsCommon/Wrappers.h>
+
+namespace DiskTools
+{
+
+// ReadFile and WriteFile take a DWORD size, and some storage drivers reject very
+// large transfers, so split requests into pieces no larger than this.
+constexpr size_t max_transfer_size = 64 * 1024 * 1024;
+
+void Block_device::write(uint64_t offset, _In_reads_bytes_(size) const uint8_t* buffer, size_t size)
+{
+    (void)offset;   // Unreferenced parameters.
+    (void)buffer;
+    (void)size;
+
+    throw std::runtime_error(u8"Device is not writable.");
+}
+
+HANDLE Block_device::native_handle() const noexcept
+{
+    return nullptr;
+}
+
+void Block_device::refresh_size()
+{
+}
+
+static OVERLAPPED overlapped_from_offset(uint64_t offset) noexcept
+{
+    OVERLAPPED overlapped{};
+    overlapped.Offset     = static_cast<DWORD>(offset & 0xffffffff);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+    return overlapped;
+}
+
+void read_file_at(_In_ HANDLE handle, uint64_t offset, _Out_writes_bytes_(size) uint8_t* buffer, size_t size)
+{
+    while(size > 0)
+    {
+        // Cast is safe as max_transfer_size is less than MAX_DWORD.
+        const DWORD amount_to_read = static_cast<DWORD>(std::min(size, max_transfer_size));
+
+        // On a synchronous handle, the OVERLAPPED offset makes this a positioned read.
+        OVERLAPPED overlapped = overlapped_from_offset(offset);
+        DWORD amount_read;
+        {
+            DISKTOOLS_TRACE_SPAN("io", "ReadFile");
+            Io_timer timer(Io_operation::read);
+            CHECK_BOOL_LAST_ERROR(ReadFile(handle, buffer, amount_to_read, &amount_read, &overlapped) != 0);
+            CHECK_EXCEPTION(amount_read > 0, u8"Unexpected end of file.");
+            timer.complete(amount_read);
+        }
+
+        if(amount_read < amount_to_read)
+        {
+            record_io_retry(Io_operation::read);
+        }
+
+        buffer += amount_read;
+        offset += amount_read;
+        size   -= amount_read;
+    }
+}
+
+void write_file_at(_In_ HANDLE handle, uint64_t offset, _In_reads_bytes_(size) const uint8_t* buffer, size_t size)
+{
+    while(size > 0)
+    {
+        // Cast is safe as max_transfer_size is less than MAX_DWORD.
+        const DWORD amount_to_write = static_cast<DWORD>(std::min(size, max_transfer_size));
+
+        OVERLAPPED overlapped = overlapped_from_offset(offset);
+        DWORD amount_written;
+        {
+            DISKTOOLS_TRACE_SPAN("io", "WriteFile");
+            Io_timer timer(Io_operation::write);
+            CHECK_BOOL_LAST_ERROR(WriteFile(handle, buffer, amount_to_write, &amount_written, &overlapped) != 0);
+            CHECK_EXCEPTION(amount_written > 0, u8"Unable to write to file.");
+            timer.complete(amount_written);
+        }
+
+        if(amount_written < amount_to_write)
+        {
+            record_io_retry(Io_operation::write);
+        }
+
+        buffer += amount_written;
+        offset += amount_written;
+        size   -= amount_written;
+    }
+}
+
+bool is_device_path(_In_z_ const char* path) noexcept
+{
+    return strncmp(path, "\\\\.\\", 4) == 0;
+}
+
+bool is_same_file(_In_ HANDLE handle, _In_z_ const char* path)
+{
+    if(GetFileAttributesW(PortableRuntime::utf16_from_utf8(path).c_str()) == INVALID_FILE_ATTRIBUTES)
+    {
+        return false;
+    }
+
+    // Devices need not answer the query, and are never the same as an image file.
+    BY_HANDLE_FILE_INFORMATION handle_information;
+    if(GetFileInformationByHandle(handle, &handle_information) == 0)
+    {
+        return false;
+    }
+
+    const auto path_handle = WindowsCommon::create_file(path,
+                                                        FILE_READ_ATTRIBUTES,
+                                                        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                                        nullptr,
+                                                        OPEN_EXISTING,
+                                                        FILE_ATTRIBUTE_NORMAL,
+                                                        nullptr);
+    BY_HANDLE_FILE_INFORMATION path_information;
+    CHECK_BOOL_LAST_ERROR(GetFileInformationByHandle(path_handle, &path_information) != 0);
+
+    return (handle_information.dwVolumeSerialNumber == path_information.dwVolumeSerialNumber) &&
+           (handle_information.nFileIndexHigh == path_information.nFileIndexHigh) &&
+           (handle_information.nFileIndexLow == path_information.nFileIndexLow);
+}
+
+// Image files have no geometry to query, so an image of a 4Kn GPT disk is
+// recognized by its GPT header, which is in the second sector.  Other images,
+// including images of 4Kn MBR disks, are taken to have 512 byte sectors.
+static unsigned int get_image_sector_size(_In_ HANDLE handle, uint64_t size)
+{
+    static constexpr uint8_t gpt_signature[8] = { 'E', 'F', 'I', ' ', 'P', 'A', 'R', 'T' };
+
+    if(size < 2ull * advanced_format_sector_size)
+    {
+        return legacy_sector_size;
+    }
+
+    uint8_t signature[sizeof(gpt_signature)];
+    read_file_at(handle, legacy_sector_size, signature, sizeof(signature));
+    if(std::equal(std::cbegin(gpt_signature), std::cend(gpt_signature), signature))
+    {
+        return legacy_sector_size;
+    }
+
+    read_file_at(handle, advanced_format_sector_size, signature, sizeof(signature));
+    return std::equal(std::cbegin(gpt_signature), std::cend(gpt_signature), signature) ? advanced_format_sector_size : legacy_sector_size;
+}
+
+// A disk, CD drive, or image file opened with CreateFile.
+class File_device : public Block_device
+{
+    WindowsCommon::Scoped_handle m_handle;
+    uint64_t m_size;
+    unsigned int m_sector_size;
+    bool m_is_device;
+
+    void read_modify_write(uint64_t offset, _In_reads_bytes_(size) const uint8_t* buffer, size_t size);
+
+public:
+    File_device(_In_z_ const char* path, bool writable, DWORD creation_disposition);
+
+    void make_sparse(uint64_t size);
+
+    uint64_t size() const noexcept override;
+    unsigned int sector_size() const noexcept override;
+    void read(uint64_t offset, _Out_writes_bytes_(size) uint8_t* buffer, size_t size) override;
+    void write(uint64_t offset, _In_reads_bytes_(size) const uint8_t* buffer, size_t size) override;
+    HANDLE native_handle() const noexcept override;
+    void refresh_size() override;
+};
+
+File_device::File_device(_In_z_ const char* path, bool writable, DWORD creation_disposition) :
+    m_handle(WindowsCommon::create_file(path,
+                                        writable ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ,
+                                        FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                        nullptr,
+                                        creation_disposition,
+                                        FILE_ATTRIBUTE_NORMAL,
+                                        nullptr)),
+    m_size(0),
+    m_sector_size(legacy_sector_size),
+    m_is_device(is_device_path(path))
+{
+    if(m_is_device)
+    {
+        DWORD bytes_returned;
+        GET_LENGTH_INFORMATION length_information;
+        CHECK_BOOL_LAST_ERROR(DeviceIoControl(m_handle,
+                                              IOCTL_DISK_GET_LENGTH_INFO,
+                                              nullptr,
+                                              0,
+                                              &length_information,
+                                              sizeof(length_information),
+                                              &bytes_returned,
+                                              nullptr) != 0);
+        m_size = length_information.Length.QuadPart;
+
+        // Not all drivers support the geometry request, so keep the default on failure.
+        // The alignment masks need a power of two, so odd sizes are not trusted either.
+        DISK_GEOMETRY disk_geometry;
+        if((DeviceIoControl(m_handle,
+                            IOCTL_DISK_GET_DRIVE_GEOMETRY,
+                            nullptr,
+                            0,
+                            &disk_geometry,
+                            sizeof(disk_geometry),
+                            &bytes_returned,
+                            nullptr) != 0) &&
+           is_supported_sector_size(disk_geometry.BytesPerSector))
+        {
+            m_sector_size = disk_geometry.BytesPerSector;
+        }
+    }
+    else
+    {
+        LARGE_INTEGER file_size;
+        CHECK_BOOL_LAST_ERROR(GetFileSizeEx(m_handle, &file_size) != 0);
+        m_size = file_size.QuadPart;
+
+        if(OPEN_EXISTING == creation_disposition)
+        {
+            m_sector_size = get_image_sector_size(m_handle, m_size);
+        }
+    }
+}
+
+void File_device::make_sparse(uint64_t size)
+{
+    assert(!m_is_device);
+
+    // File systems without sparse file support, such as FAT, still get a file
+    // of the right size, with the unwritten ranges filled with zeros.
+    DWORD bytes_returned;
+    (void)DeviceIoControl(m_handle, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &bytes_returned, nullptr);
+
+    LARGE_INTEGER end_of_file;
+    end_of_file.QuadPart = size;
+    CHECK_BOOL_LAST_ERROR(SetFilePointerEx(m_handle, end_of_file, nullptr, FILE_BEGIN) != 0);
+    CHECK_BOOL_LAST_ERROR(SetEndOfFile(m_handle) != 0);
+    m_size = size;
+}
+
+uint64_t File_device::size() const noexcept
+{
+    return m_size;
+}
+
+unsigned int File_device::sector_size() const noexcept
+{
+    return m_sector_size;
+}
+
+void File_device::read(uint64_t offset, _Out_writes_bytes_(size) uint8_t* buffer, size_t size)
+{
+    CHECK_EXCEPTION((offset <= m_size) && (size <= m_size - offset), u8"Read past the end of the device.");
+
+    const uint64_t sector_mask = m_sector_size - 1;
+    if(!m_is_device || (((offset | size) & sector_mask) == 0))
+    {
+        read_file_at(m_handle, offset, buffer, size);
+    }
+    else
+    {
+        // Devices only accept sector aligned transfers, so read the covering
+        // sectors and copy out the requested bytes.
+        const uint64_t aligned_offset = offset & ~sector_mask;
+        const uint64_t aligned_end = (offset + size + sector_mask) & ~sector_mask;
+
+        const size_t aligned_size = static_cast<size_t>(aligned_end - aligned_offset);
+        const auto sectors = acquire_io_buffer(aligned_size);
+        read_file_at(m_handle, aligned_offset, sectors.data(), aligned_size);
+        memcpy(buffer, sectors.data() + (offset - aligned_offset), size);
+    }
+}
+
+void File_device::read_modify_write(uint64_t offset, _In_reads_bytes_(size) const uint8_t* buffer, size_t size)
+{
+    const uint64_t sector_mask = m_sector_size - 1;
+    const uint64_t aligned_offset = offset & ~sector_mask;
+    const uint64_t aligned_end = (offset + size + sector_mask) & ~sector_mask;
+
+    const size_t aligned_size = static_cast<size_t>(aligned_end - aligned_offset);
+    const auto sectors = acquire_io_buffer(aligned_size);
+    read_file_at(m_handle, aligned_offset, sectors.data(), aligned_size);
+    memcpy(sectors.data() + (offset - aligned_offset), buffer, size);
+    write_file_at(m_handle, aligned_offset, sectors.data(), aligned_size);
+}
+
+void File_device::write(uint64_t offset, _In_reads_bytes_(size) const uint8_t* buffer, size_t size)
+{
+    const uint64_t sector_mask = m_sector_size - 1;
+    if(!m_is_device)
+    {
+        // Image files may grow.
+        write_file_at(m_handle, offset, buffer, size);
+        m_size = std::max(m_size, offset + size);
+    }
+    else
+    {
+        CHECK_EXCEPTION((offset <= m_size) && (size <= m_size - offset), u8"Write past the end of the device.");
+
+        if(((offset | size) & sector_mask) == 0)
+        {
+            write_file_at(m_handle, offset, buffer, size);
+        }
+        else
+        {
+            read_modify_write(offset, buffer, size);
+        }
+    }
+}
+
+HANDLE File_device::native_handle() const noexcept
+{
+    return m_handle;
+}
+
+void File_device::refresh_size()
+{
+    // The size of a disk does not change while it is open.
+    if(!m_is_device)
+    {
+        LARGE_INTEGER file_size;
+        CHECK_BOOL_LAST_ERROR(GetFileSizeEx(m_handle, &file_size) != 0);
+        m_size = file_size.QuadPart;
+    }
+}
+
+std::unique_ptr<Block_device> open_block_device(_In_z_ const char* path, bool writable)
+{
+    if(is_simulated_device_path(path))
+    {
+        return open_simulated_device(path, writable);
+    }
+
+    if(is_image_manifest_path(path))
+    {
+        CHECK_EXCEPTION(!writable, u8"Images in the image store are read-only: " + std::string(path));
+        return open_image_manifest(path);
+    }
+
+    return std::make_unique<File_device>(path, writable, OPEN_EXISTING);
+}
+
+std::unique_ptr<Block_device> open_physical_disk(uint8_t disk_number, bool writable)
+{
+    static_assert(sizeof(disk_number) == 1, "disk_name array is too short to hold the disk_number.");
+    char disk_name[ARRAYSIZE("\\\\.\\PHYSICALDRIVE000")];
+    CHECK_HR(StringCchPrintfA(disk_name, ARRAYSIZE(disk_name), "\\\\.\\PHYSICALDRIVE%u", disk_number));
+
+    // This call requires elevation to administrator.
+    return std::make_unique<File_device>(disk_name, writable, OPEN_EXISTING);
+}
+
+std::unique_ptr<Block_device> open_disk_or_device(const std::string& name, bool writable)
+{
+    const bool is_disk_number = !name.empty() && std::all_of(name.cbegin(), name.cend(), [](char ch)
+    {
+        return (ch >= '0') && (ch <= '9');
+    });
+
+    if(is_disk_number)
+    {
+        const int disk_number = atoi(name.c_str());
+        CHECK_EXCEPTION((name.size() <= 3) && (disk_number <= UINT8_MAX), u8"Invalid disk number: " + name);
+
+        return open_physical_disk(static_cast<uint8_t>(disk_number), writable);
+    }
+
+    return open_block_device(name.c_str(), writable);
+}
+
+std::unique_ptr<Block_device> open_image_file(_In_z_ const char* path, DWORD creation_disposition)
+{
+    assert(!is_device_path(path));
+    return std::make_unique<File_device>(path, true, creation_disposition);
+}
+
+std::unique_ptr<Block_device> create_sparse_image_file(_In_z_ const char* path, uint64_t size)
+{
+    assert(!is_device_path(path));
+    auto image = std::make_unique<File_device>(path, true, CREATE_ALWAYS);
+    image->make_sparse(size);
+
+    return image;
+}
+
+}
+
@@ -0,0 +1,68 @@
+#pragma once
+
+namespace DiskTools
+{
+
+// Random access view of a physical disk, a CD drive, an image file, or an
+// image in the image store.  All offsets and sizes are in bytes.
+// Functions throw on failure.
+class Block_device
+{
+    // Not implemented to prevent accidental copying/moving.
+    Block_device(const Block_device&) = delete;
+    Block_device(Block_device&&) noexcept = delete;
+    Block_device& operator=(const Block_device&) = delete;
+    Block_device& operator=(Block_device&&) noexcept = delete;
+
+public:
+    Block_device() noexcept = default;
+    virtual ~Block_device() noexcept = default;
+
+    virtual uint64_t size() const noexcept = 0;
+    virtual unsigned int sector_size() const noexcept = 0;
+
+    // Reads or writes exactly size bytes.  Accesses past the end of the device throw.
+    // Devices that are not writable throw on write.
+    virtual void read(uint64_t offset, _Out_writes_bytes_(size) uint8_t* buffer, size_t size) = 0;
+    virtual void write(uint64_t offset, _In_reads_bytes_(size) const uint8_t* buffer, size_t size);
+
+    // Returns the handle of a disk, CD drive, or image file, so that copies can
+    // bypass the file cache (see copy_device), or nullptr for other devices.
+    virtual HANDLE native_handle() const noexcept;
+
+    // Reads the size again, after the native handle was used to change it.
+    virtual void refresh_size();
+};
+
+// Opens a device by path.  Device paths (\\.\PHYSICALDRIVE0, \\.\CDROM0) and image
+// files are opened directly.  Paths ending in .manifest are opened from the image store,
+// and paths starting with sim: open a Simulated_device (see SimulatedDevice.h).
+std::unique_ptr<Block_device> open_block_device(_In_z_ const char* path, bool writable = false);
+std::unique_ptr<Block_device> open_physical_disk(uint8_t disk_number, bool writable = false);
+
+// Opens a physical disk if name is a disk number, such as 1, and otherwise opens name as a path.
+std::unique_ptr<Block_device> open_disk_or_device(const std::string& name, bool writable = false);
+
+// Opens an image file for reading and writing.  creation_disposition is passed
+// through to CreateFile, so CREATE_ALWAYS truncates and OPEN_ALWAYS keeps existing contents.
+std::unique_ptr<Block_device> open_image_file(_In_z_ const char* path, DWORD creation_disposition);
+
+// Creates or truncates an image file of size bytes that only takes space for
+// the ranges that are written.  The rest reads as zeros.
+std::unique_ptr<Block_device> create_sparse_image_file(_In_z_ const char* path, uint64_t size);
+
+// Returns true for device paths, such as \\.\PHYSICALDRIVE0 or \\.\CDROM0, and false for files.
+bool is_device_path(_In_z_ const char* path) noexcept;
+
+// Returns true if path names an existing file that is the one open on handle,
+// compared by volume serial number and file ID, so that links and different
+// spellings of the same path are caught.
+bool is_same_file(_In_ HANDLE handle, _In_z_ const char* path);
+
+// Positioned I/O on a synchronous file handle.  Callers should not depend on the
+// file pointer afterwards.
+void read_file_at(_In_ HANDLE handle, uint64_t offset, _Out_writes_bytes_(size) uint8_t* buffer, size_t size);
+void write_file_at(_In_ HANDLE handle, uint64_t offset, _In_reads_bytes_(size) const uint8_t* buffer, size_t size);
+
+}
+
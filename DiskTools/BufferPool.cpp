@@ -0,0 +1,274 @@
+#include "PreCompile.h"
+#include "BufferPool.h"     // Pick up forward declarations to ensure correctness.
+#include <PortableRuntime/CheckException.h>
+
+namespace DiskTools
+{
+
+// The shared pools cover each power of two from io_buffer_alignment to this size.
+constexpr size_t largest_pooled_buffer_size = 64 * 1024 * 1024;
+
+// Shared pools grow an arena of about this size at a time, so small buffers are
+// allocated many at once, and large buffers one at a time.
+constexpr size_t shared_arena_size = 4 * 1024 * 1024;
+constexpr size_t shared_maximum_buffers_per_arena = 64;
+
+// Enough for a deep queue of the largest buffers on each of many threads.
+constexpr size_t shared_maximum_arena_count = 256;
+
+constexpr uint64_t free_list_index_mask = 0xffffffff;
+
+// Large pages need SeLockMemoryPrivilege, which is granted to the user by policy,
+// but must also be enabled in the process token.  Returns false if it is not granted.
+static bool enable_lock_memory_privilege() noexcept
+{
+    HANDLE token;
+    if(OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES, &token) == 0)
+    {
+        return false;
+    }
+
+    TOKEN_PRIVILEGES privileges{};
+    privileges.PrivilegeCount = 1;
+    privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    bool is_enabled = (LookupPrivilegeValueW(nullptr, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid) != 0) &&
+                      (AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr) != 0);
+
+    // AdjustTokenPrivileges succeeds without enabling privileges that the user does not hold.
+    is_enabled = is_enabled && (GetLastError() == ERROR_SUCCESS);
+
+    CloseHandle(token);
+    return is_enabled;
+}
+
+static bool can_use_large_pages() noexcept
+{
+    static const bool is_lock_memory_enabled = (GetLargePageMinimum() != 0) && enable_lock_memory_privilege();
+    return is_lock_memory_enabled;
+}
+
+static size_t round_up(size_t value, size_t alignment) noexcept
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+Pooled_buffer::Pooled_buffer(_In_opt_ Buffer_pool* pool, uint32_t index, _In_ uint8_t* data, size_t size) noexcept :
+    m_pool(pool),
+    m_index(index),
+    m_data(data),
+    m_size(size)
+{
+}
+
+Pooled_buffer::Pooled_buffer(Pooled_buffer&& other) noexcept :
+    m_pool(other.m_pool),
+    m_index(other.m_index),
+    m_data(other.m_data),
+    m_size(other.m_size)
+{
+    other.m_pool = nullptr;
+    other.m_data = nullptr;
+    other.m_size = 0;
+}
+
+Pooled_buffer::~Pooled_buffer() noexcept
+{
+    if(m_pool != nullptr)
+    {
+        m_pool->release(m_index);
+    }
+    else if(m_data != nullptr)
+    {
+        VirtualFree(m_data, 0, MEM_RELEASE);
+    }
+}
+
+uint8_t* Pooled_buffer::data() const noexcept
+{
+    return m_data;
+}
+
+size_t Pooled_buffer::size() const noexcept
+{
+    return m_size;
+}
+
+Buffer_pool::Buffer_pool(size_t buffer_size, size_t buffers_per_arena, size_t maximum_arena_count, bool use_large_pages) :
+    m_buffer_size(round_up(std::max<size_t>(buffer_size, 1), io_buffer_alignment)),
+    m_buffers_per_arena(std::max<size_t>(buffers_per_arena, 1)),
+    m_arena_size(0),
+    m_use_large_pages(use_large_pages && can_use_large_pages()),
+    m_free_list_head(0)
+{
+    m_arena_size = m_buffer_size * m_buffers_per_arena;
+    if(m_use_large_pages)
+    {
+        // Large page allocations must be a multiple of the large page size, so
+        // fill the remainder of the last page with buffers.
+        m_arena_size = round_up(m_arena_size, GetLargePageMinimum());
+        m_buffers_per_arena = m_arena_size / m_buffer_size;
+    }
+
+    const uint64_t capacity = static_cast<uint64_t>(m_buffers_per_arena) * maximum_arena_count;
+    CHECK_EXCEPTION(capacity < free_list_index_mask, u8"Buffer pool is too large.");
+
+    m_arenas.reserve(maximum_arena_count);
+    m_next_free.reset(new std::atomic<uint32_t>[static_cast<size_t>(capacity)]);
+}
+
+Buffer_pool::~Buffer_pool() noexcept
+{
+    for(const auto arena : m_arenas)
+    {
+        VirtualFree(arena, 0, MEM_RELEASE);
+    }
+}
+
+uint8_t* Buffer_pool::buffer_address(uint32_t index) const noexcept
+{
+    return m_arenas[index / m_buffers_per_arena] + (index % m_buffers_per_arena) * m_buffer_size;
+}
+
+bool Buffer_pool::pop_free_buffer(_Out_ uint32_t* index) noexcept
+{
+    uint64_t head = m_free_list_head.load(std::memory_order_acquire);
+    for(;;)
+    {
+        const uint32_t first = static_cast<uint32_t>(head & free_list_index_mask);
+        if(first == 0)
+        {
+            *index = 0;
+            return false;
+        }
+
+        // If another thread takes the buffer first, this link may be stale, but
+        // the count in the head will have changed, so the exchange fails.
+        const uint32_t next = m_next_free[first - 1].load(std::memory_order_relaxed);
+        const uint64_t new_head = (((head >> 32) + 1) << 32) | next;
+        if(m_free_list_head.compare_exchange_weak(head, new_head, std::memory_order_acquire, std::memory_order_acquire))
+        {
+            *index = first - 1;
+            return true;
+        }
+    }
+}
+
+void Buffer_pool::push_free_buffer(uint32_t index) noexcept
+{
+    uint64_t head = m_free_list_head.load(std::memory_order_relaxed);
+    uint64_t new_head;
+    do
+    {
+        m_next_free[index].store(static_cast<uint32_t>(head & free_list_index_mask), std::memory_order_relaxed);
+        new_head = (((head >> 32) + 1) << 32) | (index + 1);
+    } while(!m_free_list_head.compare_exchange_weak(head, new_head, std::memory_order_release, std::memory_order_relaxed));
+}
+
+// Allocates a new arena, puts all but its first buffer on the free list, and
+// returns the index of the first buffer.
+uint32_t Buffer_pool::add_arena()
+{
+    CHECK_EXCEPTION(m_arenas.size() < m_arenas.capacity(), u8"Buffer pool is exhausted.  Buffers may not be released.");
+
+    uint8_t* arena = nullptr;
+    if(m_use_large_pages)
+    {
+        arena = static_cast<uint8_t*>(VirtualAlloc(nullptr, m_arena_size, MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE));
+    }
+    if(arena == nullptr)
+    {
+        // Large pages may be unavailable when physical memory is fragmented.
+        arena = static_cast<uint8_t*>(VirtualAlloc(nullptr, m_arena_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+    }
+    CHECK_EXCEPTION(arena != nullptr, u8"Unable to allocate I/O buffers.");
+
+    // Cast is safe as the constructor checks that every index fits in 32 bits.
+    const uint32_t first_index = static_cast<uint32_t>(m_arenas.size() * m_buffers_per_arena);
+    m_arenas.push_back(arena);
+
+    for(size_t buffer = m_buffers_per_arena - 1; buffer > 0; --buffer)
+    {
+        push_free_buffer(first_index + static_cast<uint32_t>(buffer));
+    }
+
+    return first_index;
+}
+
+size_t Buffer_pool::buffer_size() const noexcept
+{
+    return m_buffer_size;
+}
+
+Pooled_buffer Buffer_pool::acquire()
+{
+    uint32_t index;
+    if(!pop_free_buffer(&index))
+    {
+        std::lock_guard<std::mutex> lock(m_arena_mutex);
+
+        // Another thread may have added an arena while this one waited.
+        if(!pop_free_buffer(&index))
+        {
+            index = add_arena();
+        }
+    }
+
+    return Pooled_buffer(this, index, buffer_address(index), m_buffer_size);
+}
+
+void Buffer_pool::release(uint32_t index) noexcept
+{
+    push_free_buffer(index);
+}
+
+static bool is_large_pages_requested() noexcept
+{
+    char value[2];
+    return GetEnvironmentVariableA("DISKTOOLS_LARGE_PAGES", value, ARRAYSIZE(value)) > 0;
+}
+
+Pooled_buffer acquire_io_buffer(size_t size)
+{
+    constexpr size_t pool_count = 15;
+    static_assert((io_buffer_alignment << (pool_count - 1)) == largest_pooled_buffer_size, "pool_count must cover each power of two.");
+
+    if(size > largest_pooled_buffer_size)
+    {
+        const auto buffer = static_cast<uint8_t*>(VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+        CHECK_EXCEPTION(buffer != nullptr, u8"Unable to allocate I/O buffers.");
+
+        return Pooled_buffer(nullptr, 0, buffer, size);
+    }
+
+    // Pools are created on first use, so tools that only read a sector or two
+    // allocate one small arena.  They are never destroyed, so that buffers held
+    // by static objects stay valid until the process exits.
+    static std::array<std::atomic<Buffer_pool*>, pool_count> pools{};
+    static std::mutex pools_mutex;
+    static const bool use_large_pages = is_large_pages_requested();
+
+    unsigned int pool_index = 0;
+    while((io_buffer_alignment << pool_index) < size)
+    {
+        ++pool_index;
+    }
+
+    Buffer_pool* pool = pools[pool_index].load(std::memory_order_acquire);
+    if(pool == nullptr)
+    {
+        std::lock_guard<std::mutex> lock(pools_mutex);
+        pool = pools[pool_index].load(std::memory_order_relaxed);
+        if(pool == nullptr)
+        {
+            const size_t buffer_size = io_buffer_alignment << pool_index;
+            const size_t buffers_per_arena = std::min(std::max<size_t>(shared_arena_size / buffer_size, 1), shared_maximum_buffers_per_arena);
+            pool = new Buffer_pool(buffer_size, buffers_per_arena, shared_maximum_arena_count, use_large_pages);
+            pools[pool_index].store(pool, std::memory_order_release);
+        }
+    }
+
+    return pool->acquire();
+}
+
+}
+
@@ -0,0 +1,92 @@
+#pragma once
+
+namespace DiskTools
+{
+
+class Buffer_pool;
+
+// Every pooled buffer starts on a page boundary, which meets the alignment that
+// unbuffered I/O requires for 512, 2048, and 4096 byte sectors.
+constexpr size_t io_buffer_alignment = 4096;
+
+// A buffer from a Buffer_pool, which goes back to the pool when destroyed.
+class Pooled_buffer
+{
+    Buffer_pool* m_pool;    // nullptr for buffers too large for any pool, which are freed instead.
+    uint32_t m_index;
+    uint8_t* m_data;
+    size_t m_size;
+
+    // Not implemented to prevent accidental copying.
+    Pooled_buffer(const Pooled_buffer&) = delete;
+    Pooled_buffer& operator=(const Pooled_buffer&) = delete;
+    Pooled_buffer& operator=(Pooled_buffer&&) noexcept = delete;
+
+public:
+    Pooled_buffer(_In_opt_ Buffer_pool* pool, uint32_t index, _In_ uint8_t* data, size_t size) noexcept;
+    Pooled_buffer(Pooled_buffer&& other) noexcept;
+    ~Pooled_buffer() noexcept;
+
+    uint8_t* data() const noexcept;
+    size_t size() const noexcept;
+};
+
+// Hands out page aligned buffers of one size, carved from arenas that are
+// allocated with VirtualAlloc as the pool grows, and never freed until the pool
+// is.  Released buffers go on a lock-free free list, so once a pipeline has
+// its working set, acquiring and releasing buffers neither allocates nor locks.
+// Only adding an arena takes a lock.
+//
+// With use_large_pages, arenas are allocated with large pages when the process
+// can lock memory (the "Lock pages in memory" user right), which saves TLB
+// misses on multi-megabyte buffers, and with normal pages otherwise.
+class Buffer_pool
+{
+    size_t m_buffer_size;
+    size_t m_buffers_per_arena;
+    size_t m_arena_size;
+    bool m_use_large_pages;
+
+    std::mutex m_arena_mutex;
+    std::vector<uint8_t*> m_arenas;                         // Reserved up front, so readers never see it move.
+
+    std::unique_ptr<std::atomic<uint32_t>[]> m_next_free;   // Free list links, by buffer index.
+
+    // The low 32 bits are the index of the first free buffer plus one, or zero
+    // when the list is empty.  The high 32 bits count changes to the head, so
+    // that a pop that races with a pop and push of the same buffer fails.
+    std::atomic<uint64_t> m_free_list_head;
+
+    // Not implemented to prevent accidental copying/moving.
+    Buffer_pool(const Buffer_pool&) = delete;
+    Buffer_pool(Buffer_pool&&) noexcept = delete;
+    Buffer_pool& operator=(const Buffer_pool&) = delete;
+    Buffer_pool& operator=(Buffer_pool&&) noexcept = delete;
+
+    uint8_t* buffer_address(uint32_t index) const noexcept;
+    bool pop_free_buffer(_Out_ uint32_t* index) noexcept;
+    void push_free_buffer(uint32_t index) noexcept;
+    uint32_t add_arena();
+
+public:
+    // buffer_size is rounded up to a multiple of io_buffer_alignment.
+    // At most maximum_arena_count arenas are allocated, after which acquire throws.
+    Buffer_pool(size_t buffer_size, size_t buffers_per_arena, size_t maximum_arena_count, bool use_large_pages);
+    ~Buffer_pool() noexcept;
+
+    size_t buffer_size() const noexcept;
+
+    Pooled_buffer acquire();
+
+    // Called by Pooled_buffer.
+    void release(uint32_t index) noexcept;
+};
+
+// Returns a page aligned buffer of at least size bytes from pools shared by all
+// of DiskTools, with one pool for each power of two from 4KB to 64MB.  Larger
+// buffers are allocated and freed on each call.  Pools are thread safe, and use
+// large pages when the environment variable DISKTOOLS_LARGE_PAGES is set.
+Pooled_buffer acquire_io_buffer(size_t size);
+
+}
+
@@ -0,0 +1,75 @@
+#include "PreCompile.h"
+#include "ByteCompare.h"    // Pick up forward declarations to ensure correctness.
+
+namespace DiskTools
+{
+
+#if defined(_M_IX86) || defined(_M_X64)
+
+bool are_bytes_equal(_In_reads_bytes_(size) const uint8_t* first, _In_reads_bytes_(size) const uint8_t* second, size_t size) noexcept
+{
+    size_t index = 0;
+    for(; index + 64 <= size; index += 64)
+    {
+        const auto line_first = reinterpret_cast<const __m128i*>(first + index);
+        const auto line_second = reinterpret_cast<const __m128i*>(second + index);
+        const __m128i equal01 = _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128(line_first),     _mm_loadu_si128(line_second)),
+                                              _mm_cmpeq_epi8(_mm_loadu_si128(line_first + 1), _mm_loadu_si128(line_second + 1)));
+        const __m128i equal23 = _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128(line_first + 2), _mm_loadu_si128(line_second + 2)),
+                                              _mm_cmpeq_epi8(_mm_loadu_si128(line_first + 3), _mm_loadu_si128(line_second + 3)));
+        if(_mm_movemask_epi8(_mm_and_si128(equal01, equal23)) != 0xffff)
+        {
+            return false;
+        }
+    }
+
+    return memcmp(first + index, second + index, size - index) == 0;
+}
+
+bool is_constant(_In_reads_bytes_(size) const uint8_t* data, size_t size) noexcept
+{
+    if(0 == size)
+    {
+        return true;
+    }
+
+    const __m128i value = _mm_set1_epi8(static_cast<char>(data[0]));
+    size_t index = 0;
+    for(; index + 64 <= size; index += 64)
+    {
+        const auto line = reinterpret_cast<const __m128i*>(data + index);
+        const __m128i equal01 = _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128(line),     value),
+                                              _mm_cmpeq_epi8(_mm_loadu_si128(line + 1), value));
+        const __m128i equal23 = _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128(line + 2), value),
+                                              _mm_cmpeq_epi8(_mm_loadu_si128(line + 3), value));
+        if(_mm_movemask_epi8(_mm_and_si128(equal01, equal23)) != 0xffff)
+        {
+            return false;
+        }
+    }
+
+    return std::all_of(data + index, data + size, [data](uint8_t byte)
+    {
+        return byte == data[0];
+    });
+}
+
+#else
+
+bool are_bytes_equal(_In_reads_bytes_(size) const uint8_t* first, _In_reads_bytes_(size) const uint8_t* second, size_t size) noexcept
+{
+    return memcmp(first, second, size) == 0;
+}
+
+bool is_constant(_In_reads_bytes_(size) const uint8_t* data, size_t size) noexcept
+{
+    return std::all_of(data, data + size, [data](uint8_t byte)
+    {
+        return byte == data[0];
+    });
+}
+
+#endif
+
+}
+
@@ -0,0 +1,14 @@
+#pragma once
+
+namespace DiskTools
+{
+
+// Vectorized with SSE2 on x86 and x64.  Both compare a cache line at a time,
+// and only branch once per line, so they run at memory bandwidth.
+bool are_bytes_equal(_In_reads_bytes_(size) const uint8_t* first, _In_reads_bytes_(size) const uint8_t* second, size_t size) noexcept;
+
+// True if every byte equals the first.  True for an empty range.
+bool is_constant(_In_reads_bytes_(size) const uint8_t* data, size_t size) noexcept;
+
+}
+
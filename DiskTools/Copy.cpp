@@ -0,0 +1,223 @@
+#include "PreCompile.h"
+#include "Copy.h"           // Pick up forward declarations to ensure correctness.
+#include "BlockDevice.h"
+#include "BufferPool.h"
+#include "Trace.h"
+
+namespace DiskTools
+{
+
+// Unbuffered transfers must be aligned to the sector size of both devices.  A page
+// covers the 512 and 4096 byte sectors of disks and of the volumes that hold image
+// files, and the 2048 byte sectors of CD drives.
+constexpr uint64_t unbuffered_alignment = 4096;
+
+// Block cloning shares whole clusters, and ReFS clusters are at most 64KB.
+constexpr uint64_t block_clone_alignment = 64 * 1024;
+
+// Keeps each clone request short, so that it does not hold the files for long.
+constexpr uint64_t block_clone_piece_size = 1024 * 1024 * 1024;
+
+typedef std::unique_ptr<void, std::function<void (HANDLE handle)>> Unique_handle;
+
+// Opens a second handle to the same disk or file that bypasses the file cache.
+// Returns INVALID_HANDLE_VALUE on failure, such as when the sharing mode of the
+// first handle does not permit it.
+static Unique_handle reopen_unbuffered(_In_ HANDLE handle, DWORD desired_access)
+{
+    return Unique_handle(
+        ReOpenFile(handle, desired_access, FILE_SHARE_READ | FILE_SHARE_WRITE, FILE_FLAG_NO_BUFFERING),
+        [](HANDLE handle)
+        {
+            if(INVALID_HANDLE_VALUE != handle)
+            {
+                CloseHandle(handle);
+            }
+        });
+}
+
+// Clones up to length bytes from the start of source to the start of destination,
+// when both are files on one volume that supports block cloning.  No data is read
+// or written, as the files share clusters until either is modified.  Returns the
+// number of bytes cloned, which is zero for disks, for files on other volumes, or
+// for file systems without block cloning.
+static uint64_t clone_file_blocks(_In_ HANDLE source, _In_ HANDLE destination, uint64_t length)
+{
+    const uint64_t clone_length = length & ~(block_clone_alignment - 1);
+    if(clone_length == 0)
+    {
+        return 0;
+    }
+
+    // Fails for disks and CD drives, which are not on a volume.
+    DWORD file_system_flags;
+    if((GetVolumeInformationByHandleW(destination, nullptr, 0, nullptr, nullptr, &file_system_flags, nullptr, 0) == 0) ||
+       ((file_system_flags & FILE_SUPPORTS_BLOCK_REFCOUNTING) == 0))
+    {
+        return 0;
+    }
+
+    // The cloned range must be within the destination file.  A destination that
+    // is already larger, such as an existing image, keeps the data past the range.
+    LARGE_INTEGER original_size;
+    if(GetFileSizeEx(destination, &original_size) == 0)
+    {
+        return 0;
+    }
+
+    const bool is_extended = static_cast<uint64_t>(original_size.QuadPart) < clone_length;
+    if(is_extended)
+    {
+        FILE_END_OF_FILE_INFO end_of_file;
+        end_of_file.EndOfFile.QuadPart = clone_length;
+        if(SetFileInformationByHandle(destination, FileEndOfFileInfo, &end_of_file, sizeof(end_of_file)) == 0)
+        {
+            return 0;
+        }
+    }
+
+    uint64_t offset = 0;
+    while(offset < clone_length)
+    {
+        DUPLICATE_EXTENTS_DATA duplicate_extents{};
+        duplicate_extents.FileHandle                = source;
+        duplicate_extents.SourceFileOffset.QuadPart = offset;
+        duplicate_extents.TargetFileOffset.QuadPart = offset;
+        duplicate_extents.ByteCount.QuadPart        = std::min(clone_length - offset, block_clone_piece_size);
+
+        // Fails if the files are on different volumes, or only one of them is sparse.
+        DWORD bytes_returned;
+        if(DeviceIoControl(destination,
+                           FSCTL_DUPLICATE_EXTENTS_TO_FILE,
+                           &duplicate_extents,
+                           sizeof(duplicate_extents),
+                           nullptr,
+                           0,
+                           &bytes_returned,
+                           nullptr) == 0)
+        {
+            break;
+        }
+
+        offset += duplicate_extents.ByteCount.QuadPart;
+    }
+
+    // If nothing was cloned, the caller copies into the file as it was.  Otherwise
+    // the caller writes the rest of the extended range.
+    if(is_extended && (offset == 0))
+    {
+        FILE_END_OF_FILE_INFO end_of_file;
+        end_of_file.EndOfFile = original_size;
+        (void)SetFileInformationByHandle(destination, FileEndOfFileInfo, &end_of_file, sizeof(end_of_file));
+    }
+
+    return offset;
+}
+
+// Copies length bytes at offset from source to destination through unbuffered
+// handles.  offset and length must be multiples of unbuffered_alignment.  Returns
+// the number of bytes copied, which is zero if either handle cannot be reopened
+// unbuffered.
+static uint64_t copy_unbuffered(_In_ HANDLE source, _In_ HANDLE destination, uint64_t offset, uint64_t length, size_t buffer_size)
+{
+    assert(((offset | length) & (unbuffered_alignment - 1)) == 0);
+
+    if(length == 0)
+    {
+        return 0;
+    }
+
+    const auto unbuffered_source = reopen_unbuffered(source, GENERIC_READ);
+    const auto unbuffered_destination = reopen_unbuffered(destination, GENERIC_WRITE);
+    if((INVALID_HANDLE_VALUE == unbuffered_source.get()) || (INVALID_HANDLE_VALUE == unbuffered_destination.get()))
+    {
+        return 0;
+    }
+
+    // Unbuffered I/O requires sector aligned buffers, which the pool provides.
+    const size_t aligned_buffer_size = static_cast<size_t>(std::max(buffer_size & ~(unbuffered_alignment - 1), unbuffered_alignment));
+    const auto buffer = acquire_io_buffer(aligned_buffer_size);
+
+    uint64_t bytes_left = length;
+    while(bytes_left > 0)
+    {
+        // Cast is safe as the amount is no larger than aligned_buffer_size.
+        const size_t amount_to_copy = static_cast<size_t>(std::min<uint64_t>(bytes_left, aligned_buffer_size));
+        {
+            DISKTOOLS_TRACE_SPAN("pipeline", "read source");
+            read_file_at(unbuffered_source.get(), offset, buffer.data(), amount_to_copy);
+        }
+        {
+            DISKTOOLS_TRACE_SPAN("pipeline", "write output");
+            write_file_at(unbuffered_destination.get(), offset, buffer.data(), amount_to_copy);
+        }
+
+        offset     += amount_to_copy;
+        bytes_left -= amount_to_copy;
+    }
+
+    return length;
+}
+
+void stream_device(
+    _In_ Block_device* source,
+    uint64_t offset,
+    uint64_t length,
+    size_t buffer_size,
+    const std::function<void (_In_reads_bytes_(size) const uint8_t* buffer, size_t size)>& write_output)
+{
+    // Pooled, so that pipelines which stream many extents do not allocate for each.
+    const auto buffer = acquire_io_buffer(buffer_size);
+
+    uint64_t bytes_left = length;
+    while(bytes_left > 0)
+    {
+        // Cast is safe as the amount is no larger than buffer_size.
+        const size_t amount_to_read = static_cast<size_t>(std::min<uint64_t>(bytes_left, buffer_size));
+
+        // This is reasonably slow, but it is fast enough for single CDs or DVDs.
+        // A fast approach might be to use uncached aligned async reads, at the
+        // expense of considerable complexity.
+        {
+            DISKTOOLS_TRACE_SPAN("pipeline", "read source");
+            source->read(offset, buffer.data(), amount_to_read);
+        }
+        {
+            DISKTOOLS_TRACE_SPAN("pipeline", "write output");
+            write_output(buffer.data(), amount_to_read);
+        }
+
+        offset     += amount_to_read;
+        bytes_left -= amount_to_read;
+    }
+}
+
+void copy_device(_In_ Block_device* source, _In_ Block_device* destination, uint64_t length, size_t buffer_size)
+{
+    uint64_t copied_length = 0;
+
+    const HANDLE source_handle = source->native_handle();
+    const HANDLE destination_handle = destination->native_handle();
+    if((source_handle != nullptr) && (destination_handle != nullptr) && (length > unbuffered_alignment))
+    {
+        // Leave at least the last piece to write below, which handles lengths
+        // that are not sector aligned and keeps the size of the destination current.
+        const uint64_t direct_length = (length - 1) & ~(unbuffered_alignment - 1);
+
+        copied_length = clone_file_blocks(source_handle, destination_handle, direct_length);
+        copied_length += copy_unbuffered(source_handle, destination_handle, copied_length, direct_length - copied_length, buffer_size);
+
+        // Cloning may have changed the size of the file under the device.
+        destination->refresh_size();
+    }
+
+    uint64_t destination_offset = copied_length;
+    stream_device(source, copied_length, length - copied_length, buffer_size, [destination, &destination_offset](_In_reads_bytes_(size) const uint8_t* buffer, size_t size)
+    {
+        destination->write(destination_offset, buffer, size);
+        destination_offset += size;
+    });
+}
+
+}
+
@@ -0,0 +1,29 @@
+#pragma once
+
+namespace DiskTools
+{
+
+class Block_device;
+
+// Large enough to amortize per-request overhead on optical drives and USB sticks.
+constexpr size_t default_copy_buffer_size = 1024 * 1024;
+
+// Reads length bytes of source starting at offset, and passes each buffer to write_output.
+void stream_device(
+    _In_ Block_device* source,
+    uint64_t offset,
+    uint64_t length,
+    size_t buffer_size,
+    const std::function<void (_In_reads_bytes_(size) const uint8_t* buffer, size_t size)>& write_output);
+
+// Copies the first length bytes of source to the start of destination.  When
+// both are disks, CD drives, or image files, the copy does not pass through the
+// file cache: image files on volumes that support block cloning (such as ReFS)
+// share clusters instead of being copied, and other transfers use unbuffered
+// handles, so data moves between the devices and one aligned buffer by DMA.
+// Other devices, and the last piece of every copy, are read and written in
+// pieces of buffer_size bytes.
+void copy_device(_In_ Block_device* source, _In_ Block_device* destination, uint64_t length, size_t buffer_size);
+
+}
+
@@ -3,6 +3,8 @@
 
 #include "PreCompile.h"
 #include "DirectRead.h" // Pick up forward declarations to ensure correctness.
+#include "IoStatistics.h"
+#include "Trace.h"
 
 namespace DiskTools
 {
@@ -135,6 +137,7 @@ static HRESULT can_buffer_hold_sector(
                        &bytes_read,
                        nullptr) != 0)
     {
+        // Reading a whole sector would overrun the buffer.
         if(disk_geometry.BytesPerSector > buffer_size)
         {
             hr = TYPE_E_BUFFERTOOSMALL;
@@ -142,13 +145,9 @@ static HRESULT can_buffer_hold_sector(
 
         *minimum_buffer_size = disk_geometry.BytesPerSector;
     }
-    else
-    {
-        DWORD last_error = GetLastError();
-        hr = HRESULT_FROM_WIN32(last_error);
-    }
 
-    return S_OK;
+    // Files and drivers without geometry take the buffer size as the sector size.
+    return hr;
 }
 
 HANDLE get_disk_handle(uint8_t disk_number)
@@ -186,11 +185,17 @@ HRESULT read_sector_from_handle(
     if(SUCCEEDED(hr))
     {
         // Read in the sector.
+        DISKTOOLS_TRACE_SPAN("io", "read_sector_from_handle");
+        Io_timer timer(Io_operation::read);
         DWORD bytes_read;
         if(ReadFile(handle, buffer, *buffer_size, &bytes_read, nullptr) == 0)
         {
             hr = HRESULT_FROM_WIN32(ERROR_READ_FAULT);
         }
+        else
+        {
+            timer.complete(bytes_read);
+        }
         *buffer_size = bytes_read;
     }
 
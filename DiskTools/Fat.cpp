@@ -0,0 +1,243 @@
+#include "PreCompile.h"
+#include "Fat.h"            // Pick up forward declarations to ensure correctness.
+#include "BlockDevice.h"
+#include "PartitionTable.h"
+#include <PortableRuntime/CheckException.h>
+
+namespace DiskTools
+{
+
+static bool is_power_of_two(unsigned int value) noexcept
+{
+    return (value != 0) && ((value & (value - 1)) == 0);
+}
+
+bool fat_geometry_from_boot_sector(_In_reads_bytes_(size) const uint8_t* boot_sector, size_t size, _Out_ Fat_geometry* geometry) noexcept
+{
+    *geometry = Fat_geometry();
+
+    if((size < Boot_record_layout::size) || !has_boot_signature(Structure_view<Boot_record_layout>(boot_sector, size)))
+    {
+        return false;
+    }
+
+    // Boot sectors start with a short or near jump over the BPB.
+    if((boot_sector[0] != 0xeb) && (boot_sector[0] != 0xe9))
+    {
+        return false;
+    }
+
+    typedef Fat32_bios_parameter_block_layout Layout;
+    const Structure_view<Layout> bpb(boot_sector, size, bios_parameter_block_offset);
+    const unsigned int bytes_per_sector = bpb.get<Layout::bytes_per_sector>();
+    const unsigned int sectors_per_cluster = bpb.get<Layout::sectors_per_cluster>();
+    const unsigned int reserved_sectors = bpb.get<Layout::reserved_sectors>();
+    const unsigned int file_allocation_table_count = bpb.get<Layout::file_allocation_table_count>();
+    const unsigned int root_entry_count = bpb.get<Layout::root_entry_count>();
+    const uint8_t media_descriptor = bpb.get<Layout::media_descriptor>();
+    const uint16_t sectors_per_file_allocation_table_16 = bpb.get<Layout::sectors_per_file_allocation_table>();
+
+    if(((bytes_per_sector != 512) && (bytes_per_sector != 1024) && (bytes_per_sector != 2048) && (bytes_per_sector != 4096)) ||
+       !is_power_of_two(sectors_per_cluster) ||
+       (reserved_sectors == 0) ||
+       (file_allocation_table_count == 0) || (file_allocation_table_count > 2) ||
+       ((media_descriptor != 0xf0) && (media_descriptor < 0xf8)))
+    {
+        return false;
+    }
+
+    const uint16_t sector_count = bpb.get<Layout::sector_count>();
+    const uint64_t total_sectors = (sector_count != 0) ? sector_count : bpb.get<Layout::huge_sector_count>();
+    const uint32_t sectors_per_file_allocation_table = (sectors_per_file_allocation_table_16 != 0) ?
+                                                       sectors_per_file_allocation_table_16 :
+                                                       bpb.get<Layout::sectors_per_file_allocation_table_32>();
+    if((total_sectors == 0) || (sectors_per_file_allocation_table == 0))
+    {
+        return false;
+    }
+
+    const uint32_t root_directory_sectors = static_cast<uint32_t>((root_entry_count * Directory_entry_layout::size + bytes_per_sector - 1) / bytes_per_sector);
+    const uint64_t first_data_sector = reserved_sectors +
+                                       static_cast<uint64_t>(file_allocation_table_count) * sectors_per_file_allocation_table +
+                                       root_directory_sectors;
+    if(first_data_sector >= total_sectors)
+    {
+        return false;
+    }
+
+    const uint64_t cluster_count = (total_sectors - first_data_sector) / sectors_per_cluster;
+    if((cluster_count == 0) || (cluster_count > 0x0ffffff5))
+    {
+        return false;
+    }
+
+    Fat_type type;
+    uint64_t entries_per_table;
+    const uint64_t table_bytes = static_cast<uint64_t>(sectors_per_file_allocation_table) * bytes_per_sector;
+    if(cluster_count < fat12_cluster_limit)
+    {
+        type = Fat_type::fat12;
+        entries_per_table = table_bytes * 2 / 3;
+    }
+    else if(cluster_count < fat16_cluster_limit)
+    {
+        type = Fat_type::fat16;
+        entries_per_table = table_bytes / 2;
+    }
+    else
+    {
+        type = Fat_type::fat32;
+        entries_per_table = table_bytes / 4;
+    }
+
+    // FAT32 keeps the root directory in clusters, and only FAT32 uses the 32-bit table size.
+    const bool is_fat32 = Fat_type::fat32 == type;
+    if((is_fat32 != (sectors_per_file_allocation_table_16 == 0)) ||
+       (is_fat32 != (root_entry_count == 0)) ||
+       (entries_per_table < cluster_count + fat_first_cluster))
+    {
+        return false;
+    }
+
+    const uint32_t root_cluster = bpb.get<Layout::root_cluster>();
+    if(is_fat32 && ((root_cluster < fat_first_cluster) || (root_cluster >= cluster_count + fat_first_cluster)))
+    {
+        return false;
+    }
+
+    // With bit 7 of the FAT32 extended flags set, bits 0-3 select the only table in use.
+    const uint16_t extended_flags = bpb.get<Layout::extended_flags>();
+    const unsigned int active_table = extended_flags & 0x0f;
+    const bool is_mirroring_disabled = is_fat32 && ((extended_flags & 0x80) != 0) && (active_table < file_allocation_table_count);
+    const unsigned int backup_boot_sector = bpb.get<Layout::backup_boot_sector>();
+
+    geometry->type = type;
+    geometry->bytes_per_sector = bytes_per_sector;
+    geometry->sectors_per_cluster = sectors_per_cluster;
+    geometry->reserved_sectors = reserved_sectors;
+    geometry->file_allocation_table_count = file_allocation_table_count;
+    geometry->active_file_allocation_table = is_mirroring_disabled ? active_table : 0;
+    geometry->is_file_allocation_table_mirrored = !is_mirroring_disabled;
+    geometry->sectors_per_file_allocation_table = sectors_per_file_allocation_table;
+    geometry->root_entry_count = root_entry_count;
+    geometry->root_directory_sectors = root_directory_sectors;
+    geometry->root_cluster = is_fat32 ? root_cluster : 0;
+    geometry->backup_boot_sector = (is_fat32 && (backup_boot_sector < reserved_sectors)) ? backup_boot_sector : 0;
+    geometry->total_sectors = total_sectors;
+    geometry->first_data_sector = first_data_sector;
+    geometry->cluster_count = static_cast<uint32_t>(cluster_count);
+    geometry->media_descriptor = media_descriptor;
+
+    return true;
+}
+
+// Widens the FAT12 and FAT16 bad cluster and end of chain marks, which start at
+// 0xff7 and 0xfff7, to their FAT32 equivalents.  Smaller values, including
+// 0xff0 through 0xff6 and 0xfff0 through 0xfff6, are next cluster numbers.
+static uint32_t widen_entry(uint32_t entry, uint32_t bad_cluster) noexcept
+{
+    return (entry >= bad_cluster) ? (entry | 0x0ffff000) : entry;
+}
+
+std::vector<uint32_t> read_file_allocation_table(
+    _In_ Block_device* device,
+    uint64_t volume_offset,
+    const Fat_geometry& geometry,
+    unsigned int table_index)
+{
+    CHECK_EXCEPTION(table_index < geometry.file_allocation_table_count, u8"Invalid FAT index: " + std::to_string(table_index));
+
+    const uint64_t table_offset = volume_offset +
+                                  (geometry.reserved_sectors + static_cast<uint64_t>(table_index) * geometry.sectors_per_file_allocation_table) *
+                                  geometry.bytes_per_sector;
+    const size_t entry_count = static_cast<size_t>(geometry.cluster_count) + fat_first_cluster;
+
+    // Only read the part of the table that describes clusters.  The rest is padding.
+    size_t table_size;
+    switch(geometry.type)
+    {
+        case Fat_type::fat12:
+            table_size = (entry_count * 3 + 1) / 2;
+            break;
+        case Fat_type::fat16:
+            table_size = entry_count * 2;
+            break;
+        default:
+            table_size = entry_count * 4;
+            break;
+    }
+
+    std::vector<uint8_t> table(table_size);
+    device->read(table_offset, table.data(), table.size());
+
+    std::vector<uint32_t> entries(entry_count);
+    for(size_t cluster = 0; cluster < entry_count; ++cluster)
+    {
+        switch(geometry.type)
+        {
+            case Fat_type::fat12:
+            {
+                // Two entries share three bytes.  Even entries take the low twelve bits.
+                const size_t offset = cluster + cluster / 2;
+                const uint32_t pair = table[offset] | (static_cast<uint32_t>(table[offset + 1]) << 8);
+                entries[cluster] = widen_entry(((cluster & 1) != 0) ? (pair >> 4) : (pair & 0x0fff), 0x0ff7);
+                break;
+            }
+            case Fat_type::fat16:
+                entries[cluster] = widen_entry(load_little_endian<uint16_t>(table.data() + cluster * 2), 0xfff7);
+                break;
+            default:
+            {
+                entries[cluster] = load_little_endian<uint32_t>(table.data() + cluster * 4) & 0x0fffffff;
+                break;
+            }
+        }
+    }
+
+    return entries;
+}
+
+std::vector<uint8_t> encode_file_allocation_table(const Fat_geometry& geometry, const std::vector<uint32_t>& entries)
+{
+    CHECK_EXCEPTION(entries.size() == static_cast<size_t>(geometry.cluster_count) + fat_first_cluster, u8"The FAT has the wrong number of entries.");
+
+    std::vector<uint8_t> table(static_cast<size_t>(geometry.sectors_per_file_allocation_table) * geometry.bytes_per_sector);
+    for(size_t cluster = 0; cluster < entries.size(); ++cluster)
+    {
+        switch(geometry.type)
+        {
+            case Fat_type::fat12:
+            {
+                const size_t offset = cluster + cluster / 2;
+                const uint32_t entry = entries[cluster] & 0x0fff;
+                if((cluster & 1) != 0)
+                {
+                    table[offset] = static_cast<uint8_t>((table[offset] & 0x0f) | (entry << 4));
+                    table[offset + 1] = static_cast<uint8_t>(entry >> 4);
+                }
+                else
+                {
+                    table[offset] = static_cast<uint8_t>(entry);
+                    table[offset + 1] = static_cast<uint8_t>((table[offset + 1] & 0xf0) | (entry >> 8));
+                }
+                break;
+            }
+            case Fat_type::fat16:
+                store_little_endian(table.data() + cluster * 2, static_cast<uint16_t>(entries[cluster]));
+                break;
+            default:
+                store_little_endian<uint32_t>(table.data() + cluster * 4, entries[cluster] & 0x0fffffff);
+                break;
+        }
+    }
+
+    return table;
+}
+
+uint64_t cluster_offset(const Fat_geometry& geometry, uint32_t cluster) noexcept
+{
+    return (geometry.first_data_sector + static_cast<uint64_t>(cluster - fat_first_cluster) * geometry.sectors_per_cluster) * geometry.bytes_per_sector;
+}
+
+}
+
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "FieldView.h"
+
+namespace DiskTools
+{
+
+class Block_device;
+
+constexpr unsigned int fat_max_file_name_length = 8;
+constexpr unsigned int fat_max_extension_length = 3;
+
+// The BPB follows the three byte jump instruction at the start of the boot sector.
+constexpr unsigned int bios_parameter_block_offset = 3;
+
+// The BPB fields that FAT12, FAT16, and FAT32 share, at their offsets from bios_parameter_block_offset.
+struct Common_bios_parameter_block_layout
+{
+    typedef Byte_array_field<0, 8> OEM_name;
+    typedef Little_endian_field<uint16_t, 8> bytes_per_sector;
+    typedef Little_endian_field<uint8_t, 10> sectors_per_cluster;
+    typedef Little_endian_field<uint16_t, 11> reserved_sectors;
+    typedef Little_endian_field<uint8_t, 13> file_allocation_table_count;
+    typedef Little_endian_field<uint16_t, 14> root_entry_count;
+    typedef Little_endian_field<uint16_t, 16> sector_count;
+    typedef Little_endian_field<uint8_t, 18> media_descriptor;
+    typedef Little_endian_field<uint16_t, 19> sectors_per_file_allocation_table;
+    typedef Little_endian_field<uint16_t, 21> sectors_per_track;
+    typedef Little_endian_field<uint16_t, 23> head_count;
+    typedef Little_endian_field<uint32_t, 25> hidden_sector_count;
+    typedef Little_endian_field<uint32_t, 29> huge_sector_count;
+};
+
+// The FAT12 and FAT16 BPB.
+struct Bios_parameter_block_layout : Common_bios_parameter_block_layout
+{
+    static constexpr size_t size = 59;
+    typedef Little_endian_field<uint8_t, 33> drive_number;
+    typedef Little_endian_field<uint8_t, 35> boot_signature;
+    typedef Little_endian_field<uint32_t, 36> volume_id;
+    typedef Byte_array_field<40, fat_max_file_name_length + fat_max_extension_length> volume_label;
+    typedef Byte_array_field<51, 8> file_system_type;
+};
+
+// FAT32 shares the BPB up to huge_sector_count, and then extends it.
+struct Fat32_bios_parameter_block_layout : Common_bios_parameter_block_layout
+{
+    static constexpr size_t size = 87;
+    typedef Little_endian_field<uint32_t, 33> sectors_per_file_allocation_table_32;
+    typedef Little_endian_field<uint16_t, 37> extended_flags;
+    typedef Little_endian_field<uint16_t, 39> file_system_version;
+    typedef Little_endian_field<uint32_t, 41> root_cluster;
+    typedef Little_endian_field<uint16_t, 45> file_system_information_sector;
+    typedef Little_endian_field<uint16_t, 47> backup_boot_sector;
+    typedef Little_endian_field<uint8_t, 61> drive_number;
+    typedef Little_endian_field<uint8_t, 63> boot_signature;
+    typedef Little_endian_field<uint32_t, 64> volume_id;
+    typedef Byte_array_field<68, fat_max_file_name_length + fat_max_extension_length> volume_label;
+    typedef Byte_array_field<79, 8> file_system_type;
+};
+
+struct Directory_entry_layout
+{
+    static constexpr size_t size = 32;
+    typedef Byte_array_field<0, fat_max_file_name_length> file_name;
+    typedef Byte_array_field<8, fat_max_extension_length> extension;
+    typedef Little_endian_field<uint8_t, 11> attributes;
+    typedef Little_endian_field<uint8_t, 12> case_flags;               // Windows NT lower case flags.
+    typedef Little_endian_field<uint16_t, 14> creation_time;
+    typedef Little_endian_field<uint16_t, 16> creation_date;
+    typedef Little_endian_field<uint16_t, 18> last_access_date;
+    typedef Little_endian_field<uint16_t, 20> first_cluster_high;      // FAT32 only.
+    typedef Little_endian_field<uint16_t, 22> last_write_time;
+    typedef Little_endian_field<uint16_t, 24> last_write_date;
+    typedef Little_endian_field<uint16_t, 26> first_cluster_low;
+    typedef Little_endian_field<uint32_t, 28> file_size;
+};
+
+static_assert(bios_parameter_block_offset + Fat32_bios_parameter_block_layout::size <= 512, "BPB must fit in the smallest sector.");
+
+enum class Fat_type
+{
+    fat12,
+    fat16,
+    fat32,
+};
+
+// Cluster counts that separate the FAT types, from the Microsoft FAT specification.
+constexpr uint32_t fat12_cluster_limit = 4085;
+constexpr uint32_t fat16_cluster_limit = 65525;
+
+// The layout of a FAT volume, in sectors from the start of the volume.
+struct Fat_geometry
+{
+    Fat_type type;
+    unsigned int bytes_per_sector;
+    unsigned int sectors_per_cluster;
+    unsigned int reserved_sectors;
+    unsigned int file_allocation_table_count;
+    unsigned int active_file_allocation_table;  // FAT32 can turn off mirroring and use only one table.
+    bool is_file_allocation_table_mirrored;     // False if the other tables may hold stale data.
+    uint32_t sectors_per_file_allocation_table;
+    unsigned int root_entry_count;
+    uint32_t root_directory_sectors;        // Zero on FAT32, where the root directory is a cluster chain.
+    uint32_t root_cluster;                  // FAT32 only.
+    unsigned int backup_boot_sector;        // FAT32 only.  Zero if there is no backup.
+    uint64_t total_sectors;
+    uint64_t first_data_sector;
+    uint32_t cluster_count;
+    uint8_t media_descriptor;
+};
+
+// Validates the BPB of a boot sector, and computes the volume layout from it.
+// The FAT type is determined by cluster count, as the specification requires,
+// not by the file system type label.  Returns false for anything that is not a
+// plausible FAT boot sector.
+bool fat_geometry_from_boot_sector(_In_reads_bytes_(size) const uint8_t* boot_sector, size_t size, _Out_ Fat_geometry* geometry) noexcept;
+
+// The first two FAT entries are reserved, so cluster numbering starts at two.
+constexpr uint32_t fat_first_cluster = 2;
+
+// FAT entry values, which are the same for each FAT type once sign extended
+// from 12 or 16 bits.  Values from fat_end_of_chain up end a cluster chain.
+constexpr uint32_t fat_free_cluster = 0;
+constexpr uint32_t fat_bad_cluster = 0x0ffffff7;
+constexpr uint32_t fat_end_of_chain = 0x0ffffff8;
+
+// Reads one copy of the FAT of the volume that starts at byte volume_offset of
+// device, and decodes it.  Entry n is for cluster n, so there are cluster_count
+// + 2 entries.  FAT12 and FAT16 end of chain and bad cluster values are widened
+// to the FAT32 values above, and the reserved top four bits of FAT32 entries are
+// cleared.
+std::vector<uint32_t> read_file_allocation_table(
+    _In_ Block_device* device,
+    uint64_t volume_offset,
+    const Fat_geometry& geometry,
+    unsigned int table_index);
+
+// The inverse of read_file_allocation_table.  Encodes cluster_count + 2 entries
+// as one full copy of the FAT, sectors_per_file_allocation_table sectors long,
+// with the space past the last entry zeroed.
+std::vector<uint8_t> encode_file_allocation_table(const Fat_geometry& geometry, const std::vector<uint32_t>& entries);
+
+// The byte offset, from the start of the volume, of the first sector of a cluster.
+uint64_t cluster_offset(const Fat_geometry& geometry, uint32_t cluster) noexcept;
+
+}
+
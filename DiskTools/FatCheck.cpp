@@ -0,0 +1,437 @@
+#include "PreCompile.h"
+#include "FatCheck.h"       // Pick up forward declarations to ensure correctness.
+#include "BlockDevice.h"
+#include "ByteCompare.h"
+#include "Copy.h"
+#include "FatVolume.h"
+#include <PortableRuntime/CheckException.h>
+
+namespace DiskTools
+{
+
+// One bit per cluster.  Words are 32 bits so that _BitScanForward works on x86 as well as x64.
+class Cluster_bitmap
+{
+    std::vector<uint32_t> m_words;
+
+public:
+    explicit Cluster_bitmap(size_t bit_count) : m_words((bit_count + 31) / 32)
+    {
+    }
+
+    bool test(uint32_t bit) const noexcept
+    {
+        return (m_words[bit / 32] & (1u << (bit % 32))) != 0;
+    }
+
+    void set(uint32_t bit) noexcept
+    {
+        m_words[bit / 32] |= 1u << (bit % 32);
+    }
+
+    std::vector<uint32_t>& words() noexcept
+    {
+        return m_words;
+    }
+
+    const std::vector<uint32_t>& words() const noexcept
+    {
+        return m_words;
+    }
+};
+
+static unsigned int count_bits(uint32_t word) noexcept
+{
+    word = word - ((word >> 1) & 0x55555555);
+    word = (word & 0x33333333) + ((word >> 2) & 0x33333333);
+    return (((word + (word >> 4)) & 0x0f0f0f0f) * 0x01010101) >> 24;
+}
+
+static uint32_t count_bits(const Cluster_bitmap& bitmap) noexcept
+{
+    uint32_t count = 0;
+    for(const auto word : bitmap.words())
+    {
+        count += count_bits(word);
+    }
+
+    return count;
+}
+
+// Calls visit for each set bit, in order.
+template<typename Visit>
+static void for_each_set_bit(const Cluster_bitmap& bitmap, Visit visit)
+{
+    const auto& words = bitmap.words();
+    for(size_t word_index = 0; word_index < words.size(); ++word_index)
+    {
+        for(unsigned long word = words[word_index]; word != 0; word &= word - 1)
+        {
+            unsigned long bit;
+            _BitScanForward(&bit, word);
+            visit(static_cast<uint32_t>(word_index * 32 + bit));
+        }
+    }
+}
+
+static void add_problem(_Inout_ Fat_check_result* result, const std::string& problem)
+{
+    if(result->problems.size() < maximum_reported_problems)
+    {
+        result->problems.push_back(problem);
+    }
+    ++result->problem_count;
+}
+
+// State shared by the passes over one volume.
+class Fat_checker
+{
+    Fat_volume& m_volume;
+    const std::vector<uint32_t>& m_file_allocation_table;
+    Fat_check_result& m_result;
+    Cluster_bitmap m_reachable;
+    Cluster_bitmap m_cross_linked;
+
+    // Every chain walked, so that the files that share a cross-linked cluster can be named.
+    std::vector<std::pair<std::string, uint32_t>> m_chains;
+
+    void report(const std::string& problem)
+    {
+        add_problem(&m_result, problem);
+    }
+
+    bool is_cluster(uint32_t cluster) const noexcept
+    {
+        return (cluster >= fat_first_cluster) && (cluster < m_file_allocation_table.size());
+    }
+
+    // Marks the clusters of a chain as reachable, and returns its length.
+    // Returns false if the chain is damaged, or reaches a cluster that is
+    // already reachable, which is then marked as cross-linked.
+    bool walk_chain(const std::string& path, uint32_t first_cluster, _Out_ uint64_t* length)
+    {
+        *length = 0;
+        m_chains.emplace_back(path, first_cluster);
+
+        uint32_t cluster = first_cluster;
+        for(;;)
+        {
+            if(!is_cluster(cluster))
+            {
+                report(path + u8": the chain leaves the volume at cluster " + std::to_string(cluster) + u8".");
+                return false;
+            }
+            const uint32_t next = m_file_allocation_table[cluster];
+            if((next == fat_free_cluster) || (next == fat_bad_cluster))
+            {
+                report(path + u8": the chain reaches " + ((next == fat_free_cluster) ? u8"free" : u8"bad") +
+                       u8" cluster " + std::to_string(cluster) + u8".");
+                return false;
+            }
+            if(m_reachable.test(cluster))
+            {
+                m_cross_linked.set(cluster);
+                return false;
+            }
+            m_reachable.set(cluster);
+            ++*length;
+
+            if(next >= fat_end_of_chain)
+            {
+                return true;
+            }
+            cluster = next;
+        }
+    }
+
+    void check_directory(const std::string& path, const std::vector<Fat_directory_entry>& entries, std::vector<std::pair<std::string, Fat_directory_entry>>* pending)
+    {
+        const uint64_t cluster_size = static_cast<uint64_t>(m_volume.geometry().sectors_per_cluster) * m_volume.geometry().bytes_per_sector;
+
+        for(const auto& entry : entries)
+        {
+            const std::string entry_path = path + entry.name;
+
+            if((entry.attributes & fat_attribute_directory) != 0)
+            {
+                ++m_result.directory_count;
+                if(0 == entry.first_cluster)
+                {
+                    report(entry_path + u8": the directory has no clusters.");
+                    continue;
+                }
+
+                // Only descend into directories whose chains are intact, so a
+                // directory that links back to its parent cannot loop.
+                uint64_t length;
+                if(walk_chain(entry_path, entry.first_cluster, &length))
+                {
+                    pending->emplace_back(entry_path + u8"\\", entry);
+                }
+                continue;
+            }
+
+            ++m_result.file_count;
+            if(0 == entry.first_cluster)
+            {
+                if(entry.file_size != 0)
+                {
+                    report(entry_path + u8": the file has " + std::to_string(entry.file_size) + u8" bytes but no clusters.");
+                }
+                continue;
+            }
+
+            uint64_t length;
+            if(walk_chain(entry_path, entry.first_cluster, &length))
+            {
+                const uint64_t expected_length = (entry.file_size + cluster_size - 1) / cluster_size;
+                if(length < expected_length)
+                {
+                    report(entry_path + u8": the file has " + std::to_string(entry.file_size) + u8" bytes but only " +
+                           std::to_string(length) + u8" clusters.");
+                }
+                else if(length > std::max<uint64_t>(expected_length, 1))
+                {
+                    report(entry_path + u8": the chain has " + std::to_string(length - std::max<uint64_t>(expected_length, 1)) +
+                           u8" more clusters than the " + std::to_string(entry.file_size) + u8" byte file needs.");
+                }
+            }
+        }
+    }
+
+public:
+    Fat_checker(Fat_volume& volume, Fat_check_result& result) :
+        m_volume(volume),
+        m_file_allocation_table(volume.file_allocation_table()),
+        m_result(result),
+        m_reachable(m_file_allocation_table.size()),
+        m_cross_linked(m_file_allocation_table.size())
+    {
+    }
+
+    void check_directory_tree()
+    {
+        const bool is_fat32 = Fat_type::fat32 == m_volume.geometry().type;
+        if(is_fat32)
+        {
+            uint64_t length;
+            if(!walk_chain(u8"\\", m_volume.geometry().root_cluster, &length))
+            {
+                return;
+            }
+        }
+
+        // One level at a time, without recursion, so a deeply nested tree cannot overflow the stack.
+        std::vector<std::pair<std::string, Fat_directory_entry>> pending;
+        try
+        {
+            check_directory(u8"\\", m_volume.read_root_directory(), &pending);
+        }
+        catch(const std::exception& ex)
+        {
+            report(std::string(u8"\\: ") + ex.what());
+        }
+
+        while(!pending.empty())
+        {
+            std::vector<std::pair<std::string, Fat_directory_entry>> next_pending;
+            for(const auto& directory : pending)
+            {
+                try
+                {
+                    check_directory(directory.first, m_volume.read_directory(directory.second), &next_pending);
+                }
+                catch(const std::exception& ex)
+                {
+                    report(directory.first + u8": " + ex.what());
+                }
+            }
+            pending.swap(next_pending);
+        }
+    }
+
+    // A second walk over the chains names the owners of each cross-linked cluster.
+    void report_cross_links()
+    {
+        m_result.cross_linked_clusters = count_bits(m_cross_linked);
+        if(0 == m_result.cross_linked_clusters)
+        {
+            return;
+        }
+
+        for(const auto& chain : m_chains)
+        {
+            uint32_t cluster = chain.second;
+            for(uint64_t length = 0; is_cluster(cluster); ++length)
+            {
+                if(length >= m_result.cluster_count)
+                {
+                    report(chain.first + u8": the chain loops.");
+                    break;
+                }
+                if(m_cross_linked.test(cluster))
+                {
+                    report(chain.first + u8": cross-linked at cluster " + std::to_string(cluster) + u8".");
+                    break;
+                }
+
+                cluster = m_file_allocation_table[cluster];
+            }
+        }
+    }
+
+    void find_lost_clusters()
+    {
+        // Clusters marked bad are neither free nor in use, and belong to no chain.
+        Cluster_bitmap lost(m_file_allocation_table.size());
+        for(uint32_t cluster = fat_first_cluster; cluster < m_file_allocation_table.size(); ++cluster)
+        {
+            const uint32_t entry = m_file_allocation_table[cluster];
+            if(entry == fat_bad_cluster)
+            {
+                ++m_result.bad_clusters;
+            }
+            else if(entry != fat_free_cluster)
+            {
+                ++m_result.allocated_clusters;
+                if(!m_reachable.test(cluster))
+                {
+                    lost.set(cluster);
+                }
+            }
+        }
+
+        m_result.reachable_clusters = count_bits(m_reachable);
+        m_result.lost_clusters = count_bits(lost);
+        if(0 == m_result.lost_clusters)
+        {
+            return;
+        }
+
+        // A lost chain starts at a lost cluster that no other lost cluster points to.
+        Cluster_bitmap linked(m_file_allocation_table.size());
+        for_each_set_bit(lost, [&](uint32_t cluster)
+        {
+            const uint32_t next = m_file_allocation_table[cluster];
+            if(is_cluster(next) && lost.test(next))
+            {
+                linked.set(next);
+            }
+        });
+
+        // Chains can merge, so each cluster is only counted for the first chain that reaches it.
+        Cluster_bitmap counted(m_file_allocation_table.size());
+        uint32_t counted_clusters = 0;
+        for_each_set_bit(lost, [&](uint32_t cluster)
+        {
+            if(!linked.test(cluster))
+            {
+                ++m_result.lost_chains;
+                uint32_t length = 0;
+                for(uint32_t next = cluster; is_cluster(next) && lost.test(next) && !counted.test(next); next = m_file_allocation_table[next])
+                {
+                    counted.set(next);
+                    ++length;
+                }
+                counted_clusters += length;
+                report(u8"Lost chain at cluster " + std::to_string(cluster) + u8", " + std::to_string(length) + u8" clusters.");
+            }
+        });
+
+        // The rest only point to each other, so they form loops with no start.
+        if(counted_clusters < m_result.lost_clusters)
+        {
+            report(std::to_string(m_result.lost_clusters - counted_clusters) + u8" lost clusters form loops.");
+        }
+    }
+};
+
+// Compares the raw sectors of each FAT copy with the active copy.
+static void compare_file_allocation_tables(
+    _In_ Block_device* device,
+    uint64_t volume_offset,
+    const Fat_geometry& geometry,
+    _Inout_ Fat_check_result* result)
+{
+    const uint64_t table_size = static_cast<uint64_t>(geometry.sectors_per_file_allocation_table) * geometry.bytes_per_sector;
+    const auto table_offset = [&](unsigned int table_index)
+    {
+        return volume_offset + (geometry.reserved_sectors + static_cast<uint64_t>(table_index) * geometry.sectors_per_file_allocation_table) *
+                               geometry.bytes_per_sector;
+    };
+
+    // Entries per sector, times two to count FAT12 half bytes.
+    const unsigned int entry_halves = (Fat_type::fat12 == geometry.type) ? 3 : (Fat_type::fat16 == geometry.type) ? 4 : 8;
+
+    std::vector<uint8_t> active(default_copy_buffer_size);
+    std::vector<uint8_t> copy(default_copy_buffer_size);
+    for(unsigned int table_index = 0; table_index < geometry.file_allocation_table_count; ++table_index)
+    {
+        if(table_index == geometry.active_file_allocation_table)
+        {
+            continue;
+        }
+
+        uint64_t differing_sectors = 0;
+        uint64_t first_differing_sector = 0;
+        for(uint64_t offset = 0; offset < table_size; offset += active.size())
+        {
+            const size_t size = static_cast<size_t>(std::min<uint64_t>(active.size(), table_size - offset));
+            device->read(table_offset(geometry.active_file_allocation_table) + offset, active.data(), size);
+            device->read(table_offset(table_index) + offset, copy.data(), size);
+
+            for(size_t sector_offset = 0; sector_offset < size; sector_offset += geometry.bytes_per_sector)
+            {
+                if(!are_bytes_equal(active.data() + sector_offset, copy.data() + sector_offset, geometry.bytes_per_sector))
+                {
+                    if(0 == differing_sectors)
+                    {
+                        first_differing_sector = (offset + sector_offset) / geometry.bytes_per_sector;
+                    }
+                    ++differing_sectors;
+                }
+            }
+        }
+
+        if(differing_sectors > 0)
+        {
+            result->differing_fat_sectors += differing_sectors;
+
+            const uint64_t first_cluster = first_differing_sector * geometry.bytes_per_sector * 2 / entry_halves;
+            add_problem(result, u8"FAT " + std::to_string(table_index + 1) + u8" differs from FAT " +
+                                std::to_string(geometry.active_file_allocation_table + 1) + u8" in " +
+                                std::to_string(differing_sectors) + u8" sectors, starting at sector " +
+                                std::to_string(first_differing_sector) + u8" (near cluster " + std::to_string(first_cluster) + u8").");
+        }
+    }
+}
+
+Fat_check_result check_fat_volume(_In_ Block_device* device, uint64_t volume_offset)
+{
+    Fat_volume volume(device, volume_offset);
+    const auto& geometry = volume.geometry();
+
+    Fat_check_result result {};
+    result.cluster_count = geometry.cluster_count;
+
+    if(geometry.is_file_allocation_table_mirrored)
+    {
+        compare_file_allocation_tables(device, volume_offset, geometry, &result);
+    }
+
+    // The low byte of the first entry repeats the media descriptor.
+    if((volume.file_allocation_table()[0] & 0xff) != geometry.media_descriptor)
+    {
+        add_problem(&result, u8"The first FAT entry does not match the media descriptor.");
+    }
+
+    Fat_checker checker(volume, result);
+    checker.check_directory_tree();
+    checker.report_cross_links();
+    checker.find_lost_clusters();
+
+    return result;
+}
+
+}
+
@@ -0,0 +1,37 @@
+#pragma once
+
+namespace DiskTools
+{
+
+class Block_device;
+
+// Only this many problems are described.  The rest are only counted.
+constexpr size_t maximum_reported_problems = 1000;
+
+struct Fat_check_result
+{
+    uint32_t cluster_count;
+    uint32_t allocated_clusters;        // Clusters the FAT marks as in use.
+    uint32_t reachable_clusters;        // Clusters in the chain of some file or directory.
+    uint32_t lost_clusters;             // Allocated, but not reachable.
+    uint32_t lost_chains;               // Lost clusters that no other lost cluster points to.
+    uint32_t cross_linked_clusters;     // Clusters in more than one chain, or twice in one chain.
+    uint32_t bad_clusters;
+    uint64_t file_count;
+    uint64_t directory_count;
+    uint64_t differing_fat_sectors;     // Sectors of the other FATs that differ from the active one.
+    uint64_t problem_count;
+    std::vector<std::string> problems;  // The first maximum_reported_problems problems.
+};
+
+// Checks a FAT12/16/32 volume without changing it.  Finds chains that leave
+// the volume or reach free or bad clusters, clusters shared by more than one
+// chain, files whose size does not match the length of their chain, allocated
+// clusters that no file reaches, and FAT copies that differ.  The FATs are read
+// with a few large reads and compared a sector at a time.  Beyond the FAT
+// itself, cluster state is kept in bitmaps of one bit per cluster.  Copies are
+// not compared when FAT32 mirroring is turned off, as they may then differ.
+Fat_check_result check_fat_volume(_In_ Block_device* device, uint64_t volume_offset);
+
+}
+
@@ -0,0 +1,443 @@
+#include "PreCompile.h"
+#include "FatCompact.h"     // Pick up forward declarations to ensure correctness.
+#include "BlockDevice.h"
+#include "Copy.h"
+#include "DirectRead.h"
+#include "FatVolume.h"
+#include "PartitionTable.h"
+#include <PortableRuntime/CheckException.h>
+
+namespace DiskTools
+{
+
+// The data area is assembled in buffers of about this size, so that each write is large and sequential.
+constexpr size_t compaction_buffer_size = 4 * 1024 * 1024;
+
+// Formatters end chains with all bits set, rather than the lowest end of chain value.
+constexpr uint32_t end_of_chain_marker = 0x0fffffff;
+
+constexpr uint8_t deleted_entry_marker = 0xe5;
+
+// The FAT32 FSInfo sector caches the free cluster count and a hint for the next free cluster.
+struct File_system_information_layout
+{
+    static constexpr size_t size = 512;
+    typedef Little_endian_field<uint32_t, 0> lead_signature;
+    typedef Little_endian_field<uint32_t, 484> structure_signature;
+    typedef Little_endian_field<uint32_t, 488> free_count;
+    typedef Little_endian_field<uint32_t, 492> next_free;
+};
+
+constexpr uint32_t file_system_information_lead_signature = 0x41615252;
+constexpr uint32_t file_system_information_structure_signature = 0x61417272;
+
+struct Fat_chain
+{
+    uint32_t first_cluster;
+    bool is_directory;
+};
+
+// A run of source clusters that moves to consecutive destination clusters.
+struct Cluster_move
+{
+    uint32_t source_cluster;
+    uint32_t destination_cluster;
+    uint32_t cluster_count;
+};
+
+// Lists the chain of each file and directory, a directory level at a time,
+// each directory's entries in order.  The FAT32 root directory comes first.
+static std::vector<Fat_chain> collect_chains(_In_ Fat_volume* volume)
+{
+    std::vector<Fat_chain> chains;
+
+    Fat_directory_entry root;
+    volume->find_entry(std::string(), &root);
+    if(root.first_cluster != 0)
+    {
+        chains.push_back(Fat_chain { root.first_cluster, true });
+    }
+
+    // Each directory is listed once, so a damaged directory that links back to its parent cannot loop.
+    std::vector<bool> is_listed(volume->file_allocation_table().size());
+    std::vector<Fat_directory_entry> pending(1, root);
+    while(!pending.empty())
+    {
+        std::vector<Fat_directory_entry> next_pending;
+        for(const auto& directory : pending)
+        {
+            for(const auto& entry : volume->read_directory(directory))
+            {
+                if(0 == entry.first_cluster)
+                {
+                    continue;
+                }
+                CHECK_EXCEPTION(entry.first_cluster < is_listed.size(), entry.name + u8" starts outside the volume.");
+
+                const bool is_directory = (entry.attributes & fat_attribute_directory) != 0;
+                chains.push_back(Fat_chain { entry.first_cluster, is_directory });
+                if(is_directory)
+                {
+                    CHECK_EXCEPTION(!is_listed[entry.first_cluster], u8"Directory " + entry.name + u8" is linked from more than one place.");
+                    is_listed[entry.first_cluster] = true;
+                    next_pending.push_back(entry);
+                }
+            }
+        }
+        pending.swap(next_pending);
+    }
+
+    return chains;
+}
+
+static Fat_fragmentation measure_chains(_In_ Fat_volume* volume, const std::vector<Fat_chain>& chains)
+{
+    Fat_fragmentation fragmentation {};
+    for(const auto& chain : chains)
+    {
+        const auto run_count = volume->cluster_runs(chain.first_cluster).size();
+        ++fragmentation.chain_count;
+        fragmentation.run_count += run_count;
+        if(run_count > 1)
+        {
+            ++fragmentation.fragmented_chain_count;
+        }
+    }
+
+    const auto& file_allocation_table = volume->file_allocation_table();
+    for(uint32_t cluster = fat_first_cluster; cluster < file_allocation_table.size(); ++cluster)
+    {
+        if((file_allocation_table[cluster] != fat_free_cluster) && (file_allocation_table[cluster] != fat_bad_cluster))
+        {
+            ++fragmentation.used_clusters;
+            fragmentation.last_used_cluster = cluster;
+        }
+    }
+
+    return fragmentation;
+}
+
+Fat_fragmentation measure_fat_fragmentation(_In_ Fat_volume* volume)
+{
+    return measure_chains(volume, collect_chains(volume));
+}
+
+// Replaces the first cluster of each entry in directory data with its new cluster.
+// Deleted entries and long name entries are left alone.
+static void remap_directory(_Inout_ std::vector<uint8_t>* data, const std::vector<uint32_t>& new_clusters, bool is_fat32)
+{
+    typedef Directory_entry_layout Layout;
+    for(size_t offset = 0; offset + Layout::size <= data->size(); offset += Layout::size)
+    {
+        Mutable_structure_view<Layout> entry(data->data(), data->size(), offset);
+        const uint8_t first_byte = entry.get<Layout::file_name>()[0];
+        if(first_byte == 0)
+        {
+            break;
+        }
+
+        const uint8_t attributes = entry.get<Layout::attributes>();
+        if((first_byte == deleted_entry_marker) ||
+           ((attributes & 0x3f) == fat_attribute_long_name) ||
+           ((attributes & fat_attribute_volume_label) != 0))
+        {
+            continue;
+        }
+
+        // The high word of the first cluster is only used on FAT32.  The .. entry of a top level directory is zero.
+        const uint32_t cluster = entry.get<Layout::first_cluster_low>() | (is_fat32 ? (static_cast<uint32_t>(entry.get<Layout::first_cluster_high>()) << 16) : 0);
+        if((cluster >= fat_first_cluster) && (cluster < new_clusters.size()) && (new_clusters[cluster] != fat_free_cluster))
+        {
+            entry.set<Layout::first_cluster_low>(static_cast<uint16_t>(new_clusters[cluster]));
+            if(is_fat32)
+            {
+                entry.set<Layout::first_cluster_high>(static_cast<uint16_t>(new_clusters[cluster] >> 16));
+            }
+        }
+    }
+}
+
+// Shrinks the MBR entry of the partition at volume_offset, which must be the last partition on the device.
+static std::vector<uint8_t> truncated_master_boot_record(_In_ Block_device* source, uint64_t volume_offset, uint64_t sector_count)
+{
+    std::vector<uint8_t> sector(source->sector_size());
+    source->read(0, sector.data(), sector.size());
+
+    CHECK_EXCEPTION(sector.size() >= Boot_record_layout::size, u8"The sector size is too small for an MBR.");
+    const Mutable_structure_view<Boot_record_layout> boot_record(sector.data(), sector.size());
+    auto table = load_partition_table(boot_record);
+
+    const auto partition = std::find_if(table.begin(), table.end(), [&](const Partition_table_entry& entry)
+    {
+        return (entry.file_system_type != 0) && !is_extended_partition(entry.file_system_type) &&
+               (static_cast<uint64_t>(entry.start_sector) * sector.size() == volume_offset);
+    });
+    CHECK_EXCEPTION(partition != table.end(), u8"Only a volume in a primary MBR partition, or at the start of an image, can be truncated.");
+
+    const bool is_last = std::all_of(table.cbegin(), table.cend(), [&](const Partition_table_entry& entry)
+    {
+        return (entry.file_system_type == 0) || (&entry == &*partition) || (entry.start_sector < partition->start_sector);
+    });
+    CHECK_EXCEPTION(is_last, u8"Only the last partition on a disk can be truncated.");
+
+    partition->sectors = static_cast<uint32_t>(sector_count);
+    set_chs_address(partition->start_sector + sector_count - 1, &partition->end_head, &partition->end_sector, &partition->end_cylinder);
+    store_partition_table(boot_record, table);
+
+    return sector;
+}
+
+static void copy_range(_In_ Block_device* source, _In_ Block_device* destination, uint64_t offset, uint64_t length)
+{
+    uint64_t destination_offset = offset;
+    stream_device(source, offset, length, compaction_buffer_size, [&](_In_reads_bytes_(size) const uint8_t* buffer, size_t size)
+    {
+        destination->write(destination_offset, buffer, size);
+        destination_offset += size;
+    });
+}
+
+static void update_file_system_information(_In_ Block_device* device, uint64_t offset, unsigned int sector_size, uint32_t free_count, uint32_t next_free)
+{
+    std::vector<uint8_t> sector(sector_size);
+    device->read(offset, sector.data(), sector.size());
+
+    typedef File_system_information_layout Layout;
+    Mutable_structure_view<Layout> information(sector.data(), sector.size());
+    if((information.get<Layout::lead_signature>() == file_system_information_lead_signature) &&
+       (information.get<Layout::structure_signature>() == file_system_information_structure_signature))
+    {
+        information.set<Layout::free_count>(free_count);
+        information.set<Layout::next_free>(next_free);
+        device->write(offset, sector.data(), sector.size());
+    }
+}
+
+Fat_compaction_result compact_fat_image(
+    _In_ Block_device* source,
+    uint64_t volume_offset,
+    _In_z_ const char* destination_path,
+    bool truncate)
+{
+    Fat_volume volume(source, volume_offset);
+    const auto& geometry = volume.geometry();
+    const auto& file_allocation_table = volume.file_allocation_table();
+    const bool is_fat32 = Fat_type::fat32 == geometry.type;
+    const uint64_t cluster_size = static_cast<uint64_t>(geometry.sectors_per_cluster) * geometry.bytes_per_sector;
+
+    Fat_compaction_result result {};
+    result.source_size = source->size();
+
+    const auto chains = collect_chains(&volume);
+    result.before = measure_chains(&volume, chains);
+
+    // Plan the moves.  Each chain takes the next clusters in order, and
+    // adjacent source runs that stay adjacent are merged into one move.
+    std::vector<uint32_t> new_clusters(file_allocation_table.size(), fat_free_cluster);
+    std::vector<uint32_t> new_file_allocation_table(file_allocation_table.size(), fat_free_cluster);
+    new_file_allocation_table[0] = file_allocation_table[0];
+    new_file_allocation_table[1] = file_allocation_table[1];
+
+    std::vector<Cluster_move> moves;
+    uint32_t next_cluster = fat_first_cluster;
+    for(const auto& chain : chains)
+    {
+        const uint32_t chain_start = next_cluster;
+        for(const auto& run : volume.cluster_runs(chain.first_cluster))
+        {
+            for(uint32_t cluster = run.first_cluster; cluster < run.first_cluster + run.cluster_count; ++cluster)
+            {
+                CHECK_EXCEPTION(new_clusters[cluster] == fat_free_cluster,
+                                u8"Cluster " + std::to_string(cluster) + u8" is cross-linked.  CheckFat lists the files that share it.");
+                new_clusters[cluster] = next_cluster + (cluster - run.first_cluster);
+            }
+
+            if(!moves.empty() &&
+               (moves.back().source_cluster + moves.back().cluster_count == run.first_cluster) &&
+               (moves.back().destination_cluster + moves.back().cluster_count == next_cluster))
+            {
+                moves.back().cluster_count += run.cluster_count;
+            }
+            else
+            {
+                moves.push_back(Cluster_move { run.first_cluster, next_cluster, run.cluster_count });
+            }
+            next_cluster += run.cluster_count;
+        }
+
+        for(uint32_t cluster = chain_start; cluster + 1 < next_cluster; ++cluster)
+        {
+            new_file_allocation_table[cluster] = cluster + 1;
+        }
+        new_file_allocation_table[next_cluster - 1] = end_of_chain_marker;
+    }
+    const uint32_t used_clusters = next_cluster - fat_first_cluster;
+
+    // The FAT keeps its size when the volume shrinks, which the specification allows.
+    Fat_geometry new_geometry = geometry;
+    const uint64_t volume_size = geometry.total_sectors * geometry.bytes_per_sector;
+    uint64_t destination_size = result.source_size;
+    std::vector<uint8_t> master_boot_record;
+    if(truncate)
+    {
+        const uint32_t minimum_cluster_count = (Fat_type::fat12 == geometry.type) ? 1 :
+                                               (Fat_type::fat16 == geometry.type) ? fat12_cluster_limit : fat16_cluster_limit;
+        new_geometry.cluster_count = std::min(geometry.cluster_count, std::max(used_clusters, minimum_cluster_count));
+        new_geometry.total_sectors = std::min<uint64_t>(geometry.total_sectors,
+                                                        geometry.first_data_sector + static_cast<uint64_t>(new_geometry.cluster_count) * geometry.sectors_per_cluster);
+        destination_size = volume_offset + new_geometry.total_sectors * geometry.bytes_per_sector;
+
+        if(volume_offset != 0)
+        {
+            master_boot_record = truncated_master_boot_record(source, volume_offset, new_geometry.total_sectors);
+        }
+        new_file_allocation_table.resize(static_cast<size_t>(new_geometry.cluster_count) + fat_first_cluster);
+    }
+
+    // Creating the destination would truncate the source if they were the same file.
+    const HANDLE source_handle = source->native_handle();
+    CHECK_EXCEPTION((source_handle == nullptr) || !is_same_file(source_handle, destination_path),
+                    u8"The output file is the source image: " + std::string(destination_path));
+
+    // Nothing is written until the plan is known to work.
+    const auto destination = create_sparse_image_file(destination_path, destination_size);
+
+    // Copy what precedes the FATs: the MBR, anything before the volume, and the reserved sectors.
+    const uint64_t file_allocation_table_offset = volume_offset + static_cast<uint64_t>(geometry.reserved_sectors) * geometry.bytes_per_sector;
+    copy_range(source, destination.get(), 0, file_allocation_table_offset);
+
+    const auto encoded_table = encode_file_allocation_table(new_geometry, new_file_allocation_table);
+    for(unsigned int table_index = 0; table_index < geometry.file_allocation_table_count; ++table_index)
+    {
+        destination->write(file_allocation_table_offset + table_index * encoded_table.size(), encoded_table.data(), encoded_table.size());
+    }
+
+    if(!is_fat32)
+    {
+        std::vector<uint8_t> root_directory(static_cast<size_t>(geometry.root_directory_sectors) * geometry.bytes_per_sector);
+        const uint64_t root_directory_offset = file_allocation_table_offset + geometry.file_allocation_table_count * encoded_table.size();
+        source->read(root_directory_offset, root_directory.data(), root_directory.size());
+        remap_directory(&root_directory, new_clusters, is_fat32);
+        destination->write(root_directory_offset, root_directory.data(), root_directory.size());
+    }
+
+    // Write the data area in order.  Each move is read as one piece unless it fills the buffer.
+    const uint32_t clusters_per_buffer = static_cast<uint32_t>(std::max<uint64_t>(compaction_buffer_size / cluster_size, 1));
+    std::vector<uint8_t> buffer(static_cast<size_t>(clusters_per_buffer * cluster_size));
+    uint32_t buffer_cluster = fat_first_cluster;
+    uint32_t buffered_clusters = 0;
+    const auto flush = [&]()
+    {
+        destination->write(volume_offset + cluster_offset(geometry, buffer_cluster), buffer.data(), static_cast<size_t>(buffered_clusters * cluster_size));
+        buffer_cluster += buffered_clusters;
+        buffered_clusters = 0;
+    };
+    for(const auto& move : moves)
+    {
+        for(uint32_t moved = 0; moved < move.cluster_count; )
+        {
+            const uint32_t count = std::min(move.cluster_count - moved, clusters_per_buffer - buffered_clusters);
+            source->read(volume.cluster_device_offset(move.source_cluster + moved),
+                         buffer.data() + buffered_clusters * cluster_size,
+                         static_cast<size_t>(count * cluster_size));
+            buffered_clusters += count;
+            moved += count;
+
+            if(buffered_clusters == clusters_per_buffer)
+            {
+                flush();
+            }
+        }
+    }
+    if(buffered_clusters > 0)
+    {
+        flush();
+    }
+
+    // Directories now sit in one run each, so each is rewritten with one write.
+    for(const auto& chain : chains)
+    {
+        if(chain.is_directory)
+        {
+            Fat_directory_entry directory {};
+            directory.attributes = fat_attribute_directory;
+            directory.first_cluster = chain.first_cluster;
+
+            std::vector<uint8_t> data;
+            volume.read_file(directory, default_copy_buffer_size, [&data](_In_reads_bytes_(size) const uint8_t* buffer, size_t size)
+            {
+                data.insert(data.end(), buffer, buffer + size);
+            });
+            remap_directory(&data, new_clusters, is_fat32);
+            destination->write(volume_offset + cluster_offset(geometry, new_clusters[chain.first_cluster]), data.data(), data.size());
+        }
+    }
+
+    // The boot sector records the root directory cluster on FAT32, and the size of the volume.
+    std::vector<uint8_t> boot_sector(geometry.bytes_per_sector);
+    source->read(volume_offset, boot_sector.data(), boot_sector.size());
+    typedef Fat32_bios_parameter_block_layout Layout;
+    Mutable_structure_view<Layout> bpb(boot_sector.data(), boot_sector.size(), bios_parameter_block_offset);
+    if(is_fat32)
+    {
+        bpb.set<Layout::root_cluster>(new_clusters[geometry.root_cluster]);
+    }
+    if(bpb.get<Layout::sector_count>() != 0)
+    {
+        bpb.set<Layout::sector_count>(static_cast<uint16_t>(new_geometry.total_sectors));
+    }
+    else
+    {
+        bpb.set<Layout::huge_sector_count>(static_cast<uint32_t>(new_geometry.total_sectors));
+    }
+    destination->write(volume_offset, boot_sector.data(), boot_sector.size());
+    const unsigned int file_system_information_sector = bpb.get<Layout::file_system_information_sector>();
+
+    if(is_fat32)
+    {
+        const uint32_t free_count = new_geometry.cluster_count - used_clusters;
+        const uint32_t next_free = (used_clusters < new_geometry.cluster_count) ? next_cluster : UINT32_MAX;
+        if((file_system_information_sector != 0) && (file_system_information_sector < geometry.reserved_sectors))
+        {
+            update_file_system_information(destination.get(),
+                                           volume_offset + static_cast<uint64_t>(file_system_information_sector) * geometry.bytes_per_sector,
+                                           geometry.bytes_per_sector,
+                                           free_count,
+                                           next_free);
+        }
+
+        // The backup boot sector is followed by a backup of the FSInfo sector.
+        if(geometry.backup_boot_sector != 0)
+        {
+            destination->write(volume_offset + static_cast<uint64_t>(geometry.backup_boot_sector) * geometry.bytes_per_sector, boot_sector.data(), boot_sector.size());
+            if((file_system_information_sector != 0) && (geometry.backup_boot_sector + file_system_information_sector < geometry.reserved_sectors))
+            {
+                update_file_system_information(destination.get(),
+                                               volume_offset + static_cast<uint64_t>(geometry.backup_boot_sector + file_system_information_sector) * geometry.bytes_per_sector,
+                                               geometry.bytes_per_sector,
+                                               free_count,
+                                               next_free);
+            }
+        }
+    }
+
+    if(!master_boot_record.empty())
+    {
+        destination->write(0, master_boot_record.data(), master_boot_record.size());
+    }
+
+    // Other partitions after the volume are copied as they are.
+    if(!truncate && (volume_offset + volume_size < result.source_size))
+    {
+        copy_range(source, destination.get(), volume_offset + volume_size, result.source_size - volume_offset - volume_size);
+    }
+
+    Fat_volume compacted(destination.get(), volume_offset);
+    result.after = measure_fat_fragmentation(&compacted);
+    result.destination_size = destination_size;
+
+    return result;
+}
+
+}
+
@@ -0,0 +1,49 @@
+#pragma once
+
+namespace DiskTools
+{
+
+class Block_device;
+class Fat_volume;
+
+struct Fat_fragmentation
+{
+    uint64_t chain_count;               // Files and directories that have clusters.
+    uint64_t fragmented_chain_count;    // Those in more than one run of clusters.
+    uint64_t run_count;
+    uint32_t used_clusters;
+    uint32_t last_used_cluster;         // Zero if no cluster is used.
+};
+
+// Walks the directory tree and counts the runs in each cluster chain.
+Fat_fragmentation measure_fat_fragmentation(_In_ Fat_volume* volume);
+
+struct Fat_compaction_result
+{
+    Fat_fragmentation before;
+    Fat_fragmentation after;
+    uint64_t source_size;
+    uint64_t destination_size;
+};
+
+// Writes a copy of a disk or image to a new image file, with the FAT volume at
+// volume_offset defragmented.  Every file and directory becomes one run of
+// clusters, in directory order from the start of the data area, so the used
+// space ends up in one block.  The moves are planned in memory first, and the
+// data area is then written in one sequential pass, reading each run of the
+// source once.  Lost clusters are dropped, and bad cluster marks are cleared,
+// as they describe the source media.  Throws without writing anything if a
+// chain is broken or cross-linked.
+//
+// With truncate, the volume is shrunk to its used clusters (but no smaller
+// than its FAT type allows), and the image ends with the volume.  That is only
+// possible for a volume at the start of an unpartitioned image, or in the last
+// primary MBR partition.
+Fat_compaction_result compact_fat_image(
+    _In_ Block_device* source,
+    uint64_t volume_offset,
+    _In_z_ const char* destination_path,
+    bool truncate);
+
+}
+
@@ -0,0 +1,423 @@
+#include "PreCompile.h"
+#include "FatVolume.h"      // Pick up forward declarations to ensure correctness.
+#include "BlockDevice.h"
+#include "Copy.h"
+#include "PartitionTable.h"
+#include <PortableRuntime/CheckException.h>
+#include <PortableRuntime/Unicode.h>
+
+namespace DiskTools
+{
+
+// A directory holds at most 65536 entries, so no valid directory is larger than this.
+constexpr size_t maximum_directory_size = 65536 * Directory_entry_layout::size;
+
+// Each long name entry holds 13 UTF-16 characters, and names are at most 255 characters.
+constexpr unsigned int long_name_characters_per_entry = 13;
+constexpr unsigned int maximum_long_name_entries = 20;
+
+// A first byte of 0xe5 marks a deleted entry.  A name that really starts with 0xe5 stores 0x05 instead.
+constexpr uint8_t deleted_entry_marker = 0xe5;
+constexpr uint8_t escaped_deleted_entry_marker = 0x05;
+
+// Windows NT records names that are all lower case in bits of the reserved byte, instead of a long name.
+constexpr uint8_t lower_case_base_name = 0x08;
+constexpr uint8_t lower_case_extension = 0x10;
+
+// A long name entry shares the size and attributes of a directory entry.  The
+// characters are at offsets 1, 14, and 28.
+struct Long_name_entry_layout
+{
+    static constexpr size_t size = Directory_entry_layout::size;
+    typedef Little_endian_field<uint8_t, 0> sequence;
+    typedef Directory_entry_layout::attributes attributes;
+    typedef Little_endian_field<uint8_t, 13> checksum;
+};
+
+static bool is_fat_volume_at(_In_ Block_device* device, uint64_t offset)
+{
+    std::vector<uint8_t> boot_sector(std::max(device->sector_size(), 512u));
+    if(offset + boot_sector.size() > device->size())
+    {
+        return false;
+    }
+    device->read(offset, boot_sector.data(), boot_sector.size());
+
+    Fat_geometry geometry;
+    return fat_geometry_from_boot_sector(boot_sector.data(), boot_sector.size(), &geometry);
+}
+
+uint64_t find_fat_volume(_In_ Block_device* device, unsigned int partition_number)
+{
+    if((0 == partition_number) && is_fat_volume_at(device, 0))
+    {
+        return 0;
+    }
+
+    for(const auto& partition : read_partition_layout(device))
+    {
+        const uint64_t offset = partition.start_sector * device->sector_size();
+        if(0 == partition_number)
+        {
+            if(is_fat_volume_at(device, offset))
+            {
+                return offset;
+            }
+        }
+        else if(partition.number == partition_number)
+        {
+            CHECK_EXCEPTION(is_fat_volume_at(device, offset), u8"Partition " + std::to_string(partition_number) + u8" is not a FAT volume.");
+            return offset;
+        }
+    }
+
+    CHECK_EXCEPTION(0 != partition_number, u8"No FAT volume was found.");
+    throw std::runtime_error(u8"There is no partition " + std::to_string(partition_number) + u8".");
+}
+
+// The checksum of an 8.3 name that ties long name entries to their short entry.
+static uint8_t short_name_checksum(_In_reads_bytes_(11) const uint8_t* short_name) noexcept
+{
+    uint8_t checksum = 0;
+    for(unsigned int index = 0; index < fat_max_file_name_length + fat_max_extension_length; ++index)
+    {
+        checksum = static_cast<uint8_t>(((checksum & 1) << 7) + (checksum >> 1) + short_name[index]);
+    }
+
+    return checksum;
+}
+
+// Short names are in the OEM code page of the system that wrote them.  The current one is the best guess.
+static std::string utf8_from_short_name_part(_In_reads_(length) const uint8_t* text, size_t length, bool is_lower_case)
+{
+    while((length > 0) && (text[length - 1] == ' '))
+    {
+        --length;
+    }
+
+    std::string part(reinterpret_cast<const char*>(text), length);
+    if(is_lower_case)
+    {
+        std::transform(part.begin(), part.end(), part.begin(), [](char ch)
+        {
+            return ((ch >= 'A') && (ch <= 'Z')) ? static_cast<char>(ch - 'A' + 'a') : ch;
+        });
+    }
+
+    if(std::all_of(part.cbegin(), part.cend(), [](char ch) { return (ch & 0x80) == 0; }))
+    {
+        return part;
+    }
+
+    std::wstring wide(part.size(), L'\0');
+    const int wide_length = MultiByteToWideChar(CP_OEMCP, 0, part.data(), static_cast<int>(part.size()), &wide[0], static_cast<int>(wide.size()));
+    wide.resize(std::max(wide_length, 0));
+
+    return PortableRuntime::utf8_from_utf16(wide);
+}
+
+// Parses directory data, attaching long names to the short entries that follow them.
+static std::vector<Fat_directory_entry> parse_directory(const std::vector<uint8_t>& data, bool is_fat32)
+{
+    std::vector<Fat_directory_entry> entries;
+
+    std::vector<uint16_t> long_name;
+    unsigned int long_name_sequence = 0;   // The sequence number expected in the next long name entry, plus one.
+    uint8_t long_name_checksum = 0;
+
+    typedef Directory_entry_layout Layout;
+    for(size_t offset = 0; offset + Layout::size <= data.size(); offset += Layout::size)
+    {
+        const Structure_view<Layout> entry(data.data(), data.size(), offset);
+        const uint8_t first_byte = entry.get<Layout::file_name>()[0];
+
+        // A zero first byte marks the end of the directory.
+        if(first_byte == 0)
+        {
+            break;
+        }
+
+        if(first_byte == deleted_entry_marker)
+        {
+            long_name_sequence = 0;
+            continue;
+        }
+
+        const uint8_t attributes = entry.get<Layout::attributes>();
+        if((attributes & 0x3f) == fat_attribute_long_name)
+        {
+            const Structure_view<Long_name_entry_layout> long_name_entry(data.data(), data.size(), offset);
+            const uint8_t sequence_byte = long_name_entry.get<Long_name_entry_layout::sequence>();
+            const uint8_t checksum = long_name_entry.get<Long_name_entry_layout::checksum>();
+
+            // Long name entries come last part first.  The first one has bit 6 set in its sequence number.
+            const unsigned int sequence = sequence_byte & 0x3f;
+            if((sequence_byte & 0x40) != 0)
+            {
+                long_name.assign(static_cast<size_t>(sequence) * long_name_characters_per_entry, 0xffff);
+                long_name_sequence = sequence + 1;
+                long_name_checksum = checksum;
+            }
+
+            if((sequence == 0) || (sequence > maximum_long_name_entries) || (sequence + 1 != long_name_sequence) || (checksum != long_name_checksum))
+            {
+                long_name_sequence = 0;
+                continue;
+            }
+
+            const auto characters = long_name.begin() + (sequence - 1) * long_name_characters_per_entry;
+            for(unsigned int index = 0; index < long_name_characters_per_entry; ++index)
+            {
+                const unsigned int character_offset = (index < 5) ? (1 + index * 2) : ((index < 11) ? (14 + (index - 5) * 2) : (28 + (index - 11) * 2));
+                characters[index] = load_little_endian<uint16_t>(long_name_entry.data() + character_offset);
+            }
+
+            long_name_sequence = sequence;
+            continue;
+        }
+
+        // The checksum covers the file name and extension, which are adjacent.
+        const bool has_long_name = (1 == long_name_sequence) && (short_name_checksum(entry.get<Layout::file_name>()) == long_name_checksum);
+        long_name_sequence = 0;
+
+        if(((attributes & fat_attribute_volume_label) != 0) || (first_byte == '.'))
+        {
+            continue;
+        }
+
+        uint8_t base_name[fat_max_file_name_length];
+        std::copy(entry.get<Layout::file_name>(), entry.get<Layout::file_name>() + Layout::file_name::size, base_name);
+        if(base_name[0] == escaped_deleted_entry_marker)
+        {
+            base_name[0] = deleted_entry_marker;
+        }
+
+        const uint8_t case_flags = entry.get<Layout::case_flags>();
+        Fat_directory_entry directory_entry;
+        directory_entry.short_name = utf8_from_short_name_part(base_name, sizeof(base_name), (case_flags & lower_case_base_name) != 0);
+        const std::string extension = utf8_from_short_name_part(entry.get<Layout::extension>(), Layout::extension::size, (case_flags & lower_case_extension) != 0);
+        if(!extension.empty())
+        {
+            directory_entry.short_name += u8"." + extension;
+        }
+
+        directory_entry.name = directory_entry.short_name;
+        if(has_long_name)
+        {
+            // Names that fill their last entry exactly have no terminator, and the rest are padded with 0xffff.
+            const auto end = std::find(long_name.cbegin(), long_name.cend(), static_cast<uint16_t>(0));
+            directory_entry.name = PortableRuntime::utf8_from_utf16(std::wstring(long_name.cbegin(), end));
+        }
+
+        directory_entry.attributes = attributes;
+        directory_entry.first_cluster = entry.get<Layout::first_cluster_low>() | (is_fat32 ? (static_cast<uint32_t>(entry.get<Layout::first_cluster_high>()) << 16) : 0);
+        directory_entry.file_size = ((attributes & fat_attribute_directory) != 0) ? 0 : entry.get<Layout::file_size>();
+        directory_entry.last_write_date = entry.get<Layout::last_write_date>();
+        directory_entry.last_write_time = entry.get<Layout::last_write_time>();
+
+        entries.push_back(std::move(directory_entry));
+    }
+
+    return entries;
+}
+
+Fat_volume::Fat_volume(_In_ Block_device* device, uint64_t volume_offset) :
+    m_device(device),
+    m_volume_offset(volume_offset)
+{
+    std::vector<uint8_t> boot_sector(std::max(device->sector_size(), 512u));
+    CHECK_EXCEPTION(volume_offset + boot_sector.size() <= device->size(), u8"The FAT volume is past the end of the device.");
+    device->read(volume_offset, boot_sector.data(), boot_sector.size());
+    CHECK_EXCEPTION(fat_geometry_from_boot_sector(boot_sector.data(), boot_sector.size(), &m_geometry),
+                    u8"There is no FAT volume at byte " + std::to_string(volume_offset) + u8".");
+
+    m_file_allocation_table = read_file_allocation_table(device, volume_offset, m_geometry, m_geometry.active_file_allocation_table);
+}
+
+const Fat_geometry& Fat_volume::geometry() const noexcept
+{
+    return m_geometry;
+}
+
+uint64_t Fat_volume::volume_offset() const noexcept
+{
+    return m_volume_offset;
+}
+
+const std::vector<uint32_t>& Fat_volume::file_allocation_table() const noexcept
+{
+    return m_file_allocation_table;
+}
+
+const std::vector<Cluster_run>& Fat_volume::cluster_runs(uint32_t first_cluster)
+{
+    const auto cached = m_chain_cache.find(first_cluster);
+    if(cached != m_chain_cache.end())
+    {
+        return cached->second;
+    }
+
+    std::vector<Cluster_run> runs;
+    uint32_t cluster = first_cluster;
+    for(uint32_t length = 0; ; ++length)
+    {
+        CHECK_EXCEPTION((cluster >= fat_first_cluster) && (cluster < m_file_allocation_table.size()),
+                        u8"Cluster chain " + std::to_string(first_cluster) + u8" leaves the volume at cluster " + std::to_string(cluster) + u8".");
+
+        // A chain longer than the volume must visit some cluster twice.
+        CHECK_EXCEPTION(length < m_geometry.cluster_count, u8"Cluster chain " + std::to_string(first_cluster) + u8" loops.");
+
+        if(!runs.empty() && (runs.back().first_cluster + runs.back().cluster_count == cluster))
+        {
+            ++runs.back().cluster_count;
+        }
+        else
+        {
+            runs.push_back(Cluster_run { cluster, 1 });
+        }
+
+        const uint32_t next = m_file_allocation_table[cluster];
+        if(next >= fat_end_of_chain)
+        {
+            break;
+        }
+        CHECK_EXCEPTION((next != fat_free_cluster) && (next != fat_bad_cluster),
+                        u8"Cluster chain " + std::to_string(first_cluster) + u8" reaches a free or bad cluster after cluster " + std::to_string(cluster) + u8".");
+        cluster = next;
+    }
+
+    return m_chain_cache.emplace(first_cluster, std::move(runs)).first->second;
+}
+
+uint64_t Fat_volume::cluster_device_offset(uint32_t cluster) const noexcept
+{
+    return m_volume_offset + cluster_offset(m_geometry, cluster);
+}
+
+std::vector<uint8_t> Fat_volume::read_directory_data(uint32_t first_cluster)
+{
+    std::vector<uint8_t> data;
+
+    // The FAT12/16 root directory is a fixed area between the FATs and the first cluster.
+    if((0 == first_cluster) && (m_geometry.type != Fat_type::fat32))
+    {
+        const uint64_t root_directory_offset = m_volume_offset +
+                                               (m_geometry.reserved_sectors + static_cast<uint64_t>(m_geometry.file_allocation_table_count) *
+                                               m_geometry.sectors_per_file_allocation_table) * m_geometry.bytes_per_sector;
+        data.resize(static_cast<size_t>(m_geometry.root_directory_sectors) * m_geometry.bytes_per_sector);
+        m_device->read(root_directory_offset, data.data(), data.size());
+        return data;
+    }
+
+    Fat_directory_entry directory {};
+    directory.attributes = fat_attribute_directory;
+    directory.first_cluster = (0 == first_cluster) ? m_geometry.root_cluster : first_cluster;
+    read_file(directory, default_copy_buffer_size, [&data](_In_reads_bytes_(size) const uint8_t* buffer, size_t size)
+    {
+        CHECK_EXCEPTION(data.size() + size <= maximum_directory_size, u8"Directory is larger than the FAT limit.");
+        data.insert(data.end(), buffer, buffer + size);
+    });
+
+    return data;
+}
+
+std::vector<Fat_directory_entry> Fat_volume::read_root_directory()
+{
+    return parse_directory(read_directory_data(0), m_geometry.type == Fat_type::fat32);
+}
+
+std::vector<Fat_directory_entry> Fat_volume::read_directory(const Fat_directory_entry& directory)
+{
+    CHECK_EXCEPTION((directory.attributes & fat_attribute_directory) != 0, directory.name + u8" is not a directory.");
+    return parse_directory(read_directory_data(directory.first_cluster), m_geometry.type == Fat_type::fat32);
+}
+
+bool Fat_volume::find_entry(const std::string& path, _Out_ Fat_directory_entry* entry)
+{
+    *entry = Fat_directory_entry {};
+    entry->attributes = fat_attribute_directory;
+    entry->first_cluster = (m_geometry.type == Fat_type::fat32) ? m_geometry.root_cluster : 0;
+
+    const auto is_equal_ignoring_case = [](const std::string& left, const std::string& right)
+    {
+        return std::equal(left.cbegin(), left.cend(), right.cbegin(), right.cend(), [](char left_char, char right_char)
+        {
+            const auto lower = [](char ch)
+            {
+                return ((ch >= 'A') && (ch <= 'Z')) ? static_cast<char>(ch - 'A' + 'a') : ch;
+            };
+            return lower(left_char) == lower(right_char);
+        });
+    };
+
+    size_t start = 0;
+    while(start < path.size())
+    {
+        size_t end = path.find_first_of(u8"\\/", start);
+        if(std::string::npos == end)
+        {
+            end = path.size();
+        }
+
+        const std::string component = path.substr(start, end - start);
+        start = end + 1;
+        if(component.empty())
+        {
+            continue;
+        }
+
+        if((entry->attributes & fat_attribute_directory) == 0)
+        {
+            return false;
+        }
+
+        const auto entries = read_directory(*entry);
+        const auto found = std::find_if(entries.cbegin(), entries.cend(), [&](const Fat_directory_entry& candidate)
+        {
+            return is_equal_ignoring_case(candidate.name, component) || is_equal_ignoring_case(candidate.short_name, component);
+        });
+        if(found == entries.cend())
+        {
+            return false;
+        }
+
+        *entry = *found;
+    }
+
+    return true;
+}
+
+void Fat_volume::read_file(
+    const Fat_directory_entry& file,
+    size_t buffer_size,
+    const std::function<void (_In_reads_bytes_(size) const uint8_t* buffer, size_t size)>& write_output)
+{
+    if(0 == file.first_cluster)
+    {
+        CHECK_EXCEPTION(0 == file.file_size, file.name + u8" has a size but no clusters.");
+        return;
+    }
+
+    // Directories have no size, so all of their clusters are read.
+    const bool is_directory = (file.attributes & fat_attribute_directory) != 0;
+    const uint64_t cluster_size = static_cast<uint64_t>(m_geometry.sectors_per_cluster) * m_geometry.bytes_per_sector;
+    uint64_t remaining = is_directory ? UINT64_MAX : file.file_size;
+
+    for(const auto& run : cluster_runs(file.first_cluster))
+    {
+        if(0 == remaining)
+        {
+            break;
+        }
+
+        // Each run is one read, split only where it is larger than the buffer.
+        const uint64_t length = std::min(run.cluster_count * cluster_size, remaining);
+        stream_device(m_device, cluster_device_offset(run.first_cluster), length, buffer_size, write_output);
+        remaining -= length;
+    }
+
+    CHECK_EXCEPTION(is_directory || (0 == remaining), file.name + u8" is larger than its cluster chain.");
+}
+
+}
+
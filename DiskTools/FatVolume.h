@@ -0,0 +1,86 @@
+#pragma once
+
+#include "Fat.h"
+
+namespace DiskTools
+{
+
+class Block_device;
+
+constexpr uint8_t fat_attribute_read_only    = 0x01;
+constexpr uint8_t fat_attribute_hidden       = 0x02;
+constexpr uint8_t fat_attribute_system       = 0x04;
+constexpr uint8_t fat_attribute_volume_label = 0x08;
+constexpr uint8_t fat_attribute_directory    = 0x10;
+constexpr uint8_t fat_attribute_archive      = 0x20;
+constexpr uint8_t fat_attribute_long_name    = 0x0f;
+
+// A run of consecutive clusters in a cluster chain.
+struct Cluster_run
+{
+    uint32_t first_cluster;
+    uint32_t cluster_count;
+};
+
+struct Fat_directory_entry
+{
+    std::string name;           // The long file name if there is one, and otherwise the short name.
+    std::string short_name;     // Such as README.TXT.
+    uint8_t attributes;
+    uint32_t first_cluster;     // Zero for empty files.
+    uint32_t file_size;         // Zero for directories.
+    uint16_t last_write_date;
+    uint16_t last_write_time;
+};
+
+// Finds a FAT volume on a disk or image, and returns its byte offset.
+// partition_number is as numbered by read_partition_layout.  Zero selects a
+// volume at the start of an unpartitioned device, or else the first FAT partition.
+uint64_t find_fat_volume(_In_ Block_device* device, unsigned int partition_number);
+
+// A read-only view of a FAT12/16/32 volume.  The active FAT is read once when
+// the volume is opened, and each cluster chain is converted to cluster runs the
+// first time it is used, so directory and file reads are a few large reads.
+// Not thread safe.  device must outlive the Fat_volume.
+class Fat_volume
+{
+    Block_device* m_device;
+    uint64_t m_volume_offset;
+    Fat_geometry m_geometry;
+    std::vector<uint32_t> m_file_allocation_table;
+    std::unordered_map<uint32_t, std::vector<Cluster_run>> m_chain_cache;
+
+    std::vector<uint8_t> read_directory_data(uint32_t first_cluster);
+
+public:
+    // Throws if there is no FAT volume at volume_offset.
+    Fat_volume(_In_ Block_device* device, uint64_t volume_offset);
+
+    const Fat_geometry& geometry() const noexcept;
+    uint64_t volume_offset() const noexcept;
+    const std::vector<uint32_t>& file_allocation_table() const noexcept;
+
+    // Throws if the chain leaves the volume, reaches a free or bad cluster, or loops.
+    const std::vector<Cluster_run>& cluster_runs(uint32_t first_cluster);
+
+    // Byte offset of a cluster on the device.
+    uint64_t cluster_device_offset(uint32_t cluster) const noexcept;
+
+    // Lists a directory, without the . and .. entries, deleted entries, or the volume label.
+    std::vector<Fat_directory_entry> read_root_directory();
+    std::vector<Fat_directory_entry> read_directory(const Fat_directory_entry& directory);
+
+    // Looks up a path such as DOS\COMMAND.COM, with either slash, ignoring case,
+    // by long or short name.  An empty path is the root directory, which has
+    // a first cluster of zero on FAT12/16.  Returns false if there is no such entry.
+    bool find_entry(const std::string& path, _Out_ Fat_directory_entry* entry);
+
+    // Passes the contents of a file to write_output, in pieces of up to buffer_size bytes.
+    void read_file(
+        const Fat_directory_entry& file,
+        size_t buffer_size,
+        const std::function<void (_In_reads_bytes_(size) const uint8_t* buffer, size_t size)>& write_output);
+};
+
+}
+
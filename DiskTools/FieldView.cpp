@@ -0,0 +1,15 @@
+#include "PreCompile.h"
+#include "FieldView.h"      // Pick up forward declarations to ensure correctness.
+#include <PortableRuntime/CheckException.h>
+
+namespace DiskTools
+{
+
+[[noreturn]] void throw_structure_out_of_bounds(size_t offset, size_t structure_size, size_t buffer_size)
+{
+    CHECK_EXCEPTION(false, u8"A " + std::to_string(structure_size) + u8" byte structure at offset " + std::to_string(offset) +
+                           u8" is past the end of a " + std::to_string(buffer_size) + u8" byte buffer.");
+}
+
+}
+
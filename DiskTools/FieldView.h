@@ -0,0 +1,179 @@
+#pragma once
+
+namespace DiskTools
+{
+
+// On-disk structures are little-endian, and are often unaligned in their buffers,
+// such as the MBR partition table at offset 446, so they are read through views
+// rather than by casting the buffer to a packed structure.  A layout names the
+// size of a structure and the offset and type of each field:
+//
+//     struct Example_layout
+//     {
+//         static constexpr size_t size = 6;
+//         typedef Little_endian_field<uint16_t, 0> kind;
+//         typedef Little_endian_field<uint32_t, 2> length;
+//     };
+//
+// Structure_view<Example_layout>(buffer, buffer_size, offset).get<Example_layout::length>()
+// checks the bounds once, when the view is made, and checks the field against
+// the layout at compile time, so each field is one load, as with a cast.
+
+// Loads a little-endian integer at any alignment.  memcpy compiles to a single
+// mov, and all supported Windows targets are little-endian.  Other targets
+// assemble the value a byte at a time.
+template<typename Value>
+inline Value load_little_endian(_In_reads_bytes_(sizeof(Value)) const uint8_t* bytes) noexcept
+{
+    static_assert(std::is_integral<Value>::value, "Only integers have a byte order.");
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(_M_ARM) || defined(_M_ARM64)
+    Value value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+#else
+    uint64_t value = 0;
+    for(size_t index = 0; index < sizeof(Value); ++index)
+    {
+        value |= static_cast<uint64_t>(bytes[index]) << (index * 8);
+    }
+    return static_cast<Value>(value);
+#endif
+}
+
+// The inverse of load_little_endian.
+template<typename Value>
+inline void store_little_endian(_Out_writes_bytes_(sizeof(Value)) uint8_t* bytes, Value value) noexcept
+{
+    static_assert(std::is_integral<Value>::value, "Only integers have a byte order.");
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(_M_ARM) || defined(_M_ARM64)
+    memcpy(bytes, &value, sizeof(value));
+#else
+    const auto bits = static_cast<uint64_t>(value);
+    for(size_t index = 0; index < sizeof(Value); ++index)
+    {
+        bytes[index] = static_cast<uint8_t>(bits >> (index * 8));
+    }
+#endif
+}
+
+// A little-endian integer at a fixed offset in a structure.
+template<typename Value, size_t Offset>
+struct Little_endian_field
+{
+    typedef Value value_type;
+    static constexpr size_t offset = Offset;
+    static constexpr size_t size = sizeof(Value);
+
+    static Value load(_In_ const uint8_t* structure) noexcept
+    {
+        return load_little_endian<Value>(structure + Offset);
+    }
+
+    static void store(_Inout_ uint8_t* structure, Value value) noexcept
+    {
+        store_little_endian(structure + Offset, value);
+    }
+};
+
+// Bytes at a fixed offset in a structure, such as a name or a GUID, which are
+// returned in place rather than copied.
+template<size_t Offset, size_t Size>
+struct Byte_array_field
+{
+    typedef const uint8_t* value_type;
+    static constexpr size_t offset = Offset;
+    static constexpr size_t size = Size;
+
+    static const uint8_t* load(_In_ const uint8_t* structure) noexcept
+    {
+        return structure + Offset;
+    }
+};
+
+// Throws for a structure that does not fit in its buffer.  Kept out of line so
+// that views stay small enough to inline.
+[[noreturn]] void throw_structure_out_of_bounds(size_t offset, size_t structure_size, size_t buffer_size);
+
+// A read only view of a structure described by Layout, at offset bytes into a
+// buffer.  The view does not own the buffer, which must outlive it.
+template<typename Layout>
+class Structure_view
+{
+    const uint8_t* m_structure;
+
+public:
+    Structure_view(_In_reads_bytes_(buffer_size) const uint8_t* buffer, size_t buffer_size, size_t offset = 0) :
+        m_structure(buffer + offset)
+    {
+        if((offset > buffer_size) || (Layout::size > buffer_size - offset))
+        {
+            throw_structure_out_of_bounds(offset, Layout::size, buffer_size);
+        }
+    }
+
+    template<typename Field>
+    typename Field::value_type get() const noexcept
+    {
+        static_assert(Field::offset + Field::size <= Layout::size, "The field is outside of the structure.");
+        return Field::load(m_structure);
+    }
+
+    // A view of a structure within this one, such as an entry of a table.
+    template<typename Nested_layout>
+    Structure_view<Nested_layout> nested(size_t offset) const
+    {
+        return Structure_view<Nested_layout>(m_structure, Layout::size, offset);
+    }
+
+    const uint8_t* data() const noexcept
+    {
+        return m_structure;
+    }
+};
+
+// As Structure_view, but fields can also be stored.
+template<typename Layout>
+class Mutable_structure_view
+{
+    uint8_t* m_structure;
+
+public:
+    Mutable_structure_view(_Inout_updates_bytes_(buffer_size) uint8_t* buffer, size_t buffer_size, size_t offset = 0) :
+        m_structure(buffer + offset)
+    {
+        if((offset > buffer_size) || (Layout::size > buffer_size - offset))
+        {
+            throw_structure_out_of_bounds(offset, Layout::size, buffer_size);
+        }
+    }
+
+    template<typename Field>
+    typename Field::value_type get() const noexcept
+    {
+        static_assert(Field::offset + Field::size <= Layout::size, "The field is outside of the structure.");
+        return Field::load(m_structure);
+    }
+
+    template<typename Field>
+    void set(typename Field::value_type value) noexcept
+    {
+        static_assert(Field::offset + Field::size <= Layout::size, "The field is outside of the structure.");
+        Field::store(m_structure, value);
+    }
+
+    template<typename Nested_layout>
+    Mutable_structure_view<Nested_layout> nested(size_t offset) const
+    {
+        return Mutable_structure_view<Nested_layout>(m_structure, Layout::size, offset);
+    }
+
+    operator Structure_view<Layout>() const noexcept
+    {
+        return Structure_view<Layout>(m_structure, Layout::size);
+    }
+};
+
+}
+
@@ -0,0 +1,120 @@
+#include "PreCompile.h"
+#include "Hash.h"           // Pick up forward declarations to ensure correctness.
+
+namespace DiskTools
+{
+
+// Constants and structure of xxHash64, by Yann Collet.
+// https://github.com/Cyan4973/xxHash
+constexpr uint64_t prime64_1 = 0x9E3779B185EBCA87ull;
+constexpr uint64_t prime64_2 = 0xC2B2AE3D27D4EB4Full;
+constexpr uint64_t prime64_3 = 0x165667B19E3779F9ull;
+constexpr uint64_t prime64_4 = 0x85EBCA77C2B2AE63ull;
+constexpr uint64_t prime64_5 = 0x27D4EB2F165667C5ull;
+
+static inline uint64_t rotate_left(uint64_t value, unsigned int count) noexcept
+{
+    return (value << count) | (value >> (64 - count));
+}
+
+// memcpy is used for unaligned loads.  The compiler reduces these to single
+// mov instructions.  All supported Windows targets are little-endian.
+static inline uint64_t read64(_In_reads_bytes_(8) const uint8_t* data) noexcept
+{
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static inline uint32_t read32(_In_reads_bytes_(4) const uint8_t* data) noexcept
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static inline uint64_t hash_round(uint64_t accumulator, uint64_t input) noexcept
+{
+    accumulator += input * prime64_2;
+    accumulator = rotate_left(accumulator, 31);
+    accumulator *= prime64_1;
+    return accumulator;
+}
+
+static inline uint64_t merge_round(uint64_t accumulator, uint64_t value) noexcept
+{
+    accumulator ^= hash_round(0, value);
+    accumulator = accumulator * prime64_1 + prime64_4;
+    return accumulator;
+}
+
+uint64_t hash64(_In_reads_bytes_(size) const void* data, size_t size, uint64_t seed) noexcept
+{
+    const uint8_t* position = static_cast<const uint8_t*>(data);
+    const uint8_t* const end = position + size;
+
+    uint64_t hash;
+    if(size >= 32)
+    {
+        // Four independent lanes keep the multipliers busy.
+        uint64_t lane1 = seed + prime64_1 + prime64_2;
+        uint64_t lane2 = seed + prime64_2;
+        uint64_t lane3 = seed;
+        uint64_t lane4 = seed - prime64_1;
+
+        const uint8_t* const limit = end - 32;
+        do
+        {
+            lane1 = hash_round(lane1, read64(position));
+            lane2 = hash_round(lane2, read64(position + 8));
+            lane3 = hash_round(lane3, read64(position + 16));
+            lane4 = hash_round(lane4, read64(position + 24));
+            position += 32;
+        } while(position <= limit);
+
+        hash = rotate_left(lane1, 1) + rotate_left(lane2, 7) + rotate_left(lane3, 12) + rotate_left(lane4, 18);
+        hash = merge_round(hash, lane1);
+        hash = merge_round(hash, lane2);
+        hash = merge_round(hash, lane3);
+        hash = merge_round(hash, lane4);
+    }
+    else
+    {
+        hash = seed + prime64_5;
+    }
+
+    hash += static_cast<uint64_t>(size);
+
+    while(position + 8 <= end)
+    {
+        hash ^= hash_round(0, read64(position));
+        hash = rotate_left(hash, 27) * prime64_1 + prime64_4;
+        position += 8;
+    }
+
+    if(position + 4 <= end)
+    {
+        hash ^= static_cast<uint64_t>(read32(position)) * prime64_1;
+        hash = rotate_left(hash, 23) * prime64_2 + prime64_3;
+        position += 4;
+    }
+
+    while(position < end)
+    {
+        hash ^= (*position) * prime64_5;
+        hash = rotate_left(hash, 11) * prime64_1;
+        ++position;
+    }
+
+    // Final avalanche.
+    hash ^= hash >> 33;
+    hash *= prime64_2;
+    hash ^= hash >> 29;
+    hash *= prime64_3;
+    hash ^= hash >> 32;
+
+    return hash;
+}
+
+}
+
@@ -0,0 +1,11 @@
+#pragma once
+
+namespace DiskTools
+{
+
+// Fast non-cryptographic 64-bit hash (the xxHash64 algorithm).
+// Suitable for content addressing and change detection, but not for security.
+uint64_t hash64(_In_reads_bytes_(size) const void* data, size_t size, uint64_t seed = 0) noexcept;
+
+}
+
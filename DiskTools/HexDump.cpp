@@ -0,0 +1,280 @@
+#include "PreCompile.h"
+#include "HexDump.h"        // Pick up forward declarations to ensure correctness.
+#include <PortableRuntime/CheckException.h>
+
+namespace DiskTools
+{
+
+constexpr size_t bytes_per_line = 16;
+
+// "0000002048+010  " + 16 * "xx " + one extra space in the middle + " |" + 16 chars + "|\n".
+// The LBA takes ten digits, or up to the 20 digits of UINT64_MAX for larger LBAs.
+constexpr size_t minimum_lba_digits = 10;
+constexpr size_t maximum_lba_digits = 20;
+constexpr size_t offset_digits = 3;
+constexpr size_t hex_column_offset = 1 + offset_digits + 2;
+constexpr size_t ascii_column_offset = hex_column_offset + bytes_per_line * 3 + 3;
+constexpr size_t maximum_line_length = maximum_lba_digits + ascii_column_offset + bytes_per_line + 2;
+
+constexpr size_t output_buffer_size = 1024 * 1024;
+
+static const char hex_digits[] = "0123456789abcdef";
+
+#if defined(_M_IX86) || defined(_M_X64)
+
+// SSE2 is available on every processor that the x86 and x64 builds target.
+// Each nibble n becomes '0' + n, plus the gap between '9' and 'a' when n > 9.
+static __m128i hex_from_nibbles(__m128i nibbles) noexcept
+{
+    const __m128i is_letter = _mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9));
+    const __m128i letter_gap = _mm_and_si128(is_letter, _mm_set1_epi8('a' - '0' - 10));
+    return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letter_gap);
+}
+
+// Encodes sixteen bytes into 32 hex digits.
+static void encode_hex_16(_In_reads_bytes_(16) const uint8_t* data, _Out_writes_(32) char* output) noexcept
+{
+    const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+    const __m128i nibble_mask = _mm_set1_epi8(0x0f);
+    const __m128i high = hex_from_nibbles(_mm_and_si128(_mm_srli_epi16(bytes, 4), nibble_mask));
+    const __m128i low  = hex_from_nibbles(_mm_and_si128(bytes, nibble_mask));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(output),      _mm_unpacklo_epi8(high, low));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 16), _mm_unpackhi_epi8(high, low));
+}
+
+// Replaces bytes outside of printable ASCII with '.'.
+static void printable_16(_In_reads_bytes_(16) const uint8_t* data, _Out_writes_(16) char* output) noexcept
+{
+    // Signed compares, so bytes of 0x80 and above are negative, and are not printable.
+    const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+    const __m128i is_printable = _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(0x1f)),
+                                               _mm_cmplt_epi8(bytes, _mm_set1_epi8(0x7f)));
+    const __m128i result = _mm_or_si128(_mm_and_si128(is_printable, bytes),
+                                        _mm_andnot_si128(is_printable, _mm_set1_epi8('.')));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(output), result);
+}
+
+#else
+
+static void encode_hex_16(_In_reads_bytes_(16) const uint8_t* data, _Out_writes_(32) char* output) noexcept
+{
+    for(size_t index = 0; index < 16; ++index)
+    {
+        output[index * 2]     = hex_digits[data[index] >> 4];
+        output[index * 2 + 1] = hex_digits[data[index] & 0x0f];
+    }
+}
+
+static void printable_16(_In_reads_bytes_(16) const uint8_t* data, _Out_writes_(16) char* output) noexcept
+{
+    for(size_t index = 0; index < 16; ++index)
+    {
+        output[index] = ((data[index] >= 0x20) && (data[index] < 0x7f)) ? static_cast<char>(data[index]) : '.';
+    }
+}
+
+#endif
+
+void encode_hex(_In_reads_bytes_(size) const uint8_t* data, size_t size, _Out_writes_(size * 2) char* output) noexcept
+{
+    for(; size >= 16; size -= 16)
+    {
+        encode_hex_16(data, output);
+        data   += 16;
+        output += 32;
+    }
+
+    for(size_t index = 0; index < size; ++index)
+    {
+        output[index * 2]     = hex_digits[data[index] >> 4];
+        output[index * 2 + 1] = hex_digits[data[index] & 0x0f];
+    }
+}
+
+static size_t decimal_digits(uint64_t value) noexcept
+{
+    size_t digits = 1;
+    for(; value >= 10; value /= 10)
+    {
+        ++digits;
+    }
+
+    return digits;
+}
+
+Hex_dump_formatter::Hex_dump_formatter(
+    uint64_t first_sector,
+    uint64_t last_sector,
+    unsigned int sector_size,
+    bool collapse_repeats,
+    const std::function<void (_In_reads_(size) const char* text, size_t size)>& write_output) :
+    m_write_output(write_output),
+    m_buffer(output_buffer_size),
+    m_buffer_used(0),
+    m_sector(first_sector),
+    m_lba_digits(std::max(minimum_lba_digits, decimal_digits(std::max(first_sector, last_sector)))),
+    m_sector_size(sector_size),
+    m_sector_offset(0),
+    m_collapse_repeats(collapse_repeats),
+    m_is_collapsing(false),
+    m_has_previous_line(false),
+    m_previous_line(),
+    m_partial_line(),
+    m_partial_line_size(0)
+{
+    CHECK_EXCEPTION((sector_size > 0) && (sector_size % bytes_per_line == 0), u8"Sector size must be a multiple of 16.");
+}
+
+void Hex_dump_formatter::flush_buffer()
+{
+    if(m_buffer_used > 0)
+    {
+        m_write_output(m_buffer.data(), m_buffer_used);
+        m_buffer_used = 0;
+    }
+}
+
+// Formats a line of up to sixteen bytes at the current position.
+void Hex_dump_formatter::format_line(_In_reads_bytes_(size) const uint8_t* line, size_t size)
+{
+    assert(size <= bytes_per_line);
+
+    if(m_buffer.size() - m_buffer_used < maximum_line_length)
+    {
+        flush_buffer();
+    }
+    char* output = m_buffer.data() + m_buffer_used;
+    const size_t hex_column = m_lba_digits + hex_column_offset;
+    const size_t ascii_column = m_lba_digits + ascii_column_offset;
+
+    // LBA in decimal, and offset in hex.
+    uint64_t sector = m_sector;
+    for(size_t digit = m_lba_digits; digit > 0; --digit)
+    {
+        output[digit - 1] = static_cast<char>('0' + (sector % 10));
+        sector /= 10;
+    }
+    output[m_lba_digits] = '+';
+    for(size_t digit = 0; digit < offset_digits; ++digit)
+    {
+        output[m_lba_digits + 1 + digit] = hex_digits[(m_sector_offset >> ((offset_digits - 1 - digit) * 4)) & 0x0f];
+    }
+
+    // Pad a short final line to full length, so the ASCII column lines up.
+    std::array<uint8_t, bytes_per_line> padded{};
+    std::copy(line, line + size, padded.begin());
+
+    char hex[bytes_per_line * 2];
+    encode_hex_16(padded.data(), hex);
+
+    std::fill(output + m_lba_digits + 1 + offset_digits, output + ascii_column, ' ');
+    for(size_t index = 0; index < size; ++index)
+    {
+        // One extra space separates the two halves of the line.
+        const size_t column = hex_column + index * 3 + ((index >= bytes_per_line / 2) ? 1 : 0);
+        output[column]     = hex[index * 2];
+        output[column + 1] = hex[index * 2 + 1];
+    }
+
+    output[ascii_column - 1] = '|';
+    printable_16(padded.data(), output + ascii_column);
+    output[ascii_column + size] = '|';
+    output[ascii_column + size + 1] = '\n';
+
+    m_buffer_used += ascii_column + size + 2;
+}
+
+void Hex_dump_formatter::add_line(_In_reads_bytes_(size) const uint8_t* line, size_t size)
+{
+    const bool is_repeat = m_collapse_repeats &&
+                           m_has_previous_line &&
+                           (size == bytes_per_line) &&
+                           (memcmp(line, m_previous_line.data(), bytes_per_line) == 0);
+    if(is_repeat)
+    {
+        if(!m_is_collapsing)
+        {
+            if(m_buffer.size() - m_buffer_used < 2)
+            {
+                flush_buffer();
+            }
+            m_buffer[m_buffer_used++] = '*';
+            m_buffer[m_buffer_used++] = '\n';
+            m_is_collapsing = true;
+        }
+    }
+    else
+    {
+        format_line(line, size);
+        m_is_collapsing = false;
+    }
+
+    if(size == bytes_per_line)
+    {
+        std::copy(line, line + bytes_per_line, m_previous_line.begin());
+        m_has_previous_line = true;
+    }
+
+    m_sector_offset += static_cast<unsigned int>(size);
+    if(m_sector_offset == m_sector_size)
+    {
+        m_sector_offset = 0;
+        ++m_sector;
+    }
+}
+
+void Hex_dump_formatter::write(_In_reads_bytes_(size) const uint8_t* data, size_t size)
+{
+    // Complete a line left over from the previous write.
+    if(m_partial_line_size > 0)
+    {
+        const size_t amount = std::min(size, bytes_per_line - m_partial_line_size);
+        std::copy(data, data + amount, m_partial_line.begin() + m_partial_line_size);
+        m_partial_line_size += amount;
+        data += amount;
+        size -= amount;
+
+        if(m_partial_line_size == bytes_per_line)
+        {
+            add_line(m_partial_line.data(), bytes_per_line);
+            m_partial_line_size = 0;
+        }
+    }
+
+    for(; size >= bytes_per_line; size -= bytes_per_line)
+    {
+        add_line(data, bytes_per_line);
+        data += bytes_per_line;
+    }
+
+    std::copy(data, data + size, m_partial_line.begin());
+    m_partial_line_size += size;
+}
+
+void Hex_dump_formatter::finish()
+{
+    if(m_partial_line_size > 0)
+    {
+        add_line(m_partial_line.data(), m_partial_line_size);
+        m_partial_line_size = 0;
+    }
+    else if(m_is_collapsing)
+    {
+        // Show the last line of a collapsed run, so the extent of the dump is visible.
+        if(m_sector_offset == 0)
+        {
+            --m_sector;
+            m_sector_offset = m_sector_size;
+        }
+        m_sector_offset -= bytes_per_line;
+        format_line(m_previous_line.data(), bytes_per_line);
+        m_is_collapsing = false;
+    }
+
+    flush_buffer();
+}
+
+}
+
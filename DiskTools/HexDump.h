@@ -0,0 +1,51 @@
+#pragma once
+
+namespace DiskTools
+{
+
+// Writes two lowercase hex digits per byte of data to output, which must hold 2 * size chars.
+void encode_hex(_In_reads_bytes_(size) const uint8_t* data, size_t size, _Out_writes_(size * 2) char* output) noexcept;
+
+// Formats sectors in the style of hexdump -C, sixteen bytes per line:
+//   0000002048+010  eb 63 90 10 8e d0 bc 00  b0 b8 00 00 8e d8 8e c0  |.c..............|
+// Each line starts with the LBA of its sector and the byte offset within the
+// sector in hex.  The LBA is at least ten digits, and is widened to fit
+// last_sector.  A run of lines that repeat the line before is replaced by a
+// single "*" line, so runs of zeros or filler take no space.  Output is
+// collected into a large buffer and passed to write_output in big pieces.
+class Hex_dump_formatter
+{
+    std::function<void (_In_reads_(size) const char* text, size_t size)> m_write_output;
+    std::vector<char> m_buffer;
+    size_t m_buffer_used;
+    uint64_t m_sector;
+    size_t m_lba_digits;
+    unsigned int m_sector_size;
+    unsigned int m_sector_offset;
+    bool m_collapse_repeats;
+    bool m_is_collapsing;
+    bool m_has_previous_line;
+    std::array<uint8_t, 16> m_previous_line;
+    std::array<uint8_t, 16> m_partial_line;
+    size_t m_partial_line_size;
+
+    void format_line(_In_reads_bytes_(size) const uint8_t* line, size_t size);
+    void add_line(_In_reads_bytes_(size) const uint8_t* line, size_t size);
+    void flush_buffer();
+
+public:
+    Hex_dump_formatter(
+        uint64_t first_sector,
+        uint64_t last_sector,
+        unsigned int sector_size,
+        bool collapse_repeats,
+        const std::function<void (_In_reads_(size) const char* text, size_t size)>& write_output);
+
+    void write(_In_reads_bytes_(size) const uint8_t* data, size_t size);
+
+    // Formats any partial line, and passes all remaining output to write_output.
+    void finish();
+};
+
+}
+
@@ -0,0 +1,250 @@
+#include "PreCompile.h"
+#include "ImageDiff.h"      // Pick up forward declarations to ensure correctness.
+#include "BlockDevice.h"
+#include "ByteCompare.h"
+#include "Copy.h"
+#include "Hash.h"
+#include "ParallelScan.h"
+#include "SectorSize.h"
+#include "Trace.h"
+#include <PortableRuntime/CheckException.h>
+
+namespace DiskTools
+{
+
+// On-disk structures.  Fields are naturally aligned, so no packing is needed.
+// A header is followed by record_count records, each followed by length bytes.
+struct Patch_header
+{
+    uint8_t signature[8];
+    uint32_t version;
+    uint32_t sector_size;       // Of the original, for information.
+    uint64_t original_size;
+    uint64_t modified_size;
+    uint64_t record_count;
+};
+
+struct Patch_record
+{
+    uint64_t offset;
+    uint64_t length;
+    uint64_t original_hash;     // hash64 of the original bytes in the record, which may be fewer than length.
+};
+
+static_assert(sizeof(Patch_header) == 40, "Patch_header is an on-disk structure.");
+static_assert(sizeof(Patch_record) == 24, "Patch_record is an on-disk structure.");
+
+static constexpr uint8_t patch_signature[8] = { 'D', 'T', 'P', 'A', 'T', 'C', 'H', '1' };
+constexpr uint32_t patch_version = 1;
+
+// Records are split so that each one can be checked with a single buffer.
+constexpr uint64_t maximum_record_length = default_copy_buffer_size;
+
+// Appends an extent, or grows the last one if the two touch.
+static void append_extent(_Inout_ std::vector<Difference_extent>* extents, uint64_t offset, uint64_t length)
+{
+    if(!extents->empty() && (extents->back().offset + extents->back().length == offset))
+    {
+        extents->back().length += length;
+    }
+    else
+    {
+        extents->push_back(Difference_extent { offset, length });
+    }
+}
+
+std::vector<Difference_extent> find_differences(
+    const std::string& original_name,
+    const std::string& modified_name,
+    unsigned int granularity,
+    unsigned int thread_count,
+    size_t block_size)
+{
+    DISKTOOLS_TRACE_SPAN("DiskTools", "find_differences");
+
+    CHECK_EXCEPTION((granularity > 0) && ((granularity & (granularity - 1)) == 0) && (block_size % granularity == 0),
+                    u8"The comparison granularity must be a power of two that divides the block size.");
+    CHECK_EXCEPTION(thread_count > 0, u8"At least one comparison thread is required.");
+
+    const uint64_t original_size = open_disk_or_device(original_name)->size();
+    const uint64_t modified_size = open_disk_or_device(modified_name)->size();
+    const uint64_t common_size = std::min(original_size, modified_size);
+    const uint64_t block_count = (common_size + block_size - 1) / block_size;
+    thread_count = static_cast<unsigned int>(std::max<uint64_t>(std::min<uint64_t>(thread_count, block_count), 1));
+
+    // Each thread reads both devices through its own handles.
+    std::vector<std::unique_ptr<Block_device>> originals;
+    std::vector<std::unique_ptr<Block_device>> modifieds;
+    std::vector<std::vector<uint8_t>> original_buffers(thread_count);
+    std::vector<std::vector<uint8_t>> modified_buffers(thread_count);
+    for(unsigned int thread_index = 0; thread_index < thread_count; ++thread_index)
+    {
+        originals.push_back(open_disk_or_device(original_name));
+        modifieds.push_back(open_disk_or_device(modified_name));
+    }
+
+    // Each block keeps its own extents, so no locking is needed, and they are joined in order afterwards.
+    std::vector<std::vector<Difference_extent>> block_extents(static_cast<size_t>(block_count));
+    for_each_block_parallel(thread_count, block_count, [&](unsigned int thread_index, uint64_t block_index)
+    {
+        const uint64_t offset = block_index * block_size;
+        const size_t size = static_cast<size_t>(std::min<uint64_t>(block_size, common_size - offset));
+
+        auto& original_buffer = original_buffers[thread_index];
+        auto& modified_buffer = modified_buffers[thread_index];
+        original_buffer.resize(block_size);
+        modified_buffer.resize(block_size);
+        originals[thread_index]->read(offset, original_buffer.data(), size);
+        modifieds[thread_index]->read(offset, modified_buffer.data(), size);
+
+        if(are_bytes_equal(original_buffer.data(), modified_buffer.data(), size))
+        {
+            return;
+        }
+
+        // The granularity is usually the sector size, so the common sizes get
+        // loops with constant steps.
+        auto& extents = block_extents[static_cast<size_t>(block_index)];
+        with_sector_size(granularity, [&](auto fixed_granularity)
+        {
+            for(size_t unit = 0; unit < size; unit += fixed_granularity)
+            {
+                const size_t unit_size = std::min<size_t>(fixed_granularity, size - unit);
+                if(!are_bytes_equal(original_buffer.data() + unit, modified_buffer.data() + unit, unit_size))
+                {
+                    append_extent(&extents, offset + unit, unit_size);
+                }
+            }
+        });
+    });
+
+    std::vector<Difference_extent> extents;
+    for(const auto& block : block_extents)
+    {
+        for(const auto& extent : block)
+        {
+            append_extent(&extents, extent.offset, extent.length);
+        }
+    }
+
+    if(original_size != modified_size)
+    {
+        append_extent(&extents, common_size, std::max(original_size, modified_size) - common_size);
+    }
+
+    return extents;
+}
+
+void write_image_patch(
+    const std::string& original_name,
+    const std::string& modified_name,
+    const std::vector<Difference_extent>& extents,
+    _In_z_ const char* patch_file_name)
+{
+    DISKTOOLS_TRACE_SPAN("DiskTools", "write_image_patch");
+
+    const auto original = open_disk_or_device(original_name);
+    const auto modified = open_disk_or_device(modified_name);
+    const auto patch = open_image_file(patch_file_name, CREATE_ALWAYS);
+
+    // The header is written last, once the record count is known, so a patch
+    // that was cut short is rejected by the signature check.
+    uint64_t patch_offset = sizeof(Patch_header);
+    uint64_t record_count = 0;
+    std::vector<uint8_t> buffer(static_cast<size_t>(maximum_record_length));
+    for(const auto& extent : extents)
+    {
+        // Bytes past the end of the modified image are dropped, not patched.
+        const uint64_t end = std::min(extent.offset + extent.length, modified->size());
+        for(uint64_t offset = extent.offset; offset < end; offset += maximum_record_length)
+        {
+            Patch_record record;
+            record.offset = offset;
+            record.length = std::min(maximum_record_length, end - offset);
+
+            // Bytes that the original image does not have are hashed as an empty range.
+            const uint64_t original_length = (offset < original->size()) ? std::min(record.length, original->size() - offset) : 0;
+            if(original_length > 0)
+            {
+                original->read(offset, buffer.data(), static_cast<size_t>(original_length));
+            }
+            record.original_hash = hash64(buffer.data(), static_cast<size_t>(original_length));
+
+            modified->read(offset, buffer.data(), static_cast<size_t>(record.length));
+            patch->write(patch_offset, reinterpret_cast<const uint8_t*>(&record), sizeof(record));
+            patch->write(patch_offset + sizeof(record), buffer.data(), static_cast<size_t>(record.length));
+
+            patch_offset += sizeof(record) + record.length;
+            ++record_count;
+        }
+    }
+
+    Patch_header header {};
+    std::copy(std::cbegin(patch_signature), std::cend(patch_signature), header.signature);
+    header.version = patch_version;
+    header.sector_size = original->sector_size();
+    header.original_size = original->size();
+    header.modified_size = modified->size();
+    header.record_count = record_count;
+    patch->write(0, reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+}
+
+Image_patch_summary apply_image_patch(_In_z_ const char* patch_file_name, _In_ Block_device* target)
+{
+    DISKTOOLS_TRACE_SPAN("DiskTools", "apply_image_patch");
+
+    const auto patch = open_block_device(patch_file_name);
+    CHECK_EXCEPTION(patch->size() >= sizeof(Patch_header), u8"The patch is too short: " + std::string(patch_file_name));
+
+    Patch_header header;
+    patch->read(0, reinterpret_cast<uint8_t*>(&header), sizeof(header));
+    CHECK_EXCEPTION(std::equal(std::cbegin(patch_signature), std::cend(patch_signature), header.signature),
+                    u8"The file is not an image patch: " + std::string(patch_file_name));
+    CHECK_EXCEPTION(header.version == patch_version, u8"Unsupported image patch version: " + std::to_string(header.version));
+    CHECK_EXCEPTION(target->size() >= header.original_size, u8"The target is smaller than the image the patch was made from.");
+
+    // Walk the records twice: first to check that the target holds the original
+    // bytes, so a mismatch leaves the target untouched, and then to write.
+    std::vector<uint8_t> buffer(static_cast<size_t>(maximum_record_length));
+    Image_patch_summary summary { header.original_size, header.modified_size, header.record_count, 0 };
+    for(int pass = 0; pass < 2; ++pass)
+    {
+        const bool is_writing = (pass == 1);
+        uint64_t patch_offset = sizeof(Patch_header);
+        for(uint64_t index = 0; index < header.record_count; ++index)
+        {
+            Patch_record record;
+            CHECK_EXCEPTION(patch->size() - patch_offset >= sizeof(record), u8"The patch is truncated: " + std::string(patch_file_name));
+            patch->read(patch_offset, reinterpret_cast<uint8_t*>(&record), sizeof(record));
+            CHECK_EXCEPTION((record.length <= maximum_record_length) &&
+                            (record.offset + record.length <= header.modified_size) &&
+                            (patch->size() - patch_offset - sizeof(record) >= record.length),
+                            u8"The patch is corrupt: " + std::string(patch_file_name));
+
+            if(is_writing)
+            {
+                patch->read(patch_offset + sizeof(record), buffer.data(), static_cast<size_t>(record.length));
+                target->write(record.offset, buffer.data(), static_cast<size_t>(record.length));
+                summary.byte_count += record.length;
+            }
+            else
+            {
+                const uint64_t original_length = (record.offset < header.original_size) ?
+                                                 std::min(record.length, header.original_size - record.offset) : 0;
+                if(original_length > 0)
+                {
+                    target->read(record.offset, buffer.data(), static_cast<size_t>(original_length));
+                }
+                CHECK_EXCEPTION(hash64(buffer.data(), static_cast<size_t>(original_length)) == record.original_hash,
+                                u8"The target does not match the image the patch was made from, at byte " + std::to_string(record.offset) + u8".");
+            }
+
+            patch_offset += sizeof(record) + record.length;
+        }
+    }
+
+    return summary;
+}
+
+}
+
@@ -0,0 +1,53 @@
+#pragma once
+
+namespace DiskTools
+{
+
+class Block_device;
+
+// A run of bytes that differs between two devices.
+struct Difference_extent
+{
+    uint64_t offset;
+    uint64_t length;
+};
+
+// Large enough that each thread reads sequentially from both devices.
+constexpr size_t default_diff_block_size = 4 * 1024 * 1024;
+
+// Compares two disks or images (see open_disk_or_device) on up to thread_count
+// threads, in units of granularity bytes, which is a power of two that divides
+// block_size.  Adjacent differing units are merged, so extents are sorted and
+// never touch.  If the devices differ in size, the bytes past the end of the
+// shorter one are one more extent.
+std::vector<Difference_extent> find_differences(
+    const std::string& original_name,
+    const std::string& modified_name,
+    unsigned int granularity,
+    unsigned int thread_count,
+    size_t block_size);
+
+// Writes a patch that turns original into modified, given the extents from
+// find_differences.  The patch holds the modified bytes of each extent, with a
+// hash of the original bytes, so that it is not applied to the wrong image.
+void write_image_patch(
+    const std::string& original_name,
+    const std::string& modified_name,
+    const std::vector<Difference_extent>& extents,
+    _In_z_ const char* patch_file_name);
+
+struct Image_patch_summary
+{
+    uint64_t original_size;
+    uint64_t modified_size;
+    uint64_t record_count;
+    uint64_t byte_count;
+};
+
+// Checks every record of a patch against target before writing any of them,
+// and then writes the modified bytes.  Image files grow to the modified size,
+// but are not truncated when the modified image is smaller.
+Image_patch_summary apply_image_patch(_In_z_ const char* patch_file_name, _In_ Block_device* target);
+
+}
+
@@ -0,0 +1,539 @@
+#include "PreCompile.h"
+#include "ImageStore.h"     // Pick up forward declarations to ensure correctness.
+#include "Hash.h"
+#include "Trace.h"
+#include <PortableRuntime/CheckException.h>
+#include <PortableRuntime/Unicode.h>
+#include <WindowsCommon/CheckHR.h>
+
+namespace DiskTools
+{
+
+constexpr uint64_t chunk_hash_high_seed = 0x6A09E667F3BCC908ull;
+
+constexpr char pack_file_name[] = "chunks.pack";
+constexpr char index_file_name[] = "chunks.index";
+constexpr char images_directory_name[] = "images";
+constexpr char manifest_extension[] = ".manifest";
+
+// On-disk structures.  Fields are naturally aligned, so no packing is needed.
+struct Chunk_index_record
+{
+    Chunk_hash hash;
+    uint64_t offset;
+    uint32_t size;
+    uint32_t reserved;
+};
+
+struct Manifest_header
+{
+    uint8_t signature[8];
+    uint64_t image_size;
+    uint32_t sector_size;
+    uint32_t entry_count;
+};
+static_assert(sizeof(Chunk_index_record) == 32, "Chunk_index_record is an on-disk structure.");
+static_assert(sizeof(Manifest_header) == 24, "Manifest_header is an on-disk structure.");
+
+static constexpr uint8_t manifest_signature[8] = { 'D', 'T', 'I', 'M', 'A', 'G', 'E', '1' };
+
+Chunk_hash hash_chunk(_In_reads_bytes_(size) const uint8_t* data, size_t size) noexcept
+{
+    Chunk_hash hash;
+    hash.low  = hash64(data, size, 0);
+    hash.high = hash64(data, size, chunk_hash_high_seed);
+
+    return hash;
+}
+
+static unsigned int log2_of_power_of_two(uint32_t value) noexcept
+{
+    assert((value != 0) && ((value & (value - 1)) == 0));
+
+    unsigned int log2 = 0;
+    while(value > 1)
+    {
+        value >>= 1;
+        ++log2;
+    }
+
+    return log2;
+}
+
+Chunking_parameters fixed_chunking(uint32_t chunk_size) noexcept
+{
+    Chunking_parameters parameters;
+    parameters.method       = Chunking_method::fixed;
+    parameters.minimum_size = chunk_size;
+    parameters.average_size = chunk_size;
+    parameters.maximum_size = chunk_size;
+
+    return parameters;
+}
+
+Chunking_parameters content_defined_chunking(uint32_t average_size) noexcept
+{
+    // Ratios recommended by the FastCDC paper.
+    Chunking_parameters parameters;
+    parameters.method       = Chunking_method::content_defined;
+    parameters.minimum_size = average_size / 4;
+    parameters.average_size = average_size;
+    parameters.maximum_size = average_size * 4;
+
+    return parameters;
+}
+
+// Random values for the gear rolling hash, from splitmix64 so that chunk
+// boundaries are stable across builds and machines.
+static const std::array<uint64_t, 256>& gear_table()
+{
+    static const std::array<uint64_t, 256> table = []()
+    {
+        std::array<uint64_t, 256> values;
+        uint64_t state = 0;
+        for(auto& value : values)
+        {
+            state += 0x9E3779B97F4A7C15ull;
+            uint64_t mixed = state;
+            mixed = (mixed ^ (mixed >> 30)) * 0xBF58476D1CE4E5B9ull;
+            mixed = (mixed ^ (mixed >> 27)) * 0x94D049BB133111EBull;
+            value = mixed ^ (mixed >> 31);
+        }
+
+        return values;
+    }();
+
+    return table;
+}
+
+// The gear hash shifts left, so the high bits depend on the most input bytes.
+static uint64_t high_bit_mask(unsigned int bit_count) noexcept
+{
+    return (bit_count == 0) ? 0 : (~0ull << (64 - bit_count));
+}
+
+// Returns the size of the next chunk, or zero if more data is needed to decide.
+static size_t find_chunk_boundary(
+    _In_reads_bytes_(size) const uint8_t* data,
+    size_t size,
+    const Chunking_parameters& parameters,
+    bool end_of_image)
+{
+    if(Chunking_method::fixed == parameters.method)
+    {
+        if(size >= parameters.average_size)
+        {
+            return parameters.average_size;
+        }
+
+        return end_of_image ? size : 0;
+    }
+
+    if(size <= parameters.minimum_size)
+    {
+        return end_of_image ? size : 0;
+    }
+
+    // Normalized chunking: a stricter mask before the average size and a looser
+    // one after it pulls chunk sizes towards the average.
+    const unsigned int average_bits = log2_of_power_of_two(parameters.average_size);
+    const uint64_t strict_mask = high_bit_mask(average_bits + 2);
+    const uint64_t loose_mask = high_bit_mask(average_bits - 2);
+
+    const auto& gear = gear_table();
+    const size_t limit = std::min<size_t>(size, parameters.maximum_size);
+    const size_t normal_limit = std::min<size_t>(limit, parameters.average_size);
+
+    uint64_t fingerprint = 0;
+    size_t index = parameters.minimum_size;
+    for(; index < normal_limit; ++index)
+    {
+        fingerprint = (fingerprint << 1) + gear[data[index]];
+        if((fingerprint & strict_mask) == 0)
+        {
+            return index + 1;
+        }
+    }
+    for(; index < limit; ++index)
+    {
+        fingerprint = (fingerprint << 1) + gear[data[index]];
+        if((fingerprint & loose_mask) == 0)
+        {
+            return index + 1;
+        }
+    }
+
+    if(limit == parameters.maximum_size)
+    {
+        return limit;
+    }
+
+    return end_of_image ? size : 0;
+}
+
+static void create_directory(const std::string& path)
+{
+    if(CreateDirectoryW(PortableRuntime::utf16_from_utf8(path).c_str(), nullptr) == 0)
+    {
+        const DWORD last_error = GetLastError();
+        CHECK_EXCEPTION(ERROR_ALREADY_EXISTS == last_error, u8"Unable to create directory: " + path);
+    }
+}
+
+Image_store::Image_store(const std::string& root_path) :
+    m_root_path(root_path)
+{
+    create_directory(m_root_path);
+    create_directory(m_root_path + "\\" + images_directory_name);
+
+    m_pack       = open_image_file((m_root_path + "\\" + pack_file_name).c_str(), OPEN_ALWAYS);
+    m_index_file = open_image_file((m_root_path + "\\" + index_file_name).c_str(), OPEN_ALWAYS);
+
+    load_index();
+}
+
+void Image_store::load_index()
+{
+    // A partial trailing record or a record past the end of the pack can only be
+    // the result of an interrupted session.  Those chunks are simply stored again.
+    const uint64_t record_count = m_index_file->size() / sizeof(Chunk_index_record);
+    const uint64_t pack_size = m_pack->size();
+
+    std::vector<Chunk_index_record> records(static_cast<size_t>(record_count));
+    m_index_file->read(0, reinterpret_cast<uint8_t*>(records.data()), records.size() * sizeof(Chunk_index_record));
+
+    m_index.reserve(records.size());
+    for(const auto& record : records)
+    {
+        if(record.offset + record.size <= pack_size)
+        {
+            Chunk_location location;
+            location.offset = record.offset;
+            location.size   = record.size;
+            m_index.emplace(record.hash, location);
+        }
+    }
+}
+
+std::string Image_store::manifest_path(const std::string& image_name) const
+{
+    CHECK_EXCEPTION(image_name.find_first_of("\\/:") == std::string::npos, u8"Invalid image name: " + image_name);
+
+    return m_root_path + "\\" + images_directory_name + "\\" + image_name + manifest_extension;
+}
+
+bool Image_store::contains_image(const std::string& image_name) const
+{
+    const auto attributes = GetFileAttributesW(PortableRuntime::utf16_from_utf8(manifest_path(image_name)).c_str());
+    return (INVALID_FILE_ATTRIBUTES != attributes) && ((attributes & FILE_ATTRIBUTE_DIRECTORY) == 0);
+}
+
+std::unique_ptr<Block_device> Image_store::open_image(const std::string& image_name) const
+{
+    return open_image_manifest(manifest_path(image_name).c_str());
+}
+
+Chunk_location Image_store::store_chunk(
+    const Chunk_hash& hash,
+    _In_reads_bytes_(size) const uint8_t* data,
+    uint32_t size,
+    _Out_ bool* is_new_chunk)
+{
+    const auto existing = m_index.find(hash);
+    if(existing != m_index.cend())
+    {
+        assert(existing->second.size == size);
+        *is_new_chunk = false;
+        return existing->second;
+    }
+
+    DISKTOOLS_TRACE_SPAN("store", "append chunk");
+
+    Chunk_location location;
+    location.offset = m_pack->size();
+    location.size   = size;
+    m_pack->write(location.offset, data, size);
+    m_index.emplace(hash, location);
+
+    Chunk_index_record record{};
+    record.hash   = hash;
+    record.offset = location.offset;
+    record.size   = location.size;
+    const auto record_bytes = reinterpret_cast<const uint8_t*>(&record);
+    m_pending_index_records.insert(m_pending_index_records.end(), record_bytes, record_bytes + sizeof(record));
+
+    *is_new_chunk = true;
+    return location;
+}
+
+// Writes the data of a file through to the disk.  Devices without a handle,
+// such as memory devices, have nothing to flush.
+static void flush_file_buffers(const Block_device& device)
+{
+    const HANDLE handle = device.native_handle();
+    if(nullptr != handle)
+    {
+        CHECK_BOOL_LAST_ERROR(FlushFileBuffers(handle));
+    }
+}
+
+void Image_store::flush_index()
+{
+    if(!m_pending_index_records.empty())
+    {
+        DISKTOOLS_TRACE_SPAN("store", "flush index");
+
+        // The chunks must be on the disk before the index records that point at them.
+        flush_file_buffers(*m_pack);
+        m_index_file->write(m_index_file->size(), m_pending_index_records.data(), m_pending_index_records.size());
+        m_pending_index_records.clear();
+        flush_file_buffers(*m_index_file);
+    }
+}
+
+uint64_t Image_store::stored_bytes() const noexcept
+{
+    return m_pack->size();
+}
+
+Image_store_writer::Image_store_writer(
+    _In_ Image_store* store,
+    const std::string& image_name,
+    const Chunking_parameters& parameters,
+    unsigned int sector_size) :
+    m_store(store),
+    m_image_name(image_name),
+    m_parameters(parameters),
+    m_sector_size(sector_size),
+    m_image_size(0),
+    m_new_bytes(0)
+{
+    assert(m_parameters.minimum_size <= m_parameters.average_size);
+    assert(m_parameters.average_size <= m_parameters.maximum_size);
+
+    m_pending.reserve(m_parameters.maximum_size);
+}
+
+// Returns the number of bytes consumed.  Unconsumed bytes are the start of a chunk
+// whose end is not yet known.
+size_t Image_store_writer::store_chunks(_In_reads_bytes_(size) const uint8_t* data, size_t size, bool end_of_image)
+{
+    size_t consumed = 0;
+    while(consumed < size)
+    {
+        size_t chunk_size;
+        {
+            DISKTOOLS_TRACE_SPAN("store", "find chunk boundary");
+            chunk_size = find_chunk_boundary(data + consumed, size - consumed, m_parameters, end_of_image);
+        }
+        if(0 == chunk_size)
+        {
+            break;
+        }
+
+        // Cast is safe as chunk_size is no larger than maximum_size.
+        const uint32_t chunk_size32 = static_cast<uint32_t>(chunk_size);
+        Chunk_hash hash;
+        {
+            DISKTOOLS_TRACE_SPAN("store", "hash chunk");
+            hash = hash_chunk(data + consumed, chunk_size);
+        }
+
+        bool is_new_chunk;
+        const Chunk_location location = m_store->store_chunk(hash, data + consumed, chunk_size32, &is_new_chunk);
+        if(is_new_chunk)
+        {
+            m_new_bytes += chunk_size;
+        }
+
+        Manifest_entry entry{};
+        entry.hash        = hash;
+        entry.pack_offset = location.offset;
+        entry.size        = chunk_size32;
+        m_entries.push_back(entry);
+
+        consumed += chunk_size;
+    }
+
+    return consumed;
+}
+
+void Image_store_writer::write(_In_reads_bytes_(size) const uint8_t* data, size_t size)
+{
+    m_image_size += size;
+
+    // Complete any chunk left over from the previous write first.
+    while((size > 0) && !m_pending.empty())
+    {
+        const size_t amount = std::min(size, m_parameters.maximum_size - m_pending.size());
+        m_pending.insert(m_pending.end(), data, data + amount);
+        data += amount;
+        size -= amount;
+
+        const size_t consumed = store_chunks(m_pending.data(), m_pending.size(), false);
+        m_pending.erase(m_pending.begin(), m_pending.begin() + consumed);
+    }
+
+    // Chunk directly from the caller's buffer, and only copy the tail.
+    if(size > 0)
+    {
+        const size_t consumed = store_chunks(data, size, false);
+        m_pending.assign(data + consumed, data + size);
+    }
+}
+
+void Image_store_writer::commit()
+{
+    DISKTOOLS_TRACE_SPAN("store", "commit");
+
+    const size_t consumed = store_chunks(m_pending.data(), m_pending.size(), true);
+    (void)consumed;     // Prevent unreferenced variable warning in Release build.
+    assert(consumed == m_pending.size());
+    m_pending.clear();
+
+    // Chunks must be durable before any manifest references them.  Flushing
+    // the index flushes the pack first.
+    m_store->flush_index();
+
+    Manifest_header header{};
+    std::copy(std::cbegin(manifest_signature), std::cend(manifest_signature), header.signature);
+    header.image_size  = m_image_size;
+    header.sector_size = m_sector_size;
+    header.entry_count = static_cast<uint32_t>(m_entries.size());
+    CHECK_EXCEPTION(m_entries.size() == header.entry_count, u8"Image has too many chunks: " + m_image_name);
+
+    const auto manifest = open_image_file(m_store->manifest_path(m_image_name).c_str(), CREATE_ALWAYS);
+    manifest->write(0, reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+    manifest->write(sizeof(header), reinterpret_cast<const uint8_t*>(m_entries.data()), m_entries.size() * sizeof(Manifest_entry));
+    flush_file_buffers(*manifest);
+}
+
+uint64_t Image_store_writer::image_size() const noexcept
+{
+    return m_image_size;
+}
+
+uint64_t Image_store_writer::new_bytes() const noexcept
+{
+    return m_new_bytes;
+}
+
+bool is_image_manifest_path(_In_z_ const char* path) noexcept
+{
+    const size_t length = strlen(path);
+    const size_t extension_length = ARRAYSIZE(manifest_extension) - 1;
+
+    return (length > extension_length) && (_stricmp(path + length - extension_length, manifest_extension) == 0);
+}
+
+// The store root is two levels above the manifest: <root>\images\name.manifest.
+static std::string store_root_from_manifest_path(const std::string& manifest_path)
+{
+    const auto file_separator = manifest_path.find_last_of("\\/");
+    CHECK_EXCEPTION((file_separator != std::string::npos) && (file_separator > 0), u8"Manifest is not in an image store: " + manifest_path);
+
+    const auto directory_separator = manifest_path.find_last_of("\\/", file_separator - 1);
+    CHECK_EXCEPTION(directory_separator != std::string::npos, u8"Manifest is not in an image store: " + manifest_path);
+
+    return manifest_path.substr(0, directory_separator);
+}
+
+// An image read back through its manifest.  Reads of consecutive chunks that are
+// also consecutive in the pack are coalesced into a single read.
+class Manifest_device : public Block_device
+{
+    std::unique_ptr<Block_device> m_pack;
+    std::vector<Manifest_entry> m_entries;
+    std::vector<uint64_t> m_entry_offsets;  // Image offset of each entry, followed by the image size.
+    uint64_t m_size;
+    unsigned int m_sector_size;
+
+public:
+    explicit Manifest_device(const std::string& manifest_path);
+
+    uint64_t size() const noexcept override;
+    unsigned int sector_size() const noexcept override;
+    void read(uint64_t offset, _Out_writes_bytes_(size) uint8_t* buffer, size_t size) override;
+};
+
+Manifest_device::Manifest_device(const std::string& manifest_path) :
+    m_size(0),
+    m_sector_size(0)
+{
+    const auto manifest = open_block_device(manifest_path.c_str());
+
+    Manifest_header header;
+    CHECK_EXCEPTION(manifest->size() >= sizeof(header), u8"Manifest is truncated: " + manifest_path);
+    manifest->read(0, reinterpret_cast<uint8_t*>(&header), sizeof(header));
+    CHECK_EXCEPTION(std::equal(std::cbegin(manifest_signature), std::cend(manifest_signature), header.signature),
+                    u8"Not an image manifest: " + manifest_path);
+    CHECK_EXCEPTION(manifest->size() == sizeof(header) + static_cast<uint64_t>(header.entry_count) * sizeof(Manifest_entry),
+                    u8"Manifest is truncated: " + manifest_path);
+
+    m_entries.resize(header.entry_count);
+    manifest->read(sizeof(header), reinterpret_cast<uint8_t*>(m_entries.data()), m_entries.size() * sizeof(Manifest_entry));
+
+    m_entry_offsets.reserve(m_entries.size() + 1);
+    uint64_t image_offset = 0;
+    for(const auto& entry : m_entries)
+    {
+        m_entry_offsets.push_back(image_offset);
+        image_offset += entry.size;
+    }
+    m_entry_offsets.push_back(image_offset);
+    CHECK_EXCEPTION(image_offset == header.image_size, u8"Manifest is corrupt: " + manifest_path);
+
+    m_size = header.image_size;
+    m_sector_size = header.sector_size;
+
+    const std::string root_path = store_root_from_manifest_path(manifest_path);
+    m_pack = open_block_device((root_path + "\\" + pack_file_name).c_str());
+}
+
+uint64_t Manifest_device::size() const noexcept
+{
+    return m_size;
+}
+
+unsigned int Manifest_device::sector_size() const noexcept
+{
+    return m_sector_size;
+}
+
+void Manifest_device::read(uint64_t offset, _Out_writes_bytes_(size) uint8_t* buffer, size_t size)
+{
+    CHECK_EXCEPTION((offset <= m_size) && (size <= m_size - offset), u8"Read past the end of the image.");
+
+    // Find the entry that contains offset.
+    size_t index = std::upper_bound(std::cbegin(m_entry_offsets), std::cend(m_entry_offsets), offset) - std::cbegin(m_entry_offsets) - 1;
+
+    while(size > 0)
+    {
+        const uint64_t pack_offset = m_entries[index].pack_offset + (offset - m_entry_offsets[index]);
+        size_t amount = static_cast<size_t>(std::min<uint64_t>(size, m_entry_offsets[index + 1] - offset));
+
+        // Extend the read over chunks that follow on in the pack.
+        while((amount < size) &&
+              (index + 1 < m_entries.size()) &&
+              (m_entries[index + 1].pack_offset == m_entries[index].pack_offset + m_entries[index].size))
+        {
+            ++index;
+            amount += static_cast<size_t>(std::min<uint64_t>(size - amount, m_entries[index].size));
+        }
+
+        m_pack->read(pack_offset, buffer, amount);
+
+        buffer += amount;
+        offset += amount;
+        size   -= amount;
+        ++index;
+    }
+}
+
+std::unique_ptr<Block_device> open_image_manifest(_In_z_ const char* manifest_path)
+{
+    return std::make_unique<Manifest_device>(manifest_path);
+}
+
+}
+
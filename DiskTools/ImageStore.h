@@ -0,0 +1,132 @@
+#pragma once
+
+#include "BlockDevice.h"
+
+namespace DiskTools
+{
+
+// Content key of a chunk.  Two differently seeded 64-bit hashes make accidental
+// collisions negligible even across billions of chunks.
+struct Chunk_hash
+{
+    uint64_t low;
+    uint64_t high;
+};
+
+inline bool operator==(const Chunk_hash& left, const Chunk_hash& right) noexcept
+{
+    return (left.low == right.low) && (left.high == right.high);
+}
+
+struct Chunk_hash_hasher
+{
+    size_t operator()(const Chunk_hash& hash) const noexcept
+    {
+        // The hash is already well distributed.
+        return static_cast<size_t>(hash.low);
+    }
+};
+
+Chunk_hash hash_chunk(_In_reads_bytes_(size) const uint8_t* data, size_t size) noexcept;
+
+enum class Chunking_method
+{
+    fixed,
+    content_defined,
+};
+
+// Fixed chunking is the fastest, but an insertion shifts every later chunk.
+// Content defined chunking (FastCDC) picks boundaries from the data itself,
+// so images that differ by inserted or removed files still share most chunks.
+struct Chunking_parameters
+{
+    Chunking_method method;
+    uint32_t minimum_size;  // Ignored for fixed chunking.
+    uint32_t average_size;  // The chunk size for fixed chunking.  Must be a power of two.
+    uint32_t maximum_size;  // Ignored for fixed chunking.
+};
+
+Chunking_parameters fixed_chunking(uint32_t chunk_size) noexcept;
+Chunking_parameters content_defined_chunking(uint32_t average_size) noexcept;
+
+struct Chunk_location
+{
+    uint64_t offset;        // Byte offset in the chunk pack.
+    uint32_t size;
+};
+
+// Fields are naturally aligned, so no packing is needed.
+struct Manifest_entry
+{
+    Chunk_hash hash;
+    uint64_t pack_offset;
+    uint32_t size;
+    uint32_t reserved;
+};
+static_assert(sizeof(Manifest_entry) == 32, "Manifest_entry is an on-disk structure.");
+
+// A directory of deduplicated images.  Each unique chunk is stored once:
+//   chunks.pack        Unique chunk data, appended in arrival order.
+//   chunks.index       A (hash, location) record for every chunk in chunks.pack.
+//   images\*.manifest  One per image, listing the chunks that make up the image.
+// An Image_store may have one writer at a time.  Manifests may be read concurrently.
+class Image_store
+{
+    std::string m_root_path;
+    std::unique_ptr<Block_device> m_pack;
+    std::unique_ptr<Block_device> m_index_file;
+    std::unordered_map<Chunk_hash, Chunk_location, Chunk_hash_hasher> m_index;
+    std::vector<uint8_t> m_pending_index_records;
+
+    void load_index();
+
+public:
+    // Creates the store if it does not already exist.
+    explicit Image_store(const std::string& root_path);
+
+    std::string manifest_path(const std::string& image_name) const;
+    bool contains_image(const std::string& image_name) const;
+    std::unique_ptr<Block_device> open_image(const std::string& image_name) const;
+
+    // Returns the location of the chunk, appending it to the pack only if it is new.
+    Chunk_location store_chunk(const Chunk_hash& hash, _In_reads_bytes_(size) const uint8_t* data, uint32_t size, _Out_ bool* is_new_chunk);
+
+    // Makes chunks stored since the last flush visible to later sessions.
+    void flush_index();
+
+    uint64_t stored_bytes() const noexcept;
+};
+
+// Splits a stream of image data into chunks and adds it to an Image_store.
+// Chunk boundaries do not depend on how the caller sizes its writes.
+class Image_store_writer
+{
+    Image_store* m_store;
+    std::string m_image_name;
+    Chunking_parameters m_parameters;
+    unsigned int m_sector_size;
+    std::vector<uint8_t> m_pending;
+    std::vector<Manifest_entry> m_entries;
+    uint64_t m_image_size;
+    uint64_t m_new_bytes;
+
+    size_t store_chunks(_In_reads_bytes_(size) const uint8_t* data, size_t size, bool end_of_image);
+
+public:
+    Image_store_writer(_In_ Image_store* store, const std::string& image_name, const Chunking_parameters& parameters, unsigned int sector_size);
+
+    void write(_In_reads_bytes_(size) const uint8_t* data, size_t size);
+
+    // Stores the final chunk and writes the manifest.  Until commit is called,
+    // the image is not visible in the store.
+    void commit();
+
+    uint64_t image_size() const noexcept;
+    uint64_t new_bytes() const noexcept;    // Bytes that were not already in the store.
+};
+
+bool is_image_manifest_path(_In_z_ const char* path) noexcept;
+std::unique_ptr<Block_device> open_image_manifest(_In_z_ const char* manifest_path);
+
+}
+
@@ -0,0 +1,321 @@
+#include "PreCompile.h"
+#include "IoStatistics.h"   // Pick up forward declarations to ensure correctness.
+#include "ReportUtils.h"
+#include <PortableRuntime/CheckException.h>
+
+namespace DiskTools
+{
+
+constexpr size_t io_operation_count = 2;
+
+// Latencies are kept in performance counter ticks, in buckets that split each
+// power of two into four, so each bucket is within 25% of its neighbors.
+// Values below four get a bucket each.
+constexpr unsigned int sub_bucket_bits = 2;
+constexpr unsigned int sub_bucket_count = 1 << sub_bucket_bits;
+constexpr size_t histogram_bucket_count = (64 - sub_bucket_bits + 1) * sub_bucket_count;
+
+struct Operation_counters
+{
+    std::atomic<uint64_t> operations;
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> errors;
+    std::atomic<uint64_t> retries;
+    std::array<std::atomic<uint64_t>, histogram_bucket_count> latency_histogram;
+};
+
+// Written only by the owning thread.  Read by any thread that asks for a report.
+struct Thread_io_statistics
+{
+    DWORD thread_id;
+    std::array<Operation_counters, io_operation_count> counters;
+};
+
+static std::atomic<bool> statistics_enabled(false);
+
+// Blocks are never freed, so that the counts of threads that have exited are still reported.
+static std::mutex& registry_mutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+static std::vector<std::unique_ptr<Thread_io_statistics>>& registry()
+{
+    static std::vector<std::unique_ptr<Thread_io_statistics>> thread_statistics;
+    return thread_statistics;
+}
+
+static thread_local Thread_io_statistics* current_thread_statistics = nullptr;
+
+static Operation_counters* get_counters(Io_operation operation) noexcept
+{
+    if(nullptr == current_thread_statistics)
+    {
+        try
+        {
+            // Value initialization zeroes the counters.
+            auto statistics = std::make_unique<Thread_io_statistics>();
+            statistics->thread_id = GetCurrentThreadId();
+
+            std::lock_guard<std::mutex> lock(registry_mutex());
+            registry().push_back(std::move(statistics));
+            current_thread_statistics = registry().back().get();
+        }
+        catch(const std::exception&)
+        {
+            // Out of memory.  Drop the sample rather than fail the I/O.
+            return nullptr;
+        }
+    }
+
+    return &current_thread_statistics->counters[static_cast<size_t>(operation)];
+}
+
+// Only the owning thread writes, so a plain load and store is enough, and
+// avoids the cost of an interlocked add.
+static void add_relaxed(std::atomic<uint64_t>* counter, uint64_t value) noexcept
+{
+    counter->store(counter->load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+static unsigned int most_significant_bit(uint64_t value) noexcept
+{
+    assert(value != 0);
+
+    unsigned long index;
+#if defined(_M_X64) || defined(_M_ARM64)
+    _BitScanReverse64(&index, value);
+#else
+    const uint32_t high_dword = static_cast<uint32_t>(value >> 32);
+    if(high_dword != 0)
+    {
+        _BitScanReverse(&index, high_dword);
+        index += 32;
+    }
+    else
+    {
+        _BitScanReverse(&index, static_cast<uint32_t>(value));
+    }
+#endif
+
+    return index;
+}
+
+static size_t bucket_from_ticks(uint64_t ticks) noexcept
+{
+    if(ticks < sub_bucket_count)
+    {
+        return static_cast<size_t>(ticks);
+    }
+
+    const unsigned int msb = most_significant_bit(ticks);
+    const unsigned int sub_bucket = static_cast<unsigned int>(ticks >> (msb - sub_bucket_bits)) & (sub_bucket_count - 1);
+    return (msb - sub_bucket_bits + 1) * sub_bucket_count + sub_bucket;
+}
+
+// The smallest tick count that falls into the bucket.
+static uint64_t ticks_from_bucket(size_t bucket) noexcept
+{
+    if(bucket < sub_bucket_count)
+    {
+        return bucket;
+    }
+
+    const unsigned int shift = static_cast<unsigned int>(bucket / sub_bucket_count) - 1;
+    return static_cast<uint64_t>(sub_bucket_count + (bucket % sub_bucket_count)) << shift;
+}
+
+void enable_io_statistics(bool enable) noexcept
+{
+    statistics_enabled.store(enable, std::memory_order_relaxed);
+}
+
+bool are_io_statistics_enabled() noexcept
+{
+    return statistics_enabled.load(std::memory_order_relaxed);
+}
+
+void record_io_retry(Io_operation operation) noexcept
+{
+    if(are_io_statistics_enabled())
+    {
+        const auto counters = get_counters(operation);
+        if(counters != nullptr)
+        {
+            add_relaxed(&counters->retries, 1);
+        }
+    }
+}
+
+Io_timer::Io_timer(Io_operation operation) noexcept :
+    m_start(0),
+    m_bytes(0),
+    m_operation(operation),
+    m_is_enabled(are_io_statistics_enabled()),
+    m_is_complete(false)
+{
+    if(m_is_enabled)
+    {
+        m_start = get_ticks();
+    }
+}
+
+Io_timer::~Io_timer() noexcept
+{
+    if(m_is_enabled)
+    {
+        const uint64_t elapsed = get_ticks() - m_start;
+        const auto counters = get_counters(m_operation);
+        if(counters != nullptr)
+        {
+            if(m_is_complete)
+            {
+                add_relaxed(&counters->operations, 1);
+                add_relaxed(&counters->bytes, m_bytes);
+                add_relaxed(&counters->latency_histogram[bucket_from_ticks(elapsed)], 1);
+            }
+            else
+            {
+                add_relaxed(&counters->errors, 1);
+            }
+        }
+    }
+}
+
+void Io_timer::complete(uint64_t bytes) noexcept
+{
+    m_bytes = bytes;
+    m_is_complete = true;
+}
+
+// Plain copy of Operation_counters, for summing and formatting.
+struct Operation_totals
+{
+    uint64_t operations;
+    uint64_t bytes;
+    uint64_t errors;
+    uint64_t retries;
+    std::array<uint64_t, histogram_bucket_count> latency_histogram;
+};
+
+static void add_counters(_Inout_ Operation_totals* totals, const Operation_counters& counters) noexcept
+{
+    totals->operations += counters.operations.load(std::memory_order_relaxed);
+    totals->bytes      += counters.bytes.load(std::memory_order_relaxed);
+    totals->errors     += counters.errors.load(std::memory_order_relaxed);
+    totals->retries    += counters.retries.load(std::memory_order_relaxed);
+    for(size_t bucket = 0; bucket < histogram_bucket_count; ++bucket)
+    {
+        totals->latency_histogram[bucket] += counters.latency_histogram[bucket].load(std::memory_order_relaxed);
+    }
+}
+
+static std::string json_from_totals(const Operation_totals& totals, uint64_t tick_frequency)
+{
+    std::string json = u8"{ \"operations\": " + std::to_string(totals.operations) +
+                       u8", \"bytes\": " + std::to_string(totals.bytes) +
+                       u8", \"errors\": " + std::to_string(totals.errors) +
+                       u8", \"retries\": " + std::to_string(totals.retries) +
+                       u8", \"latency_us\": [";
+
+    // Only buckets that hold samples are listed.  Each covers [low, high).
+    bool is_first = true;
+    for(size_t bucket = 0; bucket < histogram_bucket_count; ++bucket)
+    {
+        if(totals.latency_histogram[bucket] != 0)
+        {
+            const uint64_t high = (bucket + 1 < histogram_bucket_count) ? ticks_from_bucket(bucket + 1) : UINT64_MAX;
+            json += is_first ? u8" " : u8", ";
+            json += u8"{ \"low\": " + format_microseconds(ticks_from_bucket(bucket), tick_frequency) +
+                    u8", \"high\": " + format_microseconds(high, tick_frequency) +
+                    u8", \"count\": " + std::to_string(totals.latency_histogram[bucket]) + u8" }";
+            is_first = false;
+        }
+    }
+    json += is_first ? u8"] }" : u8" ] }";
+
+    return json;
+}
+
+static std::string json_from_operations(const std::array<Operation_totals, io_operation_count>& totals, uint64_t tick_frequency)
+{
+    return u8"\"read\": " + json_from_totals(totals[static_cast<size_t>(Io_operation::read)], tick_frequency) +
+           u8", \"write\": " + json_from_totals(totals[static_cast<size_t>(Io_operation::write)], tick_frequency);
+}
+
+std::string io_statistics_json()
+{
+    const uint64_t tick_frequency = get_tick_frequency();
+
+    // Value initialization zeroes the totals.
+    std::array<Operation_totals, io_operation_count> totals{};
+    std::string threads_json;
+
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        for(const auto& statistics : registry())
+        {
+            std::array<Operation_totals, io_operation_count> thread_totals{};
+            for(size_t operation = 0; operation < io_operation_count; ++operation)
+            {
+                add_counters(&thread_totals[operation], statistics->counters[operation]);
+                add_counters(&totals[operation], statistics->counters[operation]);
+            }
+
+            threads_json += threads_json.empty() ? u8"\n    " : u8",\n    ";
+            threads_json += u8"{ \"thread_id\": " + std::to_string(statistics->thread_id) + u8", " + json_from_operations(thread_totals, tick_frequency) + u8" }";
+        }
+    }
+
+    return u8"{\n  \"enabled\": " + std::string(are_io_statistics_enabled() ? u8"true" : u8"false") +
+           u8",\n  \"total\": { " + json_from_operations(totals, tick_frequency) + u8" }" +
+           u8",\n  \"threads\": [" + threads_json + u8"\n  ]\n}\n";
+}
+
+void write_io_statistics_json(_In_z_ const wchar_t* file_name)
+{
+    const std::string json = io_statistics_json();
+
+    std::ofstream output_file(file_name, std::ios::binary | std::ios::trunc);
+    CHECK_EXCEPTION(output_file.good(), u8"Error opening I/O statistics file.");
+
+    output_file.write(json.data(), json.size());
+    CHECK_EXCEPTION(!output_file.fail(), u8"Error writing I/O statistics file.");
+}
+
+Io_statistics_report::Io_statistics_report() noexcept
+{
+    wchar_t file_name[MAX_PATH];
+    const DWORD length = GetEnvironmentVariableW(L"DISKTOOLS_IO_STATISTICS", file_name, ARRAYSIZE(file_name));
+    if((length > 0) && (length < ARRAYSIZE(file_name)))
+    {
+        try
+        {
+            m_file_name = file_name;
+            enable_io_statistics(true);
+        }
+        catch(const std::exception&)
+        {
+            // Out of memory.  Run without statistics.
+        }
+    }
+}
+
+Io_statistics_report::~Io_statistics_report() noexcept
+{
+    if(!m_file_name.empty())
+    {
+        try
+        {
+            write_io_statistics_json(m_file_name.c_str());
+        }
+        catch(const std::exception&)
+        {
+            // The report is diagnostic only, so it must not change the exit status.
+        }
+    }
+}
+
+}
+
@@ -0,0 +1,69 @@
+#pragma once
+
+namespace DiskTools
+{
+
+enum class Io_operation
+{
+    read,
+    write,
+};
+
+// Statistics are collected for every read and write that DiskTools issues.
+// They are off by default.  While off, each I/O call pays for one relaxed
+// atomic load.  While on, each thread updates only its own counters, so
+// recording takes no locks and no interlocked instructions.
+void enable_io_statistics(bool enable) noexcept;
+bool are_io_statistics_enabled() noexcept;
+
+// Counts a request that had to be reissued, such as the remainder of a short read.
+void record_io_retry(Io_operation operation) noexcept;
+
+// Times one I/O call on the stack.  A timer that is destroyed without a call
+// to complete, such as when the I/O call fails or throws, counts as an error.
+class Io_timer
+{
+    uint64_t m_start;
+    uint64_t m_bytes;
+    Io_operation m_operation;
+    bool m_is_enabled;
+    bool m_is_complete;
+
+    // Not implemented to prevent accidental copying/moving.
+    Io_timer(const Io_timer&) = delete;
+    Io_timer(Io_timer&&) noexcept = delete;
+    Io_timer& operator=(const Io_timer&) = delete;
+    Io_timer& operator=(Io_timer&&) noexcept = delete;
+
+public:
+    explicit Io_timer(Io_operation operation) noexcept;
+    ~Io_timer() noexcept;
+
+    void complete(uint64_t bytes) noexcept;
+};
+
+// Returns counters and latency histograms per thread and in total, as JSON.
+// May be called at any time, from any thread.
+std::string io_statistics_json();
+void write_io_statistics_json(_In_z_ const wchar_t* file_name);
+
+// Declare one in main, outside of the exception handler.  If the environment
+// variable DISKTOOLS_IO_STATISTICS names a file, statistics are enabled, and
+// are written to that file when the program exits.
+class Io_statistics_report
+{
+    std::wstring m_file_name;
+
+    // Not implemented to prevent accidental copying/moving.
+    Io_statistics_report(const Io_statistics_report&) = delete;
+    Io_statistics_report(Io_statistics_report&&) noexcept = delete;
+    Io_statistics_report& operator=(const Io_statistics_report&) = delete;
+    Io_statistics_report& operator=(Io_statistics_report&&) noexcept = delete;
+
+public:
+    Io_statistics_report() noexcept;
+    ~Io_statistics_report() noexcept;
+};
+
+}
+
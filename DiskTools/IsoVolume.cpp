@@ -0,0 +1,442 @@
+#include "PreCompile.h"
+#include "IsoVolume.h"      // Pick up forward declarations to ensure correctness.
+#include "BlockDevice.h"
+#include "Copy.h"
+#include "FieldView.h"
+#include <PortableRuntime/CheckException.h>
+#include <PortableRuntime/Unicode.h>
+
+namespace DiskTools
+{
+
+constexpr uint8_t volume_descriptor_primary = 1;
+constexpr uint8_t volume_descriptor_supplementary = 2;
+constexpr uint8_t volume_descriptor_terminator = 255;
+
+// Discs have a handful of descriptors.  This bounds the search on a damaged one.
+constexpr unsigned int maximum_volume_descriptors = 32;
+
+// Limits that no real disc reaches, to bound memory on a damaged one.
+constexpr uint32_t maximum_path_table_size = 16 * 1024 * 1024;
+constexpr uint32_t maximum_directory_size = 16 * 1024 * 1024;
+
+constexpr uint8_t standard_identifier[5] = { 'C', 'D', '0', '0', '1' };
+
+// Both-endian fields are stored little-endian and then big-endian.  Only the
+// little-endian half is read.
+struct Iso_volume_descriptor_layout
+{
+    static constexpr size_t size = 190;
+    typedef Little_endian_field<uint8_t, 0> type;
+    typedef Byte_array_field<1, 5> identifier;
+    typedef Little_endian_field<uint8_t, 6> version;
+    typedef Little_endian_field<uint8_t, 7> flags;
+    typedef Byte_array_field<8, 32> system_identifier;
+    typedef Byte_array_field<40, 32> volume_identifier;
+    typedef Little_endian_field<uint32_t, 80> volume_space_size;
+    typedef Byte_array_field<88, 32> escape_sequences;
+    typedef Little_endian_field<uint16_t, 120> volume_set_size;
+    typedef Little_endian_field<uint16_t, 124> volume_sequence_number;
+    typedef Little_endian_field<uint16_t, 128> logical_block_size;
+    typedef Little_endian_field<uint32_t, 132> path_table_size;
+    typedef Little_endian_field<uint32_t, 140> type_l_path_table;
+    typedef Little_endian_field<uint32_t, 144> optional_type_l_path_table;
+    typedef Byte_array_field<156, 34> root_directory_record;
+};
+
+// The name follows the fixed part.
+struct Iso_directory_record_layout
+{
+    static constexpr size_t size = 33;
+    typedef Little_endian_field<uint8_t, 0> length;
+    typedef Little_endian_field<uint8_t, 1> extended_attribute_length;
+    typedef Little_endian_field<uint32_t, 2> extent_sector;
+    typedef Little_endian_field<uint32_t, 10> data_length;
+    typedef Byte_array_field<18, 7> recording_time;
+    typedef Little_endian_field<uint8_t, 25> flags;
+    typedef Little_endian_field<uint8_t, 26> file_unit_size;
+    typedef Little_endian_field<uint8_t, 27> interleave_gap_size;
+    typedef Little_endian_field<uint16_t, 28> volume_sequence_number;
+    typedef Little_endian_field<uint8_t, 32> name_length;
+};
+
+// A little-endian path table record.  The name follows, padded to an even length.
+struct Iso_path_table_record_layout
+{
+    static constexpr size_t size = 8;
+    typedef Little_endian_field<uint8_t, 0> name_length;
+    typedef Little_endian_field<uint8_t, 1> extended_attribute_length;
+    typedef Little_endian_field<uint32_t, 2> extent_sector;
+    typedef Little_endian_field<uint16_t, 6> parent_directory_number;
+};
+
+// The fields of a volume descriptor that locate the volume and its path table.
+struct Iso_volume_descriptor
+{
+    uint32_t volume_space_size;
+    unsigned int logical_block_size;
+    uint32_t path_table_size;
+    uint32_t type_l_path_table;
+};
+
+static Iso_volume_descriptor load_volume_descriptor(Structure_view<Iso_volume_descriptor_layout> descriptor) noexcept
+{
+    typedef Iso_volume_descriptor_layout Layout;
+
+    Iso_volume_descriptor fields;
+    fields.volume_space_size  = descriptor.get<Layout::volume_space_size>();
+    fields.logical_block_size = descriptor.get<Layout::logical_block_size>();
+    fields.path_table_size    = descriptor.get<Layout::path_table_size>();
+    fields.type_l_path_table  = descriptor.get<Layout::type_l_path_table>();
+    return fields;
+}
+
+// Logical blocks are a power of two of at least 512 bytes, and no larger than a sector.
+static bool is_valid_logical_block_size(unsigned int size) noexcept
+{
+    return (size >= 512) && (size <= iso_sector_size) && ((size & (size - 1)) == 0);
+}
+
+// Joliet descriptors are supplementary descriptors that name UCS-2 level 1, 2, or 3.
+static bool is_joliet_descriptor(Structure_view<Iso_volume_descriptor_layout> descriptor) noexcept
+{
+    typedef Iso_volume_descriptor_layout Layout;
+
+    const uint8_t* escape_sequences = descriptor.get<Layout::escape_sequences>();
+    return (descriptor.get<Layout::type>() == volume_descriptor_supplementary) &&
+           (escape_sequences[0] == '%') && (escape_sequences[1] == '/') &&
+           ((escape_sequences[2] == '@') || (escape_sequences[2] == 'C') || (escape_sequences[2] == 'E'));
+}
+
+// Reads the volume descriptor set.  Returns false if there is no primary volume descriptor.
+static bool read_volume_descriptors(
+    _In_ Block_device* device,
+    _Out_ Iso_volume_descriptor* primary,
+    _Out_ Iso_volume_descriptor* joliet,
+    _Out_ bool* has_joliet)
+{
+    bool has_primary = false;
+    *has_joliet = false;
+
+    std::vector<uint8_t> sector(iso_sector_size);
+    for(unsigned int index = 0; index < maximum_volume_descriptors; ++index)
+    {
+        const uint64_t offset = (iso_volume_descriptor_sector + index) * iso_sector_size;
+        if(offset + sector.size() > device->size())
+        {
+            break;
+        }
+        device->read(offset, sector.data(), sector.size());
+
+        typedef Iso_volume_descriptor_layout Layout;
+        const Structure_view<Layout> descriptor(sector.data(), sector.size());
+        if((memcmp(descriptor.get<Layout::identifier>(), standard_identifier, sizeof(standard_identifier)) != 0) ||
+           (descriptor.get<Layout::type>() == volume_descriptor_terminator))
+        {
+            break;
+        }
+
+        if((descriptor.get<Layout::type>() == volume_descriptor_primary) && !has_primary)
+        {
+            *primary = load_volume_descriptor(descriptor);
+            has_primary = true;
+        }
+        else if(is_joliet_descriptor(descriptor) && !*has_joliet)
+        {
+            *joliet = load_volume_descriptor(descriptor);
+            *has_joliet = true;
+        }
+    }
+
+    return has_primary;
+}
+
+uint64_t iso9660_volume_size(_In_ Block_device* device)
+{
+    Iso_volume_descriptor primary;
+    Iso_volume_descriptor joliet;
+    bool has_joliet;
+    if(!read_volume_descriptors(device, &primary, &joliet, &has_joliet) || !is_valid_logical_block_size(primary.logical_block_size))
+    {
+        return 0;
+    }
+
+    return static_cast<uint64_t>(primary.volume_space_size) * primary.logical_block_size;
+}
+
+// Joliet names are big-endian UCS-2.  ISO 9660 names are restricted to upper
+// case letters, digits, and underscore, so anything else is replaced.
+static std::string decode_name(_In_reads_bytes_(length) const uint8_t* name, size_t length, bool is_joliet)
+{
+    std::string decoded;
+    if(is_joliet)
+    {
+        std::wstring wide;
+        for(size_t index = 0; index + 1 < length; index += 2)
+        {
+            wide.push_back(static_cast<wchar_t>((name[index] << 8) | name[index + 1]));
+        }
+        decoded = PortableRuntime::utf8_from_utf16(wide);
+    }
+    else
+    {
+        std::transform(name, name + length, std::back_inserter(decoded), [](uint8_t character)
+        {
+            return (character < 0x80) ? static_cast<char>(character) : '_';
+        });
+    }
+
+    // File names end in a version number, such as ;1, and files without an extension keep the dot.
+    const auto version = decoded.find(';');
+    if(version != std::string::npos)
+    {
+        decoded.erase(version);
+        if(!decoded.empty() && (decoded.back() == '.'))
+        {
+            decoded.pop_back();
+        }
+    }
+
+    return decoded;
+}
+
+// Index keys are lower case, with backslashes and no leading or trailing separator.
+static std::string index_key(const std::string& path)
+{
+    std::string key;
+    for(const char character : path)
+    {
+        if((character == '\\') || (character == '/'))
+        {
+            if(!key.empty() && (key.back() != '\\'))
+            {
+                key.push_back('\\');
+            }
+        }
+        else
+        {
+            key.push_back(((character >= 'A') && (character <= 'Z')) ? static_cast<char>(character - 'A' + 'a') : character);
+        }
+    }
+
+    if(!key.empty() && (key.back() == '\\'))
+    {
+        key.pop_back();
+    }
+
+    return key;
+}
+
+Iso_volume::Iso_volume(_In_ Block_device* device) :
+    m_device(device),
+    m_logical_block_size(iso_sector_size),
+    m_volume_sector_count(0),
+    m_is_joliet(false)
+{
+    Iso_volume_descriptor primary;
+    Iso_volume_descriptor joliet;
+    CHECK_EXCEPTION(read_volume_descriptors(device, &primary, &joliet, &m_is_joliet), u8"There is no ISO 9660 volume.");
+
+    // Both descriptors describe the same extents, so sizes come from the primary.
+    const auto& descriptor = m_is_joliet ? joliet : primary;
+    m_volume_sector_count = primary.volume_space_size;
+    m_logical_block_size = descriptor.logical_block_size;
+    CHECK_EXCEPTION(is_valid_logical_block_size(m_logical_block_size),
+                    u8"Invalid ISO 9660 logical block size: " + std::to_string(m_logical_block_size));
+    CHECK_EXCEPTION((descriptor.path_table_size > 0) && (descriptor.path_table_size <= maximum_path_table_size), u8"Invalid ISO 9660 path table size.");
+
+    // The path table lists every directory, parents first, so each path can be
+    // built from its parent's.  Directory numbers start at one, with the root.
+    typedef Iso_path_table_record_layout Layout;
+    const auto path_table = read_extent(descriptor.type_l_path_table, descriptor.path_table_size);
+    std::vector<std::string> paths;
+    for(size_t offset = 0; offset + Layout::size <= path_table.size(); )
+    {
+        const Structure_view<Layout> record(path_table.data(), path_table.size(), offset);
+        const uint8_t name_length = record.get<Layout::name_length>();
+        if(0 == name_length)
+        {
+            break;
+        }
+        CHECK_EXCEPTION(offset + Layout::size + name_length <= path_table.size(), u8"The ISO 9660 path table is damaged.");
+
+        std::string path;
+        if(!paths.empty())
+        {
+            const uint16_t parent_directory_number = record.get<Layout::parent_directory_number>();
+            CHECK_EXCEPTION((parent_directory_number >= 1) && (parent_directory_number <= paths.size()),
+                            u8"The ISO 9660 path table is damaged.");
+            const auto& parent_path = paths[parent_directory_number - 1];
+            const auto name = decode_name(path_table.data() + offset + Layout::size, name_length, m_is_joliet);
+            path = parent_path.empty() ? name : parent_path + u8"\\" + name;
+        }
+
+        const uint32_t first_sector = record.get<Layout::extent_sector>() + record.get<Layout::extended_attribute_length>();
+        m_directory_index.emplace(index_key(path), Iso_path_table_entry { path, first_sector });
+        paths.push_back(std::move(path));
+
+        offset += Layout::size + name_length + (name_length & 1);
+    }
+    CHECK_EXCEPTION(!paths.empty(), u8"The ISO 9660 path table is empty.");
+}
+
+bool Iso_volume::is_joliet() const noexcept
+{
+    return m_is_joliet;
+}
+
+unsigned int Iso_volume::logical_block_size() const noexcept
+{
+    return m_logical_block_size;
+}
+
+uint64_t Iso_volume::volume_sector_count() const noexcept
+{
+    return m_volume_sector_count;
+}
+
+std::vector<uint8_t> Iso_volume::read_extent(uint32_t first_sector, uint32_t length)
+{
+    CHECK_EXCEPTION(first_sector + (static_cast<uint64_t>(length) + m_logical_block_size - 1) / m_logical_block_size <= m_volume_sector_count,
+                    u8"Extent at sector " + std::to_string(first_sector) + u8" is past the end of the volume.");
+
+    std::vector<uint8_t> data(length);
+    m_device->read(static_cast<uint64_t>(first_sector) * m_logical_block_size, data.data(), data.size());
+    return data;
+}
+
+// Parses directory records.  Records never cross a sector boundary, and a zero
+// length byte pads out the rest of a sector.
+static std::vector<Iso_directory_entry> parse_directory(const std::vector<uint8_t>& data, bool is_joliet, bool include_self)
+{
+    std::vector<Iso_directory_entry> entries;
+    bool is_continued = false;
+
+    for(size_t offset = 0; offset < data.size(); )
+    {
+        const uint8_t length = data[offset];
+        if(0 == length)
+        {
+            offset = (offset / iso_sector_size + 1) * iso_sector_size;
+            continue;
+        }
+
+        typedef Iso_directory_record_layout Layout;
+        CHECK_EXCEPTION((length >= Layout::size) && (offset + length <= data.size()), u8"An ISO 9660 directory is damaged.");
+        const Structure_view<Layout> record(data.data(), data.size(), offset);
+        const uint8_t name_length = record.get<Layout::name_length>();
+        CHECK_EXCEPTION(Layout::size + name_length <= length, u8"An ISO 9660 directory is damaged.");
+
+        const uint8_t* name = data.data() + offset + Layout::size;
+        offset += length;
+
+        const uint8_t flags = record.get<Layout::flags>();
+        const uint32_t data_length = record.get<Layout::data_length>();
+        const Iso_extent extent = { record.get<Layout::extent_sector>() + record.get<Layout::extended_attribute_length>(), data_length };
+
+        // Each extent of a multi-extent file but the last has the multi-extent flag.
+        if(is_continued)
+        {
+            entries.back().extents.push_back(extent);
+            entries.back().size += data_length;
+            is_continued = (flags & iso_flag_multi_extent) != 0;
+            continue;
+        }
+
+        // The . and .. entries have the names 0 and 1.
+        const bool is_self = (1 == name_length) && (0 == name[0]);
+        if(((1 == name_length) && (1 == name[0])) || (is_self && !include_self))
+        {
+            continue;
+        }
+
+        Iso_directory_entry entry;
+        entry.name = is_self ? std::string() : decode_name(name, name_length, is_joliet);
+        entry.flags = flags;
+        entry.size = data_length;
+        entry.extents.push_back(extent);
+        const uint8_t* recording_time = record.get<Layout::recording_time>();
+        std::copy(recording_time, recording_time + Layout::recording_time::size, entry.recording_time);
+        entries.push_back(std::move(entry));
+
+        is_continued = (flags & iso_flag_multi_extent) != 0;
+    }
+
+    return entries;
+}
+
+// The first record of a directory describes the directory itself, including its size.
+Iso_directory_entry Iso_volume::read_directory_record(uint32_t first_sector)
+{
+    const auto entries = parse_directory(read_extent(first_sector, iso_sector_size), m_is_joliet, true);
+    CHECK_EXCEPTION(!entries.empty() && entries.front().name.empty() && ((entries.front().flags & iso_flag_directory) != 0),
+                    u8"There is no ISO 9660 directory at sector " + std::to_string(first_sector) + u8".");
+
+    return entries.front();
+}
+
+std::vector<Iso_directory_entry> Iso_volume::read_directory_at(uint32_t first_sector)
+{
+    const auto directory = read_directory_record(first_sector);
+    CHECK_EXCEPTION(directory.size <= maximum_directory_size, u8"An ISO 9660 directory is too large.");
+
+    return parse_directory(read_extent(first_sector, static_cast<uint32_t>(directory.size)), m_is_joliet, false);
+}
+
+std::vector<Iso_directory_entry> Iso_volume::read_directory(const std::string& path)
+{
+    const auto directory = m_directory_index.find(index_key(path));
+    CHECK_EXCEPTION(directory != m_directory_index.end(), u8"Directory not found: " + path);
+
+    return read_directory_at(directory->second.first_sector);
+}
+
+bool Iso_volume::find_entry(const std::string& path, _Out_ Iso_directory_entry* entry)
+{
+    const auto key = index_key(path);
+
+    // Directories are found in the index without reading their parent.
+    const auto directory = m_directory_index.find(key);
+    if(directory != m_directory_index.end())
+    {
+        const auto& path_entry = directory->second;
+        *entry = read_directory_record(path_entry.first_sector);
+        entry->name = path_entry.path.substr(path_entry.path.find_last_of('\\') + 1);
+        return true;
+    }
+
+    const auto separator = key.find_last_of('\\');
+    const auto parent = m_directory_index.find((separator == std::string::npos) ? std::string() : key.substr(0, separator));
+    if(parent == m_directory_index.end())
+    {
+        return false;
+    }
+
+    const auto name = key.substr(separator + 1);
+    for(auto& candidate : read_directory_at(parent->second.first_sector))
+    {
+        if(index_key(candidate.name) == name)
+        {
+            *entry = std::move(candidate);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void Iso_volume::read_file(
+    const Iso_directory_entry& file,
+    size_t buffer_size,
+    const std::function<void (_In_reads_bytes_(size) const uint8_t* buffer, size_t size)>& write_output)
+{
+    for(const auto& extent : file.extents)
+    {
+        CHECK_EXCEPTION(extent.first_sector + (static_cast<uint64_t>(extent.length) + m_logical_block_size - 1) / m_logical_block_size <= m_volume_sector_count,
+                        file.name + u8" extends past the end of the volume.");
+        stream_device(m_device, static_cast<uint64_t>(extent.first_sector) * m_logical_block_size, extent.length, buffer_size, write_output);
+    }
+}
+
+}
+
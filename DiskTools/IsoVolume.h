@@ -0,0 +1,86 @@
+#pragma once
+
+namespace DiskTools
+{
+
+class Block_device;
+
+// Volume descriptors start at logical sector 16, after the system area.
+constexpr uint64_t iso_volume_descriptor_sector = 16;
+constexpr unsigned int iso_sector_size = 2048;
+
+constexpr uint8_t iso_flag_hidden = 0x01;
+constexpr uint8_t iso_flag_directory = 0x02;
+constexpr uint8_t iso_flag_multi_extent = 0x80;
+
+// A contiguous part of a file.  Files over 4GB are stored as several extents.
+struct Iso_extent
+{
+    uint32_t first_sector;
+    uint32_t length;
+};
+
+struct Iso_directory_entry
+{
+    std::string name;                   // Without the ;1 version suffix.
+    uint8_t flags;
+    uint64_t size;
+    std::vector<Iso_extent> extents;
+    uint8_t recording_time[7];          // Years since 1900, month, day, hour, minute, second, and 15 minute offset from GMT.
+};
+
+// A directory, as listed in the path table.
+struct Iso_path_table_entry
+{
+    std::string path;                   // Such as DOCS\ENGLISH.  Empty for the root directory.
+    uint32_t first_sector;
+};
+
+// Returns the number of bytes that the primary volume descriptor of an ISO 9660
+// volume claims, which counts logical blocks of the size that it names.  Returns
+// zero if there is no ISO 9660 volume, or if its logical block size is invalid.
+uint64_t iso9660_volume_size(_In_ Block_device* device);
+
+// A read-only view of an ISO 9660 volume, through its Joliet descriptor when
+// there is one, so that names are Unicode and not limited to 8.3.  The path
+// table is read once when the volume is opened, into a hash table from path to
+// directory extent, so finding a directory reads only that directory.  Files
+// are read as one read per extent.  Works on any Block_device, including image
+// store manifests.  Not thread safe.  device must outlive the Iso_volume.
+class Iso_volume
+{
+    Block_device* m_device;
+    unsigned int m_logical_block_size;
+    uint64_t m_volume_sector_count;
+    bool m_is_joliet;
+    std::unordered_map<std::string, Iso_path_table_entry> m_directory_index;
+
+    std::vector<uint8_t> read_extent(uint32_t first_sector, uint32_t length);
+    Iso_directory_entry read_directory_record(uint32_t first_sector);
+    std::vector<Iso_directory_entry> read_directory_at(uint32_t first_sector);
+
+public:
+    // Throws if there is no ISO 9660 volume.
+    explicit Iso_volume(_In_ Block_device* device);
+
+    bool is_joliet() const noexcept;
+    unsigned int logical_block_size() const noexcept;
+    uint64_t volume_sector_count() const noexcept;
+
+    // Lists a directory, such as DOCS\ENGLISH with either slash, ignoring case.
+    // An empty path is the root directory.  The . and .. entries are not listed.
+    // Throws if there is no such directory.
+    std::vector<Iso_directory_entry> read_directory(const std::string& path);
+
+    // Looks up a file or directory by path.  Returns false if there is no such entry.
+    bool find_entry(const std::string& path, _Out_ Iso_directory_entry* entry);
+
+    // Passes the contents of a file to write_output, in pieces of up to buffer_size bytes.
+    void read_file(
+        const Iso_directory_entry& file,
+        size_t buffer_size,
+        const std::function<void (_In_reads_bytes_(size) const uint8_t* buffer, size_t size)>& write_output);
+};
+
+}
+
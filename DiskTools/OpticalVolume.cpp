@@ -0,0 +1,179 @@
+#include "PreCompile.h"
+#include "OpticalVolume.h"  // Pick up forward declarations to ensure correctness.
+#include "BlockDevice.h"
+#include "FieldView.h"
+#include "IsoVolume.h"
+#include <PortableRuntime/CheckException.h>
+
+namespace DiskTools
+{
+
+constexpr unsigned int udf_sector_size = 2048;
+
+constexpr uint16_t udf_tag_anchor_volume_descriptor_pointer = 2;
+constexpr uint16_t udf_tag_partition_descriptor = 5;
+constexpr uint16_t udf_tag_terminating_descriptor = 8;
+
+// A volume descriptor sequence is at least 16 sectors, and rarely much more.
+constexpr uint32_t maximum_volume_descriptor_sequence_sectors = 64;
+
+// The closing anchor is at the last sector of the volume, or 256 sectors before it.
+constexpr uint32_t closing_anchor_search_sectors = 257;
+
+// Every UDF descriptor starts with a tag.
+struct Udf_descriptor_tag_layout
+{
+    static constexpr size_t size = 16;
+    typedef Little_endian_field<uint16_t, 0> identifier;
+    typedef Little_endian_field<uint16_t, 2> version;
+    typedef Little_endian_field<uint8_t, 4> checksum;
+    typedef Little_endian_field<uint16_t, 6> serial_number;
+    typedef Little_endian_field<uint16_t, 8> crc;
+    typedef Little_endian_field<uint16_t, 10> crc_length;
+    typedef Little_endian_field<uint32_t, 12> location;     // The sector that holds the descriptor, which guards against stale copies.
+};
+
+struct Udf_extent_layout
+{
+    static constexpr size_t size = 8;
+    typedef Little_endian_field<uint32_t, 0> length;        // In bytes.
+    typedef Little_endian_field<uint32_t, 4> location;      // In sectors.
+};
+
+struct Udf_anchor_volume_descriptor_pointer_layout
+{
+    static constexpr size_t size = 32;
+    static constexpr size_t main_volume_descriptor_sequence_offset = 16;
+    static constexpr size_t reserve_volume_descriptor_sequence_offset = 24;
+};
+
+struct Udf_partition_descriptor_layout
+{
+    static constexpr size_t size = 196;
+    typedef Little_endian_field<uint32_t, 16> volume_descriptor_sequence_number;
+    typedef Little_endian_field<uint16_t, 20> partition_flags;
+    typedef Little_endian_field<uint16_t, 22> partition_number;
+    typedef Little_endian_field<uint32_t, 184> access_type;
+    typedef Little_endian_field<uint32_t, 188> partition_starting_location;
+    typedef Little_endian_field<uint32_t, 192> partition_length;
+};
+
+struct Udf_extent
+{
+    uint32_t length;
+    uint32_t location;
+};
+
+static Udf_extent load_extent(Structure_view<Udf_extent_layout> extent) noexcept
+{
+    return Udf_extent { extent.get<Udf_extent_layout::length>(), extent.get<Udf_extent_layout::location>() };
+}
+
+// True if the tag has the identifier, records the sector it is in, and its checksum holds.
+static bool is_valid_tag(Structure_view<Udf_descriptor_tag_layout> tag, uint16_t identifier, uint64_t sector) noexcept
+{
+    typedef Udf_descriptor_tag_layout Layout;
+
+    // The checksum is the sum of the other 15 bytes of the tag.
+    uint8_t checksum = 0;
+    for(size_t index = 0; index < Layout::size; ++index)
+    {
+        if(index != Layout::checksum::offset)
+        {
+            checksum = static_cast<uint8_t>(checksum + tag.data()[index]);
+        }
+    }
+
+    return (tag.get<Layout::identifier>() == identifier) && (tag.get<Layout::location>() == sector) && (tag.get<Layout::checksum>() == checksum);
+}
+
+// Returns the sector past the end of a descriptor sequence extent.
+static uint64_t extent_end(const Udf_extent& extent) noexcept
+{
+    return extent.location + (static_cast<uint64_t>(extent.length) + udf_sector_size - 1) / udf_sector_size;
+}
+
+uint64_t udf_volume_sector_count(_In_ Block_device* device)
+{
+    const uint64_t device_sectors = device->size() / udf_sector_size;
+    if(device_sectors <= udf_anchor_sector)
+    {
+        return 0;
+    }
+
+    std::vector<uint8_t> sector(udf_sector_size);
+    device->read(udf_anchor_sector * udf_sector_size, sector.data(), sector.size());
+    if(!is_valid_tag(Structure_view<Udf_descriptor_tag_layout>(sector.data(), sector.size()), udf_tag_anchor_volume_descriptor_pointer, udf_anchor_sector))
+    {
+        return 0;
+    }
+
+    typedef Udf_anchor_volume_descriptor_pointer_layout Anchor_layout;
+    const Structure_view<Anchor_layout> anchor(sector.data(), sector.size());
+    const Udf_extent main_sequence = load_extent(anchor.nested<Udf_extent_layout>(Anchor_layout::main_volume_descriptor_sequence_offset));
+    const Udf_extent reserve_sequence = load_extent(anchor.nested<Udf_extent_layout>(Anchor_layout::reserve_volume_descriptor_sequence_offset));
+    uint64_t end = std::max(udf_anchor_sector + 1, std::max(extent_end(main_sequence), extent_end(reserve_sequence)));
+
+    // The partitions hold the file data, and are listed in the main sequence.
+    const uint32_t sequence_sectors = std::min(static_cast<uint32_t>(extent_end(main_sequence) - main_sequence.location),
+                                               maximum_volume_descriptor_sequence_sectors);
+    if(main_sequence.location + static_cast<uint64_t>(sequence_sectors) <= device_sectors)
+    {
+        std::vector<uint8_t> sequence(static_cast<size_t>(sequence_sectors) * udf_sector_size);
+        device->read(static_cast<uint64_t>(main_sequence.location) * udf_sector_size, sequence.data(), sequence.size());
+
+        for(uint32_t index = 0; index < sequence_sectors; ++index)
+        {
+            const size_t descriptor_offset = static_cast<size_t>(index) * udf_sector_size;
+            const Structure_view<Udf_descriptor_tag_layout> tag(sequence.data(), sequence.size(), descriptor_offset);
+            const uint64_t descriptor_sector = static_cast<uint64_t>(main_sequence.location) + index;
+            if(is_valid_tag(tag, udf_tag_terminating_descriptor, descriptor_sector))
+            {
+                break;
+            }
+            if(is_valid_tag(tag, udf_tag_partition_descriptor, descriptor_sector))
+            {
+                typedef Udf_partition_descriptor_layout Partition_layout;
+                const Structure_view<Partition_layout> partition(sequence.data(), sequence.size(), descriptor_offset);
+                end = std::max(end, static_cast<uint64_t>(partition.get<Partition_layout::partition_starting_location>()) +
+                                    partition.get<Partition_layout::partition_length>());
+            }
+        }
+    }
+
+    // A closing anchor at the last sector, or 256 sectors before it, marks the true end.
+    const uint32_t search_sectors = static_cast<uint32_t>(std::min<uint64_t>(closing_anchor_search_sectors, device_sectors - std::min(end, device_sectors)));
+    if(search_sectors > 0)
+    {
+        std::vector<uint8_t> tail(static_cast<size_t>(search_sectors) * udf_sector_size);
+        device->read(end * udf_sector_size, tail.data(), tail.size());
+        for(uint32_t index = search_sectors; index > 0; --index)
+        {
+            const Structure_view<Udf_descriptor_tag_layout> tag(tail.data(), tail.size(), static_cast<size_t>(index - 1) * udf_sector_size);
+            if(is_valid_tag(tag, udf_tag_anchor_volume_descriptor_pointer, end + index - 1))
+            {
+                end += index;
+                break;
+            }
+        }
+    }
+
+    return end;
+}
+
+uint64_t optical_volume_size(_In_ Block_device* device)
+{
+    // Volume descriptors start at sector 16, so anything smaller holds neither file system.
+    if(device->size() < (iso_volume_descriptor_sector + 1) * iso_sector_size)
+    {
+        return 0;
+    }
+
+    const uint64_t iso9660_size = iso9660_volume_size(device);
+    const uint64_t udf_size = udf_volume_sector_count(device) * udf_sector_size;
+
+    return std::max(iso9660_size, udf_size);
+}
+
+}
+
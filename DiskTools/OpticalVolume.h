@@ -0,0 +1,25 @@
+#pragma once
+
+namespace DiskTools
+{
+
+class Block_device;
+
+// UDF places its first anchor volume descriptor pointer at logical sector 256.
+constexpr uint64_t udf_anchor_sector = 256;
+
+// Returns the number of 2048 byte sectors that a UDF volume spans: through its
+// partitions and volume descriptor sequences, and the anchor that follows them
+// at the end of the volume when there is one.  Returns zero if there is no
+// valid anchor at sector 256.
+uint64_t udf_volume_sector_count(_In_ Block_device* device);
+
+// Returns the number of bytes of a CD, DVD, or image that its file systems use:
+// the larger of the ISO 9660 and UDF volume sizes, for bridge discs that have
+// both.  Recordable and padded media are often much larger than their volume.
+// Returns zero if neither file system is found, so the caller can fall back to
+// the device size.
+uint64_t optical_volume_size(_In_ Block_device* device);
+
+}
+
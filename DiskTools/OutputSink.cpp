@@ -0,0 +1,265 @@
+#include "PreCompile.h"
+#include "OutputSink.h"     // Pick up forward declarations to ensure correctness.
+#include <PortableRuntime/CheckException.h>
+#include <WindowsCommon/CheckHR.h>
+
+namespace DiskTools
+{
+
+// The digits of 00 to 99, so that each division produces two digits.
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// Enough for the 20 digits of UINT64_MAX.
+constexpr size_t maximum_decimal_digits = 20;
+
+// Writes the digits of value so that they end at end, and returns the first digit.
+static char* format_decimal(uint64_t value, _Out_writes_(maximum_decimal_digits) char* end) noexcept
+{
+    char* first = end;
+    while(value >= 100)
+    {
+        const unsigned int pair = static_cast<unsigned int>(value % 100) * 2;
+        value /= 100;
+        *--first = digit_pairs[pair + 1];
+        *--first = digit_pairs[pair];
+    }
+
+    if(value >= 10)
+    {
+        const unsigned int pair = static_cast<unsigned int>(value) * 2;
+        *--first = digit_pairs[pair + 1];
+        *--first = digit_pairs[pair];
+    }
+    else
+    {
+        *--first = static_cast<char>('0' + value);
+    }
+
+    return first;
+}
+
+void append_decimal(_Inout_ std::string* text, uint64_t value, unsigned int width, char fill)
+{
+    char digits[maximum_decimal_digits];
+    const char* first = format_decimal(value, std::end(digits));
+    const size_t digit_count = std::end(digits) - first;
+
+    if(width > digit_count)
+    {
+        text->append(width - digit_count, fill);
+    }
+    text->append(first, digit_count);
+}
+
+void append_hex(_Inout_ std::string* text, uint64_t value, unsigned int minimum_digits)
+{
+    static const char hex_digits[] = "0123456789abcdef";
+
+    char digits[16];
+    char* first = std::end(digits);
+    do
+    {
+        *--first = hex_digits[value & 0xf];
+        value >>= 4;
+    } while(value != 0);
+
+    const size_t digit_count = std::end(digits) - first;
+    if(minimum_digits > digit_count)
+    {
+        text->append(minimum_digits - digit_count, '0');
+    }
+    text->append(first, digit_count);
+}
+
+// Returns the length of the longest prefix of text that does not end partway
+// through a UTF-8 sequence, so that console output is converted whole characters at a time.
+static size_t complete_utf8_length(const std::string& text) noexcept
+{
+    // A sequence is at most four bytes, so only the last three can start an incomplete one.
+    const size_t size = text.size();
+    for(size_t back = 1; (back <= 3) && (back <= size); ++back)
+    {
+        const unsigned char ch = static_cast<unsigned char>(text[size - back]);
+        if((ch & 0xc0) != 0x80)
+        {
+            // A lead byte: 110xxxxx starts two bytes, 1110xxxx three, and 11110xxx four.
+            const size_t sequence_size = ((ch & 0xe0) == 0xc0) ? 2 : ((ch & 0xf0) == 0xe0) ? 3 : ((ch & 0xf8) == 0xf0) ? 4 : 1;
+            return (sequence_size > back) ? (size - back) : size;
+        }
+    }
+
+    return size;
+}
+
+static HANDLE get_standard_output()
+{
+    const HANDLE output = GetStdHandle(STD_OUTPUT_HANDLE);
+    CHECK_BOOL_LAST_ERROR((output != nullptr) && (output != INVALID_HANDLE_VALUE));
+
+    return output;
+}
+
+Output_sink::Output_sink() : Output_sink(get_standard_output())
+{
+}
+
+Output_sink::Output_sink(_In_ HANDLE output) :
+    m_output(output),
+    m_is_console(false),
+    m_is_standard_output(output == GetStdHandle(STD_OUTPUT_HANDLE))
+{
+    // GetConsoleMode fails for files and pipes.
+    DWORD mode;
+    m_is_console = GetConsoleMode(output, &mode) != 0;
+
+    m_buffer.reserve(output_sink_buffer_size);
+}
+
+Output_sink::~Output_sink() noexcept
+{
+    try
+    {
+        flush();
+    }
+    catch(const std::exception&)
+    {
+        // Destructors must not throw.  Callers that care call flush first.
+    }
+}
+
+void Output_sink::write_through(_In_reads_(size) const char* text, size_t size)
+{
+    if(m_is_console)
+    {
+        // Cast is safe as callers pass at most output_sink_buffer_size bytes at a time to the console.
+        const int wide_size = MultiByteToWideChar(CP_UTF8, 0, text, static_cast<int>(size), nullptr, 0);
+        CHECK_BOOL_LAST_ERROR(wide_size > 0);
+        std::wstring wide_text(wide_size, L'\0');
+        CHECK_BOOL_LAST_ERROR(MultiByteToWideChar(CP_UTF8, 0, text, static_cast<int>(size), &wide_text[0], wide_size) == wide_size);
+
+        DWORD amount_written;
+        CHECK_BOOL_LAST_ERROR(WriteConsoleW(m_output, wide_text.data(), static_cast<DWORD>(wide_text.size()), &amount_written, nullptr) != 0);
+        return;
+    }
+
+    while(size > 0)
+    {
+        // Cast is safe as the amount is no larger than MAXDWORD.
+        const DWORD amount_to_write = static_cast<DWORD>(std::min<size_t>(size, MAXDWORD));
+        DWORD amount_written;
+        CHECK_BOOL_LAST_ERROR(WriteFile(m_output, text, amount_to_write, &amount_written, nullptr) != 0);
+        text += amount_written;
+        size -= amount_written;
+    }
+}
+
+Output_sink& Output_sink::write(_In_reads_(size) const char* text, size_t size)
+{
+    if(m_buffer.size() + size > output_sink_buffer_size)
+    {
+        flush();
+    }
+
+    if(size >= output_sink_buffer_size)
+    {
+        if(!m_is_console)
+        {
+            write_through(text, size);
+            return *this;
+        }
+
+        // The console needs whole characters, so pass large text through the buffer in pieces.
+        while(size > output_sink_buffer_size)
+        {
+            m_buffer.append(text, output_sink_buffer_size);
+            text += output_sink_buffer_size;
+            size -= output_sink_buffer_size;
+            flush();
+        }
+    }
+
+    m_buffer.append(text, size);
+    return *this;
+}
+
+Output_sink& Output_sink::write(_In_z_ const char* text)
+{
+    return write(text, strlen(text));
+}
+
+Output_sink& Output_sink::write(const std::string& text)
+{
+    return write(text.data(), text.size());
+}
+
+Output_sink& Output_sink::write_decimal(uint64_t value, unsigned int width, char fill)
+{
+    if(m_buffer.size() + std::max<size_t>(width, maximum_decimal_digits) > output_sink_buffer_size)
+    {
+        flush();
+    }
+
+    append_decimal(&m_buffer, value, width, fill);
+    return *this;
+}
+
+Output_sink& Output_sink::write_hex(uint64_t value, unsigned int minimum_digits)
+{
+    if(m_buffer.size() + std::max<size_t>(minimum_digits, 16) > output_sink_buffer_size)
+    {
+        flush();
+    }
+
+    append_hex(&m_buffer, value, minimum_digits);
+    return *this;
+}
+
+Output_sink& Output_sink::write_padded(const std::string& text, int width)
+{
+    // Count code points, which are the bytes that do not continue a sequence.
+    const size_t length = std::count_if(text.cbegin(), text.cend(), [](char ch)
+    {
+        return (static_cast<unsigned char>(ch) & 0xc0) != 0x80;
+    });
+    const size_t padding = static_cast<size_t>(std::abs(width)) - std::min<size_t>(length, std::abs(width));
+
+    if(width > 0)
+    {
+        m_buffer.append(padding, ' ');
+    }
+    write(text);
+    if(width < 0)
+    {
+        m_buffer.append(padding, ' ');
+    }
+
+    return *this;
+}
+
+void Output_sink::flush()
+{
+    if(m_is_standard_output)
+    {
+        fflush(stdout);
+    }
+
+    const size_t size = m_is_console ? complete_utf8_length(m_buffer) : m_buffer.size();
+    if(size > 0)
+    {
+        write_through(m_buffer.data(), size);
+    }
+    m_buffer.erase(0, size);
+}
+
+}
+
@@ -0,0 +1,62 @@
+#pragma once
+
+namespace DiskTools
+{
+
+// Text is written in pieces of about this size.  Larger writes go straight through.
+constexpr size_t output_sink_buffer_size = 1024 * 1024;
+
+// Appends value in decimal, right aligned in width characters with fill.
+// Formats without printf, which is the bulk of the cost of long reports.
+void append_decimal(_Inout_ std::string* text, uint64_t value, unsigned int width = 0, char fill = ' ');
+
+// Appends value in lowercase hexadecimal, with at least minimum_digits digits.
+void append_hex(_Inout_ std::string* text, uint64_t value, unsigned int minimum_digits = 1);
+
+// Collects UTF-8 report text in one large buffer, and writes it to a file or
+// the console in large pieces, rather than one printf and one write per field.
+// Console output is converted to UTF-16 and written with WriteConsoleW, so it
+// is independent of the console code page.  Other output is written as UTF-8
+// bytes.  Lines end in \n alone, and are not translated.  Not thread safe.
+class Output_sink
+{
+    HANDLE m_output;
+    bool m_is_console;
+    bool m_is_standard_output;
+    std::string m_buffer;
+
+    // Not implemented to prevent accidental copying/moving.
+    Output_sink(const Output_sink&) = delete;
+    Output_sink(Output_sink&&) noexcept = delete;
+    Output_sink& operator=(const Output_sink&) = delete;
+    Output_sink& operator=(Output_sink&&) noexcept = delete;
+
+    void write_through(_In_reads_(size) const char* text, size_t size);
+
+public:
+    // Writes to standard output.
+    Output_sink();
+    explicit Output_sink(_In_ HANDLE output);
+
+    // Flushes, but ignores errors.  Call flush to see them.
+    ~Output_sink() noexcept;
+
+    Output_sink& write(_In_reads_(size) const char* text, size_t size);
+    Output_sink& write(_In_z_ const char* text);
+    Output_sink& write(const std::string& text);
+
+    // As append_decimal and append_hex.
+    Output_sink& write_decimal(uint64_t value, unsigned int width = 0, char fill = ' ');
+    Output_sink& write_hex(uint64_t value, unsigned int minimum_digits = 1);
+
+    // Pads text with spaces to width characters, on the left, or with a negative
+    // width, on the right, as printf does.  Characters are counted as UTF-8 code points.
+    Output_sink& write_padded(const std::string& text, int width);
+
+    // Writes all buffered text.  Text written to stdout with the CRT before
+    // the buffered text is flushed first, so the two stay in order.
+    void flush();
+};
+
+}
+
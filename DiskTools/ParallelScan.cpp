@@ -0,0 +1,98 @@
+#include "PreCompile.h"
+#include "ParallelScan.h"   // Pick up forward declarations to ensure correctness.
+#include "BlockDevice.h"
+#include "Trace.h"
+#include <PortableRuntime/CheckException.h>
+
+namespace DiskTools
+{
+
+unsigned int for_each_block_parallel(
+    unsigned int thread_count,
+    uint64_t block_count,
+    const std::function<void (unsigned int thread_index, uint64_t block_index)>& process_block)
+{
+    CHECK_EXCEPTION(thread_count > 0, u8"At least one scan thread is required.");
+    thread_count = static_cast<unsigned int>(std::max<uint64_t>(std::min<uint64_t>(thread_count, block_count), 1));
+
+    std::atomic<uint64_t> next_block(0);
+    std::vector<std::exception_ptr> thread_exceptions(thread_count);
+
+    const auto worker = [&](unsigned int thread_index)
+    {
+        try
+        {
+            for(uint64_t block_index = next_block++; block_index < block_count; block_index = next_block++)
+            {
+                process_block(thread_index, block_index);
+            }
+        }
+        catch(...)
+        {
+            thread_exceptions[thread_index] = std::current_exception();
+
+            // Stop the other workers.
+            next_block = block_count;
+        }
+    };
+
+    // The calling thread does the work of the first worker.
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count - 1);
+    {
+        const Thread_joiner joiner(&threads);
+        try
+        {
+            for(unsigned int thread_index = 1; thread_index < thread_count; ++thread_index)
+            {
+                threads.emplace_back([&worker, thread_index]()
+                {
+                    DISKTOOLS_TRACE_THREAD_NAME("scanner");
+                    worker(thread_index);
+                });
+            }
+        }
+        catch(...)
+        {
+            // Stop the workers that did start, so that joining them is quick.
+            next_block = block_count;
+            throw;
+        }
+        worker(0);
+    }
+
+    for(const auto& exception : thread_exceptions)
+    {
+        if(exception)
+        {
+            std::rethrow_exception(exception);
+        }
+    }
+
+    return thread_count;
+}
+
+unsigned int for_each_block_parallel(
+    const std::string& device_name,
+    unsigned int thread_count,
+    uint64_t block_count,
+    const std::function<void (_In_ Block_device* device, unsigned int thread_index, uint64_t block_index)>& process_block)
+{
+    CHECK_EXCEPTION(thread_count > 0, u8"At least one scan thread is required.");
+    thread_count = static_cast<unsigned int>(std::max<uint64_t>(std::min<uint64_t>(thread_count, block_count), 1));
+
+    // Open every handle up front, so that a bad path fails before any work starts.
+    std::vector<std::unique_ptr<Block_device>> devices;
+    for(unsigned int thread_index = 0; thread_index < thread_count; ++thread_index)
+    {
+        devices.push_back(open_disk_or_device(device_name));
+    }
+
+    return for_each_block_parallel(thread_count, block_count, [&](unsigned int thread_index, uint64_t block_index)
+    {
+        process_block(devices[thread_index].get(), thread_index, block_index);
+    });
+}
+
+}
+
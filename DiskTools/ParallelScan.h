@@ -0,0 +1,56 @@
+#pragma once
+
+namespace DiskTools
+{
+
+class Block_device;
+
+// Joins threads on every exit path, as destroying a joinable std::thread ends the process.
+class Thread_joiner
+{
+    std::vector<std::thread>* m_threads;
+
+    // Not implemented to prevent accidental copying/moving.
+    Thread_joiner(const Thread_joiner&) = delete;
+    Thread_joiner(Thread_joiner&&) noexcept = delete;
+    Thread_joiner& operator=(const Thread_joiner&) = delete;
+    Thread_joiner& operator=(Thread_joiner&&) noexcept = delete;
+
+public:
+    explicit Thread_joiner(_In_ std::vector<std::thread>* threads) noexcept :
+        m_threads(threads)
+    {
+    }
+
+    ~Thread_joiner()
+    {
+        std::for_each(m_threads->begin(), m_threads->end(), [](std::thread& thread)
+        {
+            if(thread.joinable())
+            {
+                thread.join();
+            }
+        });
+    }
+};
+
+// Calls process_block once for each block index in [0, block_count), on up to
+// thread_count threads, including the calling thread.  thread_index, which is
+// less than the thread count, can index per-thread state.  Threads claim blocks
+// in increasing order.  The first exception stops the remaining blocks, and is
+// rethrown once all threads have finished.  Returns the number of threads used.
+unsigned int for_each_block_parallel(
+    unsigned int thread_count,
+    uint64_t block_count,
+    const std::function<void (unsigned int thread_index, uint64_t block_index)>& process_block);
+
+// As above, but each thread opens its own handle to device_name (see
+// open_disk_or_device), so the reads of each thread proceed independently.
+unsigned int for_each_block_parallel(
+    const std::string& device_name,
+    unsigned int thread_count,
+    uint64_t block_count,
+    const std::function<void (_In_ Block_device* device, unsigned int thread_index, uint64_t block_index)>& process_block);
+
+}
+
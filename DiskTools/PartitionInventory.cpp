@@ -0,0 +1,354 @@
+#include "PreCompile.h"
+#include "PartitionInventory.h" // Pick up forward declarations to ensure correctness.
+#include "BlockDevice.h"
+#include "OutputSink.h"
+#include "ParallelScan.h"
+#include "PartitionLayoutCache.h"
+#include "PartitionTable.h"
+#include "ReportUtils.h"
+#include <PortableRuntime/CheckException.h>
+#include <PortableRuntime/Unicode.h>
+
+namespace DiskTools
+{
+
+static const char csv_header[] = u8"target,sector_size,device_size,scheme,partition,start_sector,sector_count,size,type,logical,error\n";
+
+// Collects the records of each target, and writes them in target order, as the
+// targets finish in whatever order the threads reach them.
+class Ordered_record_writer
+{
+    std::mutex m_mutex;
+    Output_sink m_sink;
+    uint64_t m_next_index;
+    std::unordered_map<uint64_t, std::string> m_pending;
+
+    // Not implemented to prevent accidental copying/moving.
+    Ordered_record_writer(const Ordered_record_writer&) = delete;
+    Ordered_record_writer(Ordered_record_writer&&) noexcept = delete;
+    Ordered_record_writer& operator=(const Ordered_record_writer&) = delete;
+    Ordered_record_writer& operator=(Ordered_record_writer&&) noexcept = delete;
+
+public:
+    explicit Ordered_record_writer(_In_ HANDLE output) : m_sink(output), m_next_index(0)
+    {
+    }
+
+    void submit(uint64_t index, std::string&& records)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if(index != m_next_index)
+        {
+            m_pending.emplace(index, std::move(records));
+            return;
+        }
+
+        m_sink.write(records);
+        ++m_next_index;
+        for(auto next = m_pending.find(m_next_index); next != m_pending.end(); next = m_pending.find(m_next_index))
+        {
+            m_sink.write(next->second);
+            m_pending.erase(next);
+            ++m_next_index;
+        }
+    }
+
+    void append(const std::string& text)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_sink.write(text);
+    }
+
+    void flush()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        assert(m_pending.empty());
+        m_sink.flush();
+    }
+};
+
+static std::string csv_escape(const std::string& value)
+{
+    if(value.find_first_of(",\"\r\n") == std::string::npos)
+    {
+        return value;
+    }
+
+    std::string escaped = u8"\"";
+    for(const char ch : value)
+    {
+        if('"' == ch)
+        {
+            escaped.push_back('"');
+        }
+        escaped.push_back(ch);
+    }
+    escaped.push_back('"');
+
+    return escaped;
+}
+
+static std::string format_type(uint8_t file_system_type)
+{
+    std::string type = u8"0x";
+    append_hex(&type, file_system_type, 2);
+    return type;
+}
+
+// What is known of a target, for the fields that every one of its records repeats.
+struct Target_layout
+{
+    unsigned int sector_size;
+    uint64_t device_size;
+    std::vector<Partition_location> partitions;
+    std::string error;                  // Empty if the target was read.
+};
+
+static const char* scheme_name(const Target_layout& layout) noexcept
+{
+    if(!layout.error.empty())
+    {
+        return u8"";
+    }
+    if(layout.partitions.empty())
+    {
+        return u8"none";
+    }
+
+    return layout.partitions.front().is_gpt ? u8"gpt" : u8"mbr";
+}
+
+static std::string format_csv_records(const std::string& target, const Target_layout& layout)
+{
+    std::string target_fields = csv_escape(target) + u8",";
+    if(layout.error.empty())
+    {
+        append_decimal(&target_fields, layout.sector_size);
+        target_fields += u8",";
+        append_decimal(&target_fields, layout.device_size);
+    }
+    else
+    {
+        target_fields += u8",";
+    }
+    target_fields += std::string(u8",") + scheme_name(layout) + u8",";
+
+    if(layout.partitions.empty())
+    {
+        return target_fields + u8",,,,,," + csv_escape(layout.error) + u8"\n";
+    }
+
+    std::string records;
+    for(const auto& partition : layout.partitions)
+    {
+        records += target_fields;
+        append_decimal(&records, partition.number);
+        records += u8",";
+        append_decimal(&records, partition.start_sector);
+        records += u8",";
+        append_decimal(&records, partition.sector_count);
+        records += u8",";
+        append_decimal(&records, partition.sector_count * layout.sector_size);
+        records += u8",";
+        records += format_type(partition.file_system_type);
+        records += partition.is_logical ? u8",true,\n" : u8",false,\n";
+    }
+
+    return records;
+}
+
+static std::string format_json_records(const std::string& target, const Target_layout& layout)
+{
+    const std::string target_fields = u8"{\"target\": \"" + json_escape(target) + u8"\"";
+    if(!layout.error.empty())
+    {
+        return target_fields + u8", \"error\": \"" + json_escape(layout.error) + u8"\"}\n";
+    }
+
+    std::string device_fields = target_fields + u8", \"sector_size\": ";
+    append_decimal(&device_fields, layout.sector_size);
+    device_fields += u8", \"device_size\": ";
+    append_decimal(&device_fields, layout.device_size);
+    device_fields += std::string(u8", \"scheme\": \"") + scheme_name(layout) + u8"\"";
+    if(layout.partitions.empty())
+    {
+        return device_fields + u8"}\n";
+    }
+
+    std::string records;
+    for(const auto& partition : layout.partitions)
+    {
+        records += device_fields;
+        records += u8", \"partition\": ";
+        append_decimal(&records, partition.number);
+        records += u8", \"start_sector\": ";
+        append_decimal(&records, partition.start_sector);
+        records += u8", \"sector_count\": ";
+        append_decimal(&records, partition.sector_count);
+        records += u8", \"size\": ";
+        append_decimal(&records, partition.sector_count * layout.sector_size);
+        records += u8", \"type\": \"" + format_type(partition.file_system_type) + u8"\"";
+        records += partition.is_logical ? u8", \"logical\": true}\n" : u8", \"logical\": false}\n";
+    }
+
+    return records;
+}
+
+static Target_layout read_target_layout(const std::string& target, _In_opt_ Partition_layout_cache* cache)
+{
+    Target_layout layout{};
+    try
+    {
+        const auto device = open_disk_or_device(target);
+        layout.sector_size = device->sector_size();
+        layout.device_size = device->size();
+        layout.partitions = (cache != nullptr) ? cache->read_partition_layout(device.get(), target) : read_partition_layout(device.get());
+    }
+    catch(const std::exception& ex)
+    {
+        // One unreadable target should not stop an inventory of thousands.
+        layout.partitions.clear();
+        layout.error = ex.what();
+
+        // System error messages end with a line break.
+        while(!layout.error.empty() && ((layout.error.back() == '\r') || (layout.error.back() == '\n') || (layout.error.back() == ' ')))
+        {
+            layout.error.pop_back();
+        }
+    }
+
+    return layout;
+}
+
+static bool is_wildcard_pattern(const std::string& target) noexcept
+{
+    return target.find_first_of(u8"*?") != std::string::npos;
+}
+
+static void append_matching_files(const std::string& pattern, _Inout_ std::vector<std::string>* targets)
+{
+    // FindFirstFile matches only the last component, so keep the directory to prefix the matches.
+    const size_t separator = pattern.find_last_of(u8"\\/");
+    const std::string directory = (separator == std::string::npos) ? std::string() : pattern.substr(0, separator + 1);
+
+    WIN32_FIND_DATAW find_data;
+    std::unique_ptr<void, std::function<void (HANDLE handle)>> find_handle(
+        FindFirstFileW(PortableRuntime::utf16_from_utf8(pattern).c_str(), &find_data),
+        [](HANDLE handle)
+        {
+            if(INVALID_HANDLE_VALUE != handle)
+            {
+                FindClose(handle);
+            }
+        });
+    CHECK_EXCEPTION(INVALID_HANDLE_VALUE != find_handle.get(), u8"No files match: " + pattern);
+
+    std::vector<std::string> matches;
+    do
+    {
+        if((find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0)
+        {
+            matches.push_back(directory + PortableRuntime::utf8_from_utf16(find_data.cFileName));
+        }
+    } while(FindNextFileW(find_handle.get(), &find_data) != 0);
+    CHECK_EXCEPTION(!matches.empty(), u8"No files match: " + pattern);
+
+    // Only NTFS returns names in order, so sort them for output that is the same on every volume.
+    std::sort(matches.begin(), matches.end());
+    targets->insert(targets->end(), matches.cbegin(), matches.cend());
+}
+
+std::vector<std::string> expand_inventory_targets(const std::vector<std::string>& arguments)
+{
+    std::vector<std::string> targets;
+    for(const auto& argument : arguments)
+    {
+        if((argument.size() > 1) && ('@' == argument.front()))
+        {
+            const std::string list_name = argument.substr(1);
+            std::ifstream list(PortableRuntime::utf16_from_utf8(list_name));
+            CHECK_EXCEPTION(list.good(), u8"Error opening: " + list_name);
+
+            std::vector<std::string> listed_targets;
+            std::string line;
+            while(std::getline(list, line))
+            {
+                while(!line.empty() && ((line.back() == '\r') || (line.back() == ' ') || (line.back() == '\t')))
+                {
+                    line.pop_back();
+                }
+                if(!line.empty() && (line.front() != '#'))
+                {
+                    listed_targets.push_back(line);
+                }
+            }
+            CHECK_EXCEPTION(!list.bad(), u8"Error reading: " + list_name);
+
+            // Lists may hold patterns, but not other lists.
+            for(const auto& target : listed_targets)
+            {
+                if(is_wildcard_pattern(target))
+                {
+                    append_matching_files(target, &targets);
+                }
+                else
+                {
+                    targets.push_back(target);
+                }
+            }
+        }
+        else if(is_wildcard_pattern(argument))
+        {
+            append_matching_files(argument, &targets);
+        }
+        else
+        {
+            targets.push_back(argument);
+        }
+    }
+
+    return targets;
+}
+
+Inventory_summary write_partition_inventory(
+    const std::vector<std::string>& targets,
+    Inventory_format format,
+    unsigned int thread_count,
+    _In_ HANDLE output,
+    _In_opt_ Partition_layout_cache* cache)
+{
+    Ordered_record_writer writer(output);
+    if(Inventory_format::csv == format)
+    {
+        writer.append(csv_header);
+    }
+
+    std::atomic<uint64_t> failed_target_count(0);
+    std::atomic<uint64_t> partition_count(0);
+
+    for_each_block_parallel(thread_count, targets.size(), [&](unsigned int, uint64_t target_index)
+    {
+        // Cast is safe as target_index is less than targets.size().
+        const auto& target = targets[static_cast<size_t>(target_index)];
+        const auto layout = read_target_layout(target, cache);
+        if(!layout.error.empty())
+        {
+            ++failed_target_count;
+        }
+        partition_count += layout.partitions.size();
+
+        writer.submit(target_index, (Inventory_format::csv == format) ? format_csv_records(target, layout) : format_json_records(target, layout));
+    });
+    writer.flush();
+
+    Inventory_summary summary;
+    summary.target_count = targets.size();
+    summary.failed_target_count = failed_target_count;
+    summary.partition_count = partition_count;
+
+    return summary;
+}
+
+}
+
@@ -0,0 +1,46 @@
+#pragma once
+
+namespace DiskTools
+{
+
+class Partition_layout_cache;
+
+enum class Inventory_format
+{
+    csv,
+    json_lines,     // One JSON object per line.
+};
+
+struct Inventory_summary
+{
+    uint64_t target_count;
+    uint64_t failed_target_count;
+    uint64_t partition_count;
+};
+
+// Expands the targets of a batch.  Disk numbers and device or image paths are
+// kept as they are, paths with * or ? are replaced by the files that they match,
+// and @name is replaced by the targets listed in the text file name, one per
+// line.  Blank lines and lines starting with # are skipped.  Throws if a pattern
+// matches no files or a list cannot be read.
+std::vector<std::string> expand_inventory_targets(const std::vector<std::string>& arguments);
+
+// Reads the partition table of each target (see read_partition_layout) and writes
+// one record per partition to output, with the target, its sector and device
+// size, and the location and type of the partition.  Targets without partitions
+// get one record without partition fields, and targets that cannot be read get one
+// record with an error field, so that every target appears in the output.
+//
+// Targets are read on thread_count threads, each with its own handle, so many
+// reads are in flight at once on slow or networked storage.  Records are written
+// in target order, through an Output_sink.  If cache is not null, layouts are
+// read through it (see Partition_layout_cache).
+Inventory_summary write_partition_inventory(
+    const std::vector<std::string>& targets,
+    Inventory_format format,
+    unsigned int thread_count,
+    _In_ HANDLE output,
+    _In_opt_ Partition_layout_cache* cache = nullptr);
+
+}
+
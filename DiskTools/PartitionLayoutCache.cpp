@@ -0,0 +1,363 @@
+#include "PreCompile.h"
+#include "PartitionLayoutCache.h"   // Pick up forward declarations to ensure correctness.
+#include "BlockDevice.h"
+#include "Hash.h"
+#include "OutputSink.h"
+#include <PortableRuntime/CheckException.h>
+#include <PortableRuntime/Unicode.h>
+
+namespace DiskTools
+{
+
+// On-disk structures.  Fields are naturally aligned, so no packing is needed.
+// The header is followed by the records, each followed by its table sectors
+// and then its partitions.
+struct Layout_cache_header
+{
+    uint8_t signature[8];
+    uint32_t version;
+    uint32_t record_count;
+};
+
+struct Layout_cache_record
+{
+    uint64_t identity_hash;
+    uint64_t device_size;
+    uint64_t table_hash;
+    uint32_t sector_size;
+    uint32_t table_sector_count;
+    uint32_t partition_count;
+    uint32_t reserved;
+};
+
+struct Layout_cache_partition
+{
+    uint64_t start_sector;
+    uint64_t sector_count;
+    uint32_t number;
+    uint8_t file_system_type;
+    uint8_t is_logical;
+    uint8_t is_gpt;
+    uint8_t reserved;
+    Partition_table_entry table_entry;
+};
+
+static_assert(sizeof(Layout_cache_header) == 16, "Layout_cache_header is an on-disk structure.");
+static_assert(sizeof(Layout_cache_record) == 40, "Layout_cache_record is an on-disk structure.");
+static_assert(sizeof(Layout_cache_partition) == 40, "Layout_cache_partition is an on-disk structure.");
+
+static constexpr uint8_t layout_cache_signature[8] = { 'D', 'T', 'L', 'A', 'Y', 'O', 'U', 'T' };
+constexpr uint32_t layout_cache_version = 1;
+
+// Far beyond any real cache, so that a corrupt file cannot cause a huge allocation.
+constexpr uint64_t maximum_layout_cache_file_size = 64 * 1024 * 1024;
+constexpr uint32_t maximum_cached_table_sectors = 1024;
+constexpr uint32_t maximum_cached_partitions = 1024;
+
+// Layouts that were not used by this process are dropped when the cache grows
+// past this many, so images that are long gone do not stay in the file forever.
+constexpr size_t maximum_cached_layouts = 4096;
+
+// Returns a NUL terminated string from a storage descriptor, without the padding
+// that some drives add, or an empty string if the descriptor does not have it.
+static std::string descriptor_string(_In_reads_bytes_(size) const uint8_t* descriptor, size_t size, DWORD offset)
+{
+    if((offset == 0) || (offset >= size))
+    {
+        return std::string();
+    }
+
+    const auto first = reinterpret_cast<const char*>(descriptor) + offset;
+    std::string value(first, std::find(first, reinterpret_cast<const char*>(descriptor) + size, '\0'));
+    value.erase(0, value.find_first_not_of(' '));
+    value.erase(value.find_last_not_of(' ') + 1);
+
+    return value;
+}
+
+// A disk keeps its serial number when disks are renumbered, and an image keeps its
+// file ID when it is opened by another path.  Other devices are known only by name.
+static std::string device_identity(_In_ Block_device* device, const std::string& device_name)
+{
+    const HANDLE handle = device->native_handle();
+    const bool is_disk_number = !device_name.empty() && std::all_of(device_name.cbegin(), device_name.cend(), [](char ch)
+    {
+        return (ch >= '0') && (ch <= '9');
+    });
+
+    if((nullptr != handle) && (is_disk_number || is_device_path(device_name.c_str())))
+    {
+        STORAGE_PROPERTY_QUERY query{};
+        query.PropertyId = StorageDeviceProperty;
+        query.QueryType = PropertyStandardQuery;
+
+        alignas(STORAGE_DEVICE_DESCRIPTOR) uint8_t descriptor[1024];
+        DWORD bytes_returned;
+        if(DeviceIoControl(handle,
+                           IOCTL_STORAGE_QUERY_PROPERTY,
+                           &query,
+                           sizeof(query),
+                           descriptor,
+                           sizeof(descriptor),
+                           &bytes_returned,
+                           nullptr) != 0)
+        {
+            const auto header = reinterpret_cast<const STORAGE_DEVICE_DESCRIPTOR*>(descriptor);
+            const std::string serial_number = descriptor_string(descriptor, bytes_returned, header->SerialNumberOffset);
+            if(!serial_number.empty())
+            {
+                return u8"disk:" + descriptor_string(descriptor, bytes_returned, header->VendorIdOffset) +
+                       u8"|" + descriptor_string(descriptor, bytes_returned, header->ProductIdOffset) +
+                       u8"|" + serial_number;
+            }
+        }
+    }
+    else if(nullptr != handle)
+    {
+        // Storage queries on a file reach the disk that holds it, so files use their ID instead.
+        BY_HANDLE_FILE_INFORMATION file_information;
+        if(GetFileInformationByHandle(handle, &file_information) != 0)
+        {
+            std::string identity = u8"file:";
+            append_hex(&identity, file_information.dwVolumeSerialNumber, 8);
+            identity += u8":";
+            append_hex(&identity, (static_cast<uint64_t>(file_information.nFileIndexHigh) << 32) | file_information.nFileIndexLow, 16);
+            return identity;
+        }
+    }
+
+    return u8"name:" + device_name;
+}
+
+Partition_layout_cache::Partition_layout_cache(const std::string& path) :
+    m_path(path),
+    m_is_modified(false)
+{
+    if(!m_path.empty())
+    {
+        try
+        {
+            load();
+        }
+        catch(const std::exception&)
+        {
+            // A cache that cannot be read is rebuilt.
+            m_layouts.clear();
+        }
+    }
+}
+
+void Partition_layout_cache::load()
+{
+    if(GetFileAttributesW(PortableRuntime::utf16_from_utf8(m_path).c_str()) == INVALID_FILE_ATTRIBUTES)
+    {
+        return;
+    }
+
+    const auto file = open_block_device(m_path.c_str());
+    CHECK_EXCEPTION((file->size() >= sizeof(Layout_cache_header)) && (file->size() <= maximum_layout_cache_file_size),
+                    u8"The partition layout cache is corrupt: " + m_path);
+
+    std::vector<uint8_t> contents(static_cast<size_t>(file->size()));
+    file->read(0, contents.data(), contents.size());
+
+    Layout_cache_header header;
+    memcpy(&header, contents.data(), sizeof(header));
+    if(!std::equal(std::cbegin(layout_cache_signature), std::cend(layout_cache_signature), header.signature) ||
+       (header.version != layout_cache_version))
+    {
+        // Left by another version of the tools, and replaced on the next save.
+        return;
+    }
+
+    size_t offset = sizeof(header);
+    for(uint32_t record_index = 0; record_index < header.record_count; ++record_index)
+    {
+        CHECK_EXCEPTION(contents.size() - offset >= sizeof(Layout_cache_record), u8"The partition layout cache is corrupt: " + m_path);
+        Layout_cache_record record;
+        memcpy(&record, contents.data() + offset, sizeof(record));
+        offset += sizeof(record);
+
+        CHECK_EXCEPTION((record.table_sector_count <= maximum_cached_table_sectors) &&
+                        (record.partition_count <= maximum_cached_partitions) &&
+                        (contents.size() - offset >= record.table_sector_count * sizeof(uint64_t) + record.partition_count * sizeof(Layout_cache_partition)),
+                        u8"The partition layout cache is corrupt: " + m_path);
+
+        Cached_layout layout;
+        layout.fingerprint.device_size = record.device_size;
+        layout.fingerprint.sector_size = record.sector_size;
+        layout.fingerprint.table_hash = record.table_hash;
+        layout.is_used = false;
+
+        auto& table_sectors = layout.fingerprint.table_sectors;
+        table_sectors.resize(record.table_sector_count);
+        memcpy(table_sectors.data(), contents.data() + offset, table_sectors.size() * sizeof(uint64_t));
+        offset += table_sectors.size() * sizeof(uint64_t);
+
+        for(uint32_t partition_index = 0; partition_index < record.partition_count; ++partition_index)
+        {
+            Layout_cache_partition partition;
+            memcpy(&partition, contents.data() + offset, sizeof(partition));
+            offset += sizeof(partition);
+
+            layout.partitions.push_back(Partition_location { partition.number,
+                                                             partition.start_sector,
+                                                             partition.sector_count,
+                                                             partition.file_system_type,
+                                                             partition.is_logical != 0,
+                                                             partition.is_gpt != 0,
+                                                             partition.table_entry });
+        }
+
+        m_layouts[record.identity_hash] = std::move(layout);
+    }
+}
+
+std::vector<Partition_location> Partition_layout_cache::read_partition_layout(
+    _In_ Block_device* device,
+    const std::string& device_name,
+    _Out_opt_ Partition_table_fingerprint* fingerprint)
+{
+    const std::string identity = device_identity(device, device_name);
+    const uint64_t identity_hash = hash64(identity.data(), identity.size());
+
+    // Copy the cached layout, so that the sectors are read without holding the lock.
+    bool is_cached = false;
+    Cached_layout cached;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        const auto layout = m_layouts.find(identity_hash);
+        if(layout != m_layouts.end())
+        {
+            layout->second.is_used = true;
+            cached = layout->second;
+            is_cached = true;
+        }
+    }
+
+    if(is_cached && matches_partition_table_fingerprint(device, cached.fingerprint))
+    {
+        if(fingerprint != nullptr)
+        {
+            *fingerprint = std::move(cached.fingerprint);
+        }
+        return cached.partitions;
+    }
+
+    Partition_table_sectors table_sectors;
+    auto partitions = DiskTools::read_partition_layout(device, &table_sectors);
+
+    Cached_layout layout;
+    layout.fingerprint = make_partition_table_fingerprint(device, std::move(table_sectors));
+    layout.partitions = partitions;
+    layout.is_used = true;
+
+    if(fingerprint != nullptr)
+    {
+        *fingerprint = layout.fingerprint;
+    }
+
+    // Layouts that cannot be stored are read again next time.
+    if((layout.fingerprint.table_sectors.size() <= maximum_cached_table_sectors) && (layout.partitions.size() <= maximum_cached_partitions))
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_layouts[identity_hash] = std::move(layout);
+        m_is_modified = true;
+    }
+
+    return partitions;
+}
+
+void Partition_layout_cache::save()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(m_path.empty() || !m_is_modified)
+    {
+        return;
+    }
+
+    if(m_layouts.size() > maximum_cached_layouts)
+    {
+        for(auto layout = m_layouts.begin(); layout != m_layouts.end();)
+        {
+            layout = layout->second.is_used ? std::next(layout) : m_layouts.erase(layout);
+        }
+    }
+
+    Layout_cache_header header{};
+    std::copy(std::cbegin(layout_cache_signature), std::cend(layout_cache_signature), header.signature);
+    header.version = layout_cache_version;
+    header.record_count = static_cast<uint32_t>(m_layouts.size());
+
+    std::vector<uint8_t> contents(reinterpret_cast<const uint8_t*>(&header), reinterpret_cast<const uint8_t*>(&header + 1));
+    for(const auto& layout : m_layouts)
+    {
+        Layout_cache_record record{};
+        record.identity_hash = layout.first;
+        const auto& fingerprint = layout.second.fingerprint;
+        record.device_size = fingerprint.device_size;
+        record.table_hash = fingerprint.table_hash;
+        record.sector_size = fingerprint.sector_size;
+        record.table_sector_count = static_cast<uint32_t>(fingerprint.table_sectors.size());
+        record.partition_count = static_cast<uint32_t>(layout.second.partitions.size());
+        contents.insert(contents.end(), reinterpret_cast<const uint8_t*>(&record), reinterpret_cast<const uint8_t*>(&record + 1));
+
+        const auto sectors = reinterpret_cast<const uint8_t*>(fingerprint.table_sectors.data());
+        contents.insert(contents.end(), sectors, sectors + fingerprint.table_sectors.size() * sizeof(uint64_t));
+
+        for(const auto& location : layout.second.partitions)
+        {
+            Layout_cache_partition partition{};
+            partition.start_sector = location.start_sector;
+            partition.sector_count = location.sector_count;
+            partition.number = location.number;
+            partition.file_system_type = location.file_system_type;
+            partition.is_logical = location.is_logical ? 1 : 0;
+            partition.is_gpt = location.is_gpt ? 1 : 0;
+            partition.table_entry = location.table_entry;
+            contents.insert(contents.end(), reinterpret_cast<const uint8_t*>(&partition), reinterpret_cast<const uint8_t*>(&partition + 1));
+        }
+    }
+
+    // Write a file of its own, and then replace the cache, so that a run that
+    // is reading the cache never sees half a file.
+    const std::string temporary_path = m_path + u8"." + std::to_string(GetCurrentProcessId()) + u8".tmp";
+    open_image_file(temporary_path.c_str(), CREATE_ALWAYS)->write(0, contents.data(), contents.size());
+
+    const std::wstring temporary_path_utf16 = PortableRuntime::utf16_from_utf8(temporary_path);
+    if(MoveFileExW(temporary_path_utf16.c_str(), PortableRuntime::utf16_from_utf8(m_path).c_str(), MOVEFILE_REPLACE_EXISTING) == 0)
+    {
+        DeleteFileW(temporary_path_utf16.c_str());
+        CHECK_EXCEPTION(false, u8"Unable to write the partition layout cache: " + m_path);
+    }
+
+    m_is_modified = false;
+}
+
+std::string default_layout_cache_path()
+{
+    wchar_t path[MAX_PATH];
+    DWORD length = GetEnvironmentVariableW(L"DISKTOOLS_LAYOUT_CACHE", path, ARRAYSIZE(path));
+    if((length > 0) && (length < ARRAYSIZE(path)))
+    {
+        return PortableRuntime::utf8_from_utf16(path);
+    }
+
+    length = GetEnvironmentVariableW(L"LOCALAPPDATA", path, ARRAYSIZE(path));
+    if((length == 0) || (length >= ARRAYSIZE(path)))
+    {
+        return std::string();
+    }
+
+    const std::wstring directory = std::wstring(path) + L"\\DiskTools";
+    if((CreateDirectoryW(directory.c_str(), nullptr) == 0) && (GetLastError() != ERROR_ALREADY_EXISTS))
+    {
+        return std::string();
+    }
+
+    return PortableRuntime::utf8_from_utf16((directory + L"\\PartitionLayouts.cache").c_str());
+}
+
+}
+
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "PartitionTable.h"
+
+namespace DiskTools
+{
+
+class Block_device;
+
+// Partition layouts kept in a file between runs, so that tools that list the
+// partitions of many disks do not walk every partition table at every launch.
+// Layouts are keyed by the identity of the device: the serial number of a disk,
+// the volume and file ID of an image, or else the name of the device.  A cached
+// layout is used only if the device has the same size and sector size, and if
+// the MBR, the GPT header, and each EBR still hash to the same value, so a disk
+// with a GPT or without logical partitions is checked with one small read.
+// Safe to use from many threads.
+class Partition_layout_cache
+{
+    struct Cached_layout
+    {
+        Partition_table_fingerprint fingerprint;
+        std::vector<Partition_location> partitions;
+        bool is_used;                   // Looked up by this process, so kept when the file is trimmed.
+    };
+
+    std::string m_path;
+    std::mutex m_mutex;
+    std::unordered_map<uint64_t, Cached_layout> m_layouts;
+    bool m_is_modified;
+
+    // Not implemented to prevent accidental copying/moving.
+    Partition_layout_cache(const Partition_layout_cache&) = delete;
+    Partition_layout_cache(Partition_layout_cache&&) noexcept = delete;
+    Partition_layout_cache& operator=(const Partition_layout_cache&) = delete;
+    Partition_layout_cache& operator=(Partition_layout_cache&&) noexcept = delete;
+
+    void load();
+
+public:
+    // Loads the cache file at path.  A missing, corrupt, or outdated file gives an
+    // empty cache, as does an empty path, which keeps the cache in memory only.
+    explicit Partition_layout_cache(const std::string& path);
+
+    // As read_partition_layout, but from the cache if the partition tables have not changed.
+    // device_name is the name that the device was opened with.  If fingerprint is not
+    // null, it receives the fingerprint of the tables, as Partition_monitor keeps.
+    std::vector<Partition_location> read_partition_layout(
+        _In_ Block_device* device,
+        const std::string& device_name,
+        _Out_opt_ Partition_table_fingerprint* fingerprint = nullptr);
+
+    // Writes the cache file, if any layouts changed.  The file is replaced in one
+    // step, so concurrent runs see either the old or the new file.
+    void save();
+};
+
+// The cache file named by the DISKTOOLS_LAYOUT_CACHE environment variable, or else
+// DiskTools\PartitionLayouts.cache under the local application data directory,
+// which is created if needed.  Empty if neither is available.
+std::string default_layout_cache_path();
+
+}
+
@@ -0,0 +1,179 @@
+#include "PreCompile.h"
+#include "PartitionMonitor.h"   // Pick up forward declarations to ensure correctness.
+#include "BlockDevice.h"
+#include "ParallelScan.h"
+#include "PartitionLayoutCache.h"
+
+namespace DiskTools
+{
+
+static bool is_same_partition(const Partition_location& previous, const Partition_location& current) noexcept
+{
+    return (previous.start_sector == current.start_sector) &&
+           (previous.sector_count == current.sector_count) &&
+           (previous.file_system_type == current.file_system_type) &&
+           (previous.is_logical == current.is_logical) &&
+           (previous.is_gpt == current.is_gpt) &&
+           (memcmp(&previous.table_entry, &current.table_entry, sizeof(current.table_entry)) == 0);
+}
+
+static std::vector<const Partition_location*> sorted_by_number(const std::vector<Partition_location>& partitions)
+{
+    std::vector<const Partition_location*> sorted;
+    sorted.reserve(partitions.size());
+    for(const auto& partition : partitions)
+    {
+        sorted.push_back(&partition);
+    }
+
+    std::stable_sort(sorted.begin(), sorted.end(), [](const Partition_location* first, const Partition_location* second)
+    {
+        return first->number < second->number;
+    });
+
+    return sorted;
+}
+
+// Matches the partitions of the two scans of a device by number.
+static void append_differences(
+    const std::string& device_name,
+    const std::vector<Partition_location>& previous_partitions,
+    const std::vector<Partition_location>& current_partitions,
+    _Inout_ std::vector<Partition_difference>* differences)
+{
+    const auto previous = sorted_by_number(previous_partitions);
+    const auto current = sorted_by_number(current_partitions);
+
+    size_t previous_index = 0;
+    size_t current_index = 0;
+    while((previous_index < previous.size()) || (current_index < current.size()))
+    {
+        const bool has_previous = previous_index < previous.size();
+        const bool has_current = current_index < current.size();
+
+        if(has_previous && (!has_current || (previous[previous_index]->number < current[current_index]->number)))
+        {
+            differences->push_back(Partition_difference { device_name, Partition_change::removed, *previous[previous_index], Partition_location{} });
+            ++previous_index;
+        }
+        else if(has_current && (!has_previous || (current[current_index]->number < previous[previous_index]->number)))
+        {
+            differences->push_back(Partition_difference { device_name, Partition_change::added, Partition_location{}, *current[current_index] });
+            ++current_index;
+        }
+        else
+        {
+            if(!is_same_partition(*previous[previous_index], *current[current_index]))
+            {
+                differences->push_back(Partition_difference { device_name, Partition_change::changed, *previous[previous_index], *current[current_index] });
+            }
+            ++previous_index;
+            ++current_index;
+        }
+    }
+}
+
+// Fills in device, which has its name set, from a new scan.  previous is the
+// device as of the last scan, or null if it is new to the monitor.
+static void scan_device(
+    _Inout_ Monitored_device* device,
+    _In_opt_ const Monitored_device* previous,
+    _Inout_opt_ Partition_layout_cache* cache)
+{
+    try
+    {
+        const auto block_device = open_disk_or_device(device->name);
+
+        if((previous != nullptr) && previous->is_readable && matches_partition_table_fingerprint(block_device.get(), previous->fingerprint))
+        {
+            device->fingerprint = previous->fingerprint;
+            device->partitions = previous->partitions;
+        }
+        else if((previous == nullptr) && (cache != nullptr))
+        {
+            device->partitions = cache->read_partition_layout(block_device.get(), device->name, &device->fingerprint);
+        }
+        else
+        {
+            Partition_table_sectors table_sectors;
+            device->partitions = read_partition_layout(block_device.get(), &table_sectors);
+            device->fingerprint = make_partition_table_fingerprint(block_device.get(), std::move(table_sectors));
+        }
+
+        device->is_readable = true;
+    }
+    catch(const std::bad_alloc&)
+    {
+        throw;
+    }
+    catch(const std::exception&)
+    {
+        // A missing or ejected disk has no partitions until it can be read again.
+        device->is_readable = false;
+        device->fingerprint = Partition_table_fingerprint{};
+        device->partitions.clear();
+    }
+}
+
+std::vector<Partition_difference> Partition_monitor::rescan(
+    const std::vector<std::string>& device_names,
+    unsigned int thread_count,
+    _Inout_opt_ Partition_layout_cache* cache)
+{
+    std::unordered_map<std::string, const Monitored_device*> previous_devices;
+    for(const auto& device : m_devices)
+    {
+        previous_devices.emplace(device.name, &device);
+    }
+
+    std::vector<Monitored_device> devices(device_names.size());
+    for(size_t index = 0; index < devices.size(); ++index)
+    {
+        devices[index].name = device_names[index];
+    }
+
+    // Each device is opened and read by one thread, so scans of slow or
+    // unresponsive disks overlap.
+    for_each_block_parallel(thread_count, devices.size(), [&](unsigned int, uint64_t device_index)
+    {
+        // Cast is safe as the index is less than devices.size().
+        auto& device = devices[static_cast<size_t>(device_index)];
+        const auto previous = previous_devices.find(device.name);
+        scan_device(&device, (previous != previous_devices.cend()) ? previous->second : nullptr, cache);
+    });
+
+    // A name given twice is compared once.
+    std::vector<Partition_difference> differences;
+    std::unordered_set<std::string> compared_names;
+    const std::vector<Partition_location> no_partitions;
+    for(const auto& device : devices)
+    {
+        if(compared_names.insert(device.name).second)
+        {
+            const auto previous = previous_devices.find(device.name);
+            append_differences(device.name,
+                               (previous != previous_devices.cend()) ? previous->second->partitions : no_partitions,
+                               device.partitions,
+                               &differences);
+        }
+    }
+
+    for(const auto& device : m_devices)
+    {
+        if(compared_names.insert(device.name).second)
+        {
+            append_differences(device.name, device.partitions, no_partitions, &differences);
+        }
+    }
+
+    m_devices = std::move(devices);
+    return differences;
+}
+
+const std::vector<Monitored_device>& Partition_monitor::devices() const noexcept
+{
+    return m_devices;
+}
+
+}
+
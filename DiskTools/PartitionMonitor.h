@@ -0,0 +1,70 @@
+#pragma once
+
+#include "PartitionTable.h"
+
+namespace DiskTools
+{
+
+class Partition_layout_cache;
+
+enum class Partition_change
+{
+    added,
+    removed,
+    changed,                    // Same number, but a different location, type, or table entry.
+};
+
+// A partition that differs between two scans.
+struct Partition_difference
+{
+    std::string device_name;
+    Partition_change change;
+    Partition_location previous;    // Zero for added partitions.
+    Partition_location current;     // Zero for removed partitions.
+};
+
+// A device as of the latest scan.
+struct Monitored_device
+{
+    std::string name;
+    bool is_readable;           // False if the device could not be opened or read, so it has no partitions.
+    Partition_table_fingerprint fingerprint;
+    std::vector<Partition_location> partitions;
+};
+
+// Watches the partitions of a set of devices.  Each scan opens each device and
+// hashes the sectors that held its partition tables, which is one read for a
+// GPT disk or an MBR disk without logical partitions, and walks the tables
+// again only for devices whose size or table hash changed.  Devices are not
+// held open between scans, so disks can still be ejected.  Not thread safe,
+// although each scan reads the devices on many threads.
+class Partition_monitor
+{
+    std::vector<Monitored_device> m_devices;
+
+    // Not implemented to prevent accidental copying/moving.
+    Partition_monitor(const Partition_monitor&) = delete;
+    Partition_monitor(Partition_monitor&&) noexcept = delete;
+    Partition_monitor& operator=(const Partition_monitor&) = delete;
+    Partition_monitor& operator=(Partition_monitor&&) noexcept = delete;
+
+public:
+    Partition_monitor() noexcept = default;
+
+    // Scans device_names (see open_disk_or_device) on up to thread_count threads,
+    // and returns how their partitions differ from the previous scan, by device
+    // in the order of device_names, and then by partition number.  Partitions of
+    // devices that were not in the previous scan are added, and partitions of
+    // devices that are no longer named, or that can no longer be read, are removed.
+    // Devices new to the monitor are read through cache, if it is not null.
+    std::vector<Partition_difference> rescan(
+        const std::vector<std::string>& device_names,
+        unsigned int thread_count,
+        _Inout_opt_ Partition_layout_cache* cache = nullptr);
+
+    // The devices of the latest scan, in the order of device_names.
+    const std::vector<Monitored_device>& devices() const noexcept;
+};
+
+}
+
@@ -0,0 +1,667 @@
+#include "PreCompile.h"
+#include "PartitionRecovery.h"  // Pick up forward declarations to ensure correctness.
+#include "BlockDevice.h"
+#include "Fat.h"
+#include "ParallelScan.h"
+#include "PartitionTable.h"
+#include "SectorSize.h"
+#include "Trace.h"
+#include <PortableRuntime/CheckException.h>
+
+namespace DiskTools
+{
+
+constexpr uint8_t file_system_type_fat12 = 0x01;
+constexpr uint8_t file_system_type_fat16_small = 0x04;
+constexpr uint8_t file_system_type_fat16 = 0x06;
+constexpr uint8_t file_system_type_ntfs = 0x07;
+constexpr uint8_t file_system_type_fat32 = 0x0b;
+constexpr uint8_t file_system_type_fat32_lba = 0x0c;
+constexpr uint8_t file_system_type_fat16_lba = 0x0e;
+constexpr uint8_t file_system_type_extended_lba = 0x0f;
+
+// Candidates are read in blocks of about this size, so that dense strides
+// stream, and sparse strides still give each thread a useful amount of work.
+constexpr uint64_t recovery_block_size = 4 * 1024 * 1024;
+
+// Strides up to this many bytes are read as contiguous runs rather than sector by sector.
+constexpr uint64_t dense_stride_size = 64 * 1024;
+
+struct Ntfs_boot_sector_layout
+{
+    static constexpr size_t size = 0x40;
+    typedef Byte_array_field<0x03, 8> OEM_name;
+    typedef Little_endian_field<uint16_t, 0x0b> bytes_per_sector;
+    typedef Little_endian_field<uint8_t, 0x0d> sectors_per_cluster;
+    typedef Little_endian_field<uint64_t, 0x28> total_sectors;
+    typedef Little_endian_field<uint64_t, 0x30> mft_cluster;
+    typedef Little_endian_field<uint64_t, 0x38> mft_mirror_cluster;
+};
+
+enum class Candidate_kind
+{
+    fat,
+    ntfs,
+    ebr,
+};
+
+// A sector that looks like a boot sector or EBR, before it is checked.
+struct Candidate
+{
+    uint64_t sector;
+    Candidate_kind kind;
+    std::vector<uint8_t> contents;
+};
+
+static bool is_ntfs_boot_sector(_In_reads_bytes_(sector_size) const uint8_t* sector, unsigned int sector_size)
+{
+    typedef Ntfs_boot_sector_layout Layout;
+    const Structure_view<Layout> boot_sector(sector, sector_size);
+
+    return has_boot_signature(Structure_view<Boot_record_layout>(sector, sector_size)) &&
+           (memcmp(boot_sector.get<Layout::OEM_name>(), u8"NTFS    ", Layout::OEM_name::size) == 0) &&
+           (boot_sector.get<Layout::bytes_per_sector>() == sector_size) &&
+           (boot_sector.get<Layout::sectors_per_cluster>() != 0) &&
+           (boot_sector.get<Layout::total_sectors>() != 0);
+}
+
+// An EBR describes one logical volume, and optionally links to the next EBR.
+// Its last two entries are unused.
+static bool is_ebr(_In_reads_bytes_(sector_size) const uint8_t* sector, unsigned int sector_size)
+{
+    const Structure_view<Boot_record_layout> boot_record(sector, sector_size);
+    if(!has_boot_signature(boot_record))
+    {
+        return false;
+    }
+
+    const auto entries = load_partition_table(boot_record);
+
+    const auto is_empty = [](const Partition_table_entry& entry)
+    {
+        return (entry.file_system_type == 0) && (entry.start_sector == 0) && (entry.sectors == 0);
+    };
+
+    return ((entries[0].bootable == 0) || (entries[0].bootable == 0x80)) &&
+           (entries[0].file_system_type != 0) &&
+           !is_extended_partition(entries[0].file_system_type) &&
+           (entries[0].start_sector != 0) &&
+           (entries[0].sectors != 0) &&
+           (is_empty(entries[1]) || (is_extended_partition(entries[1].file_system_type) && (entries[1].start_sector != 0))) &&
+           is_empty(entries[2]) &&
+           is_empty(entries[3]);
+}
+
+template<typename Sector_size>
+static void classify_sector(
+    _In_reads_bytes_(sector_size) const uint8_t* sector,
+    Sector_size sector_size,
+    uint64_t sector_number,
+    _Inout_ std::vector<Candidate>* candidates)
+{
+    Candidate_kind kind;
+    Fat_geometry geometry;
+    if(fat_geometry_from_boot_sector(sector, sector_size, &geometry) && (geometry.bytes_per_sector == sector_size))
+    {
+        kind = Candidate_kind::fat;
+    }
+    else if(is_ntfs_boot_sector(sector, sector_size))
+    {
+        kind = Candidate_kind::ntfs;
+    }
+    else if(is_ebr(sector, sector_size))
+    {
+        kind = Candidate_kind::ebr;
+    }
+    else
+    {
+        return;
+    }
+
+    candidates->push_back(Candidate { sector_number, kind, std::vector<uint8_t>(sector, sector + sector_size) });
+}
+
+// A run of candidate sectors, count sectors apart from first_sector on.
+struct Recovery_block
+{
+    uint64_t first_sector;
+    uint64_t count;
+};
+
+static std::vector<Recovery_block> get_recovery_blocks(
+    const std::vector<std::pair<uint64_t, uint64_t>>& gaps,
+    uint32_t stride,
+    uint64_t candidates_per_block)
+{
+    std::vector<Recovery_block> blocks;
+    for(const auto& gap : gaps)
+    {
+        uint64_t sector = (gap.first + stride - 1) / stride * stride;
+        while(sector < gap.second)
+        {
+            const uint64_t count = std::min(candidates_per_block, (gap.second - sector + stride - 1) / stride);
+            blocks.push_back(Recovery_block { sector, count });
+            sector += count * stride;
+        }
+    }
+
+    return blocks;
+}
+
+// Reads the candidate sectors of a block, and keeps those that look like boot sectors.
+template<typename Sector_size>
+static void scan_recovery_block(
+    _In_ Block_device* device,
+    const Recovery_block& block,
+    const std::vector<uint32_t>& earlier_strides,
+    uint32_t stride,
+    Sector_size sector_size,
+    bool is_dense,
+    _Inout_ std::vector<uint8_t>* buffer,
+    _Inout_ std::vector<Candidate>* candidates)
+{
+    const auto is_new_candidate = [&earlier_strides](uint64_t sector)
+    {
+        return std::none_of(earlier_strides.cbegin(), earlier_strides.cend(), [sector](uint32_t earlier_stride)
+        {
+            return sector % earlier_stride == 0;
+        });
+    };
+
+    if(is_dense)
+    {
+        // One read covers every candidate in the block.
+        const size_t span = static_cast<size_t>(((block.count - 1) * stride + 1) * sector_size);
+        buffer->resize(span);
+        device->read(block.first_sector * sector_size, buffer->data(), span);
+
+        for(uint64_t index = 0; index < block.count; ++index)
+        {
+            const uint64_t sector = block.first_sector + index * stride;
+            if(is_new_candidate(sector))
+            {
+                classify_sector(buffer->data() + index * stride * sector_size, sector_size, sector, candidates);
+            }
+        }
+    }
+    else
+    {
+        buffer->resize(sector_size);
+        for(uint64_t index = 0; index < block.count; ++index)
+        {
+            const uint64_t sector = block.first_sector + index * stride;
+            if(is_new_candidate(sector))
+            {
+                device->read(sector * sector_size, buffer->data(), sector_size);
+                classify_sector(buffer->data(), sector_size, sector, candidates);
+            }
+        }
+    }
+}
+
+// Reads the candidate sectors of each block, and keeps those that look like boot sectors.
+static std::vector<Candidate> find_candidates(
+    const std::string& device_name,
+    const std::vector<std::pair<uint64_t, uint64_t>>& gaps,
+    const std::vector<uint32_t>& earlier_strides,
+    uint32_t stride,
+    unsigned int sector_size,
+    unsigned int thread_count)
+{
+    const bool is_dense = static_cast<uint64_t>(stride) * sector_size <= dense_stride_size;
+    const uint64_t candidates_per_block = is_dense ?
+                                          std::max<uint64_t>(recovery_block_size / (static_cast<uint64_t>(stride) * sector_size), 1) :
+                                          recovery_block_size / dense_stride_size;
+    const auto blocks = get_recovery_blocks(gaps, stride, candidates_per_block);
+
+    std::vector<std::vector<Candidate>> thread_candidates(thread_count);
+    std::vector<std::vector<uint8_t>> thread_buffers(thread_count);
+
+    // Compiled for 512 and 4096 byte sectors, so the sector offsets of the
+    // candidates are shifts.
+    with_sector_size(sector_size, [&](auto fixed_sector_size)
+    {
+        for_each_block_parallel(device_name, thread_count, blocks.size(), [&](_In_ Block_device* device, unsigned int thread_index, uint64_t block_index)
+        {
+            DISKTOOLS_TRACE_SPAN("recovery", "scan block");
+
+            scan_recovery_block(device,
+                                blocks[static_cast<size_t>(block_index)],
+                                earlier_strides,
+                                stride,
+                                fixed_sector_size,
+                                is_dense,
+                                &thread_buffers[thread_index],
+                                &thread_candidates[thread_index]);
+        });
+    });
+
+    std::vector<Candidate> candidates;
+    for(auto& worker_candidates : thread_candidates)
+    {
+        std::move(worker_candidates.begin(), worker_candidates.end(), std::back_inserter(candidates));
+    }
+
+    return candidates;
+}
+
+// Reads a sector, or returns an empty vector if it is past the end of the device.
+static std::vector<uint8_t> read_sector(_In_ Block_device* device, uint64_t sector)
+{
+    std::vector<uint8_t> contents;
+
+    const unsigned int sector_size = device->sector_size();
+    if(sector < device->size() / sector_size)
+    {
+        contents.resize(sector_size);
+        device->read(sector * sector_size, contents.data(), sector_size);
+    }
+
+    return contents;
+}
+
+static uint8_t get_fat_partition_type(const Fat_geometry& geometry, uint64_t end_sector) noexcept
+{
+    const bool needs_lba = end_sector > chs_sector_limit;
+    switch(geometry.type)
+    {
+        case Fat_type::fat12:
+            return file_system_type_fat12;
+
+        case Fat_type::fat16:
+            return needs_lba ? file_system_type_fat16_lba : ((geometry.total_sectors < 65536) ? file_system_type_fat16_small : file_system_type_fat16);
+
+        default:
+            return needs_lba ? file_system_type_fat32_lba : file_system_type_fat32;
+    }
+}
+
+// True if each FAT starts with the media descriptor, and the first sectors of the copies match.
+static bool are_fats_consistent(_In_ Block_device* device, uint64_t start_sector, const Fat_geometry& geometry)
+{
+    std::vector<uint8_t> first_table;
+    for(unsigned int table = 0; table < geometry.file_allocation_table_count; ++table)
+    {
+        const auto contents = read_sector(device, start_sector + geometry.reserved_sectors + static_cast<uint64_t>(table) * geometry.sectors_per_file_allocation_table);
+        if(contents.empty() || (contents[0] != geometry.media_descriptor) || (contents[1] != 0xff))
+        {
+            return false;
+        }
+
+        if(first_table.empty())
+        {
+            first_table = contents;
+        }
+        else if(contents != first_table)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool check_fat_candidate(_In_ Block_device* device, const Candidate& candidate, _Out_ Recovered_partition* partition)
+{
+    const uint64_t device_sectors = device->size() / device->sector_size();
+
+    Fat_geometry geometry;
+    fat_geometry_from_boot_sector(candidate.contents.data(), candidate.contents.size(), &geometry);
+
+    uint64_t start_sector = candidate.sector;
+    std::string evidence = (Fat_type::fat32 == geometry.type) ? u8"FAT32 boot sector" : ((Fat_type::fat16 == geometry.type) ? u8"FAT16 boot sector" : u8"FAT12 boot sector");
+    bool is_verified = are_fats_consistent(device, start_sector, geometry);
+
+    if(!is_verified && (geometry.backup_boot_sector != 0) && (candidate.sector >= geometry.backup_boot_sector))
+    {
+        // This may be the backup boot sector of a volume that lost its primary.
+        const uint64_t primary_sector = candidate.sector - geometry.backup_boot_sector;
+        if(are_fats_consistent(device, primary_sector, geometry))
+        {
+            if(read_sector(device, primary_sector) == candidate.contents)
+            {
+                // The primary is intact, and is found on its own.
+                return false;
+            }
+
+            start_sector = primary_sector;
+            evidence = u8"FAT32 backup boot sector";
+            is_verified = true;
+        }
+    }
+
+    if(start_sector + geometry.total_sectors > device_sectors)
+    {
+        return false;
+    }
+
+    if(is_verified)
+    {
+        evidence += u8", FAT copies agree";
+    }
+    if((geometry.backup_boot_sector != 0) && (start_sector == candidate.sector) &&
+       (read_sector(device, start_sector + geometry.backup_boot_sector) == candidate.contents))
+    {
+        evidence += u8", backup boot sector matches";
+        is_verified = true;
+    }
+
+    *partition = Recovered_partition();
+    partition->start_sector = start_sector;
+    partition->sector_count = geometry.total_sectors;
+    partition->file_system_type = get_fat_partition_type(geometry, start_sector + geometry.total_sectors);
+    partition->is_verified = is_verified;
+    partition->evidence = evidence;
+
+    return true;
+}
+
+static bool is_mft_at(_In_ Block_device* device, uint64_t start_sector, Structure_view<Ntfs_boot_sector_layout> boot_sector)
+{
+    typedef Ntfs_boot_sector_layout Layout;
+    const uint8_t sectors_per_cluster = boot_sector.get<Layout::sectors_per_cluster>();
+    const uint64_t mft_cluster = boot_sector.get<Layout::mft_cluster>();
+
+    // Cluster sizes over 64K are given as a negative power of two, which a
+    // recovery scan can treat as implausible.
+    if((sectors_per_cluster > 0x80) || (mft_cluster > UINT64_MAX / sectors_per_cluster))
+    {
+        return false;
+    }
+
+    const auto contents = read_sector(device, start_sector + mft_cluster * sectors_per_cluster);
+    return !contents.empty() && (memcmp(contents.data(), u8"FILE", 4) == 0);
+}
+
+static bool check_ntfs_candidate(_In_ Block_device* device, const Candidate& candidate, _Out_ Recovered_partition* partition)
+{
+    const uint64_t device_sectors = device->size() / device->sector_size();
+
+    const Structure_view<Ntfs_boot_sector_layout> boot_sector(candidate.contents.data(), candidate.contents.size());
+
+    // The copy of the boot sector is the sector after the end of the volume.
+    const uint64_t total_sectors = boot_sector.get<Ntfs_boot_sector_layout::total_sectors>();
+    uint64_t start_sector = candidate.sector;
+    std::string evidence = u8"NTFS boot sector";
+    bool is_verified = false;
+
+    if(is_mft_at(device, start_sector, boot_sector))
+    {
+        evidence += u8", MFT found";
+        is_verified = true;
+
+        if(read_sector(device, start_sector + total_sectors) == candidate.contents)
+        {
+            evidence += u8", backup boot sector matches";
+        }
+    }
+    else if((candidate.sector >= total_sectors) && is_mft_at(device, candidate.sector - total_sectors, boot_sector))
+    {
+        // This is the backup at the end of a volume.
+        start_sector = candidate.sector - total_sectors;
+        if(read_sector(device, start_sector) == candidate.contents)
+        {
+            // The primary is intact, and is found on its own.
+            return false;
+        }
+
+        evidence = u8"NTFS backup boot sector, MFT found";
+        is_verified = true;
+    }
+
+    if((total_sectors >= device_sectors) || (start_sector > device_sectors - total_sectors - 1))
+    {
+        return false;
+    }
+
+    *partition = Recovered_partition();
+    partition->start_sector = start_sector;
+    partition->sector_count = total_sectors + 1;
+    partition->file_system_type = file_system_type_ntfs;
+    partition->is_verified = is_verified;
+    partition->evidence = evidence;
+
+    return true;
+}
+
+static bool check_ebr_candidate(_In_ Block_device* device, const Candidate& candidate, _Out_ Recovered_partition* partition)
+{
+    const uint64_t device_sectors = device->size() / device->sector_size();
+
+    const auto entries = load_partition_table(Structure_view<Boot_record_layout>(candidate.contents.data(), candidate.contents.size()));
+
+    // The logical volume is relative to its EBR.
+    const uint64_t start_sector = candidate.sector + entries[0].start_sector;
+    if(start_sector + entries[0].sectors > device_sectors)
+    {
+        return false;
+    }
+
+    const auto boot_sector = read_sector(device, start_sector);
+
+    *partition = Recovered_partition();
+    partition->start_sector = start_sector;
+    partition->sector_count = entries[0].sectors;
+    partition->file_system_type = entries[0].file_system_type;
+    partition->is_logical = true;
+    partition->table_sector = candidate.sector;
+    partition->is_verified = !boot_sector.empty() && has_boot_signature(Structure_view<Boot_record_layout>(boot_sector.data(), boot_sector.size()));
+    partition->evidence = partition->is_verified ? u8"EBR, boot sector found" : u8"EBR";
+
+    return true;
+}
+
+// Combines what is known about volumes that start at the same sector, so an EBR
+// and the boot sector of the volume it describes become one logical volume.
+static void merge_partition(const Recovered_partition& partition, _Inout_ std::vector<Recovered_partition>* partitions)
+{
+    const auto existing = std::find_if(partitions->begin(), partitions->end(), [&partition](const Recovered_partition& other)
+    {
+        return other.start_sector == partition.start_sector;
+    });
+
+    if(existing == partitions->end())
+    {
+        partitions->push_back(partition);
+    }
+    else
+    {
+        // The boot sector gives a better size and type than the EBR.
+        Recovered_partition merged = partition.is_logical ? *existing : partition;
+        const Recovered_partition& ebr = partition.is_logical ? partition : *existing;
+        if(ebr.is_logical)
+        {
+            merged.is_logical = true;
+            merged.table_sector = ebr.table_sector;
+            merged.evidence += u8", " + ebr.evidence;
+        }
+        merged.is_verified = existing->is_verified || partition.is_verified;
+        *existing = merged;
+    }
+}
+
+// Keeps the most trustworthy volumes that do not overlap, preferring verified
+// volumes, then earlier ones, then larger ones, so a volume wins over anything
+// found inside it.
+static std::vector<Recovered_partition> select_partitions(std::vector<Recovered_partition> partitions)
+{
+    std::sort(partitions.begin(), partitions.end(), [](const Recovered_partition& left, const Recovered_partition& right)
+    {
+        return std::make_tuple(!left.is_verified, left.start_sector, UINT64_MAX - left.sector_count) <
+               std::make_tuple(!right.is_verified, right.start_sector, UINT64_MAX - right.sector_count);
+    });
+
+    std::vector<Recovered_partition> selected;
+    for(const auto& partition : partitions)
+    {
+        const bool overlaps = std::any_of(selected.cbegin(), selected.cend(), [&partition](const Recovered_partition& other)
+        {
+            return (partition.start_sector < other.start_sector + other.sector_count) &&
+                   (other.start_sector < partition.start_sector + partition.sector_count);
+        });
+        if(!overlaps)
+        {
+            selected.push_back(partition);
+        }
+    }
+
+    std::sort(selected.begin(), selected.end(), [](const Recovered_partition& left, const Recovered_partition& right)
+    {
+        return left.start_sector < right.start_sector;
+    });
+
+    return selected;
+}
+
+// The ranges of the device that are not inside any volume.  Sector zero holds
+// the partition table that is being rebuilt, so it is never a candidate.
+static std::vector<std::pair<uint64_t, uint64_t>> get_gaps(const std::vector<Recovered_partition>& partitions, uint64_t device_sectors)
+{
+    std::vector<std::pair<uint64_t, uint64_t>> gaps;
+
+    uint64_t start = 1;
+    for(const auto& partition : partitions)
+    {
+        if(partition.start_sector > start)
+        {
+            gaps.emplace_back(start, partition.start_sector);
+        }
+        start = std::max(start, partition.start_sector + partition.sector_count);
+    }
+    if(device_sectors > start)
+    {
+        gaps.emplace_back(start, device_sectors);
+    }
+
+    return gaps;
+}
+
+std::vector<uint32_t> default_recovery_strides(unsigned int sector_size)
+{
+    std::vector<uint32_t> strides { std::max<uint32_t>(1024 * 1024 / sector_size, 1) };
+
+    // Only disks with 512 byte sectors predate 1MB alignment.
+    if(512 == sector_size)
+    {
+        strides.push_back(chs_sectors_per_track);
+    }
+
+    return strides;
+}
+
+std::vector<Recovered_partition> find_lost_partitions(
+    const std::string& device_name,
+    const std::vector<uint32_t>& strides,
+    unsigned int thread_count)
+{
+    CHECK_EXCEPTION(std::all_of(strides.cbegin(), strides.cend(), [](uint32_t stride) { return stride > 0; }), u8"Strides must be at least one sector.");
+
+    const auto device = open_disk_or_device(device_name);
+    const unsigned int sector_size = device->sector_size();
+    const uint64_t device_sectors = device->size() / sector_size;
+    CHECK_EXCEPTION(sector_size >= 512, u8"Sectors must be at least 512 bytes to hold a boot sector.");
+
+    std::vector<Recovered_partition> partitions;
+    std::vector<uint32_t> earlier_strides;
+    for(const auto stride : strides)
+    {
+        DISKTOOLS_TRACE_SPAN("recovery", "stride pass");
+
+        const auto candidates = find_candidates(device_name, get_gaps(partitions, device_sectors), earlier_strides, stride, sector_size, thread_count);
+
+        // Checking reads only a few sectors per candidate, so it is done on one thread.
+        std::vector<Recovered_partition> found = partitions;
+        for(const auto& candidate : candidates)
+        {
+            Recovered_partition partition;
+            bool is_plausible;
+            switch(candidate.kind)
+            {
+                case Candidate_kind::fat:
+                    is_plausible = check_fat_candidate(device.get(), candidate, &partition);
+                    break;
+
+                case Candidate_kind::ntfs:
+                    is_plausible = check_ntfs_candidate(device.get(), candidate, &partition);
+                    break;
+
+                default:
+                    is_plausible = check_ebr_candidate(device.get(), candidate, &partition);
+                    break;
+            }
+
+            if(is_plausible)
+            {
+                merge_partition(partition, &found);
+            }
+        }
+
+        partitions = select_partitions(std::move(found));
+        earlier_strides.push_back(stride);
+    }
+
+    return partitions;
+}
+
+static Partition_table_entry make_partition_table_entry(uint64_t start_sector, uint64_t sector_count, uint8_t file_system_type) noexcept
+{
+    Partition_table_entry entry = {};
+    entry.file_system_type = file_system_type;
+    entry.start_sector = static_cast<uint32_t>(start_sector);
+    entry.sectors = static_cast<uint32_t>(sector_count);
+    set_chs_address(start_sector, &entry.begin_head, &entry.begin_sector, &entry.begin_cylinder);
+    set_chs_address(start_sector + sector_count - 1, &entry.end_head, &entry.end_sector, &entry.end_cylinder);
+
+    return entry;
+}
+
+std::array<Partition_table_entry, partition_table_entry_count> propose_partition_table(const std::vector<Recovered_partition>& partitions)
+{
+    const auto fits_in_mbr = [](uint64_t start_sector, uint64_t sector_count)
+    {
+        return (start_sector <= UINT32_MAX) && (sector_count <= UINT32_MAX);
+    };
+
+    // The extended partition starts at the first EBR, and ends with the last logical volume.
+    uint64_t extended_start = UINT64_MAX;
+    uint64_t extended_end = 0;
+    for(const auto& partition : partitions)
+    {
+        if(partition.is_logical)
+        {
+            extended_start = std::min(extended_start, partition.table_sector);
+            extended_end = std::max(extended_end, partition.start_sector + partition.sector_count);
+        }
+    }
+    const bool has_extended = (extended_end != 0) && fits_in_mbr(extended_start, extended_end - extended_start);
+
+    std::vector<Partition_table_entry> entries;
+    if(has_extended)
+    {
+        entries.push_back(make_partition_table_entry(extended_start, extended_end - extended_start, file_system_type_extended_lba));
+    }
+
+    for(const auto& partition : partitions)
+    {
+        const bool is_inside_extended = has_extended && (partition.start_sector >= extended_start) && (partition.start_sector < extended_end);
+        if(!partition.is_logical && !is_inside_extended && (entries.size() < partition_table_entry_count) &&
+           fits_in_mbr(partition.start_sector, partition.sector_count))
+        {
+            entries.push_back(make_partition_table_entry(partition.start_sector, partition.sector_count, partition.file_system_type));
+        }
+    }
+
+    // Entries are conventionally in disk order.
+    std::sort(entries.begin(), entries.end(), [](const Partition_table_entry& left, const Partition_table_entry& right)
+    {
+        return left.start_sector < right.start_sector;
+    });
+
+    std::array<Partition_table_entry, partition_table_entry_count> table = {};
+    std::copy(entries.cbegin(), entries.cend(), table.begin());
+
+    return table;
+}
+
+}
+
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "DirectRead.h"
+
+namespace DiskTools
+{
+
+// A volume found on disk without the help of the partition table.
+struct Recovered_partition
+{
+    uint64_t start_sector;
+    uint64_t sector_count;
+    uint8_t file_system_type;   // Partition table type, such as 0x07 for NTFS.
+    bool is_logical;            // Described by an EBR, so it belongs in an extended partition.
+    uint64_t table_sector;      // The EBR that describes a logical partition.
+    bool is_verified;           // A backup copy or a second structure agrees with the boot sector.
+    std::string evidence;
+};
+
+// Partitions start on 1MB boundaries on current versions of Windows, and on
+// track boundaries (63 sectors) on older ones, so those are scanned first.
+std::vector<uint32_t> default_recovery_strides(unsigned int sector_size);
+
+// Looks for FAT and NTFS boot sectors and EBRs at multiples of each stride in
+// turn, coarsest first.  Each pass only reads the sectors that are not inside a
+// volume found by an earlier pass, so a stride of 1 can follow to check every
+// sector that remains.  Candidates are checked against their backups (the FAT32
+// backup boot sector, the NTFS boot sector copy at the end of the volume, the
+// second FAT), and a volume whose primary boot sector is gone is found through
+// its backup.  Returns non-overlapping volumes, sorted by start sector.
+std::vector<Recovered_partition> find_lost_partitions(
+    const std::string& device_name,
+    const std::vector<uint32_t>& strides,
+    unsigned int thread_count);
+
+// Builds an MBR partition table from recovered volumes.  Logical volumes go
+// into one extended partition that spans their EBRs.  Volumes that do not fit
+// in four entries or in 32-bit sector numbers are left out.  CHS values assume
+// 255 heads and 63 sectors per track.
+std::array<Partition_table_entry, partition_table_entry_count> propose_partition_table(const std::vector<Recovered_partition>& partitions);
+
+}
+
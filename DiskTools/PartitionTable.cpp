@@ -0,0 +1,386 @@
+#include "PreCompile.h"
+#include "PartitionTable.h" // Pick up forward declarations to ensure correctness.
+#include "BlockDevice.h"
+#include "DirectRead.h"
+#include "Hash.h"
+#include <PortableRuntime/CheckException.h>
+
+namespace DiskTools
+{
+
+constexpr uint8_t file_system_type_gpt = 0xee;
+
+// A corrupt EBR chain can loop, so the walk gives up after this many links.
+constexpr unsigned int maximum_logical_partitions = 128;
+
+// Entries beyond this are ignored, which is four times the usual count.
+constexpr uint32_t maximum_gpt_entries = 512;
+
+constexpr uint16_t boot_record_signature = 0xaa55;
+
+struct Gpt_header_layout
+{
+    static constexpr size_t size = 92;
+    typedef Byte_array_field<0, 8> signature;
+    typedef Little_endian_field<uint32_t, 8> revision;
+    typedef Little_endian_field<uint32_t, 12> header_size;
+    typedef Little_endian_field<uint32_t, 16> header_crc32;
+    typedef Little_endian_field<uint64_t, 24> current_lba;
+    typedef Little_endian_field<uint64_t, 32> backup_lba;
+    typedef Little_endian_field<uint64_t, 40> first_usable_lba;
+    typedef Little_endian_field<uint64_t, 48> last_usable_lba;
+    typedef Byte_array_field<56, 16> disk_guid;
+    typedef Little_endian_field<uint64_t, 72> partition_entry_lba;
+    typedef Little_endian_field<uint32_t, 80> partition_entry_count;
+    typedef Little_endian_field<uint32_t, 84> partition_entry_size;
+    typedef Little_endian_field<uint32_t, 88> partition_entry_array_crc32;
+};
+
+struct Gpt_partition_entry_layout
+{
+    static constexpr size_t size = 128;
+    typedef Byte_array_field<0, 16> partition_type_guid;
+    typedef Byte_array_field<16, 16> unique_partition_guid;
+    typedef Little_endian_field<uint64_t, 32> first_lba;
+    typedef Little_endian_field<uint64_t, 40> last_lba;     // Inclusive.
+    typedef Little_endian_field<uint64_t, 48> attributes;
+    typedef Byte_array_field<56, 72> partition_name;        // UTF-16.
+};
+
+static constexpr uint8_t gpt_signature[8] = { 'E', 'F', 'I', ' ', 'P', 'A', 'R', 'T' };
+
+bool has_boot_signature(Structure_view<Boot_record_layout> boot_record) noexcept
+{
+    return boot_record.get<Boot_record_layout::boot_signature>() == boot_record_signature;
+}
+
+static Partition_table_entry load_partition_table_entry(Structure_view<Partition_table_entry_layout> entry) noexcept
+{
+    typedef Partition_table_entry_layout Layout;
+
+    Partition_table_entry value;
+    value.bootable = entry.get<Layout::bootable>();
+    value.begin_head = entry.get<Layout::begin_head>();
+    value.begin_sector = entry.get<Layout::begin_sector>();
+    value.begin_cylinder = entry.get<Layout::begin_cylinder>();
+    value.file_system_type = entry.get<Layout::file_system_type>();
+    value.end_head = entry.get<Layout::end_head>();
+    value.end_sector = entry.get<Layout::end_sector>();
+    value.end_cylinder = entry.get<Layout::end_cylinder>();
+    value.start_sector = entry.get<Layout::start_sector>();
+    value.sectors = entry.get<Layout::sectors>();
+
+    return value;
+}
+
+static void store_partition_table_entry(Mutable_structure_view<Partition_table_entry_layout> entry, const Partition_table_entry& value) noexcept
+{
+    typedef Partition_table_entry_layout Layout;
+
+    entry.set<Layout::bootable>(value.bootable);
+    entry.set<Layout::begin_head>(value.begin_head);
+    entry.set<Layout::begin_sector>(value.begin_sector);
+    entry.set<Layout::begin_cylinder>(value.begin_cylinder);
+    entry.set<Layout::file_system_type>(value.file_system_type);
+    entry.set<Layout::end_head>(value.end_head);
+    entry.set<Layout::end_sector>(value.end_sector);
+    entry.set<Layout::end_cylinder>(value.end_cylinder);
+    entry.set<Layout::start_sector>(value.start_sector);
+    entry.set<Layout::sectors>(value.sectors);
+}
+
+std::array<Partition_table_entry, partition_table_entry_count> load_partition_table(Structure_view<Boot_record_layout> boot_record)
+{
+    std::array<Partition_table_entry, partition_table_entry_count> table;
+    for(unsigned int index = 0; index < partition_table_entry_count; ++index)
+    {
+        table[index] = load_partition_table_entry(boot_record.nested<Partition_table_entry_layout>(
+            Boot_record_layout::partition_table_offset + index * Partition_table_entry_layout::size));
+    }
+
+    return table;
+}
+
+void store_partition_table(
+    Mutable_structure_view<Boot_record_layout> boot_record,
+    const std::array<Partition_table_entry, partition_table_entry_count>& table)
+{
+    for(unsigned int index = 0; index < partition_table_entry_count; ++index)
+    {
+        store_partition_table_entry(boot_record.nested<Partition_table_entry_layout>(
+            Boot_record_layout::partition_table_offset + index * Partition_table_entry_layout::size), table[index]);
+    }
+}
+
+static std::vector<uint8_t> read_sector(_In_ Block_device* device, uint64_t sector, _Inout_opt_ Partition_table_sectors* table_sectors)
+{
+    std::vector<uint8_t> buffer(device->sector_size());
+    device->read(sector * buffer.size(), buffer.data(), buffer.size());
+
+    if(table_sectors != nullptr)
+    {
+        table_sectors->sectors.push_back(sector);
+        table_sectors->contents.insert(table_sectors->contents.end(), buffer.cbegin(), buffer.cend());
+    }
+
+    return buffer;
+}
+
+// Returns the table of a sector that ends in a boot signature, or false.
+static bool read_partition_table(
+    _In_ Block_device* device,
+    uint64_t sector,
+    _Out_ std::array<Partition_table_entry, partition_table_entry_count>* table,
+    _Inout_opt_ Partition_table_sectors* table_sectors)
+{
+    const auto buffer = read_sector(device, sector, table_sectors);
+    if(buffer.size() < Boot_record_layout::size)
+    {
+        return false;
+    }
+
+    const Structure_view<Boot_record_layout> boot_record(buffer.data(), buffer.size());
+    if(!has_boot_signature(boot_record))
+    {
+        return false;
+    }
+
+    *table = load_partition_table(boot_record);
+    return true;
+}
+
+// The entry that an MBR would hold for a partition, as hybrid MBRs do.
+static Partition_table_entry mbr_entry_for(uint64_t start_sector, uint64_t sector_count, uint8_t file_system_type) noexcept
+{
+    Partition_table_entry entry{};
+    entry.file_system_type = file_system_type;
+    entry.start_sector = static_cast<uint32_t>(std::min<uint64_t>(start_sector, UINT32_MAX));
+    entry.sectors = static_cast<uint32_t>(std::min<uint64_t>(sector_count, UINT32_MAX));
+    set_chs_address(start_sector, &entry.begin_head, &entry.begin_sector, &entry.begin_cylinder);
+    set_chs_address(start_sector + sector_count - 1, &entry.end_head, &entry.end_sector, &entry.end_cylinder);
+
+    return entry;
+}
+
+static void read_gpt_layout(
+    _In_ Block_device* device,
+    _Inout_ std::vector<Partition_location>* partitions,
+    _Inout_opt_ Partition_table_sectors* table_sectors)
+{
+    const auto header_sector = read_sector(device, 1, table_sectors);
+    CHECK_EXCEPTION(header_sector.size() >= Gpt_header_layout::size, u8"The sector size is too small for a GPT header.");
+
+    typedef Gpt_header_layout Header;
+    const Structure_view<Header> header(header_sector.data(), header_sector.size());
+    const uint32_t entry_size = header.get<Header::partition_entry_size>();
+    if(!std::equal(std::cbegin(gpt_signature), std::cend(gpt_signature), header.get<Header::signature>()) ||
+       (entry_size < Gpt_partition_entry_layout::size) ||
+       (entry_size % 8 != 0))
+    {
+        return;
+    }
+
+    const uint64_t entry_lba = header.get<Header::partition_entry_lba>();
+    const uint32_t entry_count = std::min(header.get<Header::partition_entry_count>(), maximum_gpt_entries);
+    const uint64_t sector_count = device->size() / device->sector_size();
+    const uint64_t array_size = static_cast<uint64_t>(entry_count) * entry_size;
+    const uint64_t array_offset = entry_lba * device->sector_size();
+    if((entry_lba < 2) ||
+       (entry_lba >= sector_count) ||
+       (array_size > device->size() - array_offset))
+    {
+        return;
+    }
+
+    std::vector<uint8_t> entries(static_cast<size_t>(array_size));
+    device->read(array_offset, entries.data(), entries.size());
+
+    typedef Gpt_partition_entry_layout Entry;
+    for(uint32_t index = 0; index < entry_count; ++index)
+    {
+        const Structure_view<Entry> entry(entries.data(), entries.size(), static_cast<size_t>(index) * entry_size);
+
+        // An all zero type GUID marks an unused entry.
+        const uint8_t* type_guid = entry.get<Entry::partition_type_guid>();
+        const bool is_unused = std::all_of(type_guid, type_guid + Entry::partition_type_guid::size, [](uint8_t value)
+        {
+            return value == 0;
+        });
+        const uint64_t first_lba = entry.get<Entry::first_lba>();
+        const uint64_t last_lba = entry.get<Entry::last_lba>();
+        if(is_unused || (last_lba < first_lba))
+        {
+            continue;
+        }
+
+        const uint64_t partition_sectors = last_lba - first_lba + 1;
+        partitions->push_back(Partition_location { index + 1,
+                                                   first_lba,
+                                                   partition_sectors,
+                                                   file_system_type_gpt,
+                                                   false,
+                                                   true,
+                                                   mbr_entry_for(first_lba, partition_sectors, file_system_type_gpt) });
+    }
+}
+
+static void read_logical_partitions(
+    _In_ Block_device* device,
+    uint64_t extended_start,
+    _Inout_ std::vector<Partition_location>* partitions,
+    _Inout_opt_ Partition_table_sectors* table_sectors)
+{
+    // The first entry of each EBR is relative to that EBR, and the link to the
+    // next EBR is relative to the start of the extended partition.
+    uint64_t table_sector = extended_start;
+    for(unsigned int link = 0; link < maximum_logical_partitions; ++link)
+    {
+        std::array<Partition_table_entry, partition_table_entry_count> table;
+        if(!read_partition_table(device, table_sector, &table, table_sectors))
+        {
+            break;
+        }
+
+        if((table[0].file_system_type != 0) && (table[0].sectors != 0))
+        {
+            const auto number = static_cast<unsigned int>(partitions->size()) + 1;
+            partitions->push_back(Partition_location { number, table_sector + table[0].start_sector, table[0].sectors, table[0].file_system_type, true, false, table[0] });
+        }
+
+        if(!is_extended_partition(table[1].file_system_type) || (table[1].start_sector == 0))
+        {
+            break;
+        }
+        table_sector = extended_start + table[1].start_sector;
+    }
+}
+
+std::vector<Partition_location> read_partition_layout(_In_ Block_device* device, _Out_opt_ Partition_table_sectors* table_sectors)
+{
+    std::vector<Partition_location> partitions;
+    if(table_sectors != nullptr)
+    {
+        table_sectors->sectors.clear();
+        table_sectors->contents.clear();
+    }
+
+    std::array<Partition_table_entry, partition_table_entry_count> table;
+    if((device->size() < device->sector_size()) || !read_partition_table(device, 0, &table, table_sectors))
+    {
+        return partitions;
+    }
+
+    const bool is_protective_mbr = std::any_of(table.cbegin(), table.cend(), [](const Partition_table_entry& entry)
+    {
+        return entry.file_system_type == file_system_type_gpt;
+    });
+    if(is_protective_mbr && (device->size() >= 2ull * device->sector_size()))
+    {
+        read_gpt_layout(device, &partitions, table_sectors);
+        if(!partitions.empty())
+        {
+            return partitions;
+        }
+    }
+
+    // Number the primary entries first, as Windows and Linux both do.
+    for(unsigned int index = 0; index < partition_table_entry_count; ++index)
+    {
+        const auto& entry = table[index];
+        if((entry.file_system_type != 0) && (entry.sectors != 0) && !is_extended_partition(entry.file_system_type))
+        {
+            partitions.push_back(Partition_location { index + 1, entry.start_sector, entry.sectors, entry.file_system_type, false, false, entry });
+        }
+    }
+
+    const auto extended = std::find_if(table.cbegin(), table.cend(), [](const Partition_table_entry& entry)
+    {
+        return is_extended_partition(entry.file_system_type) && (entry.start_sector != 0);
+    });
+    if(extended != table.cend())
+    {
+        // Logical partitions are numbered after the four primary slots.
+        std::vector<Partition_location> logical_partitions;
+        read_logical_partitions(device, extended->start_sector, &logical_partitions, table_sectors);
+        for(auto& partition : logical_partitions)
+        {
+            partition.number += partition_table_entry_count;
+            partitions.push_back(partition);
+        }
+    }
+
+    return partitions;
+}
+
+Partition_table_fingerprint make_partition_table_fingerprint(_In_ const Block_device* device, Partition_table_sectors table_sectors)
+{
+    return Partition_table_fingerprint { device->size(),
+                                         device->sector_size(),
+                                         hash64(table_sectors.contents.data(), table_sectors.contents.size()),
+                                         std::move(table_sectors.sectors) };
+}
+
+bool matches_partition_table_fingerprint(_In_ Block_device* device, const Partition_table_fingerprint& fingerprint)
+{
+    if((device->size() != fingerprint.device_size) || (device->sector_size() != fingerprint.sector_size))
+    {
+        return false;
+    }
+
+    const auto& sectors = fingerprint.table_sectors;
+    const size_t sector_size = device->sector_size();
+    std::vector<uint8_t> contents(sectors.size() * sector_size);
+
+    size_t index = 0;
+    while(index < sectors.size())
+    {
+        size_t run = 1;
+        while((index + run < sectors.size()) && (sectors[index + run] == sectors[index] + run))
+        {
+            ++run;
+        }
+
+        device->read(sectors[index] * sector_size, contents.data() + index * sector_size, run * sector_size);
+        index += run;
+    }
+
+    return hash64(contents.data(), contents.size()) == fingerprint.table_hash;
+}
+
+void set_chs_address(uint64_t sector, _Out_ uint8_t* head, _Out_ uint8_t* sector_and_cylinder_high, _Out_ uint8_t* cylinder) noexcept
+{
+    // Sectors past the reach of CHS use the largest value, and rely on the LBA fields.
+    uint32_t cylinder_number = 1023;
+    uint32_t head_number = chs_heads - 1;
+    uint32_t sector_number = chs_sectors_per_track;
+    if(sector < chs_sector_limit)
+    {
+        cylinder_number = static_cast<uint32_t>(sector / (chs_heads * chs_sectors_per_track));
+        head_number = static_cast<uint32_t>(sector / chs_sectors_per_track % chs_heads);
+        sector_number = static_cast<uint32_t>(sector % chs_sectors_per_track + 1);
+    }
+
+    *head = static_cast<uint8_t>(head_number);
+    *sector_and_cylinder_high = static_cast<uint8_t>(sector_number | ((cylinder_number >> 2) & 0xc0));
+    *cylinder = static_cast<uint8_t>(cylinder_number);
+}
+
+std::vector<const Partition_location*> partitions_overlapping(
+    const std::vector<Partition_location>& partitions,
+    uint64_t start_sector,
+    uint64_t sector_count)
+{
+    std::vector<const Partition_location*> overlapping;
+    for(const auto& partition : partitions)
+    {
+        if((partition.start_sector < start_sector + sector_count) && (start_sector < partition.start_sector + partition.sector_count))
+        {
+            overlapping.push_back(&partition);
+        }
+    }
+
+    return overlapping;
+}
+
+}
+
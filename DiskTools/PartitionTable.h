@@ -0,0 +1,112 @@
+#pragma once
+
+#include "DirectRead.h"
+#include "FieldView.h"
+
+namespace DiskTools
+{
+
+class Block_device;
+
+// CHS addressing with 255 heads and 63 sectors per track ends at cylinder 1024.
+constexpr uint32_t chs_heads = 255;
+constexpr uint32_t chs_sectors_per_track = 63;
+constexpr uint64_t chs_sector_limit = 1024 * chs_heads * chs_sectors_per_track;
+
+// The layout of an MBR partition table entry, as Partition_table_entry holds it.
+struct Partition_table_entry_layout
+{
+    static constexpr size_t size = 16;
+    typedef Little_endian_field<uint8_t, 0> bootable;
+    typedef Little_endian_field<uint8_t, 1> begin_head;
+    typedef Little_endian_field<uint8_t, 2> begin_sector;
+    typedef Little_endian_field<uint8_t, 3> begin_cylinder;
+    typedef Little_endian_field<uint8_t, 4> file_system_type;
+    typedef Little_endian_field<uint8_t, 5> end_head;
+    typedef Little_endian_field<uint8_t, 6> end_sector;
+    typedef Little_endian_field<uint8_t, 7> end_cylinder;
+    typedef Little_endian_field<uint32_t, 8> start_sector;
+    typedef Little_endian_field<uint32_t, 12> sectors;
+};
+
+static_assert(Partition_table_entry_layout::size == sizeof(Partition_table_entry), "Partition_table_entry is an on-disk structure.");
+
+// The first 512 bytes of an MBR or EBR, whatever the sector size.  The partition
+// table immediately precedes the boot signature.
+struct Boot_record_layout
+{
+    static constexpr size_t size = 512;
+    static constexpr size_t partition_table_offset = 510 - Partition_table_entry_layout::size * partition_table_entry_count;
+    typedef Little_endian_field<uint16_t, 510> boot_signature;
+};
+
+// True if the boot record ends in 0x55 0xAA.
+bool has_boot_signature(Structure_view<Boot_record_layout> boot_record) noexcept;
+
+// Reads and writes the partition table of an MBR or EBR.
+std::array<Partition_table_entry, partition_table_entry_count> load_partition_table(Structure_view<Boot_record_layout> boot_record);
+void store_partition_table(
+    Mutable_structure_view<Boot_record_layout> boot_record,
+    const std::array<Partition_table_entry, partition_table_entry_count>& table);
+
+// A partition described by the partition table of a disk or image.
+struct Partition_location
+{
+    unsigned int number;        // Numbered from one in table order, MBR entries before logical partitions.
+    uint64_t start_sector;
+    uint64_t sector_count;
+    uint8_t file_system_type;   // MBR partition type.  GPT partitions are reported as 0xEE.
+    bool is_logical;            // Described by an EBR in an extended partition.
+    bool is_gpt;
+
+    // The MBR or EBR entry as stored, so the start sector of a logical partition
+    // is relative to its EBR.  GPT partitions get the entry that an MBR would
+    // hold for them, with sector fields clamped to 32 bits.
+    Partition_table_entry table_entry;
+};
+
+// The sectors that a partition layout was read from, in the order they were read.
+struct Partition_table_sectors
+{
+    std::vector<uint64_t> sectors;
+    std::vector<uint8_t> contents;      // Each sector of sectors, one after another.
+};
+
+// Identifies the partition tables of a device, so that a change to them is
+// found by hashing a few sectors rather than walking the tables again.
+struct Partition_table_fingerprint
+{
+    uint64_t device_size;
+    unsigned int sector_size;
+    uint64_t table_hash;                // hash64 of the table sectors, one after another.
+    std::vector<uint64_t> table_sectors;
+};
+
+// Reads the partitions of an MBR disk, following the EBR chain of an extended
+// partition, or of a GPT disk when the MBR holds a protective entry.  Extended
+// partition entries themselves are not returned.  A device without a valid MBR
+// has no partitions.  Throws if the device cannot be read.
+// If table_sectors is not null, it receives the MBR, the GPT header, and each
+// EBR that was read.  The GPT partition entries are not included, as the GPT
+// header holds their CRC.
+std::vector<Partition_location> read_partition_layout(_In_ Block_device* device, _Out_opt_ Partition_table_sectors* table_sectors = nullptr);
+
+// Returns the fingerprint of the tables that read_partition_layout reported in table_sectors.
+Partition_table_fingerprint make_partition_table_fingerprint(_In_ const Block_device* device, Partition_table_sectors table_sectors);
+
+// Returns true if the device has the size and sector size of the fingerprint, and
+// its table sectors still hash to the same value.  Adjacent sectors, such as the
+// MBR and the GPT header, are read at once.  Throws if the device cannot be read.
+bool matches_partition_table_fingerprint(_In_ Block_device* device, const Partition_table_fingerprint& fingerprint);
+
+// Encodes a sector number as an MBR CHS address, with 255 heads and 63 sectors per track.
+void set_chs_address(uint64_t sector, _Out_ uint8_t* head, _Out_ uint8_t* sector_and_cylinder_high, _Out_ uint8_t* cylinder) noexcept;
+
+// Returns the partitions that overlap [start_sector, start_sector + sector_count).
+std::vector<const Partition_location*> partitions_overlapping(
+    const std::vector<Partition_location>& partitions,
+    uint64_t start_sector,
+    uint64_t sector_count);
+
+}
+
@@ -1,12 +1,29 @@
 #pragma once
 
 #include <cassert>
+#include <cmath>
+#include <cstddef>
 #include <cstdint>
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <exception>
+#include <fstream>
 #include <functional>
+#include <iterator>
 #include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 #include <tchar.h>
 #include <windows.h>
+#include <intrin.h>
 #include <commctrl.h>
 #include <strsafe.h>
 
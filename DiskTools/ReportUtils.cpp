@@ -0,0 +1,41 @@
+#include "PreCompile.h"
+#include "ReportUtils.h"    // Pick up forward declarations to ensure correctness.
+#include "OutputSink.h"
+#include <PortableRuntime/CheckException.h>
+
+namespace DiskTools
+{
+
+std::string format_microseconds(uint64_t ticks, uint64_t tick_frequency)
+{
+    char buffer[32];
+    CHECK_EXCEPTION(SUCCEEDED(StringCchPrintfA(buffer, ARRAYSIZE(buffer), "%.3f", ticks * 1000000.0 / tick_frequency)), u8"Formatting failed.");
+    return buffer;
+}
+
+std::string json_escape(const std::string& value)
+{
+    std::string escaped;
+    for(const char ch : value)
+    {
+        if(('"' == ch) || ('\\' == ch))
+        {
+            escaped.push_back('\\');
+            escaped.push_back(ch);
+        }
+        else if(static_cast<unsigned char>(ch) < 0x20)
+        {
+            escaped += u8"\\u";
+            append_hex(&escaped, static_cast<unsigned char>(ch), 4);
+        }
+        else
+        {
+            escaped.push_back(ch);
+        }
+    }
+
+    return escaped;
+}
+
+}
+
@@ -0,0 +1,29 @@
+#pragma once
+
+namespace DiskTools
+{
+
+// Timings are kept in performance counter ticks, and converted for reports.
+inline uint64_t get_ticks() noexcept
+{
+    LARGE_INTEGER ticks;
+    QueryPerformanceCounter(&ticks);
+    return ticks.QuadPart;
+}
+
+inline uint64_t get_tick_frequency() noexcept
+{
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    return frequency.QuadPart;
+}
+
+// Formats ticks as microseconds, with three decimal places.
+std::string format_microseconds(uint64_t ticks, uint64_t tick_frequency);
+
+// Escapes text for use inside a JSON string.  Quotes, backslashes, and control
+// characters are escaped.  Other UTF-8 is passed through.
+std::string json_escape(const std::string& value);
+
+}
+
@@ -0,0 +1,48 @@
+#pragma once
+
+namespace DiskTools
+{
+
+// Logical sector sizes.  512e disks have 4096 byte physical sectors, but report,
+// and are addressed in, 512 byte sectors.  4Kn disks report 4096.
+constexpr unsigned int legacy_sector_size = 512;
+constexpr unsigned int advanced_format_sector_size = 4096;
+
+// The largest logical sector size that the tools accept.
+constexpr unsigned int maximum_sector_size = 4096;
+
+// True for powers of two from 512 to maximum_sector_size, which covers disks,
+// 4Kn disks, and the 2048 byte sectors of CD drives.
+constexpr bool is_supported_sector_size(unsigned int sector_size) noexcept
+{
+    return (sector_size >= legacy_sector_size) && (sector_size <= maximum_sector_size) && ((sector_size & (sector_size - 1)) == 0);
+}
+
+// A sector size known at compile time.  It converts to unsigned int, so code
+// written against a sector size parameter accepts either.
+template<unsigned int Size>
+using Fixed_sector_size = std::integral_constant<unsigned int, Size>;
+
+// Calls process with Fixed_sector_size<512> or Fixed_sector_size<4096> when
+// sector_size is one of those, and with sector_size otherwise.  process is a
+// generic lambda or function template, so it is compiled once for each common
+// size, with sector offsets and alignment masks folded to constants, and once
+// for any other size.
+template<typename Function>
+auto with_sector_size(unsigned int sector_size, Function&& process) -> decltype(process(sector_size))
+{
+    switch(sector_size)
+    {
+        case legacy_sector_size:
+            return process(Fixed_sector_size<legacy_sector_size>());
+
+        case advanced_format_sector_size:
+            return process(Fixed_sector_size<advanced_format_sector_size>());
+
+        default:
+            return process(sector_size);
+    }
+}
+
+}
+
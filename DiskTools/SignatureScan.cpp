@@ -0,0 +1,289 @@
+#include "PreCompile.h"
+#include "SignatureScan.h"  // Pick up forward declarations to ensure correctness.
+#include "BlockDevice.h"
+#include "ParallelScan.h"
+#include "Trace.h"
+#include <PortableRuntime/CheckException.h>
+
+namespace DiskTools
+{
+
+// Signatures with an alignment at least this large are checked at each aligned
+// position.  Smaller alignments are found with the vector search below.
+constexpr unsigned int stride_alignment = 16;
+
+static Signature make_signature(_In_z_ const char* name, const std::string& pattern, unsigned int pattern_offset, unsigned int alignment)
+{
+    return Signature { name, std::vector<uint8_t>(std::cbegin(pattern), std::cend(pattern)), pattern_offset, alignment };
+}
+
+std::vector<Signature> standard_signatures()
+{
+    // std::string lengths are given where the pattern holds a NUL.
+    return std::vector<Signature>
+    {
+        make_signature(u8"Boot signature",            u8"\x55\xaa",                                       510, 512),
+        make_signature(u8"GPT header",                u8"EFI PART",                                       0,   512),
+        make_signature(u8"FAT12/16 boot sector",      u8"FAT1",                                           54,  512),
+        make_signature(u8"FAT32 boot sector",         u8"FAT32   ",                                       82,  512),
+        make_signature(u8"NTFS boot sector",          u8"NTFS    ",                                       3,   512),
+        make_signature(u8"exFAT boot sector",         u8"EXFAT   ",                                       3,   512),
+        make_signature(u8"ISO9660 volume descriptor", u8"CD001",                                          1,   2048),
+        make_signature(u8"UDF volume descriptor",     u8"NSR0",                                           1,   2048),
+        make_signature(u8"ZIP file",                  u8"PK\x03\x04",                                     0,   512),
+        make_signature(u8"PDF file",                  u8"%PDF-",                                          0,   512),
+        make_signature(u8"PNG file",                  u8"\x89PNG\r\n\x1a\n",                              0,   512),
+        make_signature(u8"JPEG file",                 u8"\xff\xd8\xff",                                   0,   512),
+        make_signature(u8"GIF file",                  u8"GIF8",                                           0,   512),
+        make_signature(u8"Compound document file",    u8"\xd0\xcf\x11\xe0\xa1\xb1\x1a\xe1",               0,   512),
+        make_signature(u8"7-Zip file",                u8"7z\xbc\xaf\x27\x1c",                             0,   512),
+        make_signature(u8"RAR file",                  u8"Rar!\x1a\x07",                                   0,   512),
+        make_signature(u8"gzip file",                 u8"\x1f\x8b\x08",                                   0,   512),
+        make_signature(u8"SQLite database",           std::string(u8"SQLite format 3\0", 16),             0,   512),
+        make_signature(u8"VHD footer",                u8"conectix",                                       0,   512),
+        make_signature(u8"Executable",                u8"MZ",                                             0,   512),
+    };
+}
+
+// State shared by the signatures that are found with the vector search.
+struct Vector_search
+{
+    std::vector<size_t> signature_indices;
+    std::vector<uint8_t> first_bytes;
+    std::vector<uint8_t> second_bytes;  // Equal to the first byte of the next position for one byte patterns.
+    std::vector<bool> is_single_byte;
+};
+
+// Bit n of the result is set if position n of data might start one of the patterns.
+// data must hold 17 bytes.
+#if defined(_M_IX86) || defined(_M_X64)
+
+static unsigned int candidate_mask_16(_In_reads_bytes_(17) const uint8_t* data, const Vector_search& search) noexcept
+{
+    const __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+    const __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 1));
+
+    __m128i candidates = _mm_setzero_si128();
+    for(size_t index = 0; index < search.first_bytes.size(); ++index)
+    {
+        __m128i match = _mm_cmpeq_epi8(first, _mm_set1_epi8(static_cast<char>(search.first_bytes[index])));
+        if(!search.is_single_byte[index])
+        {
+            match = _mm_and_si128(match, _mm_cmpeq_epi8(second, _mm_set1_epi8(static_cast<char>(search.second_bytes[index]))));
+        }
+        candidates = _mm_or_si128(candidates, match);
+    }
+
+    return static_cast<unsigned int>(_mm_movemask_epi8(candidates));
+}
+
+#else
+
+static unsigned int candidate_mask_16(_In_reads_bytes_(17) const uint8_t* data, const Vector_search& search) noexcept
+{
+    unsigned int candidates = 0;
+    for(unsigned int position = 0; position < 16; ++position)
+    {
+        for(size_t index = 0; index < search.first_bytes.size(); ++index)
+        {
+            if((data[position] == search.first_bytes[index]) &&
+               (search.is_single_byte[index] || (data[position + 1] == search.second_bytes[index])))
+            {
+                candidates |= 1u << position;
+                break;
+            }
+        }
+    }
+
+    return candidates;
+}
+
+#endif
+
+// A block of the scan.  Matches must start in [start, end), and buffer holds
+// the device from start onwards, including enough past end to hold any pattern.
+struct Scan_block
+{
+    unsigned int sector_size;
+    uint64_t start;
+    uint64_t end;
+    const uint8_t* buffer;
+    size_t buffer_size;
+};
+
+static Signature_hit make_hit(uint64_t match_start, unsigned int sector_size, size_t signature_index) noexcept
+{
+    return Signature_hit { match_start / sector_size, static_cast<unsigned int>(match_start % sector_size), signature_index };
+}
+
+static bool matches_at(const Signature& signature, const Scan_block& block, size_t pattern_position) noexcept
+{
+    if((pattern_position < signature.pattern_offset) ||
+       (signature.pattern.size() > block.buffer_size - pattern_position))
+    {
+        return false;
+    }
+
+    const uint64_t match_start = block.start + pattern_position - signature.pattern_offset;
+    return (match_start < block.end) &&
+           (match_start % signature.alignment == 0) &&
+           (memcmp(block.buffer + pattern_position, signature.pattern.data(), signature.pattern.size()) == 0);
+}
+
+static void check_candidate(
+    const std::vector<Signature>& signatures,
+    const Vector_search& search,
+    const Scan_block& block,
+    size_t pattern_position,
+    _Inout_ std::vector<Signature_hit>* hits)
+{
+    for(const auto signature_index : search.signature_indices)
+    {
+        const auto& signature = signatures[signature_index];
+        if(matches_at(signature, block, pattern_position))
+        {
+            hits->push_back(make_hit(block.start + pattern_position - signature.pattern_offset, block.sector_size, signature_index));
+        }
+    }
+}
+
+static void scan_block(
+    const std::vector<Signature>& signatures,
+    const std::vector<size_t>& stride_indices,
+    const Vector_search& search,
+    const Scan_block& block,
+    _Inout_ std::vector<Signature_hit>* hits)
+{
+    DISKTOOLS_TRACE_SPAN("scan", "match block");
+
+    // Signatures at coarse alignments, such as sector signatures, only need one compare per position.
+    for(const auto signature_index : stride_indices)
+    {
+        const auto& signature = signatures[signature_index];
+        const uint64_t first_match = (block.start + signature.alignment - 1) / signature.alignment * signature.alignment;
+        for(uint64_t match_start = first_match; match_start < block.end; match_start += signature.alignment)
+        {
+            const size_t pattern_position = static_cast<size_t>(match_start - block.start) + signature.pattern_offset;
+            if(matches_at(signature, block, pattern_position))
+            {
+                hits->push_back(make_hit(match_start, block.sector_size, signature_index));
+            }
+        }
+    }
+
+    if(!search.signature_indices.empty())
+    {
+        // Filter sixteen positions at a time on the first two bytes of each pattern,
+        // and only compare whole patterns at the candidates.
+        size_t position = 0;
+        for(; block.buffer_size - position >= 17; position += 16)
+        {
+            unsigned int candidates = candidate_mask_16(block.buffer + position, search);
+            while(candidates != 0)
+            {
+                unsigned long bit;
+                _BitScanForward(&bit, candidates);
+                candidates &= candidates - 1;
+
+                check_candidate(signatures, search, block, position + bit, hits);
+            }
+        }
+
+        for(; position < block.buffer_size; ++position)
+        {
+            check_candidate(signatures, search, block, position, hits);
+        }
+    }
+}
+
+std::vector<Signature_hit> scan_signatures(
+    const std::string& device_name,
+    const std::vector<Signature>& signatures,
+    uint64_t first_sector,
+    uint64_t sector_count,
+    unsigned int thread_count,
+    size_t block_size)
+{
+    CHECK_EXCEPTION(thread_count > 0, u8"At least one scan thread is required.");
+
+    std::vector<size_t> stride_indices;
+    Vector_search search;
+    size_t longest_match = 1;
+    for(size_t index = 0; index < signatures.size(); ++index)
+    {
+        const auto& signature = signatures[index];
+        CHECK_EXCEPTION(!signature.pattern.empty() && (signature.alignment > 0), u8"Invalid signature: " + signature.name);
+        longest_match = std::max<size_t>(longest_match, signature.pattern_offset + signature.pattern.size());
+
+        if(signature.alignment >= stride_alignment)
+        {
+            stride_indices.push_back(index);
+        }
+        else
+        {
+            search.signature_indices.push_back(index);
+            search.first_bytes.push_back(signature.pattern[0]);
+            search.second_bytes.push_back((signature.pattern.size() > 1) ? signature.pattern[1] : 0);
+            search.is_single_byte.push_back(signature.pattern.size() == 1);
+        }
+    }
+
+    uint64_t sector_size;
+    uint64_t device_size;
+    {
+        const auto device = open_disk_or_device(device_name);
+        sector_size = device->sector_size();
+        device_size = device->size();
+    }
+    const uint64_t device_sectors = device_size / sector_size;
+    CHECK_EXCEPTION(first_sector < device_sectors,
+                    u8"Sector " + std::to_string(first_sector) + u8" is past the end of the device, which has " + std::to_string(device_sectors) + u8" sectors.");
+    sector_count = std::min(sector_count, device_sectors - first_sector);
+
+    // Blocks are whole sectors, so reads stay sector aligned on devices.
+    block_size = static_cast<size_t>((std::max<uint64_t>(block_size, sector_size) + sector_size - 1) / sector_size * sector_size);
+    const uint64_t range_start = first_sector * sector_size;
+    const uint64_t range_end = range_start + sector_count * sector_size;
+    const uint64_t block_count = (range_end - range_start + block_size - 1) / block_size;
+
+    // Each block is read with enough of the next to hold a match that starts at its end.
+    const size_t overlap = static_cast<size_t>((longest_match - 1 + sector_size - 1) / sector_size * sector_size);
+
+    std::vector<std::vector<Signature_hit>> thread_hits(thread_count);
+    std::vector<std::vector<uint8_t>> thread_buffers(thread_count);
+
+    for_each_block_parallel(device_name, thread_count, block_count, [&](_In_ Block_device* device, unsigned int thread_index, uint64_t block_index)
+    {
+        auto& buffer = thread_buffers[thread_index];
+        buffer.resize(block_size + overlap);
+
+        Scan_block block;
+        block.sector_size = static_cast<unsigned int>(sector_size);
+        block.start = range_start + block_index * block_size;
+        block.end = std::min<uint64_t>(block.start + block_size, range_end);
+        block.buffer = buffer.data();
+        block.buffer_size = static_cast<size_t>(std::min<uint64_t>(block.end + overlap, device_size) - block.start);
+
+        {
+            DISKTOOLS_TRACE_SPAN("scan", "read block");
+            device->read(block.start, buffer.data(), block.buffer_size);
+        }
+
+        scan_block(signatures, stride_indices, search, block, &thread_hits[thread_index]);
+    });
+
+    std::vector<Signature_hit> hits;
+    for(const auto& worker_hits : thread_hits)
+    {
+        hits.insert(hits.end(), worker_hits.cbegin(), worker_hits.cend());
+    }
+    std::sort(hits.begin(), hits.end(), [](const Signature_hit& left, const Signature_hit& right)
+    {
+        return std::tie(left.sector, left.sector_offset, left.signature_index) < std::tie(right.sector, right.sector_offset, right.signature_index);
+    });
+
+    return hits;
+}
+
+}
+
@@ -0,0 +1,50 @@
+#pragma once
+
+namespace DiskTools
+{
+
+// A byte pattern to search for.  A match starts at a multiple of alignment bytes
+// from the start of the device, and pattern must appear pattern_offset bytes
+// after the start of the match.  For example, the boot signature is 55 aa at
+// offset 510 of a 512 byte aligned sector.
+struct Signature
+{
+    std::string name;
+    std::vector<uint8_t> pattern;
+    unsigned int pattern_offset;
+    unsigned int alignment;
+};
+
+struct Signature_hit
+{
+    uint64_t sector;            // LBA of the start of the match.
+    unsigned int sector_offset; // Byte offset of the start of the match within the sector.
+    size_t signature_index;     // Index into the signatures passed to scan_signatures.
+};
+
+// Boot sectors (0x55AA), partition table and file system magic (GPT, FAT, NTFS,
+// exFAT, ISO9660, UDF), and the headers of common file formats.  File headers
+// are only matched at the start of a sector, as files start at cluster boundaries.
+std::vector<Signature> standard_signatures();
+
+// Large enough to keep a device streaming, and small enough that each worker
+// thread has several blocks to scan on small images.
+constexpr size_t default_scan_block_size = 4 * 1024 * 1024;
+
+// Passed as sector_count to scan to the end of the device.
+constexpr uint64_t scan_to_end = UINT64_MAX;
+
+// Finds every match of signatures that starts in the given range of sectors.
+// The range is split into blocks that thread_count workers scan in parallel,
+// each with its own handle to device_name (see open_disk_or_device).  Hits are
+// sorted by position, then by signature index.
+std::vector<Signature_hit> scan_signatures(
+    const std::string& device_name,
+    const std::vector<Signature>& signatures,
+    uint64_t first_sector,
+    uint64_t sector_count,
+    unsigned int thread_count,
+    size_t block_size);
+
+}
+
@@ -0,0 +1,314 @@
+#include "PreCompile.h"
+#include "SimulatedDevice.h"    // Pick up forward declarations to ensure correctness.
+#include "ReportUtils.h"
+#include "Trace.h"
+#include <PortableRuntime/CheckException.h>
+
+namespace DiskTools
+{
+
+constexpr char simulated_device_prefix[] = "sim:";
+constexpr char memory_backing_prefix[] = "memory:";
+constexpr uint64_t nanoseconds_per_second = 1000000000;
+
+class Memory_device : public Block_device
+{
+    std::vector<uint8_t> m_data;
+    unsigned int m_sector_size;
+
+public:
+    Memory_device(uint64_t size, unsigned int sector_size);
+
+    uint64_t size() const noexcept override;
+    unsigned int sector_size() const noexcept override;
+    void read(uint64_t offset, _Out_writes_bytes_(size) uint8_t* buffer, size_t size) override;
+    void write(uint64_t offset, _In_reads_bytes_(size) const uint8_t* buffer, size_t size) override;
+};
+
+Memory_device::Memory_device(uint64_t size, unsigned int sector_size) :
+    m_sector_size(sector_size)
+{
+    CHECK_EXCEPTION(size <= SIZE_MAX, u8"Memory device is too large.");
+    m_data.resize(static_cast<size_t>(size));
+}
+
+uint64_t Memory_device::size() const noexcept
+{
+    return m_data.size();
+}
+
+unsigned int Memory_device::sector_size() const noexcept
+{
+    return m_sector_size;
+}
+
+void Memory_device::read(uint64_t offset, _Out_writes_bytes_(size) uint8_t* buffer, size_t size)
+{
+    CHECK_EXCEPTION((offset <= m_data.size()) && (size <= m_data.size() - offset), u8"Read past the end of the device.");
+    memcpy(buffer, m_data.data() + offset, size);
+}
+
+void Memory_device::write(uint64_t offset, _In_reads_bytes_(size) const uint8_t* buffer, size_t size)
+{
+    CHECK_EXCEPTION((offset <= m_data.size()) && (size <= m_data.size() - offset), u8"Write past the end of the device.");
+    memcpy(m_data.data() + offset, buffer, size);
+}
+
+std::unique_ptr<Block_device> create_memory_device(uint64_t size, unsigned int sector_size)
+{
+    return std::make_unique<Memory_device>(size, sector_size);
+}
+
+// Sleep has millisecond granularity at best, so sleep for most of the wait,
+// and spin for the remainder.
+static void wait_until(uint64_t target_ticks) noexcept
+{
+    const uint64_t ticks_per_millisecond = get_tick_frequency() / 1000;
+    for(uint64_t now = get_ticks(); now < target_ticks; now = get_ticks())
+    {
+        const uint64_t remaining_milliseconds = (target_ticks - now) / ticks_per_millisecond;
+        if(remaining_milliseconds > 2)
+        {
+            Sleep(static_cast<DWORD>(std::min<uint64_t>(remaining_milliseconds - 2, INFINITE - 1)));
+        }
+        else
+        {
+            YieldProcessor();
+        }
+    }
+}
+
+Simulated_device::Simulated_device(std::unique_ptr<Block_device> backing, const Simulated_device_parameters& parameters) :
+    m_backing(std::move(backing)),
+    m_parameters(parameters),
+    m_head_offset(0),
+    m_simulated_ns(0),
+    m_busy_until_ticks(0)
+{
+    CHECK_EXCEPTION((m_parameters.sector_size != 0) && ((m_parameters.sector_size & (m_parameters.sector_size - 1)) == 0),
+                    u8"Sector size must be a power of two.");
+    CHECK_EXCEPTION(m_parameters.seek_minimum_ns <= m_parameters.seek_maximum_ns, u8"seek_min must not be larger than seek_max.");
+}
+
+uint64_t Simulated_device::size() const noexcept
+{
+    return m_backing->size();
+}
+
+unsigned int Simulated_device::sector_size() const noexcept
+{
+    return m_parameters.sector_size;
+}
+
+// Called with m_mutex held.
+void Simulated_device::charge(uint64_t offset, size_t size, uint64_t bytes_per_second)
+{
+    uint64_t cost_ns = m_parameters.latency_ns;
+
+    if(offset != m_head_offset)
+    {
+        const uint64_t distance = (offset > m_head_offset) ? (offset - m_head_offset) : (m_head_offset - offset);
+        const double fraction = std::min(1.0, static_cast<double>(distance) / std::max<uint64_t>(1, m_backing->size()));
+        cost_ns += m_parameters.seek_minimum_ns +
+                   static_cast<uint64_t>((m_parameters.seek_maximum_ns - m_parameters.seek_minimum_ns) * fraction);
+    }
+
+    if(bytes_per_second != 0)
+    {
+        // Split to avoid overflow for large transfers.
+        cost_ns += (size / bytes_per_second) * nanoseconds_per_second +
+                   ((size % bytes_per_second) * nanoseconds_per_second) / bytes_per_second;
+    }
+
+    m_head_offset = offset + size;
+    m_simulated_ns += cost_ns;
+
+    if(Simulated_clock::real == m_parameters.clock)
+    {
+        DISKTOOLS_TRACE_SPAN("simulated", "device busy");
+
+        // A request starts when the device is free, so that waits are not
+        // shortened by the time callers spent between requests.
+        const uint64_t tick_frequency = get_tick_frequency();
+        const uint64_t cost_ticks = (cost_ns / nanoseconds_per_second) * tick_frequency +
+                                    ((cost_ns % nanoseconds_per_second) * tick_frequency) / nanoseconds_per_second;
+        m_busy_until_ticks = std::max(get_ticks(), m_busy_until_ticks) + cost_ticks;
+        wait_until(m_busy_until_ticks);
+    }
+}
+
+void Simulated_device::read(uint64_t offset, _Out_writes_bytes_(size) uint8_t* buffer, size_t size)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_backing->read(offset, buffer, size);
+    charge(offset, size, m_parameters.read_bytes_per_second);
+
+    if(size > 0)
+    {
+        const uint64_t first_sector = offset / m_parameters.sector_size;
+        const uint64_t last_sector = (offset + size - 1) / m_parameters.sector_size;
+        for(const auto& bad_range : m_parameters.bad_sectors)
+        {
+            if((bad_range.first <= last_sector) && (first_sector <= bad_range.second))
+            {
+                const uint64_t bad_sector = std::max(first_sector, bad_range.first);
+                throw std::runtime_error(u8"Simulated read error at LBA " + std::to_string(bad_sector) + u8".");
+            }
+        }
+    }
+}
+
+void Simulated_device::write(uint64_t offset, _In_reads_bytes_(size) const uint8_t* buffer, size_t size)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_backing->write(offset, buffer, size);
+    charge(offset, size, m_parameters.write_bytes_per_second);
+}
+
+uint64_t Simulated_device::simulated_nanoseconds() noexcept
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_simulated_ns;
+}
+
+bool is_simulated_device_path(_In_z_ const char* path) noexcept
+{
+    return strncmp(path, simulated_device_prefix, ARRAYSIZE(simulated_device_prefix) - 1) == 0;
+}
+
+// Parses a number with a suffix, where units lists each suffix with its multiplier.
+static uint64_t parse_quantity(const std::string& text, const std::vector<std::pair<std::string, uint64_t>>& units, const std::string& option_name)
+{
+    char* end;
+    const uint64_t value = _strtoui64(text.c_str(), &end, 10);
+    CHECK_EXCEPTION(end != text.c_str(), u8"Invalid value for " + option_name + u8": " + text);
+
+    const std::string suffix(end);
+    const auto unit = std::find_if(units.cbegin(), units.cend(), [&suffix](const std::pair<std::string, uint64_t>& unit)
+    {
+        return _stricmp(unit.first.c_str(), suffix.c_str()) == 0;
+    });
+    CHECK_EXCEPTION(unit != units.cend(), u8"Invalid unit for " + option_name + u8": " + text);
+
+    return value * unit->second;
+}
+
+static uint64_t parse_size(const std::string& text, const std::string& option_name)
+{
+    return parse_quantity(text, { { "", 1 }, { "K", 1024 }, { "M", 1024 * 1024 }, { "G", 1024 * 1024 * 1024 } }, option_name);
+}
+
+static uint64_t parse_nanoseconds(const std::string& text, const std::string& option_name)
+{
+    return parse_quantity(text, { { "ns", 1 }, { "us", 1000 }, { "ms", 1000000 }, { "s", nanoseconds_per_second } }, option_name);
+}
+
+static std::vector<std::pair<uint64_t, uint64_t>> parse_sector_ranges(const std::string& text)
+{
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+
+    size_t start = 0;
+    while(start < text.size())
+    {
+        const size_t end = std::min(text.find('+', start), text.size());
+        const std::string range = text.substr(start, end - start);
+
+        const size_t dash = range.find('-');
+        const uint64_t first = parse_size(range.substr(0, dash), u8"bad");
+        const uint64_t last = (std::string::npos == dash) ? first : parse_size(range.substr(dash + 1), u8"bad");
+        CHECK_EXCEPTION(first <= last, u8"Invalid bad sector range: " + range);
+        ranges.emplace_back(first, last);
+
+        start = end + 1;
+    }
+
+    return ranges;
+}
+
+std::unique_ptr<Simulated_device> open_simulated_device(_In_z_ const char* path, bool writable)
+{
+    assert(is_simulated_device_path(path));
+
+    // '?' cannot appear in Windows file names, so it cleanly ends the backing path.
+    const std::string specification(path + ARRAYSIZE(simulated_device_prefix) - 1);
+    const size_t options_start = specification.find('?');
+    const std::string backing_path = specification.substr(0, options_start);
+    const std::string options = (std::string::npos == options_start) ? std::string() : specification.substr(options_start + 1);
+
+    Simulated_device_parameters parameters{};
+    parameters.clock = Simulated_clock::real;
+    parameters.sector_size = 512;
+
+    size_t start = 0;
+    while(start < options.size())
+    {
+        const size_t end = std::min(options.find(',', start), options.size());
+        const std::string option = options.substr(start, end - start);
+        const size_t equals = option.find('=');
+        CHECK_EXCEPTION(equals != std::string::npos, u8"Simulated device options take the form name=value: " + option);
+
+        const std::string name = option.substr(0, equals);
+        const std::string value = option.substr(equals + 1);
+        if(u8"clock" == name)
+        {
+            CHECK_EXCEPTION((u8"real" == value) || (u8"simulated" == value), u8"clock must be real or simulated.");
+            parameters.clock = (u8"real" == value) ? Simulated_clock::real : Simulated_clock::simulated;
+        }
+        else if(u8"sector" == name)
+        {
+            parameters.sector_size = static_cast<unsigned int>(parse_size(value, name));
+        }
+        else if(u8"latency" == name)
+        {
+            parameters.latency_ns = parse_nanoseconds(value, name);
+        }
+        else if(u8"seek_min" == name)
+        {
+            parameters.seek_minimum_ns = parse_nanoseconds(value, name);
+        }
+        else if(u8"seek_max" == name)
+        {
+            parameters.seek_maximum_ns = parse_nanoseconds(value, name);
+        }
+        else if(u8"read_bandwidth" == name)
+        {
+            parameters.read_bytes_per_second = parse_size(value, name);
+        }
+        else if(u8"write_bandwidth" == name)
+        {
+            parameters.write_bytes_per_second = parse_size(value, name);
+        }
+        else if(u8"bad" == name)
+        {
+            const auto ranges = parse_sector_ranges(value);
+            parameters.bad_sectors.insert(parameters.bad_sectors.end(), ranges.cbegin(), ranges.cend());
+        }
+        else
+        {
+            throw std::runtime_error(u8"Unknown simulated device option: " + name);
+        }
+
+        start = end + 1;
+    }
+
+    // seek_min alone charges the same for a seek of any distance.
+    parameters.seek_maximum_ns = std::max(parameters.seek_minimum_ns, parameters.seek_maximum_ns);
+
+    std::unique_ptr<Block_device> backing;
+    if(backing_path.compare(0, ARRAYSIZE(memory_backing_prefix) - 1, memory_backing_prefix) == 0)
+    {
+        backing = create_memory_device(parse_size(backing_path.substr(ARRAYSIZE(memory_backing_prefix) - 1), u8"memory"), parameters.sector_size);
+    }
+    else
+    {
+        CHECK_EXCEPTION(!is_simulated_device_path(backing_path.c_str()), u8"Simulated devices cannot be nested.");
+        backing = open_block_device(backing_path.c_str(), writable);
+    }
+
+    return std::make_unique<Simulated_device>(std::move(backing), parameters);
+}
+
+}
+
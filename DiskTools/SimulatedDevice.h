@@ -0,0 +1,75 @@
+#pragma once
+
+#include "BlockDevice.h"
+
+namespace DiskTools
+{
+
+// How a Simulated_device spends the time that its model charges for a request.
+enum class Simulated_clock
+{
+    real,           // Wait, so that callers measure the modelled timing.
+    simulated,      // Do not wait.  The time is only added to simulated_nanoseconds.
+};
+
+// Cost model for a Simulated_device.  A request costs
+//   latency + seek + size / bandwidth
+// where the seek is free when the request starts where the previous one ended,
+// and otherwise grows linearly from seek_minimum to seek_maximum with the
+// distance moved, as a fraction of the device size.
+struct Simulated_device_parameters
+{
+    Simulated_clock clock;
+    unsigned int sector_size;
+    uint64_t latency_ns;
+    uint64_t seek_minimum_ns;
+    uint64_t seek_maximum_ns;
+    uint64_t read_bytes_per_second;     // Zero is unlimited.
+    uint64_t write_bytes_per_second;    // Zero is unlimited.
+
+    // Inclusive [first, last] LBA ranges.  Reads that touch one throw, after
+    // paying for the request.  Writes succeed, as drives remap on write.
+    std::vector<std::pair<uint64_t, uint64_t>> bad_sectors;
+};
+
+// A device with deterministic, configurable performance and failures, for
+// repeatable benchmarks of the tools without real CD drives or USB sticks.
+// Requests are served one at a time, as by a drive with one head.
+class Simulated_device : public Block_device
+{
+    std::unique_ptr<Block_device> m_backing;
+    Simulated_device_parameters m_parameters;
+    std::mutex m_mutex;
+    uint64_t m_head_offset;
+    uint64_t m_simulated_ns;
+    uint64_t m_busy_until_ticks;
+
+    void charge(uint64_t offset, size_t size, uint64_t bytes_per_second);
+
+public:
+    Simulated_device(std::unique_ptr<Block_device> backing, const Simulated_device_parameters& parameters);
+
+    uint64_t size() const noexcept override;
+    unsigned int sector_size() const noexcept override;
+    void read(uint64_t offset, _Out_writes_bytes_(size) uint8_t* buffer, size_t size) override;
+    void write(uint64_t offset, _In_reads_bytes_(size) const uint8_t* buffer, size_t size) override;
+
+    // Total time charged by the model since the device was opened.
+    uint64_t simulated_nanoseconds() noexcept;
+};
+
+// A zero filled, writable device in memory.
+std::unique_ptr<Block_device> create_memory_device(uint64_t size, unsigned int sector_size);
+
+// Simulated devices can be opened by any tool that takes a device path, using
+//   sim:backing?option=value,option=value
+// where backing is an image file or device path, or memory:size.  Options:
+//   clock=real|simulated, sector=bytes, latency=time, seek_min=time,
+//   seek_max=time, read_bandwidth=size, write_bandwidth=size, bad=lba[-lba][+...]
+// Times take an ns, us, ms, or s suffix.  Sizes take a K, M, or G suffix.
+// For example: sim:memory:700M?latency=1ms,seek_max=120ms,read_bandwidth=3600K
+bool is_simulated_device_path(_In_z_ const char* path) noexcept;
+std::unique_ptr<Simulated_device> open_simulated_device(_In_z_ const char* path, bool writable);
+
+}
+
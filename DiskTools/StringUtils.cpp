@@ -1,5 +1,6 @@
 #include "PreCompile.h"
 #include "StringUtils.h"    // Pick up forward declarations to ensure correctness.
+#include <PortableRuntime/CheckException.h>
 
 namespace DiskTools
 {
@@ -116,5 +117,14 @@ void pretty_print64(
     output_formatted_number(temp_buffer, output_string, size_in_chars);
 }
 
+uint64_t parse_unsigned(const std::string& text, const std::string& argument_name)
+{
+    char* end;
+    const uint64_t value = _strtoui64(text.c_str(), &end, 10);
+    CHECK_EXCEPTION(!text.empty() && (*end == '\0'), u8"Invalid number for --" + argument_name + u8": " + text);
+
+    return value;
+}
+
 }
 
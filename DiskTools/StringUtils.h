@@ -6,5 +6,9 @@ namespace DiskTools
 void pretty_print32(uint32_t value, _Out_writes_z_(size_in_chars) PTSTR output_string, _In_range_(0, INT_MAX) size_t size_in_chars);
 void pretty_print64(uint64_t value, _Out_writes_z_(size_in_chars) PTSTR output_string, _In_range_(0, INT_MAX) size_t size_in_chars);
 
+// Parses a decimal command line value, such as a sector number or a count.
+// Throws, naming the option as --argument_name, if text is not a number.
+uint64_t parse_unsigned(const std::string& text, const std::string& argument_name);
+
 }
 
@@ -0,0 +1,224 @@
+#include "PreCompile.h"
+#include "Trace.h"          // Pick up forward declarations to ensure correctness.
+#include "ReportUtils.h"
+#include <PortableRuntime/CheckException.h>
+
+#ifdef DISKTOOLS_TRACE
+
+namespace DiskTools
+{
+
+// 32 bytes per event, so each thread's ring buffer takes 2MB.
+constexpr size_t trace_ring_capacity = 64 * 1024;
+
+struct Trace_event
+{
+    const char* category;
+    const char* name;
+    uint64_t start;
+    uint64_t duration;
+};
+
+// Written only by the owning thread.
+struct Thread_trace
+{
+    DWORD thread_id;
+    std::atomic<const char*> thread_name;
+    std::atomic<uint64_t> event_count;      // Total recorded, including events that have been overwritten.
+    std::array<Trace_event, trace_ring_capacity> events;
+};
+
+static std::atomic<bool> trace_enabled(false);
+
+// Rings are never freed, so that the spans of threads that have exited are still written.
+static std::mutex& registry_mutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+static std::vector<std::unique_ptr<Thread_trace>>& registry()
+{
+    static std::vector<std::unique_ptr<Thread_trace>> thread_traces;
+    return thread_traces;
+}
+
+static thread_local Thread_trace* current_thread_trace = nullptr;
+
+static Thread_trace* get_thread_trace() noexcept
+{
+    if(nullptr == current_thread_trace)
+    {
+        try
+        {
+            // Value initialization zeroes the counts.
+            auto thread_trace = std::make_unique<Thread_trace>();
+            thread_trace->thread_id = GetCurrentThreadId();
+
+            std::lock_guard<std::mutex> lock(registry_mutex());
+            registry().push_back(std::move(thread_trace));
+            current_thread_trace = registry().back().get();
+        }
+        catch(const std::exception&)
+        {
+            // Out of memory.  Drop the span rather than fail the traced work.
+            return nullptr;
+        }
+    }
+
+    return current_thread_trace;
+}
+
+Trace_span::Trace_span(_In_z_ const char* category, _In_z_ const char* name) noexcept :
+    m_category(category),
+    m_name(name),
+    m_start(0),
+    m_is_enabled(trace_enabled.load(std::memory_order_relaxed))
+{
+    if(m_is_enabled)
+    {
+        m_start = get_ticks();
+    }
+}
+
+Trace_span::~Trace_span() noexcept
+{
+    if(m_is_enabled)
+    {
+        const uint64_t end = get_ticks();
+        const auto thread_trace = get_thread_trace();
+        if(thread_trace != nullptr)
+        {
+            const uint64_t event_count = thread_trace->event_count.load(std::memory_order_relaxed);
+            auto& event = thread_trace->events[event_count % trace_ring_capacity];
+            event.category = m_category;
+            event.name     = m_name;
+            event.start    = m_start;
+            event.duration = end - m_start;
+
+            // Publish the event to readers.
+            thread_trace->event_count.store(event_count + 1, std::memory_order_release);
+        }
+    }
+}
+
+void enable_trace(bool enable) noexcept
+{
+    trace_enabled.store(enable, std::memory_order_relaxed);
+}
+
+void set_trace_thread_name(_In_z_ const char* name) noexcept
+{
+    const auto thread_trace = get_thread_trace();
+    if(thread_trace != nullptr)
+    {
+        thread_trace->thread_name.store(name, std::memory_order_relaxed);
+    }
+}
+
+std::string trace_json()
+{
+    const uint64_t tick_frequency = get_tick_frequency();
+    const std::string process_id = std::to_string(GetCurrentProcessId());
+
+    std::string json = u8"{\n  \"displayTimeUnit\": \"ms\",\n  \"traceEvents\": [";
+    bool is_first = true;
+    const auto append_event = [&json, &is_first](const std::string& event)
+    {
+        json += is_first ? u8"\n    " : u8",\n    ";
+        json += event;
+        is_first = false;
+    };
+
+    std::lock_guard<std::mutex> lock(registry_mutex());
+
+    // Timestamps are relative to the earliest retained event, which keeps them short.
+    uint64_t base = UINT64_MAX;
+    for(const auto& thread_trace : registry())
+    {
+        const uint64_t event_count = thread_trace->event_count.load(std::memory_order_acquire);
+        const uint64_t first = (event_count > trace_ring_capacity) ? (event_count - trace_ring_capacity) : 0;
+        for(uint64_t index = first; index < event_count; ++index)
+        {
+            base = std::min(base, thread_trace->events[index % trace_ring_capacity].start);
+        }
+    }
+
+    for(const auto& thread_trace : registry())
+    {
+        const std::string thread_id = std::to_string(thread_trace->thread_id);
+
+        const char* thread_name = thread_trace->thread_name.load(std::memory_order_relaxed);
+        if(thread_name != nullptr)
+        {
+            append_event(u8"{ \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " + process_id + u8", \"tid\": " + thread_id +
+                         u8", \"args\": { \"name\": \"" + json_escape(thread_name) + u8"\" } }");
+        }
+
+        const uint64_t event_count = thread_trace->event_count.load(std::memory_order_acquire);
+        const uint64_t first = (event_count > trace_ring_capacity) ? (event_count - trace_ring_capacity) : 0;
+        for(uint64_t index = first; index < event_count; ++index)
+        {
+            const auto& event = thread_trace->events[index % trace_ring_capacity];
+            append_event(u8"{ \"name\": \"" + json_escape(event.name) + u8"\", \"cat\": \"" + json_escape(event.category) +
+                         u8"\", \"ph\": \"X\", \"ts\": " + format_microseconds(event.start - base, tick_frequency) +
+                         u8", \"dur\": " + format_microseconds(event.duration, tick_frequency) +
+                         u8", \"pid\": " + process_id + u8", \"tid\": " + thread_id + u8" }");
+        }
+    }
+
+    json += u8"\n  ]\n}\n";
+    return json;
+}
+
+void write_trace_json(_In_z_ const wchar_t* file_name)
+{
+    const std::string json = trace_json();
+
+    std::ofstream output_file(file_name, std::ios::binary | std::ios::trunc);
+    CHECK_EXCEPTION(output_file.good(), u8"Error opening trace file.");
+
+    output_file.write(json.data(), json.size());
+    CHECK_EXCEPTION(!output_file.fail(), u8"Error writing trace file.");
+}
+
+Trace_report::Trace_report() noexcept
+{
+    wchar_t file_name[MAX_PATH];
+    const DWORD length = GetEnvironmentVariableW(L"DISKTOOLS_TRACE", file_name, ARRAYSIZE(file_name));
+    if((length > 0) && (length < ARRAYSIZE(file_name)))
+    {
+        try
+        {
+            m_file_name = file_name;
+            enable_trace(true);
+            set_trace_thread_name(u8"main");
+        }
+        catch(const std::exception&)
+        {
+            // Out of memory.  Run without tracing.
+        }
+    }
+}
+
+Trace_report::~Trace_report() noexcept
+{
+    if(!m_file_name.empty())
+    {
+        enable_trace(false);
+
+        try
+        {
+            write_trace_json(m_file_name.c_str());
+        }
+        catch(const std::exception&)
+        {
+            // The trace is diagnostic only, so it must not change the exit status.
+        }
+    }
+}
+
+}
+
+#endif
+
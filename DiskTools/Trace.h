@@ -0,0 +1,79 @@
+#pragma once
+
+// Trace spans are compiled in only when DISKTOOLS_TRACE is defined, which
+// building with "msbuild /p:DiskToolsTrace=true" does.  Otherwise the macros
+// below expand to nothing, and no trace code is linked.
+#ifdef DISKTOOLS_TRACE
+
+namespace DiskTools
+{
+
+// Records how long a stage took, from construction to destruction.  category
+// and name must be string literals, as only the pointers are stored.
+// Each thread records into its own ring buffer, which keeps the most recent
+// events when it fills.  Recording takes no locks.
+class Trace_span
+{
+    const char* m_category;
+    const char* m_name;
+    uint64_t m_start;
+    bool m_is_enabled;
+
+    // Not implemented to prevent accidental copying/moving.
+    Trace_span(const Trace_span&) = delete;
+    Trace_span(Trace_span&&) noexcept = delete;
+    Trace_span& operator=(const Trace_span&) = delete;
+    Trace_span& operator=(Trace_span&&) noexcept = delete;
+
+public:
+    Trace_span(_In_z_ const char* category, _In_z_ const char* name) noexcept;
+    ~Trace_span() noexcept;
+};
+
+void enable_trace(bool enable) noexcept;
+
+// Labels the calling thread in the trace viewer.  name must be a string literal.
+void set_trace_thread_name(_In_z_ const char* name) noexcept;
+
+// Returns the recorded spans in Chrome trace event format, which loads in
+// Perfetto and chrome://tracing.  Call after the traced work has finished, as
+// threads that are still recording may overwrite events as they are read.
+std::string trace_json();
+void write_trace_json(_In_z_ const wchar_t* file_name);
+
+// If the environment variable DISKTOOLS_TRACE names a file, tracing is enabled,
+// and the trace is written to that file when the program exits.
+class Trace_report
+{
+    std::wstring m_file_name;
+
+    // Not implemented to prevent accidental copying/moving.
+    Trace_report(const Trace_report&) = delete;
+    Trace_report(Trace_report&&) noexcept = delete;
+    Trace_report& operator=(const Trace_report&) = delete;
+    Trace_report& operator=(Trace_report&&) noexcept = delete;
+
+public:
+    Trace_report() noexcept;
+    ~Trace_report() noexcept;
+};
+
+}
+
+#define DISKTOOLS_TRACE_CONCATENATE_(left, right) left##right
+#define DISKTOOLS_TRACE_CONCATENATE(left, right) DISKTOOLS_TRACE_CONCATENATE_(left, right)
+
+#define DISKTOOLS_TRACE_SPAN(category, name) const DiskTools::Trace_span DISKTOOLS_TRACE_CONCATENATE(trace_span_, __LINE__)((category), (name))
+#define DISKTOOLS_TRACE_THREAD_NAME(name) DiskTools::set_trace_thread_name(name)
+
+// Declare in main, outside of the exception handler.
+#define DISKTOOLS_TRACE_REPORT() const DiskTools::Trace_report trace_report
+
+#else
+
+#define DISKTOOLS_TRACE_SPAN(category, name)
+#define DISKTOOLS_TRACE_THREAD_NAME(name)
+#define DISKTOOLS_TRACE_REPORT()
+
+#endif
+
@@ -0,0 +1,153 @@
+#include "PreCompile.h"
+#include "UsageMap.h"       // Pick up forward declarations to ensure correctness.
+#include "BlockDevice.h"
+#include "ByteCompare.h"
+#include "ParallelScan.h"
+#include "Trace.h"
+#include <PortableRuntime/CheckException.h>
+
+namespace DiskTools
+{
+
+// On-disk structure.  Fields are naturally aligned, so no packing is needed.
+// The header is followed by the blocks, four to a byte, first block in the low bits.
+struct Usage_map_header
+{
+    uint8_t signature[8];
+    uint32_t version;
+    uint32_t block_size;
+    uint64_t device_size;
+    uint64_t block_count;
+};
+
+static_assert(sizeof(Usage_map_header) == 32, "Usage_map_header is an on-disk structure.");
+
+static constexpr uint8_t usage_map_signature[8] = { 'D', 'T', 'U', 'S', 'A', 'G', 'E', '1' };
+constexpr uint32_t usage_map_version = 1;
+constexpr unsigned int blocks_per_map_byte = 4;
+
+// Each thread reads this much at a time, so that small blocks do not mean small reads.
+constexpr size_t usage_read_size = 4 * 1024 * 1024;
+
+// Shannon entropy of the byte histogram, in bits per byte.
+static double entropy_bits_per_byte(_In_reads_bytes_(size) const uint8_t* data, size_t size) noexcept
+{
+    // Four histograms break the dependency between neighboring bytes that hit the same count.
+    uint32_t counts[4][256] = {};
+    size_t index = 0;
+    for(; index + 4 <= size; index += 4)
+    {
+        ++counts[0][data[index]];
+        ++counts[1][data[index + 1]];
+        ++counts[2][data[index + 2]];
+        ++counts[3][data[index + 3]];
+    }
+    for(; index < size; ++index)
+    {
+        ++counts[0][data[index]];
+    }
+
+    // H = log2(n) - sum(c * log2(c)) / n
+    double weighted_sum = 0.0;
+    for(unsigned int value = 0; value < 256; ++value)
+    {
+        const uint32_t count = counts[0][value] + counts[1][value] + counts[2][value] + counts[3][value];
+        if(count > 1)
+        {
+            weighted_sum += count * std::log2(static_cast<double>(count));
+        }
+    }
+
+    return std::log2(static_cast<double>(size)) - weighted_sum / size;
+}
+
+Block_usage classify_block(_In_reads_bytes_(size) const uint8_t* data, size_t size) noexcept
+{
+    if(is_constant(data, size))
+    {
+        return ((size == 0) || (data[0] == 0)) ? Block_usage::zero : Block_usage::filler;
+    }
+
+    return (entropy_bits_per_byte(data, size) >= high_entropy_bits_per_byte) ? Block_usage::high_entropy : Block_usage::low_entropy;
+}
+
+Usage_map map_device_usage(const std::string& device_name, unsigned int block_size, unsigned int thread_count)
+{
+    DISKTOOLS_TRACE_SPAN("DiskTools", "map_device_usage");
+
+    Usage_map map;
+    {
+        const auto device = open_disk_or_device(device_name);
+        CHECK_EXCEPTION((block_size > 0) && (block_size % device->sector_size() == 0),
+                        u8"The block size must be a multiple of the sector size: " + std::to_string(block_size));
+        map.device_size = device->size();
+    }
+    map.block_size = block_size;
+    map.blocks.resize(static_cast<size_t>((map.device_size + block_size - 1) / block_size));
+
+    // Each read covers a whole number of blocks.
+    const uint64_t read_size = std::max<uint64_t>(usage_read_size / block_size, 1) * block_size;
+    const uint64_t read_count = (map.device_size + read_size - 1) / read_size;
+
+    std::vector<std::vector<uint8_t>> buffers(thread_count);
+    for_each_block_parallel(device_name, thread_count, read_count, [&](_In_ Block_device* device, unsigned int thread_index, uint64_t read_index)
+    {
+        const uint64_t offset = read_index * read_size;
+        const size_t size = static_cast<size_t>(std::min(read_size, map.device_size - offset));
+
+        auto& buffer = buffers[thread_index];
+        buffer.resize(static_cast<size_t>(read_size));
+        device->read(offset, buffer.data(), size);
+
+        // Each block belongs to exactly one read, so threads never write the same entry.
+        for(size_t block_offset = 0; block_offset < size; block_offset += block_size)
+        {
+            const size_t block_index = static_cast<size_t>((offset + block_offset) / block_size);
+            map.blocks[block_index] = classify_block(buffer.data() + block_offset, std::min<size_t>(block_size, size - block_offset));
+        }
+    });
+
+    return map;
+}
+
+std::vector<Usage_extent> usage_extents(const Usage_map& map)
+{
+    std::vector<Usage_extent> extents;
+    for(size_t index = 0; index < map.blocks.size(); ++index)
+    {
+        const uint64_t offset = static_cast<uint64_t>(index) * map.block_size;
+        const uint64_t length = std::min<uint64_t>(map.block_size, map.device_size - offset);
+        if(!extents.empty() && (extents.back().usage == map.blocks[index]))
+        {
+            extents.back().length += length;
+        }
+        else
+        {
+            extents.push_back(Usage_extent { offset, length, map.blocks[index] });
+        }
+    }
+
+    return extents;
+}
+
+void write_usage_map(const Usage_map& map, _In_z_ const char* file_name)
+{
+    Usage_map_header header {};
+    std::copy(std::cbegin(usage_map_signature), std::cend(usage_map_signature), header.signature);
+    header.version = usage_map_version;
+    header.block_size = map.block_size;
+    header.device_size = map.device_size;
+    header.block_count = map.blocks.size();
+
+    std::vector<uint8_t> buffer(sizeof(header) + (map.blocks.size() + blocks_per_map_byte - 1) / blocks_per_map_byte);
+    memcpy(buffer.data(), &header, sizeof(header));
+    for(size_t index = 0; index < map.blocks.size(); ++index)
+    {
+        buffer[sizeof(header) + index / blocks_per_map_byte] |= static_cast<uint8_t>(static_cast<unsigned int>(map.blocks[index]) << (index % blocks_per_map_byte * 2));
+    }
+
+    open_image_file(file_name, CREATE_ALWAYS)->write(0, buffer.data(), buffer.size());
+}
+
+}
+
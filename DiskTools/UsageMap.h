@@ -0,0 +1,51 @@
+#pragma once
+
+namespace DiskTools
+{
+
+// What a block of a device holds, as far as imaging and compression care.
+enum class Block_usage : uint8_t
+{
+    zero,           // Every byte is zero.
+    filler,         // Every byte is the same nonzero value, such as the 0xF6 that formatting leaves.
+    low_entropy,    // Worth compressing: text, code, file system metadata.
+    high_entropy,   // Already compressed or encrypted, so not worth compressing again.
+};
+
+// Small enough to find the free space between files, large enough that the map stays small.
+constexpr unsigned int default_usage_block_size = 64 * 1024;
+
+// Blocks estimated at this many bits of entropy per byte or more are high entropy.
+constexpr double high_entropy_bits_per_byte = 7.5;
+
+// One entry per block_size bytes of a device.  The last block may be short.
+struct Usage_map
+{
+    uint64_t device_size;
+    unsigned int block_size;
+    std::vector<Block_usage> blocks;
+};
+
+// A run of blocks with the same usage, in bytes.
+struct Usage_extent
+{
+    uint64_t offset;
+    uint64_t length;
+    Block_usage usage;
+};
+
+Block_usage classify_block(_In_reads_bytes_(size) const uint8_t* data, size_t size) noexcept;
+
+// Reads a disk or image (see open_disk_or_device) once, on up to thread_count
+// threads, and classifies each block.  block_size is a multiple of the sector size.
+Usage_map map_device_usage(const std::string& device_name, unsigned int block_size, unsigned int thread_count);
+
+// Joins adjacent blocks with the same usage.
+std::vector<Usage_extent> usage_extents(const Usage_map& map);
+
+// A map file is a short header and two bits per block, so a terabyte at the
+// default block size takes 4MB.
+void write_usage_map(const Usage_map& map, _In_z_ const char* file_name);
+
+}
+
@@ -0,0 +1,196 @@
+// This program searches a disk or image for boot sectors, file system magic,
+// and file headers, and lists the LBA of each hit.
+
+#include "PreCompile.h"
+#include <DiskTools/IoStatistics.h>
+#include <DiskTools/OutputSink.h>
+#include <DiskTools/SignatureScan.h>
+#include <DiskTools/StringUtils.h>
+#include <DiskTools/Trace.h>
+#include <Parsing/CommandLine.h>
+#include <WindowsCommon/CheckHR.h>
+#include <WindowsCommon/CommandLine.h>
+#include <WindowsCommon/DebuggerTracing.h>
+#include <WindowsCommon/Wrappers.h>
+#include <PortableRuntime/CheckException.h>
+#include <PortableRuntime/Tracing.h>
+#include <PortableRuntime/Unicode.h>
+
+namespace FindSignatures
+{
+
+// Parses a pattern written as hex digits, such as 55aa.
+static std::vector<uint8_t> parse_hex_pattern(const std::string& text)
+{
+    const auto nibble = [&text](char digit)
+    {
+        if((digit >= '0') && (digit <= '9'))
+        {
+            return digit - '0';
+        }
+        if((digit >= 'a') && (digit <= 'f'))
+        {
+            return digit - 'a' + 10;
+        }
+        CHECK_EXCEPTION((digit >= 'A') && (digit <= 'F'), u8"Invalid hex pattern: " + text);
+        return digit - 'A' + 10;
+    };
+
+    CHECK_EXCEPTION(!text.empty() && (text.size() % 2 == 0), u8"Hex patterns need two digits per byte: " + text);
+
+    std::vector<uint8_t> pattern;
+    for(size_t index = 0; index < text.size(); index += 2)
+    {
+        pattern.push_back(static_cast<uint8_t>((nibble(text[index]) << 4) | nibble(text[index + 1])));
+    }
+
+    return pattern;
+}
+
+static int parse_arguments_and_execute()
+{
+    enum
+    {
+        Argument_drive = 0,
+        Argument_logical_sector,
+        Argument_count,
+        Argument_threads,
+        Argument_pattern,
+        Argument_pattern_offset,
+        Argument_alignment,
+        Argument_help,
+    };
+
+    const std::vector<Parsing::Argument_descriptor> argument_map =
+    {
+        { Argument_drive,          u8"drive",          u8'd', true,  u8"The disk number, or the path of a device or image, to scan. Default: 0." },
+        { Argument_logical_sector, u8"logical-sector", u8's', true,  u8"The first sector to scan. Default: 0." },
+        { Argument_count,          u8"count",          u8'c', true,  u8"The number of sectors to scan. Default: to the end of the device." },
+        { Argument_threads,        u8"threads",        u8't', true,  u8"The number of scan threads. Default: one per processor." },
+        { Argument_pattern,        u8"pattern",        u8'p', true,  u8"Search for this hex pattern, such as 55aa, instead of the standard signatures." },
+        { Argument_pattern_offset, u8"pattern-offset", u8'o', true,  u8"The offset of --pattern from the aligned start of a match. Default: 0." },
+        { Argument_alignment,      u8"alignment",      u8'a', true,  u8"Only match --pattern at multiples of this many bytes. Default: 1." },
+        { Argument_help,           u8"help",           u8'?', false, nullptr },
+    };
+#ifndef NDEBUG
+    Parsing::validate_argument_map(argument_map);
+#endif
+
+    const auto arguments = WindowsCommon::args_from_command_line();
+    const auto options = Parsing::options_from_allowed_args(arguments, argument_map);
+
+    const auto unsigned_or_default = [&options, &argument_map](int argument, uint64_t default_value)
+    {
+        return (options.count(argument) > 0) ? DiskTools::parse_unsigned(options.at(argument), argument_map[argument].long_name) : default_value;
+    };
+
+    int error_level = 0;
+    if(options.count(Argument_help) == 0)
+    {
+        const std::string drive = (options.count(Argument_drive) > 0) ? options.at(Argument_drive) : std::string(u8"0");
+        const uint64_t first_sector = unsigned_or_default(Argument_logical_sector, 0);
+        const uint64_t count = unsigned_or_default(Argument_count, DiskTools::scan_to_end);
+        const unsigned int thread_count = static_cast<unsigned int>(std::max<uint64_t>(unsigned_or_default(Argument_threads, std::thread::hardware_concurrency()), 1));
+
+        std::vector<DiskTools::Signature> signatures;
+        if(options.count(Argument_pattern) > 0)
+        {
+            const uint64_t pattern_offset = unsigned_or_default(Argument_pattern_offset, 0);
+            const uint64_t alignment = unsigned_or_default(Argument_alignment, 1);
+            CHECK_EXCEPTION((pattern_offset < 1024 * 1024) && (alignment > 0) && (alignment <= UINT_MAX),
+                            u8"--" + std::string(argument_map[Argument_alignment].long_name) + u8" or --" +
+                            std::string(argument_map[Argument_pattern_offset].long_name) + u8" is out of range.");
+
+            signatures.push_back(DiskTools::Signature { options.at(Argument_pattern),
+                                                        parse_hex_pattern(options.at(Argument_pattern)),
+                                                        static_cast<unsigned int>(pattern_offset),
+                                                        static_cast<unsigned int>(alignment) });
+        }
+        else
+        {
+            signatures = DiskTools::standard_signatures();
+        }
+
+        const auto hits = DiskTools::scan_signatures(drive, signatures, first_sector, count, thread_count, DiskTools::default_scan_block_size);
+
+        DiskTools::Output_sink output;
+        output.write(u8"         LBA  Offset  Signature\n");
+        for(const auto& hit : hits)
+        {
+            std::string offset = u8"+";
+            DiskTools::append_hex(&offset, hit.sector_offset);
+            output.write_decimal(hit.sector, 12).write(u8"  ").write_padded(offset, -6).write(u8"  ");
+            output.write(signatures[hit.signature_index].name).write(u8"\n");
+        }
+        output.flush();
+        std::fwprintf(stderr, L"%llu hits.\n", static_cast<unsigned long long>(hits.size()));
+    }
+    else
+    {
+        constexpr auto arg_program_name = 0;
+
+        // Hold a reference to program_name_long for the duration of the output functions.
+        const auto program_name_long = PortableRuntime::utf16_from_utf8(arguments[arg_program_name]);
+        const auto program_name = PathFindFileNameW(program_name_long.c_str());
+
+        std::fwprintf(stderr, L"Usage: %s [options]\nOptions:\n", program_name);
+        std::fwprintf(stderr, PortableRuntime::utf16_from_utf8(Parsing::Options_help_text(argument_map)).c_str());
+        std::fwprintf(stderr,
+                      L"\nTo find boot sectors and file systems on the second drive:\n  %s -%c 1\n",
+                      program_name,
+                      argument_map[Argument_drive].short_name);
+        std::fwprintf(stderr,
+                      L"\nTo find every boot signature in an image:\n  %s -%c disk.img -%c 55aa -%c 510 -%c 512\n",
+                      program_name,
+                      argument_map[Argument_drive].short_name,
+                      argument_map[Argument_pattern].short_name,
+                      argument_map[Argument_pattern_offset].short_name,
+                      argument_map[Argument_alignment].short_name);
+        error_level = 1;
+    }
+
+    return error_level;
+}
+
+}
+
+int wmain(int argc, _In_reads_(argc) wchar_t** argv)
+{
+    (void)argc;     // Unreferenced parameter.
+    (void)argv;
+
+    // ERRORLEVEL zero is the success code.
+    int error_level;
+
+    // Set outside the try block so error messages use the proper code page.
+    // This class does not throw.
+    WindowsCommon::UTF8_console_code_page code_page;
+
+    // Writes I/O statistics on exit when DISKTOOLS_IO_STATISTICS is set.
+    DiskTools::Io_statistics_report io_statistics_report;
+
+    // Writes a trace on exit when built with DISKTOOLS_TRACE and DISKTOOLS_TRACE is set.
+    DISKTOOLS_TRACE_REPORT();
+
+    try
+    {
+        PortableRuntime::set_dprintf(WindowsCommon::debugger_dprintf);
+
+        // Set wprintf output to UTF-8 in Windows console.
+        // CHECK_EXCEPTION ensures against the case that the CRT invalid parameter handler
+        // routine is set by a global constructor.
+        CHECK_EXCEPTION(_setmode(_fileno(stdout), _O_U8TEXT) != -1, u8"Failed to set UTF-8 output mode.");
+        CHECK_EXCEPTION(_setmode(_fileno(stderr), _O_U8TEXT) != -1, u8"Failed to set UTF-8 output mode.");
+
+        assert(WindowsCommon::args_from_command_line().size() == (static_cast<size_t>(argc)));
+        error_level = FindSignatures::parse_arguments_and_execute();
+    }
+    catch(const std::exception& ex)
+    {
+        std::fwprintf(stderr, L"\n%s\n", PortableRuntime::utf16_from_utf8(ex.what()).c_str());
+        error_level = 1;
+    }
+
+    return error_level;
+}
+
@@ -1,46 +1,68 @@
 #include "PreCompile.h"
-#include <DiskTools/DirectRead.h>
+#include <DiskTools/BlockDevice.h>
+#include <DiskTools/Copy.h>
+#include <DiskTools/HexDump.h>
+#include <DiskTools/IoStatistics.h>
+#include <DiskTools/OutputSink.h>
+#include <DiskTools/StringUtils.h>
 #include <Parsing/CommandLine.h>
 #include <WindowsCommon/CheckHR.h>
 #include <WindowsCommon/CommandLine.h>
 #include <WindowsCommon/DebuggerTracing.h>
+#include <WindowsCommon/ScopedWindowsTypes.h>
+#include <WindowsCommon/Wrappers.h>
 #include <PortableRuntime/CheckException.h>
 #include <PortableRuntime/Tracing.h>
 #include <PortableRuntime/Unicode.h>
 
-// TODO: 2016: Temp for prototyping.
-#include <functional>
-#include <WindowsCommon/ScopedWindowsTypes.h>
-
 namespace GetSector
 {
 
-// TODO: 2016: This should be the replacement for read_sector_from_disk, but it should go in the
-// WindowsCommon namespace (as should DiskTools), as it uses exceptions and returns a buffer directly.
-static std::vector<uint8_t> read_physical_drive_sector(uint8_t drive_number, uint64_t sector_number)
+// Large enough that multi-gigabyte dumps are not limited by per-request
+// overhead.  A multiple of every sector size, so reads stay sector aligned.
+constexpr size_t dump_buffer_size = 4 * 1024 * 1024;
+
+// Streams count sectors starting at sector_number to output, either as raw bytes or
+// as a hex dump.  Memory use does not depend on count.
+static void dump_sectors(
+    const std::string& device_name,
+    uint64_t sector_number,
+    uint64_t count,
+    bool is_hex_dump,
+    bool collapse_repeats,
+    _In_ HANDLE output)
 {
-    // TODO: 2016: Get the disk's configured sector size.
-    constexpr unsigned int sector_size = 512;
-
-    std::vector<uint8_t> buffer;
-    buffer.resize(sector_size);
-
-    unsigned int buffer_size = sector_size;
-    const HRESULT hr = DiskTools::read_sector_from_disk(buffer.data(), &buffer_size, drive_number, sector_number);
-    CHECK_HR(hr);
-
-    return buffer;
-}
-
-static void read_physical_drive_sector_to_file(uint8_t drive_number, uint64_t sector_number, _In_z_ const wchar_t* output_file_name)
-{
-    std::vector<uint8_t> sector = read_physical_drive_sector(drive_number, sector_number);
-
-    std::ofstream output_file(output_file_name, std::ios::binary | std::ios::trunc);
-    CHECK_EXCEPTION(output_file.good(), u8"Error opening: " + PortableRuntime::utf8_from_utf16(output_file_name));
-
-    output_file.write(reinterpret_cast<const char*>(sector.data()), sector.size());
-    CHECK_EXCEPTION(!output_file.fail(), u8"Error writing output file.");
+    const auto device = DiskTools::open_disk_or_device(device_name);
+    const uint64_t sector_size = device->sector_size();
+    const uint64_t device_sectors = device->size() / sector_size;
+    CHECK_EXCEPTION((sector_number < device_sectors) && (count <= device_sectors - sector_number),
+                    u8"Sectors " + std::to_string(sector_number) + u8" to " + std::to_string(sector_number + count - 1) +
+                    u8" are past the end of the device, which has " + std::to_string(device_sectors) + u8" sectors.");
+
+    const uint64_t offset = sector_number * sector_size;
+    const uint64_t length = count * sector_size;
+    DiskTools::Output_sink sink(output);
+    if(is_hex_dump)
+    {
+        DiskTools::Hex_dump_formatter formatter(sector_number, sector_number + count - 1, device->sector_size(), collapse_repeats, [&sink](_In_reads_(size) const char* text, size_t size)
+        {
+            sink.write(text, size);
+        });
+
+        DiskTools::stream_device(device.get(), offset, length, dump_buffer_size, [&formatter](_In_reads_bytes_(size) const uint8_t* buffer, size_t size)
+        {
+            formatter.write(buffer, size);
+        });
+        formatter.finish();
+    }
+    else
+    {
+        DiskTools::stream_device(device.get(), offset, length, dump_buffer_size, [&sink](_In_reads_bytes_(size) const uint8_t* buffer, size_t size)
+        {
+            sink.write(reinterpret_cast<const char*>(buffer), size);
+        });
+    }
+    sink.flush();
 }
 
 static int parse_arguments_and_execute()
@@ -48,14 +70,22 @@ static int parse_arguments_and_execute()
     enum
     {
         Argument_logical_sector = 0,
+        Argument_count,
+        Argument_drive,
         Argument_file_name,
+        Argument_hex,
+        Argument_all_lines,
         Argument_help,
     };
 
     const std::vector<Parsing::Argument_descriptor> argument_map =
     {
-        { Argument_logical_sector, u8"logical-sector", u8's', true,  u8"The logical block address (LBA) of the sector to read." },
+        { Argument_logical_sector, u8"logical-sector", u8's', true,  u8"The logical block address (LBA) of the first sector to read." },
+        { Argument_count,          u8"count",          u8'c', true,  u8"The number of sectors to read. Default: 1." },
+        { Argument_drive,          u8"drive",          u8'd', true,  u8"The physical drive number, or a device or image path. Default: 0." },
         { Argument_file_name,      u8"file-name",      u8'f', true,  u8"The name of the file to hold the output. This file will be overwritten." },
+        { Argument_hex,            u8"hex",            u8'x', false, u8"Write a hex dump instead of raw bytes. Without --file-name, the dump goes to the console." },
+        { Argument_all_lines,      u8"all-lines",      u8'a', false, u8"Do not collapse repeated lines in the hex dump." },
         { Argument_help,           u8"help",           u8'?', false, nullptr },
     };
 #ifndef NDEBUG
@@ -69,13 +99,34 @@ static int parse_arguments_and_execute()
     if(options.count(Argument_help) == 0)
     {
         CHECK_EXCEPTION(options.count(Argument_logical_sector) > 0, u8"Missing a required argument: --" + std::string(argument_map[Argument_logical_sector].long_name));
-        CHECK_EXCEPTION(options.count(Argument_file_name) > 0,      u8"Missing a required argument: --" + std::string(argument_map[Argument_file_name].long_name));
-
-        // There is no _atoui64 function (and perhaps a private implementation is a good idea), but
-        // reading an int64_t into a uint64_t will have no negative (ha!) consequences, as any sector
-        // number is considered a valid sector to read.
-        const uint64_t sector_number = _atoi64(options.at(Argument_logical_sector).c_str());
-        GetSector::read_physical_drive_sector_to_file(0, sector_number, PortableRuntime::utf16_from_utf8(options.at(Argument_file_name)).c_str());
+        const bool is_hex_dump = options.count(Argument_hex) > 0;
+        CHECK_EXCEPTION(is_hex_dump || (options.count(Argument_file_name) > 0), u8"Missing a required argument: --" + std::string(argument_map[Argument_file_name].long_name));
+
+        const uint64_t sector_number = DiskTools::parse_unsigned(options.at(Argument_logical_sector), argument_map[Argument_logical_sector].long_name);
+        const uint64_t count = (options.count(Argument_count) > 0) ? DiskTools::parse_unsigned(options.at(Argument_count), argument_map[Argument_count].long_name) : 1;
+        CHECK_EXCEPTION(count > 0, u8"--" + std::string(argument_map[Argument_count].long_name) + u8" must be at least 1.");
+
+        const std::string drive = (options.count(Argument_drive) > 0) ? options.at(Argument_drive) : std::string(u8"0");
+        const bool collapse_repeats = options.count(Argument_all_lines) == 0;
+
+        if(options.count(Argument_file_name) > 0)
+        {
+            const auto output_file = WindowsCommon::create_file(options.at(Argument_file_name).c_str(),
+                                                                GENERIC_WRITE,
+                                                                0,
+                                                                nullptr,
+                                                                CREATE_ALWAYS,
+                                                                FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+                                                                nullptr);
+            dump_sectors(drive, sector_number, count, is_hex_dump, collapse_repeats, output_file);
+        }
+        else
+        {
+            // The hex dump is ASCII, so it can bypass the CRT's UTF-16 console translation.
+            const HANDLE output = GetStdHandle(STD_OUTPUT_HANDLE);
+            CHECK_BOOL_LAST_ERROR((output != nullptr) && (output != INVALID_HANDLE_VALUE));
+            dump_sectors(drive, sector_number, count, is_hex_dump, collapse_repeats, output);
+        }
     }
     else
     {
@@ -88,10 +139,22 @@ static int parse_arguments_and_execute()
         std::fwprintf(stderr, L"Usage: %s [options]\nOptions:\n", program_name);
         std::fwprintf(stderr, PortableRuntime::utf16_from_utf8(Parsing::Options_help_text(argument_map)).c_str());
         std::fwprintf(stderr,
-                      L"\nTo read the Master Boot Record:\n  %s -%c 1 -%c mbr.bin\n",
+                      L"\nTo read the Master Boot Record:\n  %s -%c 0 -%c mbr.bin\n",
+                      program_name,
+                      argument_map[Argument_logical_sector].short_name,
+                      argument_map[Argument_file_name].short_name);
+        std::fwprintf(stderr,
+                      L"\nTo read the first 2048 sectors of the second drive:\n  %s -%c 1 -%c 0 -%c 2048 -%c start.bin\n",
                       program_name,
+                      argument_map[Argument_drive].short_name,
                       argument_map[Argument_logical_sector].short_name,
+                      argument_map[Argument_count].short_name,
                       argument_map[Argument_file_name].short_name);
+        std::fwprintf(stderr,
+                      L"\nTo view the Master Boot Record:\n  %s -%c 0 -%c\n",
+                      program_name,
+                      argument_map[Argument_logical_sector].short_name,
+                      argument_map[Argument_hex].short_name);
         error_level = 1;
     }
 
@@ -112,6 +175,9 @@ int wmain(int argc, _In_reads_(argc) wchar_t** argv)
     // This class does not throw.
     WindowsCommon::UTF8_console_code_page code_page;
 
+    // Writes I/O statistics on exit when DISKTOOLS_IO_STATISTICS is set.
+    DiskTools::Io_statistics_report io_statistics_report;
+
     try
     {
         PortableRuntime::set_dprintf(WindowsCommon::debugger_dprintf);
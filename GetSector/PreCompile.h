@@ -2,10 +2,13 @@
 
 #include <cassert>
 #include <algorithm>
+#include <array>
 #include <cstdint>
 #include <fstream>
+#include <functional>
 #include <unordered_map>
 #include <memory>
+#include <string>
 #include <vector>
 
 #ifdef _MSC_VER
@@ -0,0 +1,181 @@
+// This program reads a disk or image once and maps which regions are zero,
+// filler, or low or high entropy data, so imaging and compression can skip or
+// route blocks without reading them again.
+
+#include "PreCompile.h"
+#include <DiskTools/BlockDevice.h>
+#include <DiskTools/IoStatistics.h>
+#include <DiskTools/OutputSink.h>
+#include <DiskTools/StringUtils.h>
+#include <DiskTools/Trace.h>
+#include <DiskTools/UsageMap.h>
+#include <Parsing/CommandLine.h>
+#include <WindowsCommon/CheckHR.h>
+#include <WindowsCommon/CommandLine.h>
+#include <WindowsCommon/DebuggerTracing.h>
+#include <WindowsCommon/Wrappers.h>
+#include <PortableRuntime/CheckException.h>
+#include <PortableRuntime/Tracing.h>
+#include <PortableRuntime/Unicode.h>
+
+namespace MapDisk
+{
+
+static PCWSTR usage_name(DiskTools::Block_usage usage)
+{
+    switch(usage)
+    {
+        case DiskTools::Block_usage::zero:
+            return L"Zero";
+        case DiskTools::Block_usage::filler:
+            return L"Filler";
+        case DiskTools::Block_usage::low_entropy:
+            return L"Low entropy";
+        default:
+            return L"High entropy";
+    }
+}
+
+static void map_disk(const std::string& drive, unsigned int block_size, unsigned int thread_count, _In_opt_z_ const char* map_file_name)
+{
+    const unsigned int sector_size = DiskTools::open_disk_or_device(drive)->sector_size();
+    const auto map = DiskTools::map_device_usage(drive, block_size, thread_count);
+
+    // A map of a large disk has many thousands of extents.
+    DiskTools::Output_sink output;
+    output.write(u8"         LBA       Sectors  Usage\n");
+    std::array<uint64_t, 4> usage_bytes = {};
+    for(const auto& extent : DiskTools::usage_extents(map))
+    {
+        output.write_decimal(extent.offset / sector_size, 12).write(u8"  ");
+        output.write_decimal((extent.length + sector_size - 1) / sector_size, 12).write(u8"  ");
+        output.write(PortableRuntime::utf8_from_utf16(usage_name(extent.usage))).write(u8"\n");
+        usage_bytes[static_cast<size_t>(extent.usage)] += extent.length;
+    }
+    output.flush();
+
+    for(size_t usage = 0; usage < usage_bytes.size(); ++usage)
+    {
+        std::fwprintf(stderr,
+                      L"%-12s  %14llu bytes  %5.1f%%\n",
+                      usage_name(static_cast<DiskTools::Block_usage>(usage)),
+                      static_cast<unsigned long long>(usage_bytes[usage]),
+                      (map.device_size > 0) ? 100.0 * usage_bytes[usage] / map.device_size : 0.0);
+    }
+
+    if(nullptr != map_file_name)
+    {
+        DiskTools::write_usage_map(map, map_file_name);
+    }
+}
+
+static int parse_arguments_and_execute()
+{
+    enum
+    {
+        Argument_drive = 0,
+        Argument_block_size,
+        Argument_threads,
+        Argument_map_file,
+        Argument_help,
+    };
+
+    const std::vector<Parsing::Argument_descriptor> argument_map =
+    {
+        { Argument_drive,      u8"drive",      u8'd', true,  u8"The disk number, or the path of a device or image, to map. Default: 0." },
+        { Argument_block_size, u8"block-size", u8'b', true,  u8"The number of bytes that each map entry covers. Default: 65536." },
+        { Argument_threads,    u8"threads",    u8't', true,  u8"The number of threads that read and classify blocks. Default: one per processor." },
+        { Argument_map_file,   u8"map-file",   u8'm', true,  u8"Also write the map to this file, at two bits per block." },
+        { Argument_help,       u8"help",       u8'?', false, nullptr },
+    };
+#ifndef NDEBUG
+    Parsing::validate_argument_map(argument_map);
+#endif
+
+    const auto arguments = WindowsCommon::args_from_command_line();
+    const auto options = Parsing::options_from_allowed_args(arguments, argument_map);
+
+    const auto unsigned_or_default = [&options, &argument_map](int argument, uint64_t default_value)
+    {
+        return (options.count(argument) > 0) ? DiskTools::parse_unsigned(options.at(argument), argument_map[argument].long_name) : default_value;
+    };
+
+    int error_level = 0;
+    if(options.count(Argument_help) == 0)
+    {
+        const std::string drive = (options.count(Argument_drive) > 0) ? options.at(Argument_drive) : std::string(u8"0");
+        const uint64_t block_size = unsigned_or_default(Argument_block_size, DiskTools::default_usage_block_size);
+        const uint64_t thread_count = std::max<uint64_t>(unsigned_or_default(Argument_threads, std::thread::hardware_concurrency()), 1);
+        CHECK_EXCEPTION((block_size <= 64 * 1024 * 1024) && (thread_count <= UINT_MAX),
+                        u8"--" + std::string(argument_map[Argument_block_size].long_name) + u8" or --" +
+                        std::string(argument_map[Argument_threads].long_name) + u8" is out of range.");
+
+        map_disk(drive,
+                 static_cast<unsigned int>(block_size),
+                 static_cast<unsigned int>(thread_count),
+                 (options.count(Argument_map_file) > 0) ? options.at(Argument_map_file).c_str() : nullptr);
+    }
+    else
+    {
+        constexpr auto arg_program_name = 0;
+
+        // Hold a reference to program_name_long for the duration of the output functions.
+        const auto program_name_long = PortableRuntime::utf16_from_utf8(arguments[arg_program_name]);
+        const auto program_name = PathFindFileNameW(program_name_long.c_str());
+
+        std::fwprintf(stderr, L"Usage: %s [options]\nOptions:\n", program_name);
+        std::fwprintf(stderr, PortableRuntime::utf16_from_utf8(Parsing::Options_help_text(argument_map)).c_str());
+        std::fwprintf(stderr,
+                      L"\nTo map the second drive in 1MB blocks, and save the map:\n  %s -%c 1 -%c 1048576 -%c disk1.map\n",
+                      program_name,
+                      argument_map[Argument_drive].short_name,
+                      argument_map[Argument_block_size].short_name,
+                      argument_map[Argument_map_file].short_name);
+        error_level = 1;
+    }
+
+    return error_level;
+}
+
+}
+
+int wmain(int argc, _In_reads_(argc) wchar_t** argv)
+{
+    (void)argc;     // Unreferenced parameter.
+    (void)argv;
+
+    // ERRORLEVEL zero is the success code.
+    int error_level;
+
+    // Set outside the try block so error messages use the proper code page.
+    // This class does not throw.
+    WindowsCommon::UTF8_console_code_page code_page;
+
+    // Writes I/O statistics on exit when DISKTOOLS_IO_STATISTICS is set.
+    DiskTools::Io_statistics_report io_statistics_report;
+
+    // Writes a trace on exit when built with DISKTOOLS_TRACE and DISKTOOLS_TRACE is set.
+    DISKTOOLS_TRACE_REPORT();
+
+    try
+    {
+        PortableRuntime::set_dprintf(WindowsCommon::debugger_dprintf);
+
+        // Set wprintf output to UTF-8 in Windows console.
+        // CHECK_EXCEPTION ensures against the case that the CRT invalid parameter handler
+        // routine is set by a global constructor.
+        CHECK_EXCEPTION(_setmode(_fileno(stdout), _O_U8TEXT) != -1, u8"Failed to set UTF-8 output mode.");
+        CHECK_EXCEPTION(_setmode(_fileno(stderr), _O_U8TEXT) != -1, u8"Failed to set UTF-8 output mode.");
+
+        assert(WindowsCommon::args_from_command_line().size() == (static_cast<size_t>(argc)));
+        error_level = MapDisk::parse_arguments_and_execute();
+    }
+    catch(const std::exception& ex)
+    {
+        std::fwprintf(stderr, L"\n%s\n", PortableRuntime::utf16_from_utf8(ex.what()).c_str());
+        error_level = 1;
+    }
+
+    return error_level;
+}
+
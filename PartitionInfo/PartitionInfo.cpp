@@ -4,8 +4,21 @@
 // Getting a handle to a disk requires Windows NT 4.0 or better.
 
 #include "PreCompile.h"
+#include <DiskTools/BlockDevice.h>
+#include <DiskTools/BufferPool.h>
 #include <DiskTools/DirectRead.h>
+#include <DiskTools/IoStatistics.h>
+#include <DiskTools/OutputSink.h>
+#include <DiskTools/PartitionLayoutCache.h>
+#include <DiskTools/PartitionInventory.h>
+#include <DiskTools/PartitionRecovery.h>
+#include <DiskTools/PartitionTable.h>
+#include <DiskTools/SectorSize.h>
+#include <Parsing/CommandLine.h>
+#include <WindowsCommon/CheckHR.h>
+#include <WindowsCommon/CommandLine.h>
 #include <WindowsCommon/DebuggerTracing.h>
+#include <WindowsCommon/Wrappers.h>
 #include <PortableRuntime/CheckException.h>
 #include <PortableRuntime/Tracing.h>
 #include <PortableRuntime/Unicode.h>
@@ -13,55 +26,57 @@
 namespace PartitionInfo
 {
 
-// Display partition table data to stdout.
-// TODO: Make this take an ostream and put it into DiskTools.
+// Display partition table data.
+// TODO: Put this into DiskTools.
 static void output_partition_table_info(
-    _In_reads_(DiskTools::partition_table_entry_count) const DiskTools::Partition_table_entry* entry,
-    unsigned int sector_size)
+    const std::array<DiskTools::Partition_table_entry, DiskTools::partition_table_entry_count>& entry,
+    unsigned int sector_size,
+    _Inout_ DiskTools::Output_sink* output)
 {
     for(unsigned int index = 0; index < DiskTools::partition_table_entry_count; ++index)
     {
         uint64_t part_size = static_cast<uint64_t>(entry[index].sectors) * sector_size;
 
-        _tprintf(_TEXT("Partition %u:\r\n"), index);
-        _tprintf(_TEXT(" Bootable: %s\r\n"), entry[index].bootable ? _TEXT("Yes") : _TEXT("No"));
+        output->write(u8"Partition ").write_decimal(index).write(u8":\n");
+        output->write(entry[index].bootable ? u8" Bootable: Yes\n" : u8" Bootable: No\n");
 
         PCTSTR file_system_name = DiskTools::get_file_system_name(entry[index].file_system_type);
         if(nullptr != file_system_name)
         {
-            _tprintf(_TEXT(" File System: %s\r\n"), file_system_name);
+            output->write(u8" File System: ").write(PortableRuntime::utf8_from_utf16(file_system_name)).write(u8"\n");
         }
 
-        _tprintf(_TEXT(" Begin Head: %u\r\n"),      entry[index].begin_head);
-        _tprintf(_TEXT(" Begin Cylinder: %u\r\n"),  entry[index].begin_cylinder);
-        _tprintf(_TEXT(" Begin Sector: %u\r\n"),    entry[index].begin_sector);
-        _tprintf(_TEXT(" End Head: %u\r\n"),        entry[index].end_head);
-        _tprintf(_TEXT(" End Cylinder: %u\r\n"),    entry[index].end_cylinder);
-        _tprintf(_TEXT(" End Sector: %u\r\n"),      entry[index].end_sector);
-        _tprintf(_TEXT(" Start Sector: %u\r\n"),    entry[index].start_sector);
-        _tprintf(_TEXT(" Sectors: %u\r\n"),         entry[index].sectors);
-        _tprintf(_TEXT(" Size of partition: %I64u bytes\r\n\r\n"), part_size);
+        output->write(u8" Begin Head: ").write_decimal(entry[index].begin_head).write(u8"\n");
+        output->write(u8" Begin Cylinder: ").write_decimal(entry[index].begin_cylinder).write(u8"\n");
+        output->write(u8" Begin Sector: ").write_decimal(entry[index].begin_sector).write(u8"\n");
+        output->write(u8" End Head: ").write_decimal(entry[index].end_head).write(u8"\n");
+        output->write(u8" End Cylinder: ").write_decimal(entry[index].end_cylinder).write(u8"\n");
+        output->write(u8" End Sector: ").write_decimal(entry[index].end_sector).write(u8"\n");
+        output->write(u8" Start Sector: ").write_decimal(entry[index].start_sector).write(u8"\n");
+        output->write(u8" Sectors: ").write_decimal(entry[index].sectors).write(u8"\n");
+        output->write(u8" Size of partition: ").write_decimal(part_size).write(u8" bytes\n\n");
     }
 }
 
 static void read_and_print_partition_table()
 {
-    // Fixed disks with partition tables will generally have a sector
-    // size of 512 bytes (valid as of 2011).
-    constexpr unsigned int sector_size = 512;
+    // The buffer holds the largest sector, and the read returns the sector size
+    // of the disk, which is 512 bytes, or 4096 for 4Kn disks.
+    // Pooled buffers are page aligned, as some drivers require of direct reads.
+    const auto buffer = DiskTools::acquire_io_buffer(DiskTools::maximum_sector_size);
+    unsigned int sector_size = DiskTools::maximum_sector_size;
 
-    std::array<uint8_t, sector_size> buffer;
-    unsigned int bytes_to_read = sector_size;
-
-    HRESULT hr = DiskTools::read_sector_from_disk(buffer.data(), &bytes_to_read, 0, 0);
+    HRESULT hr = DiskTools::read_sector_from_disk(buffer.data(), &sector_size, 0, 0);
     if(SUCCEEDED(hr))
     {
-        if(sector_size == bytes_to_read)
+        if(sector_size >= DiskTools::legacy_sector_size)
         {
-            // Final two bytes are a boot sector signature, and the partition table immediately preceeds it.
-            unsigned int table_start = sector_size - 2 - (sizeof(DiskTools::Partition_table_entry) * DiskTools::partition_table_entry_count);
-            auto entries = reinterpret_cast<DiskTools::Partition_table_entry*>(buffer.data() + table_start);
-            output_partition_table_info(entries, sector_size);
+            // The boot sector signature is at the end of the first 512 bytes of the sector,
+            // whatever the sector size, and the partition table immediately preceeds it.
+            const auto entries = DiskTools::load_partition_table(DiskTools::Structure_view<DiskTools::Boot_record_layout>(buffer.data(), sector_size));
+            DiskTools::Output_sink output;
+            output_partition_table_info(entries, sector_size, &output);
+            output.flush();
         }
         else
         {
@@ -89,6 +104,206 @@ static void read_and_print_partition_table()
     }
 }
 
+// Scans a disk for volumes that its partition table no longer describes, and
+// prints them with a partition table that would.  Nothing is written to the disk.
+static void recover_partition_table(const std::string& drive, bool is_thorough)
+{
+    const unsigned int sector_size = DiskTools::open_disk_or_device(drive)->sector_size();
+    auto strides = DiskTools::default_recovery_strides(sector_size);
+    if(is_thorough)
+    {
+        strides.push_back(1);
+    }
+
+    const auto partitions = DiskTools::find_lost_partitions(drive, strides, std::max(std::thread::hardware_concurrency(), 1u));
+    DiskTools::Output_sink output;
+    if(partitions.empty())
+    {
+        output.write(u8"No volumes found.\n");
+        output.flush();
+        return;
+    }
+
+    for(const auto& partition : partitions)
+    {
+        output.write(u8"Volume at sector ").write_decimal(partition.start_sector);
+        output.write(u8", ").write_decimal(partition.sector_count).write(u8" sectors");
+        output.write(partition.is_logical ? u8", logical" : u8"");
+        output.write(partition.is_verified ? u8"" : u8", unverified");
+        output.write(u8":\n ").write(partition.evidence).write(u8"\n");
+    }
+
+    output.write(u8"\nProposed partition table:\n\n");
+    const auto table = DiskTools::propose_partition_table(partitions);
+    output_partition_table_info(table, sector_size, &output);
+    output.flush();
+}
+
+// Splits a list of targets at semicolons, which, unlike commas, cannot appear in paths.
+static std::vector<std::string> split_target_list(const std::string& list)
+{
+    std::vector<std::string> items;
+    size_t start = 0;
+    while(start <= list.size())
+    {
+        const size_t end = std::min(list.find(';', start), list.size());
+        if(end > start)
+        {
+            items.push_back(list.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+
+    return items;
+}
+
+static unsigned int parse_thread_count(const std::string& text)
+{
+    char* end;
+    const unsigned long value = strtoul(text.c_str(), &end, 10);
+    CHECK_EXCEPTION(!text.empty() && (*end == '\0') && (value > 0) && (value <= 1024), u8"Invalid thread count: " + text);
+
+    return static_cast<unsigned int>(value);
+}
+
+// Writes the partition layouts of many disks and images as CSV or JSON, to output_path or the console.
+static int write_inventory(
+    const std::string& target_list,
+    const std::string& format_name,
+    const std::string& output_path,
+    unsigned int thread_count,
+    bool use_cache)
+{
+    CHECK_EXCEPTION((u8"csv" == format_name) || (u8"json" == format_name), u8"Unknown format: " + format_name);
+    const auto format = (u8"json" == format_name) ? DiskTools::Inventory_format::json_lines : DiskTools::Inventory_format::csv;
+
+    const auto targets = DiskTools::expand_inventory_targets(split_target_list(target_list));
+    CHECK_EXCEPTION(!targets.empty(), u8"No targets to read.");
+
+    // Most layouts are unchanged since the last run, and are checked rather than read again.
+    DiskTools::Partition_layout_cache cache(use_cache ? DiskTools::default_layout_cache_path() : std::string());
+
+    DiskTools::Inventory_summary summary;
+    if(!output_path.empty())
+    {
+        const auto output_file = WindowsCommon::create_file(output_path.c_str(),
+                                                            GENERIC_WRITE,
+                                                            0,
+                                                            nullptr,
+                                                            CREATE_ALWAYS,
+                                                            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+                                                            nullptr);
+        summary = DiskTools::write_partition_inventory(targets, format, thread_count, output_file, &cache);
+    }
+    else
+    {
+        // The records are UTF-8, so they bypass the CRT's UTF-16 console translation.
+        const HANDLE output = GetStdHandle(STD_OUTPUT_HANDLE);
+        CHECK_BOOL_LAST_ERROR((output != nullptr) && (output != INVALID_HANDLE_VALUE));
+        summary = DiskTools::write_partition_inventory(targets, format, thread_count, output, &cache);
+    }
+
+    // The records are complete without the cache, so a cache that cannot be written is not an error.
+    try
+    {
+        cache.save();
+    }
+    catch(const std::exception& ex)
+    {
+        std::fwprintf(stderr, L"Partition layouts were not saved: %s\n", PortableRuntime::utf16_from_utf8(ex.what()).c_str());
+    }
+
+    std::fwprintf(stderr,
+                  L"Read %I64u targets with %I64u partitions.  %I64u targets could not be read.\n",
+                  summary.target_count,
+                  summary.partition_count,
+                  summary.failed_target_count);
+
+    return (summary.failed_target_count > 0) ? 1 : 0;
+}
+
+static int parse_arguments_and_execute()
+{
+    enum
+    {
+        Argument_recover = 0,
+        Argument_drive,
+        Argument_thorough,
+        Argument_batch,
+        Argument_format,
+        Argument_output,
+        Argument_threads,
+        Argument_no_cache,
+        Argument_help,
+    };
+
+    const std::vector<Parsing::Argument_descriptor> argument_map =
+    {
+        { Argument_recover,  u8"recover",  u8'r', false, u8"Scan for volumes that are missing from the partition table, and propose a new table." },
+        { Argument_drive,    u8"drive",    u8'd', true,  u8"With --recover, the disk number, or the path of a device or image, to scan. Default: 0." },
+        { Argument_thorough, u8"thorough", u8't', false, u8"With --recover, also check every sector that is not inside a volume that was found." },
+        { Argument_batch,    u8"batch",    u8'b', true,  u8"Write one record per partition for each of a list of targets, separated by semicolons. A target is a disk number, a device or image path, a path with wildcards, or @file to read targets from a file, one per line." },
+        { Argument_format,   u8"format",   u8'f', true,  u8"With --batch, the output format: csv, or json for one JSON object per line. Default: csv." },
+        { Argument_output,   u8"output",   u8'o', true,  u8"With --batch, the file to hold the records. This file will be overwritten. Default: the console." },
+        { Argument_threads,  u8"threads",  u8'j', true,  u8"With --batch, the number of targets to read at once. Default: four per processor." },
+        { Argument_no_cache, u8"no-cache", u8'n', false, u8"With --batch, read every partition table instead of checking layouts saved by earlier runs." },
+        { Argument_help,     u8"help",     u8'?', false, nullptr },
+    };
+#ifndef NDEBUG
+    Parsing::validate_argument_map(argument_map);
+#endif
+
+    const auto arguments = WindowsCommon::args_from_command_line();
+    const auto options = Parsing::options_from_allowed_args(arguments, argument_map);
+
+    int error_level = 0;
+    if(options.count(Argument_help) > 0)
+    {
+        constexpr auto arg_program_name = 0;
+
+        // Hold a reference to program_name_long for the duration of the output functions.
+        const auto program_name_long = PortableRuntime::utf16_from_utf8(arguments[arg_program_name]);
+        const auto program_name = PathFindFileNameW(program_name_long.c_str());
+
+        std::fwprintf(stderr, L"Usage: %s [options]\nOptions:\n", program_name);
+        std::fwprintf(stderr, PortableRuntime::utf16_from_utf8(Parsing::Options_help_text(argument_map)).c_str());
+        std::fwprintf(stderr,
+                      L"\nTo look for lost volumes on the second drive:\n  %s -%c -%c 1\n",
+                      program_name,
+                      argument_map[Argument_recover].short_name,
+                      argument_map[Argument_drive].short_name);
+        std::fwprintf(stderr,
+                      L"\nTo list the partitions of a directory of images as JSON:\n  %s -%c images\\*.img -%c json -%c partitions.json\n",
+                      program_name,
+                      argument_map[Argument_batch].short_name,
+                      argument_map[Argument_format].short_name,
+                      argument_map[Argument_output].short_name);
+        error_level = 1;
+    }
+    else if(options.count(Argument_batch) > 0)
+    {
+        // Reads are small and mostly waiting, so run more of them than there are processors.
+        const unsigned int thread_count = (options.count(Argument_threads) > 0) ? parse_thread_count(options.at(Argument_threads))
+                                                                                 : 4 * std::max(std::thread::hardware_concurrency(), 1u);
+        error_level = write_inventory(options.at(Argument_batch),
+                                      (options.count(Argument_format) > 0) ? options.at(Argument_format) : std::string(u8"csv"),
+                                      (options.count(Argument_output) > 0) ? options.at(Argument_output) : std::string(),
+                                      thread_count,
+                                      options.count(Argument_no_cache) == 0);
+    }
+    else if(options.count(Argument_recover) > 0)
+    {
+        const std::string drive = (options.count(Argument_drive) > 0) ? options.at(Argument_drive) : std::string(u8"0");
+        recover_partition_table(drive, options.count(Argument_thorough) > 0);
+    }
+    else
+    {
+        read_and_print_partition_table();
+    }
+
+    return error_level;
+}
+
 }
 
 int wmain(int argc, _In_reads_(argc) wchar_t** argv)
@@ -99,6 +314,9 @@ int wmain(int argc, _In_reads_(argc) wchar_t** argv)
     // ERRORLEVEL zero is the success code.
     int error_level = 0;
 
+    // Writes I/O statistics on exit when DISKTOOLS_IO_STATISTICS is set.
+    DiskTools::Io_statistics_report io_statistics_report;
+
     try
     {
         PortableRuntime::set_dprintf(WindowsCommon::debugger_dprintf);
@@ -109,7 +327,8 @@ int wmain(int argc, _In_reads_(argc) wchar_t** argv)
         CHECK_EXCEPTION(_setmode(_fileno(stdout), _O_U8TEXT) != -1, u8"Failed to set UTF-8 output mode.");
         CHECK_EXCEPTION(_setmode(_fileno(stderr), _O_U8TEXT) != -1, u8"Failed to set UTF-8 output mode.");
 
-        PartitionInfo::read_and_print_partition_table();
+        assert(WindowsCommon::args_from_command_line().size() == (static_cast<size_t>(argc)));
+        error_level = PartitionInfo::parse_arguments_and_execute();
     }
     catch(const std::exception& ex)
     {
@@ -1,11 +1,22 @@
 #pragma once
 
+#include <cassert>
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <cstdint>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #ifdef _MSC_VER
 
+#include <Shlwapi.h>
+
 // TODO: 2016: Remove all instances of tchar.h.
 #include <tchar.h>
 #include <windows.h>
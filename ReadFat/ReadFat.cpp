@@ -0,0 +1,228 @@
+// This program lists the directories of a FAT12/16/32 volume on a disk or
+// image, and extracts files from it, without mounting the volume.
+
+#include "PreCompile.h"
+#include <DiskTools/BlockDevice.h>
+#include <DiskTools/Copy.h>
+#include <DiskTools/FatVolume.h>
+#include <DiskTools/IoStatistics.h>
+#include <DiskTools/OutputSink.h>
+#include <DiskTools/StringUtils.h>
+#include <DiskTools/Trace.h>
+#include <Parsing/CommandLine.h>
+#include <WindowsCommon/CheckHR.h>
+#include <WindowsCommon/CommandLine.h>
+#include <WindowsCommon/DebuggerTracing.h>
+#include <WindowsCommon/Wrappers.h>
+#include <PortableRuntime/CheckException.h>
+#include <PortableRuntime/Tracing.h>
+#include <PortableRuntime/Unicode.h>
+
+namespace ReadFat
+{
+
+// Directory loops in a damaged volume would otherwise make a recursive listing endless.
+constexpr unsigned int maximum_directory_depth = 64;
+
+static void list_directory(
+    _In_ DiskTools::Fat_volume* volume,
+    const DiskTools::Fat_directory_entry& directory,
+    const std::string& path,
+    bool is_recursive,
+    unsigned int depth,
+    _Inout_ DiskTools::Output_sink* output)
+{
+    const auto entries = volume->read_directory(directory);
+    for(const auto& entry : entries)
+    {
+        // Dates and times are packed: year since 1980, month, day, and hours, minutes.
+        const bool is_directory = (entry.attributes & DiskTools::fat_attribute_directory) != 0;
+        output->write_decimal((entry.last_write_date >> 9) + 1980u, 4, '0').write(u8"-");
+        output->write_decimal((entry.last_write_date >> 5) & 0x0fu, 2, '0').write(u8"-");
+        output->write_decimal(entry.last_write_date & 0x1fu, 2, '0').write(u8" ");
+        output->write_decimal(entry.last_write_time >> 11, 2, '0').write(u8":");
+        output->write_decimal((entry.last_write_time >> 5) & 0x3fu, 2, '0').write(u8"  ");
+        if(is_directory)
+        {
+            output->write_padded(u8"<DIR>", 12);
+        }
+        else
+        {
+            output->write_decimal(entry.file_size, 12);
+        }
+        output->write(u8"  ").write(path).write(entry.name).write(u8"\n");
+    }
+
+    if(is_recursive)
+    {
+        CHECK_EXCEPTION(depth < maximum_directory_depth, u8"Directories are nested too deeply at " + path);
+        for(const auto& entry : entries)
+        {
+            if((entry.attributes & DiskTools::fat_attribute_directory) != 0)
+            {
+                list_directory(volume, entry, path + entry.name + u8"\\", is_recursive, depth + 1, output);
+            }
+        }
+    }
+}
+
+static void list_files(const std::string& drive, unsigned int partition_number, const std::string& path, bool is_recursive)
+{
+    const auto device = DiskTools::open_disk_or_device(drive);
+    DiskTools::Fat_volume volume(device.get(), DiskTools::find_fat_volume(device.get(), partition_number));
+
+    DiskTools::Fat_directory_entry directory;
+    CHECK_EXCEPTION(volume.find_entry(path, &directory), u8"Not found: " + path);
+
+    std::string prefix = path;
+    if(!prefix.empty() && (prefix.back() != '\\') && (prefix.back() != '/'))
+    {
+        prefix += u8"\\";
+    }
+
+    DiskTools::Output_sink output;
+    list_directory(&volume, directory, prefix, is_recursive, 0, &output);
+    output.flush();
+}
+
+static void extract_file(const std::string& drive, unsigned int partition_number, const std::string& path, const std::string& output_file_name)
+{
+    DISKTOOLS_TRACE_SPAN("ReadFat", "extract");
+
+    const auto device = DiskTools::open_disk_or_device(drive);
+    DiskTools::Fat_volume volume(device.get(), DiskTools::find_fat_volume(device.get(), partition_number));
+
+    DiskTools::Fat_directory_entry file;
+    CHECK_EXCEPTION(volume.find_entry(path, &file), u8"Not found: " + path);
+    CHECK_EXCEPTION((file.attributes & DiskTools::fat_attribute_directory) == 0, path + u8" is a directory.");
+
+    const auto output = DiskTools::open_image_file(output_file_name.c_str(), CREATE_ALWAYS);
+    uint64_t offset = 0;
+    volume.read_file(file, DiskTools::default_copy_buffer_size, [&](_In_reads_bytes_(size) const uint8_t* buffer, size_t size)
+    {
+        output->write(offset, buffer, size);
+        offset += size;
+    });
+}
+
+static int parse_arguments_and_execute()
+{
+    enum
+    {
+        Argument_drive = 0,
+        Argument_partition,
+        Argument_list,
+        Argument_recursive,
+        Argument_extract,
+        Argument_output,
+        Argument_help,
+    };
+
+    const std::vector<Parsing::Argument_descriptor> argument_map =
+    {
+        { Argument_drive,     u8"drive",     u8'd', true,  u8"The disk number, or the path of a device or image, to read. Default: 0." },
+        { Argument_partition, u8"partition", u8'p', true,  u8"The partition that holds the volume. Default: the volume at the start of the device, or the first FAT partition." },
+        { Argument_list,      u8"list",      u8'l', true,  u8"List this directory.  Without --extract, the root directory is listed." },
+        { Argument_recursive, u8"recursive", u8'r', false, u8"Also list the subdirectories." },
+        { Argument_extract,   u8"extract",   u8'x', true,  u8"Copy this file out of the volume." },
+        { Argument_output,    u8"output",    u8'o', true,  u8"With --extract, the name of the copy. Default: the name of the file, in the current directory." },
+        { Argument_help,      u8"help",      u8'?', false, nullptr },
+    };
+#ifndef NDEBUG
+    Parsing::validate_argument_map(argument_map);
+#endif
+
+    const auto arguments = WindowsCommon::args_from_command_line();
+    const auto options = Parsing::options_from_allowed_args(arguments, argument_map);
+
+    int error_level = 0;
+    if(options.count(Argument_help) == 0)
+    {
+        const std::string drive = (options.count(Argument_drive) > 0) ? options.at(Argument_drive) : std::string(u8"0");
+        const uint64_t partition_number = (options.count(Argument_partition) > 0) ?
+                                          DiskTools::parse_unsigned(options.at(Argument_partition), argument_map[Argument_partition].long_name) : 0;
+        CHECK_EXCEPTION(partition_number <= UINT_MAX, u8"--" + std::string(argument_map[Argument_partition].long_name) + u8" is out of range.");
+
+        if(options.count(Argument_extract) > 0)
+        {
+            const std::string path = options.at(Argument_extract);
+            const std::string output_file_name = (options.count(Argument_output) > 0) ?
+                                                 options.at(Argument_output) :
+                                                 path.substr(path.find_last_of(u8"\\/") + 1);
+            extract_file(drive, static_cast<unsigned int>(partition_number), path, output_file_name);
+        }
+        else
+        {
+            const std::string path = (options.count(Argument_list) > 0) ? options.at(Argument_list) : std::string();
+            list_files(drive, static_cast<unsigned int>(partition_number), path, options.count(Argument_recursive) > 0);
+        }
+    }
+    else
+    {
+        constexpr auto arg_program_name = 0;
+
+        // Hold a reference to program_name_long for the duration of the output functions.
+        const auto program_name_long = PortableRuntime::utf16_from_utf8(arguments[arg_program_name]);
+        const auto program_name = PathFindFileNameW(program_name_long.c_str());
+
+        std::fwprintf(stderr, L"Usage: %s [options]\nOptions:\n", program_name);
+        std::fwprintf(stderr, PortableRuntime::utf16_from_utf8(Parsing::Options_help_text(argument_map)).c_str());
+        std::fwprintf(stderr,
+                      L"\nTo list every file on a floppy image:\n  %s -%c floppy.img -%c\n",
+                      program_name,
+                      argument_map[Argument_drive].short_name,
+                      argument_map[Argument_recursive].short_name);
+        std::fwprintf(stderr,
+                      L"\nTo copy a file from the second partition of the second drive:\n  %s -%c 1 -%c 2 -%c DOS\\COMMAND.COM\n",
+                      program_name,
+                      argument_map[Argument_drive].short_name,
+                      argument_map[Argument_partition].short_name,
+                      argument_map[Argument_extract].short_name);
+        error_level = 1;
+    }
+
+    return error_level;
+}
+
+}
+
+int wmain(int argc, _In_reads_(argc) wchar_t** argv)
+{
+    (void)argc;     // Unreferenced parameter.
+    (void)argv;
+
+    // ERRORLEVEL zero is the success code.
+    int error_level;
+
+    // Set outside the try block so error messages use the proper code page.
+    // This class does not throw.
+    WindowsCommon::UTF8_console_code_page code_page;
+
+    // Writes I/O statistics on exit when DISKTOOLS_IO_STATISTICS is set.
+    DiskTools::Io_statistics_report io_statistics_report;
+
+    // Writes a trace on exit when built with DISKTOOLS_TRACE and DISKTOOLS_TRACE is set.
+    DISKTOOLS_TRACE_REPORT();
+
+    try
+    {
+        PortableRuntime::set_dprintf(WindowsCommon::debugger_dprintf);
+
+        // Set wprintf output to UTF-8 in Windows console.
+        // CHECK_EXCEPTION ensures against the case that the CRT invalid parameter handler
+        // routine is set by a global constructor.
+        CHECK_EXCEPTION(_setmode(_fileno(stdout), _O_U8TEXT) != -1, u8"Failed to set UTF-8 output mode.");
+        CHECK_EXCEPTION(_setmode(_fileno(stderr), _O_U8TEXT) != -1, u8"Failed to set UTF-8 output mode.");
+
+        assert(WindowsCommon::args_from_command_line().size() == (static_cast<size_t>(argc)));
+        error_level = ReadFat::parse_arguments_and_execute();
+    }
+    catch(const std::exception& ex)
+    {
+        std::fwprintf(stderr, L"\n%s\n", PortableRuntime::utf16_from_utf8(ex.what()).c_str());
+        error_level = 1;
+    }
+
+    return error_level;
+}
+
@@ -0,0 +1,281 @@
+// This program lists the directories of an ISO 9660 or Joliet CD or image,
+// extracts files from it, and checks that every file can be read, such as to
+// verify the output of RipISO.
+
+#include "PreCompile.h"
+#include <DiskTools/BlockDevice.h>
+#include <DiskTools/Copy.h>
+#include <DiskTools/DirectRead.h>
+#include <DiskTools/IoStatistics.h>
+#include <DiskTools/OutputSink.h>
+#include <DiskTools/IsoVolume.h>
+#include <DiskTools/Trace.h>
+#include <Parsing/CommandLine.h>
+#include <WindowsCommon/CheckHR.h>
+#include <WindowsCommon/CommandLine.h>
+#include <WindowsCommon/DebuggerTracing.h>
+#include <WindowsCommon/Wrappers.h>
+#include <PortableRuntime/CheckException.h>
+#include <PortableRuntime/Tracing.h>
+#include <PortableRuntime/Unicode.h>
+
+namespace ReadIso
+{
+
+// Directory loops in a damaged volume would otherwise make a recursive listing endless.
+constexpr unsigned int maximum_directory_depth = 64;
+
+static std::string join_path(const std::string& directory, const std::string& name)
+{
+    return directory.empty() ? name : directory + u8"\\" + name;
+}
+
+static void list_directory(
+    _In_ DiskTools::Iso_volume* volume,
+    const std::string& path,
+    bool is_recursive,
+    unsigned int depth,
+    _Inout_ DiskTools::Output_sink* output)
+{
+    const auto entries = volume->read_directory(path);
+    for(const auto& entry : entries)
+    {
+        // Recording times are years since 1900, month, day, hour, and minute.
+        const bool is_directory = (entry.flags & DiskTools::iso_flag_directory) != 0;
+        output->write_decimal(entry.recording_time[0] + 1900u, 4, '0').write(u8"-");
+        output->write_decimal(entry.recording_time[1], 2, '0').write(u8"-");
+        output->write_decimal(entry.recording_time[2], 2, '0').write(u8" ");
+        output->write_decimal(entry.recording_time[3], 2, '0').write(u8":");
+        output->write_decimal(entry.recording_time[4], 2, '0').write(u8"  ");
+        if(is_directory)
+        {
+            output->write_padded(u8"<DIR>", 14);
+        }
+        else
+        {
+            output->write_decimal(entry.size, 14);
+        }
+        output->write(u8"  ").write(join_path(path, entry.name)).write(u8"\n");
+    }
+
+    if(is_recursive)
+    {
+        CHECK_EXCEPTION(depth < maximum_directory_depth, u8"Directories are nested too deeply at " + path);
+        for(const auto& entry : entries)
+        {
+            if((entry.flags & DiskTools::iso_flag_directory) != 0)
+            {
+                list_directory(volume, join_path(path, entry.name), is_recursive, depth + 1, output);
+            }
+        }
+    }
+}
+
+static void list_files(const std::string& drive, const std::string& path, bool is_recursive)
+{
+    const auto device = DiskTools::open_disk_or_device(drive);
+    DiskTools::Iso_volume volume(device.get());
+
+    DiskTools::Output_sink output;
+    list_directory(&volume, path, is_recursive, 0, &output);
+    output.flush();
+}
+
+static void extract_file(const std::string& drive, const std::string& path, const std::string& output_file_name)
+{
+    DISKTOOLS_TRACE_SPAN("ReadIso", "extract");
+
+    const auto device = DiskTools::open_disk_or_device(drive);
+    DiskTools::Iso_volume volume(device.get());
+
+    DiskTools::Iso_directory_entry file;
+    CHECK_EXCEPTION(volume.find_entry(path, &file), u8"Not found: " + path);
+    CHECK_EXCEPTION((file.flags & DiskTools::iso_flag_directory) == 0, path + u8" is a directory.");
+
+    const auto output = DiskTools::open_image_file(output_file_name.c_str(), CREATE_ALWAYS);
+    uint64_t offset = 0;
+    volume.read_file(file, DiskTools::default_copy_buffer_size, [&](_In_reads_bytes_(size) const uint8_t* buffer, size_t size)
+    {
+        output->write(offset, buffer, size);
+        offset += size;
+    });
+}
+
+static void read_every_file(
+    _In_ DiskTools::Iso_volume* volume,
+    const std::string& path,
+    unsigned int depth,
+    _Inout_ uint64_t* file_count,
+    _Inout_ uint64_t* byte_count)
+{
+    CHECK_EXCEPTION(depth < maximum_directory_depth, u8"Directories are nested too deeply at " + path);
+    for(const auto& entry : volume->read_directory(path))
+    {
+        const auto entry_path = join_path(path, entry.name);
+        if((entry.flags & DiskTools::iso_flag_directory) != 0)
+        {
+            read_every_file(volume, entry_path, depth + 1, file_count, byte_count);
+        }
+        else
+        {
+            volume->read_file(entry, DiskTools::default_copy_buffer_size, [byte_count](_In_reads_bytes_(size) const uint8_t*, size_t size)
+            {
+                *byte_count += size;
+            });
+            ++*file_count;
+        }
+    }
+}
+
+// Returns true if the whole volume is present and every file can be read.
+static bool verify_volume(const std::string& drive)
+{
+    DISKTOOLS_TRACE_SPAN("ReadIso", "verify");
+
+    const auto device = DiskTools::open_disk_or_device(drive);
+    DiskTools::Iso_volume volume(device.get());
+
+    const uint64_t volume_size = volume.volume_sector_count() * volume.logical_block_size();
+    if(volume_size > device->size())
+    {
+        std::fwprintf(stdout, L"The image is %llu bytes, but the volume is %llu bytes.\n", device->size(), volume_size);
+        return false;
+    }
+
+    uint64_t file_count = 0;
+    uint64_t byte_count = 0;
+    read_every_file(&volume, std::string(), 0, &file_count, &byte_count);
+    std::fwprintf(stdout,
+                  L"Read %llu files, %llu bytes, from a %s volume of %llu bytes.\n",
+                  file_count,
+                  byte_count,
+                  volume.is_joliet() ? L"Joliet" : L"ISO 9660",
+                  volume_size);
+
+    return true;
+}
+
+static int parse_arguments_and_execute()
+{
+    enum
+    {
+        Argument_drive = 0,
+        Argument_list,
+        Argument_recursive,
+        Argument_extract,
+        Argument_output,
+        Argument_verify,
+        Argument_help,
+    };
+
+    const std::vector<Parsing::Argument_descriptor> argument_map =
+    {
+        { Argument_drive,     u8"drive",     u8'd', true,  u8"The image, or the path of a device, to read. Default: the first CD drive." },
+        { Argument_list,      u8"list",      u8'l', true,  u8"List this directory.  Without --extract or --verify, the root directory is listed." },
+        { Argument_recursive, u8"recursive", u8'r', false, u8"Also list the subdirectories." },
+        { Argument_extract,   u8"extract",   u8'x', true,  u8"Copy this file out of the volume." },
+        { Argument_output,    u8"output",    u8'o', true,  u8"With --extract, the name of the copy. Default: the name of the file, in the current directory." },
+        { Argument_verify,    u8"verify",    u8'v', false, u8"Read every file, and check that the image holds the whole volume." },
+        { Argument_help,      u8"help",      u8'?', false, nullptr },
+    };
+#ifndef NDEBUG
+    Parsing::validate_argument_map(argument_map);
+#endif
+
+    const auto arguments = WindowsCommon::args_from_command_line();
+    const auto options = Parsing::options_from_allowed_args(arguments, argument_map);
+
+    int error_level = 0;
+    if(options.count(Argument_help) == 0)
+    {
+        const std::string drive = (options.count(Argument_drive) > 0) ? options.at(Argument_drive) : std::string(DiskTools::get_file_name_cdrom_0());
+
+        if(options.count(Argument_extract) > 0)
+        {
+            const std::string path = options.at(Argument_extract);
+            const std::string output_file_name = (options.count(Argument_output) > 0) ?
+                                                 options.at(Argument_output) :
+                                                 path.substr(path.find_last_of(u8"\\/") + 1);
+            extract_file(drive, path, output_file_name);
+        }
+        else if(options.count(Argument_verify) > 0)
+        {
+            if(!verify_volume(drive))
+            {
+                error_level = 1;
+            }
+        }
+        else
+        {
+            const std::string path = (options.count(Argument_list) > 0) ? options.at(Argument_list) : std::string();
+            list_files(drive, path, options.count(Argument_recursive) > 0);
+        }
+    }
+    else
+    {
+        constexpr auto arg_program_name = 0;
+
+        // Hold a reference to program_name_long for the duration of the output functions.
+        const auto program_name_long = PortableRuntime::utf16_from_utf8(arguments[arg_program_name]);
+        const auto program_name = PathFindFileNameW(program_name_long.c_str());
+
+        std::fwprintf(stderr, L"Usage: %s [options]\nOptions:\n", program_name);
+        std::fwprintf(stderr, PortableRuntime::utf16_from_utf8(Parsing::Options_help_text(argument_map)).c_str());
+        std::fwprintf(stderr,
+                      L"\nTo check an image written by RipISO:\n  %s -%c disc.iso -%c\n",
+                      program_name,
+                      argument_map[Argument_drive].short_name,
+                      argument_map[Argument_verify].short_name);
+        std::fwprintf(stderr,
+                      L"\nTo copy a file from an image in an image store:\n  %s -%c store\\images\\disc.manifest -%c SETUP\\README.TXT\n",
+                      program_name,
+                      argument_map[Argument_drive].short_name,
+                      argument_map[Argument_extract].short_name);
+        error_level = 1;
+    }
+
+    return error_level;
+}
+
+}
+
+int wmain(int argc, _In_reads_(argc) wchar_t** argv)
+{
+    (void)argc;     // Unreferenced parameter.
+    (void)argv;
+
+    // ERRORLEVEL zero is the success code.
+    int error_level;
+
+    // Set outside the try block so error messages use the proper code page.
+    // This class does not throw.
+    WindowsCommon::UTF8_console_code_page code_page;
+
+    // Writes I/O statistics on exit when DISKTOOLS_IO_STATISTICS is set.
+    DiskTools::Io_statistics_report io_statistics_report;
+
+    // Writes a trace on exit when built with DISKTOOLS_TRACE and DISKTOOLS_TRACE is set.
+    DISKTOOLS_TRACE_REPORT();
+
+    try
+    {
+        PortableRuntime::set_dprintf(WindowsCommon::debugger_dprintf);
+
+        // Set wprintf output to UTF-8 in Windows console.
+        // CHECK_EXCEPTION ensures against the case that the CRT invalid parameter handler
+        // routine is set by a global constructor.
+        CHECK_EXCEPTION(_setmode(_fileno(stdout), _O_U8TEXT) != -1, u8"Failed to set UTF-8 output mode.");
+        CHECK_EXCEPTION(_setmode(_fileno(stderr), _O_U8TEXT) != -1, u8"Failed to set UTF-8 output mode.");
+
+        assert(WindowsCommon::args_from_command_line().size() == (static_cast<size_t>(argc)));
+        error_level = ReadIso::parse_arguments_and_execute();
+    }
+    catch(const std::exception& ex)
+    {
+        std::fwprintf(stderr, L"\n%s\n", PortableRuntime::utf16_from_utf8(ex.what()).c_str());
+        error_level = 1;
+    }
+
+    return error_level;
+}
+
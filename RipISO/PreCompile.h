@@ -4,8 +4,10 @@
 
 #include <cstdint>
 #include <algorithm>
+#include <array>
 #include <functional>
 #include <memory>
+#include <string>
 #include <unordered_map>
 #include <vector>
 
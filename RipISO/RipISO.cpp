@@ -1,9 +1,13 @@
 #include "PreCompile.h"
+#include <DiskTools/AllocatedImage.h>
+#include <DiskTools/BlockDevice.h>
+#include <DiskTools/Copy.h>
 #include <DiskTools/DirectRead.h>
-#include <WindowsCommon/CheckHR.h>
+#include <DiskTools/ImageStore.h>
+#include <DiskTools/IoStatistics.h>
+#include <DiskTools/OpticalVolume.h>
+#include <DiskTools/Trace.h>
 #include <WindowsCommon/DebuggerTracing.h>
-#include <WindowsCommon/ScopedWindowsTypes.h>
-#include <WindowsCommon/Wrappers.h>
 #include <PortableRuntime/CheckException.h>
 #include <PortableRuntime/Tracing.h>
 #include <PortableRuntime/Unicode.h>
@@ -11,56 +15,119 @@
 
 namespace RipISO
 {
-    void rip_iso(_In_z_ const char* output_file_name)
+    // Chunks average 64KB, which is small enough to find shared installers and
+    // system files between discs, and large enough to keep manifests small.
+    constexpr uint32_t store_average_chunk_size = 64 * 1024;
+
+    // Returns the size of the ISO 9660 or UDF volume on the disc, or the size of
+    // the device if neither is found, or the volume claims more than the device holds.
+    // Recordable discs and drives that pad the last session report more sectors
+    // than the file system uses, and those read slowly or not at all.
+    static uint64_t rip_size(_In_ DiskTools::Block_device* disk)
+    {
+        const uint64_t device_size = disk->size();
+        const uint64_t volume_size = DiskTools::optical_volume_size(disk);
+        if((volume_size == 0) || (volume_size > device_size))
+        {
+            return device_size;
+        }
+
+        if(volume_size < device_size)
+        {
+            std::fwprintf(stdout, L"Copying %I64u of %I64u bytes, the size of the ISO 9660/UDF volume.\n", volume_size, device_size);
+        }
+
+        return volume_size;
+    }
+
+    // Returns the whole of the volume (see rip_size), or with is_allocated_only,
+    // the parts of the disk that hold data (see find_allocated_extents), and
+    // reports how much that saves.
+    static std::vector<DiskTools::Image_extent> extents_to_rip(_In_ DiskTools::Block_device* disk, bool is_allocated_only)
     {
-        const auto disk_handle = WindowsCommon::create_file(
-            DiskTools::get_file_name_cdrom_0(),
-            GENERIC_READ,
-            FILE_SHARE_READ,
-            nullptr,
-            OPEN_EXISTING,
-            FILE_ATTRIBUTE_NORMAL,
-            nullptr);
-
-        const auto output_file = WindowsCommon::create_file(
-            output_file_name,
-            GENERIC_WRITE,
-            0,
-            nullptr,
-            CREATE_ALWAYS,
-            FILE_ATTRIBUTE_NORMAL,
-            nullptr);
-
-        DWORD bytes_returned;
-        GET_LENGTH_INFORMATION length_information;
-        CHECK_BOOL_LAST_ERROR(DeviceIoControl(disk_handle,
-                                              IOCTL_DISK_GET_LENGTH_INFO,
-                                              nullptr,
-                                              0,
-                                              &length_information,
-                                              sizeof(length_information),
-                                              &bytes_returned,
-                                              nullptr) != 0);
-        constexpr unsigned int buffer_size = 1024 * 1024;
-        // TODO: 2016: This should be a std::vector.
-        std::unique_ptr<uint8_t[]> buffer = std::make_unique<uint8_t[]>(buffer_size);
-
-        ULONGLONG bytes_left = length_information.Length.QuadPart;
-        while(bytes_left > 0)
+        if(!is_allocated_only)
+        {
+            return std::vector<DiskTools::Image_extent> { { 0, rip_size(disk) } };
+        }
+
+        const auto extents = DiskTools::find_allocated_extents(disk);
+        uint64_t allocated_size = 0;
+        for(const auto& extent : extents)
         {
-            // Cast is safe as buffer_size is less than MAX_DWORD.
-            DWORD amount_to_read = bytes_left > buffer_size ? buffer_size : static_cast<DWORD>(bytes_left);
+            allocated_size += extent.length;
+        }
+        std::fwprintf(stdout, L"Copying %I64u of %I64u bytes.\n", allocated_size, disk->size());
+
+        return extents;
+    }
+
+    // Returns the size of the image that the extents describe.
+    static uint64_t image_size(_In_ DiskTools::Block_device* disk, const std::vector<DiskTools::Image_extent>& extents, bool is_allocated_only)
+    {
+        // Allocated-only images keep the device size, so partition tables stay valid.
+        return is_allocated_only ? disk->size() : extents.back().offset + extents.back().length;
+    }
+
+    // Reads the extents of the disk, and passes each buffer to write_output.
+    static void rip_iso(
+        _In_ DiskTools::Block_device* disk,
+        const std::vector<DiskTools::Image_extent>& extents,
+        uint64_t size,
+        bool fill_gaps,
+        const std::function<void (uint64_t offset, _In_reads_bytes_(size) const uint8_t* buffer, size_t size)>& write_output)
+    {
+        DISKTOOLS_TRACE_SPAN("RipISO", "rip");
+
+        DiskTools::stream_extents(disk, extents, size, DiskTools::default_copy_buffer_size, fill_gaps, write_output);
+    }
+
+    void rip_iso_to_file(_In_z_ const char* source_path, _In_z_ const char* output_file_name, bool is_allocated_only)
+    {
+        const auto disk = DiskTools::open_block_device(source_path);
+        const auto extents = extents_to_rip(disk.get(), is_allocated_only);
 
-            // This is reasonably slow, but it is fast enough for single CDs or DVDs.
-            // A fast approach might be to use uncached aligned async reads, at the
-            // expense of considerable complexity.
-            DWORD amount_read;
-            CHECK_BOOL_LAST_ERROR(ReadFile(disk_handle, buffer.get(), amount_to_read, &amount_read, nullptr) != 0);
-            CHECK_BOOL_LAST_ERROR(WriteFile(output_file, buffer.get(), amount_read, &amount_read, nullptr) != 0);
+        if(is_allocated_only)
+        {
+            // Ranges that are not copied take no space in the image, and read as zeros.
+            const auto output = DiskTools::create_sparse_image_file(output_file_name, disk->size());
+            rip_iso(disk.get(), extents, disk->size(), false, [&output](uint64_t offset, _In_reads_bytes_(size) const uint8_t* buffer, size_t size)
+            {
+                output->write(offset, buffer, size);
+            });
+            return;
+        }
 
-            bytes_left -= amount_to_read;
+        // A plain copy needs no transformation, so copy_device can bypass the file cache.
+        const auto output = DiskTools::open_image_file(output_file_name, CREATE_ALWAYS);
+        const uint64_t size = image_size(disk.get(), extents, false);
+        {
+            DISKTOOLS_TRACE_SPAN("RipISO", "rip");
+            DiskTools::copy_device(disk.get(), output.get(), size, DiskTools::default_copy_buffer_size);
         }
     }
+
+    // Adds the disc to an image store.  Only chunks that are not already in the
+    // store are written, so discs that share content cost little additional space.
+    // With is_allocated_only, unused space is stored as zeros, which cost one chunk.
+    void rip_iso_to_store(_In_z_ const char* source_path, _In_z_ const char* store_path, _In_z_ const char* image_name, bool is_allocated_only)
+    {
+        const auto disk = DiskTools::open_block_device(source_path);
+
+        DiskTools::Image_store store(store_path);
+        DiskTools::Image_store_writer writer(&store,
+                                             image_name,
+                                             DiskTools::content_defined_chunking(store_average_chunk_size),
+                                             disk->sector_size());
+
+        const auto extents = extents_to_rip(disk.get(), is_allocated_only);
+        rip_iso(disk.get(), extents, image_size(disk.get(), extents, is_allocated_only), true, [&writer](uint64_t, _In_reads_bytes_(size) const uint8_t* buffer, size_t size)
+        {
+            writer.write(buffer, size);
+        });
+        writer.commit();
+
+        std::fwprintf(stdout, L"Ripped %I64u bytes, of which %I64u bytes were new to the store.\n", writer.image_size(), writer.new_bytes());
+    }
 }
 
 int main(int argc, _In_reads_(argc) char** argv)
@@ -68,6 +135,12 @@ int main(int argc, _In_reads_(argc) char** argv)
     // ERRORLEVEL zero is the success code.
     int error_level = 0;
 
+    // Writes I/O statistics on exit when DISKTOOLS_IO_STATISTICS is set.
+    DiskTools::Io_statistics_report io_statistics_report;
+
+    // Writes a trace on exit when built with DISKTOOLS_TRACE and DISKTOOLS_TRACE is set.
+    DISKTOOLS_TRACE_REPORT();
+
     try
     {
         PortableRuntime::set_dprintf(WindowsCommon::debugger_dprintf);
@@ -80,15 +153,46 @@ int main(int argc, _In_reads_(argc) char** argv)
 
         constexpr unsigned int arg_program_name = 0;
         constexpr unsigned int arg_output_file  = 1;
+        constexpr unsigned int arg_store_option = 1;
+        constexpr unsigned int arg_store_path   = 2;
+        constexpr unsigned int arg_image_name   = 3;
+
+        constexpr unsigned int arg_source_option = 1;
+        constexpr unsigned int arg_source_path   = 2;
+
+        constexpr unsigned int arg_allocated_option = 1;
+
+        auto args = PlatformServices::get_utf8_args(argc, argv);
+
+        // An optional source device, such as an image file or a simulated device,
+        // replaces the first CD drive.  Remove it so the remaining arguments keep their positions.
+        std::string source_path = DiskTools::get_file_name_cdrom_0();
+        if((args.size() > 3) && (args[arg_source_option] == u8"--source"))
+        {
+            source_path = args[arg_source_path];
+            args.erase(args.begin() + arg_source_option, args.begin() + arg_source_path + 1);
+        }
+
+        // Copying only allocated space is also optional, and is removed the same way.
+        const bool is_allocated_only = (args.size() > 2) && (args[arg_allocated_option] == u8"--allocated");
+        if(is_allocated_only)
+        {
+            args.erase(args.begin() + arg_allocated_option);
+        }
 
-        const auto args = PlatformServices::get_utf8_args(argc, argv);
-        if(args.size() == 2)
+        if((args.size() == 4) && (args[arg_store_option] == u8"--store"))
+        {
+            RipISO::rip_iso_to_store(source_path.c_str(), args[arg_store_path].c_str(), args[arg_image_name].c_str(), is_allocated_only);
+        }
+        else if(args.size() == 2)
         {
-            RipISO::rip_iso(args[arg_output_file].c_str());
+            RipISO::rip_iso_to_file(source_path.c_str(), args[arg_output_file].c_str(), is_allocated_only);
         }
         else
         {
-            std::fwprintf(stderr, L"Usage: %s file_name.iso", PortableRuntime::utf16_from_utf8(args[arg_program_name]).c_str());
+            const auto program_name = PortableRuntime::utf16_from_utf8(args[arg_program_name]);
+            std::fwprintf(stderr, L"Usage: %s [--source device] [--allocated] file_name.iso\n", program_name.c_str());
+            std::fwprintf(stderr, L"       %s [--source device] [--allocated] --store store_directory image_name\n", program_name.c_str());
             error_level = 1;
         }
     }
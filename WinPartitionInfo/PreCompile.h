@@ -4,7 +4,12 @@
 #include <cstdint>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <array>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 #include <tchar.h>
 #include <windows.h>
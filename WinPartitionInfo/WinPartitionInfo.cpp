@@ -1,6 +1,9 @@
 #include "PreCompile.h"
 #include "Resource.h"
+#include <DiskTools/BlockDevice.h>
 #include <DiskTools/DirectRead.h>
+#include <DiskTools/PartitionLayoutCache.h>
+#include <DiskTools/PartitionMonitor.h>
 #include <DiskTools/Verify.h>
 #include <DiskTools/StringUtils.h>
 #include <DiskTools/WindowUtils.h>
@@ -8,9 +11,20 @@
 namespace WinPartitionInfo
 {
 
-constexpr unsigned int sector_size = 512;
 constexpr unsigned int max_partitions = 32;
 
+// The partition tables of the disks are checked this often, and the list is
+// rebuilt only when they change.
+constexpr UINT_PTR rescan_timer_id = 1;
+constexpr UINT rescan_interval_milliseconds = 2000;
+
+// Posted by the rescan thread when a rescan finishes.  w_param is nonzero if
+// the partitions changed.
+constexpr UINT rescan_complete_message = WM_APP + 1;
+
+// The first two disks.
+static const char* const monitored_disk_names[] = { u8"0", u8"1" };
+
 static constexpr struct Listview_columns
 {
     DWORD name;
@@ -86,122 +100,16 @@ void get_file_system_name_from_type(
     }
 }
 
-// This function may be moved to a shared library at some point if
-// the partitions vector is capped to a max per disk instead of a
-// max total.
-HRESULT read_disk_partitions_from_handle(
-    _In_ std::vector<std::pair<uint8_t, DiskTools::Partition_table_entry>>* partitions,
-    HANDLE disk_handle,
-    uint8_t disk_number,
-    uint32_t logical_partition_start_sector)
+// A partition and the disk that holds it.
+struct Disk_partition
 {
-    std::array<uint8_t, sector_size> buffer;
-    unsigned int bytes_to_read = sizeof(buffer);
-
-    HRESULT hr = DiskTools::read_sector_from_handle(buffer.data(), &bytes_to_read, disk_handle, logical_partition_start_sector);
-    if(SUCCEEDED(hr))
-    {
-        // In this implementation, bytes_to_read can never be above sector_size, but if
-        // the buffer is defined as being larger than a default minimum sector size, then this
-        // check is still correct.
-        if(sector_size <= bytes_to_read)
-        {
-            // Final two bytes are a boot sector signature, and the partition table immediately precedes it.
-            static_assert(sector_size >= 2 + (sizeof(DiskTools::Partition_table_entry) * DiskTools::partition_table_entry_count),
-                          "sector_size must be large enough to contain a partition table.");
-            unsigned int table_start = bytes_to_read - 2 - (sizeof(DiskTools::Partition_table_entry) * DiskTools::partition_table_entry_count);
-            auto entries = reinterpret_cast<DiskTools::Partition_table_entry*>(buffer.data() + table_start);
-
-            for(unsigned int entry_index = 0; entry_index < DiskTools::partition_table_entry_count; ++entry_index)
-            {
-                // If partition entry is blank, don't include it.
-                if(0x00 == entries[entry_index].file_system_type)
-                {
-                    continue;
-                }
-
-                if(DiskTools::is_extended_partition(entries[entry_index].file_system_type))
-                {
-                    continue;
-                }
-
-                partitions->push_back(std::make_pair(disk_number, entries[entry_index]));
-
-                if(max_partitions == partitions->size())
-                {
-                    break;
-                }
-            }
-
-            // Cap the size of the partitions vector.
-            if(max_partitions > partitions->size())
-            {
-                // Handle extended partitions.
-                // http://en.wikipedia.org/wiki/Extended_Boot_Record
-                for(unsigned int entry_index = 0; entry_index < DiskTools::partition_table_entry_count; ++entry_index)
-                {
-                    if(DiskTools::is_extended_partition(entries[entry_index].file_system_type))
-                    {
-                        hr = read_disk_partitions_from_handle(partitions,
-                                                              disk_handle,
-                                                              disk_number,
-                                                              logical_partition_start_sector + entries[entry_index].start_sector);
-                        break;
-                    }
-                }
-            }
-        }
-        else
-        {
-            // Sectors smaller than sector_size are not supported, as sector_size is assumed to
-            // be at least the size of a partition table (plus the two signature bytes at the end of the sector).
-            // Caution should be used when printing out this HRESULT, as Windows will display this
-            // as a "catastrophic error."
-            hr = E_UNEXPECTED;
-        }
-    }
-
-    return hr;
-}
-
-// This function may be moved to a shared library at some point if
-// read_disk_partitions_from_handle is also moved.
-HRESULT read_disk_partitions(
-    _In_ std::vector<std::pair<uint8_t, DiskTools::Partition_table_entry>>* partitions,
-    uint8_t disk_number,
-    uint32_t logical_partition_start)
-{
-    HRESULT hr = S_OK;
-
-    // Open a read handle to the physical disk.  Many sectors may be read
-    // on a single disk (in the case of extended partitions), so save the
-    // handle for reuse instead of reopening on every read.
-    // This call requires elevation to administrator.
-    std::unique_ptr<void, std::function<void (HANDLE handle)>> disk_handle(
-        DiskTools::get_disk_handle(disk_number),
-        [](HANDLE handle)
-        {
-            if(INVALID_HANDLE_VALUE != handle)
-            {
-                CloseHandle(handle);
-            }
-        });
-
-    if(INVALID_HANDLE_VALUE == disk_handle.get())
-    {
-        hr = HRESULT_FROM_WIN32(ERROR_OPEN_FAILED);
-    }
-
-    if(SUCCEEDED(hr))
-    {
-        hr = read_disk_partitions_from_handle(partitions, disk_handle.get(), disk_number, logical_partition_start);
-    }
-
-    return hr;
-}
+    uint8_t disk_number;
+    unsigned int sector_size;
+    DiskTools::Partition_location location;
+};
 
 void output_partition_table_info(
-    _In_ const std::vector<std::pair<uint8_t, DiskTools::Partition_table_entry>>* partitions,
+    _In_ const std::vector<Disk_partition>* partitions,
     _In_ HWND listview,
     _In_ HINSTANCE instance)
 {
@@ -223,25 +131,25 @@ void output_partition_table_info(
         // Built the set of strings for the row.
         // Since label strings are all the same length, all array sizes
         // are referenced as labels[0] to make the code more clear.
-        get_yesno_string(partition->second.bootable == 0x80,
+        const auto& entry = partition->location.table_entry;
+        get_yesno_string(entry.bootable == 0x80,
                          instance,
                          labels[bootable_entry],
                          ARRAYSIZE(labels[0]));
         get_file_system_name_from_type(labels[file_system_entry],
                                        ARRAYSIZE(labels[0]),
-                                       partition->second.file_system_type);
-        DiskTools::pretty_print32(partition->second.begin_head,     labels[begin_head],     ARRAYSIZE(labels[0]));
-        DiskTools::pretty_print32(partition->second.begin_head,     labels[begin_head],     ARRAYSIZE(labels[0]));
-        DiskTools::pretty_print32(partition->second.begin_cylinder, labels[begin_cylinder], ARRAYSIZE(labels[0]));
-        DiskTools::pretty_print32(partition->second.begin_sector,   labels[begin_sector],   ARRAYSIZE(labels[0]));
-        DiskTools::pretty_print32(partition->second.end_head,       labels[end_head],       ARRAYSIZE(labels[0]));
-        DiskTools::pretty_print32(partition->second.end_cylinder,   labels[end_cylinder],   ARRAYSIZE(labels[0]));
-        DiskTools::pretty_print32(partition->second.end_sector,     labels[end_sector],     ARRAYSIZE(labels[0]));
-        DiskTools::pretty_print32(partition->second.start_sector,   labels[start_sector],   ARRAYSIZE(labels[0]));
-        DiskTools::pretty_print64(static_cast<uint64_t>(partition->second.sectors) * sector_size,
+                                       partition->location.file_system_type);
+        DiskTools::pretty_print32(entry.begin_head,     labels[begin_head],     ARRAYSIZE(labels[0]));
+        DiskTools::pretty_print32(entry.begin_cylinder, labels[begin_cylinder], ARRAYSIZE(labels[0]));
+        DiskTools::pretty_print32(entry.begin_sector,   labels[begin_sector],   ARRAYSIZE(labels[0]));
+        DiskTools::pretty_print32(entry.end_head,       labels[end_head],       ARRAYSIZE(labels[0]));
+        DiskTools::pretty_print32(entry.end_cylinder,   labels[end_cylinder],   ARRAYSIZE(labels[0]));
+        DiskTools::pretty_print32(entry.end_sector,     labels[end_sector],     ARRAYSIZE(labels[0]));
+        DiskTools::pretty_print32(entry.start_sector,   labels[start_sector],   ARRAYSIZE(labels[0]));
+        DiskTools::pretty_print64(partition->location.sector_count * partition->sector_size,
                                   labels[size_in_bytes],
                                   ARRAYSIZE(labels[0]));
-        DiskTools::pretty_print32(partition->first, labels[drive_number], ARRAYSIZE(labels[0]));
+        DiskTools::pretty_print32(partition->disk_number, labels[drive_number], ARRAYSIZE(labels[0]));
 
         // Add labels to all columns of this row.
         unsigned int column = 0;
@@ -264,19 +172,32 @@ void output_partition_table_info(
 
 static void populate_listview(
     _In_ HWND listview,
-    _In_ HINSTANCE instance)
+    _In_ HINSTANCE instance,
+    const DiskTools::Partition_monitor& monitor)
 {
-    // Vector of all (drive, partition) pairs.
-    std::vector<std::pair<uint8_t, DiskTools::Partition_table_entry>> partitions;
-
-    // Read partition tables of first two disks.
-    // Ignore read errors - any entry to the partitions list is
-    // complete, and any missing entries should be obvious to
-    // the advanced user (the target of this application).  The
-    // normal errors might be a missing or ejected disk, or a sector
-    // size that isn't 512 bytes, such as very recent USB disks.
-    read_disk_partitions(&partitions, 0, 0);
-    read_disk_partitions(&partitions, 1, 0);
+    std::vector<Disk_partition> partitions;
+    for(const auto& device : monitor.devices())
+    {
+        // Disks that could not be read have no partitions.  Any missing entries
+        // should be obvious to the advanced user (the target of this application).
+        // The normal errors might be a missing or ejected disk.
+        for(const auto& location : device.partitions)
+        {
+            // Cap the size of the partitions vector.
+            if(max_partitions == partitions.size())
+            {
+                break;
+            }
+
+            // Cast is safe as the monitored names are small disk numbers.
+            partitions.push_back(Disk_partition { static_cast<uint8_t>(std::stoul(device.name)), device.fingerprint.sector_size, location });
+        }
+    }
+
+    if(!ListView_DeleteAllItems(listview))
+    {
+        throw std::bad_alloc();
+    }
     output_partition_table_info(&partitions, listview, instance);
 }
 
@@ -377,6 +298,12 @@ class Partition_table_dialog
     RECT m_original_client_rect{};
     RECT m_original_clientspace_listview_rect{};
     SIZE m_minimum_dialog_size{};
+    DiskTools::Partition_monitor m_monitor;
+
+    // The monitor is not thread safe, so it is left to the rescan thread until
+    // the thread posts rescan_complete_message.
+    std::thread m_rescan_thread;
+    std::exception_ptr m_rescan_exception;
 
     // Not implemented to prevent accidental copying/moving.  The risk on copy/move is
     // that the original may be inadvertantly destroyed before the HWND itself is.
@@ -390,6 +317,9 @@ protected:
     void on_init_dialog(_In_ HWND window, _In_ HINSTANCE instance);
     void on_get_minmax_info(_In_ MINMAXINFO* minmax_info) const;
     void on_size(_In_ HWND window, int new_client_width, int new_client_height) const;
+    void on_timer(_In_ HWND window);
+    void on_rescan_complete(_In_ HWND window, _In_ HINSTANCE instance, bool has_changed);
+    void on_destroy(_In_ HWND window);
 
 public:
     Partition_table_dialog() noexcept = default;
@@ -460,6 +390,44 @@ INT_PTR CALLBACK Partition_table_dialog::dialog_proc(
                 break;
             }
 
+            case WM_TIMER:
+            {
+                if(rescan_timer_id != w_param)
+                {
+                    break;
+                }
+                message_processed = TRUE;
+
+                // GetWindowLongPtr should never fail.
+                // dialog is not valid until WM_INITDIALOG has been sent.
+                auto dialog = reinterpret_cast<Partition_table_dialog*>(GetWindowLongPtr(window, DWLP_USER));
+                dialog->on_timer(window);
+                break;
+            }
+
+            case rescan_complete_message:
+            {
+                message_processed = TRUE;
+
+                // GetWindowLongPtr should never fail.
+                // dialog is not valid until WM_INITDIALOG has been sent.
+                auto dialog = reinterpret_cast<Partition_table_dialog*>(GetWindowLongPtr(window, DWLP_USER));
+                HINSTANCE instance = reinterpret_cast<HINSTANCE>(GetWindowLongPtr(window, GWLP_HINSTANCE));
+                dialog->on_rescan_complete(window, instance, w_param != 0);
+                break;
+            }
+
+            case WM_DESTROY:
+            {
+                message_processed = TRUE;
+
+                // GetWindowLongPtr should never fail.
+                // dialog is not valid until WM_INITDIALOG has been sent.
+                auto dialog = reinterpret_cast<Partition_table_dialog*>(GetWindowLongPtr(window, DWLP_USER));
+                dialog->on_destroy(window);
+                break;
+            }
+
             case WM_SIZE:
             {
                 message_processed = TRUE;
@@ -503,8 +471,111 @@ void Partition_table_dialog::on_init_dialog(_In_ HWND window, _In_ HINSTANCE ins
 
     HWND listview = GetDlgItem(window, IDC_PARTITIONS);
     add_listview_headers(listview, instance, listview_columns, ARRAYSIZE(listview_columns));
-    populate_listview(listview, instance);
+
+    // Read the partition tables through the layout cache, so that disks that
+    // have not changed since the last launch are checked with a sector or two.
+    DiskTools::Partition_layout_cache cache(DiskTools::default_layout_cache_path());
+    m_monitor.rescan(std::vector<std::string>(std::cbegin(monitored_disk_names), std::cend(monitored_disk_names)), ARRAYSIZE(monitored_disk_names), &cache);
+    try
+    {
+        cache.save();
+    }
+    catch(const std::bad_alloc&)
+    {
+        throw;
+    }
+    catch(const std::exception&)
+    {
+        // The layouts are read again on the next launch.
+    }
+
+    populate_listview(listview, instance, m_monitor);
     DiskTools::adjust_listview_column_widths(listview, 0);
+
+    // Without the timer, the list is not refreshed, which is still usable.
+    SetTimer(window, rescan_timer_id, rescan_interval_milliseconds, nullptr);
+}
+
+// Rescans on another thread, so that a slow or unresponsive disk does not
+// block the dialog.  The list is updated when the thread posts its result.
+void Partition_table_dialog::on_timer(_In_ HWND window)
+{
+    if(m_rescan_thread.joinable())
+    {
+        // The previous rescan is still running.
+        return;
+    }
+
+    try
+    {
+        m_rescan_thread = std::thread([this, window]()
+        {
+            bool has_changed = false;
+            try
+            {
+                const auto differences = m_monitor.rescan(std::vector<std::string>(std::cbegin(monitored_disk_names), std::cend(monitored_disk_names)),
+                                                          ARRAYSIZE(monitored_disk_names));
+                has_changed = !differences.empty();
+            }
+            catch(...)
+            {
+                m_rescan_exception = std::current_exception();
+            }
+
+            // If the dialog is being destroyed, the message is never read, and
+            // on_destroy joins this thread instead.
+            PostMessage(window, rescan_complete_message, has_changed, 0);
+        });
+    }
+    catch(const std::bad_alloc&)
+    {
+        throw;
+    }
+    catch(const std::exception&)
+    {
+        // The thread could not be started.  It is tried again on the next tick.
+    }
+}
+
+void Partition_table_dialog::on_rescan_complete(_In_ HWND window, _In_ HINSTANCE instance, bool has_changed)
+{
+    m_rescan_thread.join();
+    const auto rescan_exception = m_rescan_exception;
+    m_rescan_exception = nullptr;
+
+    try
+    {
+        if(rescan_exception)
+        {
+            std::rethrow_exception(rescan_exception);
+        }
+
+        if(has_changed)
+        {
+            HWND listview = GetDlgItem(window, IDC_PARTITIONS);
+            populate_listview(listview, instance, m_monitor);
+            DiskTools::adjust_listview_column_widths(listview, 0);
+        }
+    }
+    catch(const std::bad_alloc&)
+    {
+        throw;
+    }
+    catch(const std::exception&)
+    {
+        // The list keeps its previous contents until the next rescan.
+    }
+}
+
+void Partition_table_dialog::on_destroy(_In_ HWND window)
+{
+    KillTimer(window, rescan_timer_id);
+
+    // The dialog must outlive the rescan thread, which uses its monitor.
+    if(m_rescan_thread.joinable())
+    {
+        m_rescan_thread.join();
+    }
 }
 
 void Partition_table_dialog::on_get_minmax_info(_In_ MINMAXINFO* minmax_info) const
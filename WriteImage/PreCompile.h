@@ -2,10 +2,19 @@
 
 #include <Windows.h>
 #include <tchar.h>
+#include <cassert>
 #include <algorithm>
 #include <cstdint>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
 #include <tuple>
 #include <vector>
 
+// APIs for MSVCRT UTF-8 output.
+#include <fcntl.h>
+#include <io.h>
+
@@ -1,18 +1,110 @@
 #include "PreCompile.h"
+#include <DiskTools/BlockDevice.h>
+#include <DiskTools/Copy.h>
+#include <DiskTools/ImageDiff.h>
+#include <DiskTools/IoStatistics.h>
+#include <DiskTools/Trace.h>
+#include <WindowsCommon/CommandLine.h>
+#include <WindowsCommon/DebuggerTracing.h>
+#include <PortableRuntime/CheckException.h>
+#include <PortableRuntime/Tracing.h>
+#include <PortableRuntime/Unicode.h>
 
 namespace WriteImage
 {
+
+// Writes an image to the start of a disk.  Windows refuses writes to sectors
+// that belong to mounted volumes, so the volumes on the target disk should be
+// taken offline first.
+static void write_image(_In_z_ const char* image_file_name, const std::string& target)
+{
+    DISKTOOLS_TRACE_SPAN("WriteImage", "write image");
+
+    const auto image = DiskTools::open_block_device(image_file_name);
+    const auto disk = DiskTools::open_disk_or_device(target, true);
+    CHECK_EXCEPTION(image->size() <= disk->size(), u8"The image is larger than the disk: " + std::string(image_file_name));
+
+    DiskTools::copy_device(image.get(), disk.get(), image->size(), DiskTools::default_copy_buffer_size);
+}
+
+// Applies a patch written by DiffImage.  Only the sectors that differ are written.
+static void apply_patch(_In_z_ const char* patch_file_name, const std::string& target)
+{
+    DISKTOOLS_TRACE_SPAN("WriteImage", "apply patch");
+
+    const auto disk = DiskTools::open_disk_or_device(target, true);
+    const auto summary = DiskTools::apply_image_patch(patch_file_name, disk.get());
+
+    std::fwprintf(stderr,
+                  L"Wrote %llu bytes in %llu records.\n",
+                  static_cast<unsigned long long>(summary.byte_count),
+                  static_cast<unsigned long long>(summary.record_count));
+    if(summary.modified_size < summary.original_size)
+    {
+        std::fwprintf(stderr,
+                      L"The patched image ends at byte %llu.  The bytes after it were left as they were.\n",
+                      static_cast<unsigned long long>(summary.modified_size));
+    }
+}
+
 }
 
 int wmain(int argc, _In_reads_(argc) PWSTR* argv)
 {
     (void)argc;     // Unreferenced parameter.
     (void)argv;
-    // TODO: 2016: Consider adding a trace.
 
     // ERRORLEVEL zero is the success code.
     int error_level = 0;
 
+    // Writes I/O statistics on exit when DISKTOOLS_IO_STATISTICS is set.
+    DiskTools::Io_statistics_report io_statistics_report;
+
+    // Writes a trace on exit when built with DISKTOOLS_TRACE and DISKTOOLS_TRACE is set.
+    DISKTOOLS_TRACE_REPORT();
+
+    try
+    {
+        PortableRuntime::set_dprintf(WindowsCommon::debugger_dprintf);
+
+        // Set wprintf output to UTF-8 in Windows console.
+        // CHECK_EXCEPTION ensures against the case that the CRT invalid parameter handler
+        // routine is set by a global constructor.
+        CHECK_EXCEPTION(_setmode(_fileno(stdout), _O_U8TEXT) != -1, u8"Failed to set UTF-8 output mode.");
+        CHECK_EXCEPTION(_setmode(_fileno(stderr), _O_U8TEXT) != -1, u8"Failed to set UTF-8 output mode.");
+
+        constexpr unsigned int arg_program_name = 0;
+        constexpr unsigned int arg_image_file   = 1;
+        constexpr unsigned int arg_target       = 2;
+
+        // Patches take a switch before the positional arguments.
+        constexpr unsigned int arg_patch_switch = 1;
+        constexpr unsigned int arg_patch_file   = 2;
+        constexpr unsigned int arg_patch_target = 3;
+
+        const auto args = WindowsCommon::args_from_command_line();
+        if((args.size() == 4) && (args[arg_patch_switch] == u8"--patch"))
+        {
+            WriteImage::apply_patch(args[arg_patch_file].c_str(), args[arg_patch_target]);
+        }
+        else if(args.size() == 3)
+        {
+            WriteImage::write_image(args[arg_image_file].c_str(), args[arg_target]);
+        }
+        else
+        {
+            const auto program_name = PortableRuntime::utf16_from_utf8(args[arg_program_name]);
+            std::fwprintf(stderr, L"Usage: %s file_name.img disk_number|device\n", program_name.c_str());
+            std::fwprintf(stderr, L"       %s --patch file_name.patch disk_number|device\n", program_name.c_str());
+            error_level = 1;
+        }
+    }
+    catch(const std::exception& ex)
+    {
+        std::fwprintf(stderr, L"\n%s\n", PortableRuntime::utf16_from_utf8(ex.what()).c_str());
+        error_level = 1;
+    }
+
     return error_level;
 }
 